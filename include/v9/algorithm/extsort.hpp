@@ -0,0 +1,464 @@
+//
+// Created by kiva on 2026/10/19.
+//
+#pragma once
+
+#include <v9/algorithm/qsort.hpp>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
+#include <stdexcept>
+#include <type_traits>
+
+#include <unistd.h>
+
+namespace v9 {
+    namespace sorts {
+        struct ExternalSortOptions {
+            /**
+             * Bytes of records held in memory at once, for a run being
+             * sorted or for the I/O buffers of a merge. A merge needs at
+             * least two input buffers and an output buffer of one record
+             * each, so the limit is never below three records.
+             */
+            size_t memoryLimit = size_t(256) << 20U;
+
+            /**
+             * Bytes read or written per call while merging, when the memory
+             * limit allows that much for every run at once.
+             */
+            size_t bufferLength = size_t(4) << 20U;
+
+            /**
+             * Where runs are spilled, $TMPDIR or /tmp when empty.
+             */
+            std::string tempDirectory;
+
+            /**
+             * Sorts runs in parallel, nullptr sorts them on the caller.
+             */
+            kit::TaskPool *pool = nullptr;
+        };
+
+        struct ExternalSortStats {
+            size_t records = 0;
+            size_t runs = 0;
+
+            /**
+             * Merges that wrote a temporary run instead of the output,
+             * because there were more runs than buffers fit in memory.
+             */
+            size_t intermediateMerges = 0;
+        };
+
+        namespace detail {
+            /**
+             * Merges never read or write in pieces smaller than this,
+             * unless the memory limit cannot hold three of them.
+             */
+            constexpr size_t MIN_MERGE_BUFFER = size_t(64) << 10U;
+
+            using FilePtr = std::unique_ptr<FILE, int (*)(FILE *)>;
+
+            [[noreturn]] inline void ioError(const std::string &what) {
+                throw std::runtime_error("externalSort: " + what + ": " + strerror(errno));
+            }
+
+            /**
+             * An anonymous file in {@code directory} holding runs back to
+             * back: unlinked as soon as it is created, so it goes away when
+             * closed, exceptions included. Runs are read and written at
+             * offsets, one descriptor serves every run of a merge.
+             */
+            class SpillFile {
+            private:
+                int _fd = -1;
+
+            public:
+                explicit SpillFile(const std::string &directory) {
+                    std::string path = directory;
+                    if (path.empty()) {
+                        const char *env = getenv("TMPDIR");
+                        path = env != nullptr && *env != '\0' ? env : "/tmp";
+                    }
+                    path += "/v9-sort-XXXXXX";
+
+                    _fd = mkstemp(&path[0]);
+                    if (_fd < 0) {
+                        ioError("cannot create a file like " + path);
+                    }
+                    unlink(path.c_str());
+                }
+
+                SpillFile(SpillFile &&other) noexcept : _fd(std::exchange(other._fd, -1)) {
+                }
+
+                SpillFile &operator=(SpillFile &&other) noexcept {
+                    std::swap(_fd, other._fd);
+                    return *this;
+                }
+
+                ~SpillFile() {
+                    if (_fd >= 0) {
+                        close(_fd);
+                    }
+                }
+
+                void read(void *bytes, size_t length, size_t offset) const {
+                    auto at = static_cast<char *>(bytes);
+                    while (length > 0) {
+                        ssize_t n = pread(_fd, at, length, static_cast<off_t>(offset));
+                        if (n == 0) {
+                            throw std::runtime_error("externalSort: unexpected end of spill file");
+                        }
+                        if (n < 0) {
+                            if (errno == EINTR) {
+                                continue;
+                            }
+                            ioError("spill file read failed");
+                        }
+                        at += n;
+                        offset += n;
+                        length -= n;
+                    }
+                }
+
+                void write(const void *bytes, size_t length, size_t offset) const {
+                    auto at = static_cast<const char *>(bytes);
+                    while (length > 0) {
+                        ssize_t n = pwrite(_fd, at, length, static_cast<off_t>(offset));
+                        if (n < 0) {
+                            if (errno == EINTR) {
+                                continue;
+                            }
+                            ioError("spill file write failed");
+                        }
+                        at += n;
+                        offset += n;
+                        length -= n;
+                    }
+                }
+            };
+
+            /**
+             * Sorted records [offset, offset + count) of a spill file.
+             */
+            struct Run {
+                size_t offset;
+                size_t count;
+            };
+
+            /**
+             * Read up to {@code count} records, fewer only at the end of the file.
+             */
+            template<typename T>
+            size_t readRecords(FILE *fp, T *records, size_t count) {
+                size_t bytes = fread(records, 1, count * sizeof(T), fp);
+                if (bytes < count * sizeof(T) && ferror(fp)) {
+                    ioError("read failed");
+                }
+                if (bytes % sizeof(T) != 0) {
+                    throw std::runtime_error("externalSort: input is not a whole number of records");
+                }
+                return bytes / sizeof(T);
+            }
+
+            template<typename T>
+            void writeRecords(FILE *fp, const T *records, size_t count) {
+                if (count != 0 && fwrite(records, sizeof(T), count, fp) != count) {
+                    ioError("write failed");
+                }
+            }
+
+            /**
+             * Sequential reader of a run through a buffer.
+             */
+            template<typename T>
+            class RunReader {
+            private:
+                const SpillFile &_file;
+                size_t _next;
+                size_t _left;
+                std::vector<T> _buffer;
+                size_t _position = 0;
+                size_t _count = 0;
+
+            public:
+                RunReader(const SpillFile &file, const Run &run, size_t bufferRecords)
+                    : _file(file), _next(run.offset), _left(run.count), _buffer(bufferRecords) {
+                }
+
+                /**
+                 * The current record, or nullptr past the end of the run.
+                 */
+                const T *head() {
+                    if (_position == _count) {
+                        if (_left == 0) {
+                            return nullptr;
+                        }
+                        _count = std::min(_left, _buffer.size());
+                        _file.read(_buffer.data(), _count * sizeof(T), _next * sizeof(T));
+                        _next += _count;
+                        _left -= _count;
+                        _position = 0;
+                    }
+                    return &_buffer[_position];
+                }
+
+                void next() {
+                    ++_position;
+                }
+            };
+
+            /**
+             * Buffered writer to the output, or to the end of a spill file.
+             */
+            template<typename T>
+            class RunWriter {
+            private:
+                FILE *_output = nullptr;
+                const SpillFile *_file = nullptr;
+                size_t _offset = 0;
+                std::vector<T> _buffer;
+                size_t _count = 0;
+
+            public:
+                RunWriter(FILE *output, size_t bufferRecords) : _output(output), _buffer(bufferRecords) {
+                }
+
+                RunWriter(const SpillFile &file, size_t offset, size_t bufferRecords)
+                    : _file(&file), _offset(offset), _buffer(bufferRecords) {
+                }
+
+                /**
+                 * Records written so far, where the next run starts.
+                 */
+                size_t getOffset() const {
+                    return _offset + _count;
+                }
+
+                void put(const T &record) {
+                    _buffer[_count++] = record;
+                    if (_count == _buffer.size()) {
+                        flush();
+                    }
+                }
+
+                void flush() {
+                    if (_output != nullptr) {
+                        writeRecords(_output, _buffer.data(), _count);
+                    } else {
+                        _file->write(_buffer.data(), _count * sizeof(T), _offset * sizeof(T));
+                    }
+                    _offset += _count;
+                    _count = 0;
+                }
+            };
+
+            /**
+             * Tournament tree over k runs that keeps the loser of every match
+             * in the inner nodes, so replacing the winner costs log2(k)
+             * comparisons on one path, against 2 log2(k) for a heap.
+             * Ties go to the earlier run.
+             */
+            template<typename T, typename Less>
+            class LoserTree {
+            private:
+                std::vector<RunReader<T>> &_runs;
+                std::vector<const T *> _heads;
+
+                /**
+                 * _tree[0] is the winner, _tree[1..k) the losers, the leaf of
+                 * run i is node k + i. While building, NONE wins every match.
+                 */
+                std::vector<size_t> _tree;
+                Less &_less;
+
+                static constexpr size_t NONE = ~size_t(0);
+
+                bool beats(size_t a, size_t b) const {
+                    if (a == NONE || b == NONE) {
+                        return a == NONE;
+                    }
+                    if (_heads[a] == nullptr || _heads[b] == nullptr) {
+                        return _heads[b] == nullptr && (_heads[a] != nullptr || a < b);
+                    }
+                    if (_less(*_heads[a], *_heads[b])) {
+                        return true;
+                    }
+                    return !_less(*_heads[b], *_heads[a]) && a < b;
+                }
+
+                void replay(size_t run) {
+                    size_t winner = run;
+                    for (size_t node = (_heads.size() + run) / 2; node > 0; node /= 2) {
+                        if (beats(_tree[node], winner)) {
+                            std::swap(_tree[node], winner);
+                        }
+                    }
+                    _tree[0] = winner;
+                }
+
+            public:
+                LoserTree(std::vector<RunReader<T>> &runs, Less &less)
+                    : _runs(runs), _heads(runs.size()), _tree(runs.size(), NONE), _less(less) {
+                    for (size_t i = 0; i < _runs.size(); ++i) {
+                        _heads[i] = _runs[i].head();
+                    }
+                    for (size_t i = 0; i < _runs.size(); ++i) {
+                        replay(i);
+                    }
+                }
+
+                /**
+                 * The smallest record left, or nullptr when every run is done.
+                 */
+                const T *top() const {
+                    return _heads[_tree[0]];
+                }
+
+                void pop() {
+                    size_t run = _tree[0];
+                    _runs[run].next();
+                    _heads[run] = _runs[run].head();
+                    replay(run);
+                }
+            };
+
+            template<typename T, typename Less>
+            void mergeRuns(const SpillFile &file, const Run *runs, size_t count,
+                           RunWriter<T> &writer, size_t bufferRecords, Less &less) {
+                std::vector<RunReader<T>> readers;
+                readers.reserve(count);
+                for (size_t i = 0; i < count; ++i) {
+                    readers.emplace_back(file, runs[i], bufferRecords);
+                }
+
+                LoserTree<T, Less> tree(readers, less);
+                for (const T *record = tree.top(); record != nullptr; record = tree.top()) {
+                    writer.put(*record);
+                    tree.pop();
+                }
+                writer.flush();
+            }
+        }
+
+        /**
+         * Sort the fixed size records of {@code input} into {@code output}
+         * with at most about {@code options.memoryLimit} bytes of records in
+         * memory: runs that fill the limit are read, sorted with
+         * parallelSort() or introsort() and spilled to a temporary file, then
+         * merged with a loser tree. When the limit cannot give every run a
+         * buffer of MIN_MERGE_BUFFER, runs are merged in groups first, as
+         * many passes as it takes; a limit below three such buffers merges
+         * two runs at a time in smaller pieces. Records are raw bytes of {@code T}, in
+         * host byte order. Not stable. Throws std::runtime_error when I/O
+         * fails or the input size is not a whole number of records.
+         */
+        template<typename T, typename Less = std::less<T>>
+        ExternalSortStats externalSort(FILE *input, FILE *output,
+                                       const ExternalSortOptions &options = ExternalSortOptions(),
+                                       Less less = Less()) {
+            static_assert(std::is_trivially_copyable_v<T>, "records are copied as bytes");
+
+            ExternalSortStats stats;
+            size_t memoryRecords = std::max<size_t>(options.memoryLimit / sizeof(T), 1);
+            std::vector<T> memory(memoryRecords);
+            std::unique_ptr<detail::SpillFile> spill;
+            std::vector<detail::Run> runs;
+            size_t spilled = 0;
+
+            while (true) {
+                size_t count = detail::readRecords(input, memory.data(), memoryRecords);
+                if (count == 0) {
+                    break;
+                }
+                stats.records += count;
+                if (options.pool != nullptr) {
+                    parallelSort(memory.data(), memory.data() + count, *options.pool, less);
+                } else {
+                    introsort(memory.data(), memory.data() + count, less);
+                }
+
+                // everything fit: nothing to spill
+                if (runs.empty() && count < memoryRecords) {
+                    detail::writeRecords(output, memory.data(), count);
+                    stats.runs = 1;
+                    return stats;
+                }
+                if (!spill) {
+                    spill = std::make_unique<detail::SpillFile>(options.tempDirectory);
+                }
+                spill->write(memory.data(), count * sizeof(T), spilled * sizeof(T));
+                runs.push_back(detail::Run{spilled, count});
+                spilled += count;
+            }
+            stats.runs = runs.size();
+            if (runs.empty()) {
+                return stats;
+            }
+            // the merge buffers take the memory over
+            std::vector<T>().swap(memory);
+
+            // two runs and the output at least, in smaller pieces when the limit says so
+            size_t minBuffer = std::max<size_t>(
+                std::min(detail::MIN_MERGE_BUFFER / sizeof(T), memoryRecords / 3), 1);
+            size_t fanIn = std::max<size_t>(memoryRecords / minBuffer, 3) - 1;
+            while (runs.size() > fanIn) {
+                size_t bufferRecords = std::max(memoryRecords / (fanIn + 1), minBuffer);
+                detail::SpillFile next(options.tempDirectory);
+                std::vector<detail::Run> merged;
+                for (size_t i = 0; i < runs.size(); i += fanIn) {
+                    size_t count = std::min(fanIn, runs.size() - i);
+                    size_t offset = merged.empty() ? 0 : merged.back().offset + merged.back().count;
+                    detail::RunWriter<T> writer(next, offset, bufferRecords);
+                    detail::mergeRuns(*spill, &runs[i], count, writer, bufferRecords, less);
+                    merged.push_back(detail::Run{offset, writer.getOffset() - offset});
+                    ++stats.intermediateMerges;
+                }
+                *spill = std::move(next);
+                runs.swap(merged);
+            }
+
+            size_t bufferRecords = std::min(memoryRecords / (runs.size() + 1),
+                                            std::max<size_t>(options.bufferLength / sizeof(T), 1));
+            detail::RunWriter<T> writer(output, std::max(bufferRecords, minBuffer));
+            detail::mergeRuns(*spill, runs.data(), runs.size(), writer, std::max(bufferRecords, minBuffer), less);
+            if (fflush(output) != 0) {
+                detail::ioError("write failed");
+            }
+            return stats;
+        }
+
+        /**
+         * externalSort() from one file into another, which is replaced.
+         */
+        template<typename T, typename Less = std::less<T>>
+        ExternalSortStats externalSort(const std::string &input, const std::string &output,
+                                       const ExternalSortOptions &options = ExternalSortOptions(),
+                                       Less less = Less()) {
+            detail::FilePtr in(fopen(input.c_str(), "rb"), fclose);
+            if (!in) {
+                detail::ioError("cannot open " + input);
+            }
+            detail::FilePtr out(fopen(output.c_str(), "wb"), fclose);
+            if (!out) {
+                detail::ioError("cannot create " + output);
+            }
+            setvbuf(in.get(), nullptr, _IONBF, 0);
+            setvbuf(out.get(), nullptr, _IONBF, 0);
+
+            ExternalSortStats stats = externalSort<T>(in.get(), out.get(), options, less);
+            if (fclose(out.release()) != 0) {
+                detail::ioError("cannot close " + output);
+            }
+            return stats;
+        }
+    }
+}
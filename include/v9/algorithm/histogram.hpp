@@ -0,0 +1,133 @@
+//
+// Created by kiva on 2026/10/19.
+//
+#pragma once
+
+#include <v9/bits/types.hpp>
+
+#include <cstring>
+#include <algorithm>
+
+namespace v9 {
+    namespace stats {
+        constexpr size_t BYTE_TABLE_SIZE = 256;
+
+        /**
+         * Reference implementation: one counter table, one increment per byte.
+         * Runs of the same byte make every increment wait for the previous
+         * store of the same counter (store-to-load forwarding stall).
+         *
+         * Counts are accumulated into {@code table}, which is not cleared.
+         */
+        template <typename T>
+        void byteHistogram(const uint8_t *bytes, size_t size, T *table) {
+            for (size_t i = 0; i < size; ++i) {
+                ++table[bytes[i]];
+            }
+        }
+
+        /**
+         * Count bytes into {@code Ways} interleaved sub-tables so that
+         * consecutive equal bytes hit different counters, then fold the
+         * sub-tables into {@code table}. Input is consumed 8 bytes at a time.
+         *
+         * Counts are accumulated into {@code table}, which is not cleared.
+         */
+        template <size_t Ways, typename T>
+        void byteHistogramInterleaved(const uint8_t *bytes, size_t size, T *table) {
+            static_assert(Ways == 4 || Ways == 8, "only 4 or 8 sub-tables are supported");
+
+            // keep every sub-table counter below 2^32
+            constexpr size_t CHUNK_SIZE = size_t(1) << 31U;
+
+            uint32_t sub[Ways][BYTE_TABLE_SIZE];
+
+            while (size > 0) {
+                size_t chunk = std::min(size, CHUNK_SIZE);
+                memset(sub, 0, sizeof(sub));
+
+                const uint8_t *v = bytes;
+                const uint8_t *end = bytes + (chunk & ~size_t(7));
+                while (v != end) {
+                    uint64_t word;
+                    memcpy(&word, v, sizeof(word));
+                    v += sizeof(word);
+
+                    ++sub[0][word & 0xffU];
+                    ++sub[1 % Ways][(word >> 8U) & 0xffU];
+                    ++sub[2 % Ways][(word >> 16U) & 0xffU];
+                    ++sub[3 % Ways][(word >> 24U) & 0xffU];
+                    ++sub[4 % Ways][(word >> 32U) & 0xffU];
+                    ++sub[5 % Ways][(word >> 40U) & 0xffU];
+                    ++sub[6 % Ways][(word >> 48U) & 0xffU];
+                    ++sub[7 % Ways][(word >> 56U) & 0xffU];
+                }
+
+                // the tail that does not fill a whole word
+                for (const uint8_t *tail = bytes + chunk; v != tail; ++v) {
+                    ++sub[0][*v];
+                }
+
+                for (size_t ch = 0; ch < BYTE_TABLE_SIZE; ++ch) {
+                    uint64_t sum = 0;
+                    for (size_t w = 0; w < Ways; ++w) {
+                        sum += sub[w][ch];
+                    }
+                    table[ch] += static_cast<T>(sum);
+                }
+
+                bytes += chunk;
+                size -= chunk;
+            }
+        }
+
+        /**
+         * Estimate byte frequencies by counting one block of {@code blockSize}
+         * bytes out of every {@code stride} blocks and scaling the result
+         * up to the whole input. Bytes that were not seen in any sampled block
+         * get a count of {@code floor}, so a caller that needs every present
+         * byte to have a non-zero frequency (e.g. to build a prefix code)
+         * can pass 1.
+         *
+         * Inputs shorter than {@code blockSize * stride} are counted exactly.
+         * Counts are accumulated into {@code table}, which is not cleared.
+         */
+        template <typename T>
+        void byteHistogramSampled(const uint8_t *bytes, size_t size, T *table,
+                                  size_t blockSize, size_t stride, T floor = 0) {
+            if (blockSize == 0 || stride <= 1 || size < blockSize * stride) {
+                byteHistogramInterleaved<8>(bytes, size, table);
+                return;
+            }
+
+            uint64_t sampled[BYTE_TABLE_SIZE] = {0};
+            size_t sampledSize = 0;
+            size_t step = blockSize * stride;
+
+            for (size_t offset = 0; offset < size; offset += step) {
+                size_t block = std::min(blockSize, size - offset);
+                byteHistogramInterleaved<8>(bytes + offset, block, sampled);
+                sampledSize += block;
+            }
+
+            double scale = static_cast<double>(size) / sampledSize;
+            for (size_t ch = 0; ch < BYTE_TABLE_SIZE; ++ch) {
+                auto estimated = static_cast<T>(sampled[ch] * scale);
+                table[ch] += std::max(estimated, floor);
+            }
+        }
+
+        /**
+         * Count bytes with the fastest exact kernel for the given input size.
+         */
+        template <typename T>
+        void byteHistogramFast(const uint8_t *bytes, size_t size, T *table) {
+            // the sub-table setup and fold only pay off on non-trivial inputs
+            if (size < 4 * BYTE_TABLE_SIZE) {
+                byteHistogram(bytes, size, table);
+            } else {
+                byteHistogramInterleaved<8>(bytes, size, table);
+            }
+        }
+    }
+}
@@ -0,0 +1,741 @@
+//
+// Created by kiva on 2026/10/19.
+//
+#pragma once
+
+#include <v9/algorithm/qsort.hpp>
+
+#include <cstring>
+#include <iterator>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <type_traits>
+
+#include <immintrin.h>
+
+namespace v9 {
+    namespace sorts {
+        /**
+         * Instruction sets the key sorts can partition with.
+         */
+        enum class SortIsa {
+            SCALAR, AVX2, AVX512,
+        };
+
+        inline SortIsa detectSortIsa() {
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f")) {
+                return SortIsa::AVX512;
+            }
+            if (__builtin_cpu_supports("avx2")) {
+                return SortIsa::AVX2;
+            }
+            return SortIsa::SCALAR;
+        }
+
+        /**
+         * Keys the vectorized sorts handle: they compare with a single
+         * instruction. Floating point keys must not be NaN.
+         */
+        template<typename T>
+        constexpr bool IS_SIMD_KEY = std::is_same_v<T, int32_t> || std::is_same_v<T, int64_t>
+                                     || std::is_same_v<T, float> || std::is_same_v<T, double>;
+
+        /**
+         * Keys radixSort() handles: 4 or 8 byte integers and floating point.
+         */
+        template<typename T>
+        constexpr bool IS_RADIX_KEY = (std::is_integral_v<T> || std::is_floating_point_v<T>)
+                                      && (sizeof(T) == 4 || sizeof(T) == 8);
+
+        namespace detail {
+            constexpr uint8_t NETWORK16[][2] = {
+                {0, 13}, {1, 12}, {2, 15}, {3, 14}, {4, 8}, {5, 6}, {7, 11}, {9, 10},
+                {0, 5}, {1, 7}, {2, 9}, {3, 4}, {6, 13}, {8, 14}, {10, 15}, {11, 12},
+                {0, 1}, {2, 3}, {4, 5}, {6, 8}, {7, 9}, {10, 11}, {12, 13}, {14, 15},
+                {0, 2}, {1, 3}, {4, 10}, {5, 11}, {6, 7}, {8, 9}, {12, 14}, {13, 15},
+                {1, 2}, {3, 12}, {4, 6}, {5, 7}, {8, 10}, {9, 11}, {13, 14},
+                {1, 4}, {2, 6}, {5, 8}, {7, 10}, {9, 13}, {11, 14},
+                {2, 4}, {3, 6}, {9, 12}, {11, 13},
+                {3, 5}, {6, 8}, {7, 9}, {10, 12},
+                {3, 4}, {5, 6}, {7, 8}, {9, 10}, {11, 12},
+                {6, 7}, {8, 9},
+            };
+
+            template<typename T>
+            inline void compareExchange(T &x, T &y) {
+                T low = y < x ? y : x;
+                T high = y < x ? x : y;
+                x = low;
+                y = high;
+            }
+
+            /*
+             * Compilers branch on the floating point selects above, minss
+             * and maxss are exact: equal keys (0.0 and -0.0) stay apart.
+             */
+            inline void compareExchange(float &x, float &y) {
+                __m128 a = _mm_set_ss(x);
+                __m128 b = _mm_set_ss(y);
+                x = _mm_cvtss_f32(_mm_min_ss(b, a));
+                y = _mm_cvtss_f32(_mm_max_ss(a, b));
+            }
+
+            inline void compareExchange(double &x, double &y) {
+                __m128d a = _mm_set_sd(x);
+                __m128d b = _mm_set_sd(y);
+                x = _mm_cvtsd_f64(_mm_min_sd(b, a));
+                y = _mm_cvtsd_f64(_mm_max_sd(a, b));
+            }
+
+            /**
+             * Every comparator spelled out, so the keys stay in registers.
+             */
+            template<typename T, size_t... Steps>
+            inline void runNetwork(T *v, std::index_sequence<Steps...>) {
+                (compareExchange(v[NETWORK16[Steps][0]], v[NETWORK16[Steps][1]]), ...);
+            }
+
+            /**
+             * Sort up to 16 elements with a fixed 60 comparator network
+             * (10 layers, Green), padded with copies of the largest element.
+             * Every step is a min and a max, no branch depends on the keys.
+             */
+            template<typename T>
+            void sortNetwork(T *a, size_t size) {
+                if (size < 2) {
+                    return;
+                }
+                T v[16];
+                T top = a[0];
+                for (size_t i = 0; i < size; ++i) {
+                    v[i] = a[i];
+                    top = top < a[i] ? a[i] : top;
+                }
+                for (size_t i = size; i < 16; ++i) {
+                    v[i] = top;
+                }
+                runNetwork(v, std::make_index_sequence<std::size(NETWORK16)>());
+                std::copy(v, v + size, a);
+            }
+
+            /**
+             * Lanes of a vector whose bit is set in a mask, in order, then
+             * the others: one permutation entry per mask.
+             */
+            template<size_t Lanes>
+            struct CompressTable {
+                uint64_t entries[1U << Lanes];
+
+                constexpr CompressTable() : entries() {
+                    for (size_t mask = 0; mask < (1U << Lanes); ++mask) {
+                        uint64_t entry = 0;
+                        size_t at = 0;
+                        for (int set = 1; set >= 0; --set) {
+                            for (size_t lane = 0; lane < Lanes; ++lane) {
+                                if (((mask >> lane) & 1U) == static_cast<size_t>(set)) {
+                                    entry |= uint64_t(lane) << (8 * at++);
+                                }
+                            }
+                        }
+                        entries[mask] = entry;
+                    }
+                }
+            };
+
+            inline constexpr CompressTable<8> COMPRESS8{};
+            inline constexpr CompressTable<4> COMPRESS4{};
+
+#define V9_AVX2 inline __attribute__((always_inline, target("avx2")))
+#define V9_AVX512 inline __attribute__((always_inline, target("avx512f")))
+
+            /**
+             * One vector of keys per ISA and type: load, compare against
+             * the pivot (strictly less, or not greater), and partition a
+             * vector in register so the lanes going left come first.
+             */
+            template<typename T>
+            struct Avx2Keys;
+
+            template<>
+            struct Avx2Keys<int32_t> {
+                using Vec = __m256i;
+                static constexpr size_t LANES = 8;
+
+                V9_AVX2 static Vec load(const int32_t *p) {
+                    return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+                }
+
+                V9_AVX2 static void store(int32_t *p, const Vec &v) {
+                    _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v);
+                }
+
+                V9_AVX2 static Vec set1(int32_t x) {
+                    return _mm256_set1_epi32(x);
+                }
+
+                V9_AVX2 static unsigned goesLeft(const Vec &v, const Vec &pivot, bool equal) {
+                    auto greater = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(v, pivot))));
+                    auto less = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(pivot, v))));
+                    return equal ? ~greater & 0xffU : less;
+                }
+
+                V9_AVX2 static Vec compress(const Vec &v, unsigned mask) {
+                    __m256i index = _mm256_cvtepu8_epi32(_mm_cvtsi64_si128(static_cast<long long>(COMPRESS8.entries[mask])));
+                    return _mm256_permutevar8x32_epi32(v, index);
+                }
+            };
+
+            template<>
+            struct Avx2Keys<float> {
+                using Vec = __m256;
+                static constexpr size_t LANES = 8;
+
+                V9_AVX2 static Vec load(const float *p) {
+                    return _mm256_loadu_ps(p);
+                }
+
+                V9_AVX2 static void store(float *p, const Vec &v) {
+                    _mm256_storeu_ps(p, v);
+                }
+
+                V9_AVX2 static Vec set1(float x) {
+                    return _mm256_set1_ps(x);
+                }
+
+                V9_AVX2 static unsigned goesLeft(const Vec &v, const Vec &pivot, bool equal) {
+                    return static_cast<unsigned>(equal ? _mm256_movemask_ps(_mm256_cmp_ps(v, pivot, _CMP_LE_OQ))
+                                                       : _mm256_movemask_ps(_mm256_cmp_ps(v, pivot, _CMP_LT_OQ)));
+                }
+
+                V9_AVX2 static Vec compress(const Vec &v, unsigned mask) {
+                    __m256i index = _mm256_cvtepu8_epi32(_mm_cvtsi64_si128(static_cast<long long>(COMPRESS8.entries[mask])));
+                    return _mm256_permutevar8x32_ps(v, index);
+                }
+            };
+
+            /**
+             * 64-bit lanes are moved as pairs of 32-bit lanes.
+             */
+            V9_AVX2 __m256i pairIndex(unsigned mask) {
+                __m256i lanes = _mm256_cvtepu8_epi32(_mm_cvtsi64_si128(static_cast<long long>(COMPRESS4.entries[mask])));
+                __m256i twice = _mm256_add_epi32(lanes, lanes);
+                // lane i of 4 holds index k: 32-bit lanes 2i and 2i + 1 take 2k and 2k + 1
+                __m256i spread = _mm256_permutevar8x32_epi32(twice, _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3));
+                return _mm256_add_epi32(spread, _mm256_setr_epi32(0, 1, 0, 1, 0, 1, 0, 1));
+            }
+
+            template<>
+            struct Avx2Keys<int64_t> {
+                using Vec = __m256i;
+                static constexpr size_t LANES = 4;
+
+                V9_AVX2 static Vec load(const int64_t *p) {
+                    return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+                }
+
+                V9_AVX2 static void store(int64_t *p, const Vec &v) {
+                    _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v);
+                }
+
+                V9_AVX2 static Vec set1(int64_t x) {
+                    return _mm256_set1_epi64x(x);
+                }
+
+                V9_AVX2 static unsigned goesLeft(const Vec &v, const Vec &pivot, bool equal) {
+                    auto greater = static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(v, pivot))));
+                    auto less = static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(pivot, v))));
+                    return equal ? ~greater & 0xfU : less;
+                }
+
+                V9_AVX2 static Vec compress(const Vec &v, unsigned mask) {
+                    return _mm256_permutevar8x32_epi32(v, pairIndex(mask));
+                }
+            };
+
+            template<>
+            struct Avx2Keys<double> {
+                using Vec = __m256d;
+                static constexpr size_t LANES = 4;
+
+                V9_AVX2 static Vec load(const double *p) {
+                    return _mm256_loadu_pd(p);
+                }
+
+                V9_AVX2 static void store(double *p, const Vec &v) {
+                    _mm256_storeu_pd(p, v);
+                }
+
+                V9_AVX2 static Vec set1(double x) {
+                    return _mm256_set1_pd(x);
+                }
+
+                V9_AVX2 static unsigned goesLeft(const Vec &v, const Vec &pivot, bool equal) {
+                    return static_cast<unsigned>(equal ? _mm256_movemask_pd(_mm256_cmp_pd(v, pivot, _CMP_LE_OQ))
+                                                       : _mm256_movemask_pd(_mm256_cmp_pd(v, pivot, _CMP_LT_OQ)));
+                }
+
+                V9_AVX2 static Vec compress(const Vec &v, unsigned mask) {
+                    return _mm256_castsi256_pd(_mm256_permutevar8x32_epi32(_mm256_castpd_si256(v), pairIndex(mask)));
+                }
+            };
+
+            template<typename T>
+            struct Avx512Keys;
+
+            template<>
+            struct Avx512Keys<int32_t> {
+                using Vec = __m512i;
+                static constexpr size_t LANES = 16;
+
+                V9_AVX512 static Vec load(const int32_t *p) {
+                    return _mm512_loadu_si512(p);
+                }
+
+                V9_AVX512 static Vec set1(int32_t x) {
+                    return _mm512_set1_epi32(x);
+                }
+
+                V9_AVX512 static unsigned goesLeft(const Vec &v, const Vec &pivot, bool equal) {
+                    return equal ? _mm512_cmple_epi32_mask(v, pivot) : _mm512_cmplt_epi32_mask(v, pivot);
+                }
+
+                V9_AVX512 static void compressStore(int32_t *p, unsigned mask, const Vec &v) {
+                    _mm512_mask_compressstoreu_epi32(p, static_cast<__mmask16>(mask), v);
+                }
+            };
+
+            template<>
+            struct Avx512Keys<float> {
+                using Vec = __m512;
+                static constexpr size_t LANES = 16;
+
+                V9_AVX512 static Vec load(const float *p) {
+                    return _mm512_loadu_ps(p);
+                }
+
+                V9_AVX512 static Vec set1(float x) {
+                    return _mm512_set1_ps(x);
+                }
+
+                V9_AVX512 static unsigned goesLeft(const Vec &v, const Vec &pivot, bool equal) {
+                    return equal ? _mm512_cmp_ps_mask(v, pivot, _CMP_LE_OQ) : _mm512_cmp_ps_mask(v, pivot, _CMP_LT_OQ);
+                }
+
+                V9_AVX512 static void compressStore(float *p, unsigned mask, const Vec &v) {
+                    _mm512_mask_compressstoreu_ps(p, static_cast<__mmask16>(mask), v);
+                }
+            };
+
+            template<>
+            struct Avx512Keys<int64_t> {
+                using Vec = __m512i;
+                static constexpr size_t LANES = 8;
+
+                V9_AVX512 static Vec load(const int64_t *p) {
+                    return _mm512_loadu_si512(p);
+                }
+
+                V9_AVX512 static Vec set1(int64_t x) {
+                    return _mm512_set1_epi64(x);
+                }
+
+                V9_AVX512 static unsigned goesLeft(const Vec &v, const Vec &pivot, bool equal) {
+                    return equal ? _mm512_cmple_epi64_mask(v, pivot) : _mm512_cmplt_epi64_mask(v, pivot);
+                }
+
+                V9_AVX512 static void compressStore(int64_t *p, unsigned mask, const Vec &v) {
+                    _mm512_mask_compressstoreu_epi64(p, static_cast<__mmask8>(mask), v);
+                }
+            };
+
+            template<>
+            struct Avx512Keys<double> {
+                using Vec = __m512d;
+                static constexpr size_t LANES = 8;
+
+                V9_AVX512 static Vec load(const double *p) {
+                    return _mm512_loadu_pd(p);
+                }
+
+                V9_AVX512 static Vec set1(double x) {
+                    return _mm512_set1_pd(x);
+                }
+
+                V9_AVX512 static unsigned goesLeft(const Vec &v, const Vec &pivot, bool equal) {
+                    return equal ? _mm512_cmp_pd_mask(v, pivot, _CMP_LE_OQ) : _mm512_cmp_pd_mask(v, pivot, _CMP_LT_OQ);
+                }
+
+                V9_AVX512 static void compressStore(double *p, unsigned mask, const Vec &v) {
+                    _mm512_mask_compressstoreu_pd(p, static_cast<__mmask8>(mask), v);
+                }
+            };
+
+            /**
+             * Partition for ranges shorter than two vectors.
+             */
+            template<typename T>
+            T *partitionShort(T *first, T *last, T pivot, bool equal) {
+                T *l = first;
+                T *h = last;
+                while (l < h) {
+                    if (equal ? !(pivot < *l) : *l < pivot) {
+                        ++l;
+                    } else {
+                        std::swap(*l, *--h);
+                    }
+                }
+                return l;
+            }
+
+            /*
+             * The vector partitions below work in place. The first and the
+             * last vector are held in registers, which leaves two vectors of
+             * free space; every next vector is read from the side with less
+             * free space left, so both sides have at least one vector free
+             * when it is written back: keys going left at writeL, the others
+             * ending at writeR. What is left after the last whole vector is
+             * copied out first, so the gap is contiguous when the two held
+             * vectors go back last.
+             */
+
+            /**
+             * Partition [first, last) with AVX2: each vector is permuted so
+             * the keys going left come first, then stored whole on both
+             * sides; the extra lanes land in free space and get overwritten.
+             * @param equal Keys equal to the pivot go left as well
+             * @return Start of the keys that went right
+             */
+            template<typename T>
+            __attribute__((target("avx2")))
+            T *partitionAvx2(T *first, T *last, T pivot, bool equal) {
+                using K = Avx2Keys<T>;
+                constexpr size_t L = K::LANES;
+                if (size_t(last - first) < 2 * L) {
+                    return partitionShort(first, last, pivot, equal);
+                }
+
+                const typename K::Vec p = K::set1(pivot);
+                const typename K::Vec headVec = K::load(first);
+                const typename K::Vec tailVec = K::load(last - L);
+                T *readL = first + L;
+                T *readR = last - L;
+                T *writeL = first;
+                T *writeR = last;
+
+                auto put = [&](const typename K::Vec &v) __attribute__((always_inline, target("avx2"))) {
+                    unsigned mask = K::goesLeft(v, p, equal);
+                    auto count = static_cast<size_t>(__builtin_popcount(mask));
+                    typename K::Vec packed = K::compress(v, mask);
+                    K::store(writeL, packed);
+                    K::store(writeR - L, packed);
+                    writeL += count;
+                    writeR -= L - count;
+                };
+
+                while (size_t(readR - readL) >= L) {
+                    typename K::Vec v;
+                    if (readL - writeL <= writeR - readR) {
+                        v = K::load(readL);
+                        readL += L;
+                    } else {
+                        readR -= L;
+                        v = K::load(readR);
+                    }
+                    put(v);
+                }
+
+                T rest[L];
+                size_t restLength = readR - readL;
+                std::copy(readL, readR, rest);
+                for (size_t i = 0; i < restLength; ++i) {
+                    if (equal ? !(pivot < rest[i]) : rest[i] < pivot) {
+                        *writeL++ = rest[i];
+                    } else {
+                        *--writeR = rest[i];
+                    }
+                }
+                put(headVec);
+                put(tailVec);
+                return writeL;
+            }
+
+            /**
+             * Partition [first, last) with AVX-512 compress stores, which
+             * write exactly the lanes going to each side.
+             * @param equal Keys equal to the pivot go left as well
+             * @return Start of the keys that went right
+             */
+            template<typename T>
+            __attribute__((target("avx512f")))
+            T *partitionAvx512(T *first, T *last, T pivot, bool equal) {
+                using K = Avx512Keys<T>;
+                constexpr size_t L = K::LANES;
+                constexpr unsigned ALL = (1U << L) - 1;
+                if (size_t(last - first) < 2 * L) {
+                    return partitionShort(first, last, pivot, equal);
+                }
+
+                const typename K::Vec p = K::set1(pivot);
+                const typename K::Vec headVec = K::load(first);
+                const typename K::Vec tailVec = K::load(last - L);
+                T *readL = first + L;
+                T *readR = last - L;
+                T *writeL = first;
+                T *writeR = last;
+
+                auto put = [&](const typename K::Vec &v) __attribute__((always_inline, target("avx512f"))) {
+                    unsigned mask = K::goesLeft(v, p, equal);
+                    auto count = static_cast<size_t>(__builtin_popcount(mask));
+                    K::compressStore(writeL, mask, v);
+                    writeL += count;
+                    writeR -= L - count;
+                    K::compressStore(writeR, ~mask & ALL, v);
+                };
+
+                while (size_t(readR - readL) >= L) {
+                    typename K::Vec v;
+                    if (readL - writeL <= writeR - readR) {
+                        v = K::load(readL);
+                        readL += L;
+                    } else {
+                        readR -= L;
+                        v = K::load(readR);
+                    }
+                    put(v);
+                }
+
+                T rest[L];
+                size_t restLength = readR - readL;
+                std::copy(readL, readR, rest);
+                for (size_t i = 0; i < restLength; ++i) {
+                    if (equal ? !(pivot < rest[i]) : rest[i] < pivot) {
+                        *writeL++ = rest[i];
+                    } else {
+                        *--writeR = rest[i];
+                    }
+                }
+                put(headVec);
+                put(tailVec);
+                return writeL;
+            }
+
+#undef V9_AVX2
+#undef V9_AVX512
+
+            template<SortIsa Isa, typename T>
+            T *partitionKeys(T *first, T *last, T pivot, bool equal) {
+                if constexpr (Isa == SortIsa::AVX512) {
+                    return partitionAvx512(first, last, pivot, equal);
+                } else if constexpr (Isa == SortIsa::AVX2) {
+                    return partitionAvx2(first, last, pivot, equal);
+                } else {
+                    return partitionShort(first, last, pivot, equal);
+                }
+            }
+
+            /**
+             * introsort() on keys: vector partitions, and sorting networks
+             * instead of insertion sort.
+             */
+            template<SortIsa Isa, typename T>
+            void keyIntrosort(T *first, T *last, size_t depth, const T *bound) {
+                std::less<T> less;
+                while (size_t(last - first) > 16) {
+                    if (depth == 0) {
+                        heapSort(first, last, less);
+                        return;
+                    }
+                    --depth;
+                    choosePivot(first, last, less);
+
+                    T pivot = *first;
+                    // as in introsort(), a pivot not greater than the bound is the minimum
+                    bool equal = bound != nullptr && !(*bound < pivot);
+                    T *at = partitionKeys<Isa>(first + 1, last, pivot, equal) - 1;
+                    *first = *at;
+                    *at = pivot;
+
+                    if (equal) {
+                        first = at + 1;
+                    } else if (at - first < last - at) {
+                        keyIntrosort<Isa>(first, at, depth, bound);
+                        first = at + 1;
+                        bound = at;
+                    } else {
+                        keyIntrosort<Isa>(at + 1, last, depth, at);
+                        last = at;
+                    }
+                }
+                sortNetwork(first, last - first);
+            }
+
+            /**
+             * Order preserving map of a key to an unsigned integer:
+             * the sign bit flipped for signed integers, and for floating
+             * point every bit of negative keys, the sign bit of the others.
+             */
+            template<typename T>
+            auto radixBits(T key) {
+                using U = std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>;
+                constexpr U SIGN = U(1) << (8 * sizeof(T) - 1);
+                U bits;
+                memcpy(&bits, &key, sizeof(bits));
+                if constexpr (std::is_floating_point_v<T>) {
+                    return (bits & SIGN) != 0 ? ~bits : bits | SIGN;
+                } else if constexpr (std::is_signed_v<T>) {
+                    return bits ^ SIGN;
+                } else {
+                    return bits;
+                }
+            }
+
+            /**
+             * LSD radix sort on bytes, stable. Keys move between {@code keys}
+             * and {@code keyScratch}, values (if any) along with them. Passes
+             * on a byte every key has the same value of are skipped.
+             */
+            template<typename T, typename V>
+            void radixSort(T *keys, T *keyScratch, V *values, V *valueScratch, size_t size) {
+                constexpr size_t PASSES = sizeof(T);
+                size_t counts[PASSES * 256] = {};
+
+                for (size_t i = 0; i < size; ++i) {
+                    auto bits = radixBits(keys[i]);
+                    for (size_t pass = 0; pass < PASSES; ++pass) {
+                        ++counts[pass * 256 + ((bits >> (8 * pass)) & 0xffU)];
+                    }
+                }
+
+                T *src = keys;
+                T *dst = keyScratch;
+                V *srcValues = values;
+                V *dstValues = valueScratch;
+                for (size_t pass = 0; pass < PASSES; ++pass) {
+                    size_t *count = &counts[pass * 256];
+                    if (count[(radixBits(src[0]) >> (8 * pass)) & 0xffU] == size) {
+                        continue;
+                    }
+                    size_t offset = 0;
+                    for (size_t digit = 0; digit < 256; ++digit) {
+                        size_t n = count[digit];
+                        count[digit] = offset;
+                        offset += n;
+                    }
+                    for (size_t i = 0; i < size; ++i) {
+                        size_t to = count[(radixBits(src[i]) >> (8 * pass)) & 0xffU]++;
+                        dst[to] = src[i];
+                        if constexpr (!std::is_void_v<V>) {
+                            dstValues[to] = std::move(srcValues[i]);
+                        }
+                    }
+                    std::swap(src, dst);
+                    std::swap(srcValues, dstValues);
+                }
+
+                if (src != keys) {
+                    std::copy(src, src + size, keys);
+                    if constexpr (!std::is_void_v<V>) {
+                        std::move(srcValues, srcValues + size, values);
+                    }
+                }
+            }
+
+            /**
+             * Below this many keys, radix passes cost more than comparing.
+             */
+            constexpr size_t RADIX_CUTOFF = 512;
+        }
+
+        /**
+         * Sort keys in ascending order with vector partitions on the given
+         * instruction set. SCALAR partitions one key at a time.
+         */
+        template<typename T, typename = std::enable_if_t<IS_SIMD_KEY<T>>>
+        void keyQuicksort(T *a, size_t size, SortIsa isa) {
+            size_t depth = detail::depthLimit(size);
+            switch (isa) {
+                case SortIsa::AVX512:
+                    detail::keyIntrosort<SortIsa::AVX512>(a, a + size, depth, static_cast<const T *>(nullptr));
+                    break;
+                case SortIsa::AVX2:
+                    detail::keyIntrosort<SortIsa::AVX2>(a, a + size, depth, static_cast<const T *>(nullptr));
+                    break;
+                default:
+                    detail::keyIntrosort<SortIsa::SCALAR>(a, a + size, depth, static_cast<const T *>(nullptr));
+                    break;
+            }
+        }
+
+        /**
+         * LSD radix sort, stable, with {@code scratch} room for
+         * {@code size} keys.
+         */
+        template<typename T, typename = std::enable_if_t<IS_RADIX_KEY<T>>>
+        void radixSort(T *a, size_t size, T *scratch) {
+            if (size > 1) {
+                detail::radixSort<T, void>(a, scratch, nullptr, nullptr, size);
+            }
+        }
+
+        template<typename T, typename = std::enable_if_t<IS_RADIX_KEY<T>>>
+        void radixSort(T *a, size_t size) {
+            std::vector<T> scratch(size);
+            radixSort(a, size, scratch.data());
+        }
+
+        /**
+         * Sort keys and move values[i] along with keys[i], stable.
+         */
+        template<typename K, typename V, typename = std::enable_if_t<IS_RADIX_KEY<K>>>
+        void radixSortPairs(K *keys, V *values, size_t size) {
+            if (size > 1) {
+                std::vector<K> keyScratch(size);
+                std::vector<V> valueScratch(size);
+                detail::radixSort(keys, keyScratch.data(), values, valueScratch.data(), size);
+            }
+        }
+
+        /**
+         * Sort primitive keys the fastest way known for their type and count:
+         * a sorting network up to 16 keys, radix sort for long arrays of
+         * 4 byte keys (8 byte keys take twice the passes and lose to
+         * comparisons), otherwise a quicksort partitioning with the widest
+         * vector instructions the CPU has. Input already in order, either
+         * way, costs one pass. NaN is not supported.
+         */
+        template<typename T, typename = std::enable_if_t<IS_SIMD_KEY<T> || IS_RADIX_KEY<T>>>
+        void sortKeys(T *a, size_t size) {
+            static const SortIsa isa = detectSortIsa();
+            if (size <= 16) {
+                detail::sortNetwork(a, size);
+                return;
+            }
+            if (std::is_sorted(a, a + size)) {
+                return;
+            }
+            if (std::is_sorted(a, a + size, std::greater<T>())) {
+                std::reverse(a, a + size);
+                return;
+            }
+
+            if (sizeof(T) == 4 && size >= detail::RADIX_CUTOFF) {
+                radixSort(a, size);
+            } else if constexpr (IS_SIMD_KEY<T>) {
+                keyQuicksort(a, size, isa);
+            } else {
+                introsort(a, a + size);
+            }
+        }
+
+        /**
+         * Sort keys and move values[i] along with keys[i]. Equal keys keep
+         * their order.
+         */
+        template<typename K, typename V, typename = std::enable_if_t<IS_RADIX_KEY<K>>>
+        void sortPairs(K *keys, V *values, size_t size) {
+            radixSortPairs(keys, values, size);
+        }
+    }
+}
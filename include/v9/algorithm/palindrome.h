@@ -3,17 +3,195 @@
 //
 #pragma once
 
+#include <v9/kit/string.hpp>
+#include <v9/kit/tasks.hpp>
+
+#include <cstdint>
+#include <cstring>
 #include <string>
+#include <vector>
+#include <algorithm>
+
+#include <immintrin.h>
 
 namespace v9 {
     namespace solve {
-        bool isPalindrome(const std::string &s) {
-            for (int i = 0, j = static_cast<int>(s.size() - 1); i < j; ++i, --j) {
-                if (s[i] != s[j]) {
-                    return false;
+        namespace detail {
+            inline uint64_t loadWord(const char *p) {
+                uint64_t word;
+                memcpy(&word, p, sizeof(word));
+                return word;
+            }
+
+            /**
+             * Whether s[i + k] == s[j - 1 - k] for every k < (j - i) / 2,
+             * 8 bytes from each end at a time: the back word byte-swapped
+             * reads like the front one.
+             */
+            inline bool mirrored(const char *s, size_t i, size_t j) {
+                while (j - i >= 16) {
+                    if (loadWord(s + i) != __builtin_bswap64(loadWord(s + j - 8))) {
+                        return false;
+                    }
+                    i += 8;
+                    j -= 8;
+                }
+                for (; i + 1 < j; ++i, --j) {
+                    if (s[i] != s[j - 1]) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            /**
+             * 32 bytes from each end at a time. The back block is reversed
+             * by a byte shuffle inside each 128-bit lane and a swap of the
+             * two lanes. Once less than 64 bytes are left in the middle,
+             * one last pair of blocks, overlapping, covers all of them.
+             */
+            __attribute__((target("avx2")))
+            inline bool mirroredAvx2(const char *s, size_t size) {
+                if (size < 32) {
+                    return mirrored(s, 0, size);
+                }
+                const __m256i reverse = _mm256_setr_epi8(
+                    15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                    15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+                size_t i = 0;
+                size_t j = size;
+                while (true) {
+                    if (j - i < 64) {
+                        // overlaps the blocks compared last, which were equal
+                        i = std::min(i, (size - 32) / 2);
+                        j = size - i;
+                    }
+                    __m256i front = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i));
+                    __m256i back = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + j - 32));
+                    back = _mm256_shuffle_epi8(back, reverse);
+                    back = _mm256_permute2x128_si256(back, back, 0x01);
+                    if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(front, back)) != -1) {
+                        return false;
+                    }
+                    if (j - i < 64) {
+                        return true;
+                    }
+                    i += 32;
+                    j -= 32;
+                }
+            }
+
+            inline bool hasAvx2() {
+                __builtin_cpu_init();
+                return __builtin_cpu_supports("avx2");
+            }
+
+            /**
+             * Strings a batch task checks, at most: enough text that a
+             * task outweighs its scheduling.
+             */
+            constexpr size_t BATCH_BYTES = 64 * 1024;
+        }
+
+        /**
+         * Whether {@code s} reads the same backwards, comparing 32 bytes
+         * from each end at once when the CPU has AVX2.
+         */
+        inline bool isPalindrome(kit::StringRef s) {
+            static const bool avx2 = detail::hasAvx2();
+            return avx2 ? detail::mirroredAvx2(s.data(), s.size()) : detail::mirrored(s.data(), 0, s.size());
+        }
+
+        /**
+         * Check {@code count} strings, {@code results[i]} tells whether
+         * {@code strings[i]} is a palindrome.
+         */
+        inline void isPalindrome(const kit::StringRef *strings, size_t count, bool *results) {
+            static const bool avx2 = detail::hasAvx2();
+            if (avx2) {
+                for (size_t i = 0; i < count; ++i) {
+                    results[i] = detail::mirroredAvx2(strings[i].data(), strings[i].size());
+                }
+            } else {
+                for (size_t i = 0; i < count; ++i) {
+                    results[i] = detail::mirrored(strings[i].data(), 0, strings[i].size());
+                }
+            }
+        }
+
+        /**
+         * The batch check on {@code pool}: strings are cut into runs of
+         * about 64 KiB of text, one task each.
+         */
+        inline void isPalindrome(const kit::StringRef *strings, size_t count, bool *results,
+                                 kit::TaskPool &pool) {
+            kit::TaskGroup group(pool);
+            size_t begin = 0;
+            while (begin < count) {
+                size_t end = begin;
+                size_t bytes = 0;
+                while (end < count && bytes < detail::BATCH_BYTES) {
+                    bytes += strings[end++].size();
+                }
+                group.run([strings, results, begin, end] {
+                    isPalindrome(strings + begin, end - begin, results + begin);
+                });
+                begin = end;
+            }
+            group.wait();
+        }
+
+        /**
+         * The longest palindrome inside {@code s}, the leftmost one if
+         * there are several, in linear time: Manacher's algorithm.
+         *
+         * Palindromes centered on a character and between two characters
+         * take a pass each. A pass keeps the palindrome found so far that
+         * reaches furthest right; a center inside it starts from the radius
+         * of its mirror center, as far as the enclosing palindrome goes,
+         * and only grows past that by comparing characters. Every compare
+         * that succeeds moves the right end forward, hence O(n).
+         * @return A piece of {@code s}
+         */
+        inline kit::StringRef longestPalindrome(kit::StringRef s) {
+            const char *text = s.data();
+            auto size = static_cast<ptrdiff_t>(s.size());
+            if (size == 0) {
+                return s;
+            }
+            // the longest palindrome centered on i is 2 * radius[i] - 1 long in the
+            // first pass, the one centered right before i is 2 * radius[i] long in the second
+            std::vector<ptrdiff_t> radius(size);
+            ptrdiff_t bestBegin = 0;
+            ptrdiff_t bestLength = 1;
+
+            for (int even = 0; even <= 1; ++even) {
+                ptrdiff_t left = 0;
+                ptrdiff_t right = -1;
+                for (ptrdiff_t i = 0; i < size; ++i) {
+                    ptrdiff_t k = even ^ 1;
+                    if (i <= right) {
+                        k = std::min(radius[left + right - i + even], right - i + 1);
+                    }
+                    while (i - k - even >= 0 && i + k < size && text[i - k - even] == text[i + k]) {
+                        ++k;
+                    }
+                    radius[i] = k;
+                    if (i + k - 1 > right) {
+                        left = i - k + 1 - even;
+                        right = i + k - 1;
+                    }
+                }
+                for (ptrdiff_t i = 0; i < size; ++i) {
+                    ptrdiff_t length = 2 * radius[i] - (even ^ 1);
+                    ptrdiff_t begin = i - radius[i] + (even ^ 1);
+                    if (length > bestLength || (length == bestLength && begin < bestBegin)) {
+                        bestBegin = begin;
+                        bestLength = length;
+                    }
                 }
             }
-            return true;
+            return kit::StringRef(text + bestBegin, static_cast<size_t>(bestLength));
         }
     }
 }
@@ -5,34 +5,460 @@
 
 #include <v9/bits/types.hpp>
 #include <v9/bits/traits.hpp>
+#include <v9/kit/tasks.hpp>
+
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
 
 namespace v9 {
     namespace sorts {
-        template<typename T>
-        void qsort(T *a, size_t low, size_t high) {
-            while (low < high) {
-                size_t md = low + (high - low) / 2;
-                size_t l = low - 1;
-                size_t h = high + 1;
-                T p = a[md];
+        namespace detail {
+            /**
+             * Ranges this short are insertion sorted.
+             */
+            constexpr size_t INSERTION_CUTOFF = 16;
+
+            /**
+             * Ranges longer than this pick the pivot from nine samples.
+             */
+            constexpr size_t NINTHER_CUTOFF = 128;
 
+            /**
+             * Ranges this short are not worth a task of their own.
+             */
+            constexpr size_t PARALLEL_CUTOFF = size_t(1) << 16U;
+
+            template<typename T, typename Less>
+            void insertionSort(T *first, T *last, Less &less) {
+                if (first == last) {
+                    return;
+                }
+                for (T *i = first + 1; i != last; ++i) {
+                    if (less(*i, *first)) {
+                        T value = std::move(*i);
+                        std::move_backward(first, i, i + 1);
+                        *first = std::move(value);
+                    } else {
+                        // *first is not greater, it stops the scan
+                        T value = std::move(*i);
+                        T *j = i;
+                        while (less(value, *(j - 1))) {
+                            *j = std::move(*(j - 1));
+                            --j;
+                        }
+                        *j = std::move(value);
+                    }
+                }
+            }
+
+            template<typename T, typename Less>
+            void siftDown(T *a, size_t root, size_t size, Less &less) {
+                T value = std::move(a[root]);
                 while (true) {
-                    while (a[++l] < p);
-                    while (a[--h] > p);
-                    if (l >= h) {
+                    size_t child = 2 * root + 1;
+                    if (child >= size) {
+                        break;
+                    }
+                    if (child + 1 < size && less(a[child], a[child + 1])) {
+                        ++child;
+                    }
+                    if (!less(value, a[child])) {
                         break;
                     }
-                    std::swap(a[l], a[h]);
+                    a[root] = std::move(a[child]);
+                    root = child;
+                }
+                a[root] = std::move(value);
+            }
+
+            /**
+             * O(n log n) whatever the input, used once quicksort
+             * recursed too deep.
+             */
+            template<typename T, typename Less>
+            void heapSort(T *first, T *last, Less &less) {
+                size_t size = last - first;
+                for (size_t i = size / 2; i-- > 0;) {
+                    siftDown(first, i, size, less);
+                }
+                for (size_t i = size; i-- > 1;) {
+                    std::swap(first[0], first[i]);
+                    siftDown(first, 0, i, less);
+                }
+            }
+
+            template<typename T, typename Less>
+            T *median3(T *a, T *b, T *c, Less &less) {
+                if (less(*a, *b)) {
+                    return less(*b, *c) ? b : (less(*a, *c) ? c : a);
+                }
+                return less(*a, *c) ? a : (less(*b, *c) ? c : b);
+            }
+
+            /**
+             * Move the pivot to *first: median of three samples, or of the
+             * medians of three spread triples (Tukey's ninther) on long
+             * ranges. Either way some other element of the range is not
+             * less than it, which stops the left scan of partition().
+             */
+            template<typename T, typename Less>
+            void choosePivot(T *first, T *last, Less &less) {
+                size_t size = last - first;
+                T *mid = first + size / 2;
+                T *pivot;
+                if (size > NINTHER_CUTOFF) {
+                    size_t step = size / 8;
+                    pivot = median3(
+                        median3(first + 1, first + step, first + 2 * step, less),
+                        median3(mid - step, mid, mid + step, less),
+                        median3(last - 1 - 2 * step, last - 1 - step, last - 1, less),
+                        less);
+                } else {
+                    pivot = median3(first + 1, mid, last - 1, less);
+                }
+                std::swap(*first, *pivot);
+            }
+
+            /**
+             * Partition (first, last) around *first into elements less than
+             * it and elements not less, then move the pivot between them.
+             * Scans need no bounds checks: choosePivot() left an element not
+             * less than the pivot on its right, and once a swap happened the
+             * left part stops the right scan.
+             * @return Where the pivot ended
+             */
+            template<typename T, typename Less>
+            T *partitionRight(T *first, T *last, Less &less) {
+                T pivot = std::move(*first);
+                T *l = first;
+                T *h = last;
+                while (less(*++l, pivot)) {
+                }
+                if (l - 1 == first) {
+                    while (l < h && !less(*--h, pivot)) {
+                    }
+                } else {
+                    while (!less(*--h, pivot)) {
+                    }
+                }
+                while (l < h) {
+                    std::swap(*l, *h);
+                    while (less(*++l, pivot)) {
+                    }
+                    while (!less(*--h, pivot)) {
+                    }
+                }
+                T *at = l - 1;
+                *first = std::move(*at);
+                *at = std::move(pivot);
+                return at;
+            }
+
+            constexpr size_t BLOCK_LENGTH = 64;
+
+            /**
+             * Swap left[offsetsL[i]] with right[-offsetsR[i]], as a cycle
+             * of moves when the counts differ.
+             */
+            template<typename T>
+            void swapOffsets(T *left, T *right, const uint8_t *offsetsL, const uint8_t *offsetsR,
+                             size_t count, bool swaps) {
+                if (swaps) {
+                    for (size_t i = 0; i < count; ++i) {
+                        std::swap(left[offsetsL[i]], *(right - offsetsR[i]));
+                    }
+                } else if (count > 0) {
+                    T *l = left + offsetsL[0];
+                    T *r = right - offsetsR[0];
+                    T value = std::move(*l);
+                    *l = std::move(*r);
+                    for (size_t i = 1; i < count; ++i) {
+                        l = left + offsetsL[i];
+                        *r = std::move(*l);
+                        r = right - offsetsR[i];
+                        *l = std::move(*r);
+                    }
+                    *r = std::move(value);
                 }
+            }
 
-                l = h++;
-                if ((l - low) <= (high - h)) {
-                    qsort(a, low, l);
-                    low = h;
+            /**
+             * partitionRight() without a branch per element (block
+             * partitioning, Edelkamp and Weiss): each side first records the
+             * offsets of BLOCK_LENGTH elements that are misplaced, using the
+             * comparison as an integer, then swaps them pairwise. On random
+             * keys the scans of partitionRight() mispredict every other
+             * element, this loop only at block boundaries.
+             */
+            template<typename T, typename Less>
+            T *partitionRightBlock(T *first, T *last, Less &less) {
+                T pivot = std::move(*first);
+                T *l = first;
+                T *h = last;
+                while (less(*++l, pivot)) {
+                }
+                if (l - 1 == first) {
+                    while (l < h && !less(*--h, pivot)) {
+                    }
                 } else {
-                    qsort(a, h, high);
-                    high = l;
+                    while (!less(*--h, pivot)) {
+                    }
                 }
+
+                if (l < h) {
+                    std::swap(*l, *h);
+                    ++l;
+
+                    alignas(64) uint8_t offsetsL[BLOCK_LENGTH];
+                    alignas(64) uint8_t offsetsR[BLOCK_LENGTH];
+                    T *baseL = l;
+                    T *baseR = h;
+                    size_t countL = 0;
+                    size_t countR = 0;
+                    size_t startL = 0;
+                    size_t startR = 0;
+
+                    while (l < h) {
+                        // scan a full block on the side(s) out of offsets,
+                        // or split what is left when less than two blocks remain
+                        size_t unknown = h - l;
+                        size_t splitL = countL == 0 ? (countR == 0 ? unknown / 2 : unknown) : 0;
+                        size_t splitR = countR == 0 ? unknown - splitL : 0;
+
+                        size_t scanL = std::min(splitL, BLOCK_LENGTH);
+                        for (size_t i = 0; i < scanL; ++i) {
+                            offsetsL[countL] = static_cast<uint8_t>(i);
+                            countL += !less(*l, pivot);
+                            ++l;
+                        }
+                        size_t scanR = std::min(splitR, BLOCK_LENGTH);
+                        for (size_t i = 0; i < scanR;) {
+                            offsetsR[countR] = static_cast<uint8_t>(++i);
+                            countR += less(*--h, pivot);
+                        }
+
+                        size_t count = std::min(countL, countR);
+                        swapOffsets(baseL, baseR, offsetsL + startL, offsetsR + startR, count, countL == countR);
+                        countL -= count;
+                        countR -= count;
+                        startL += count;
+                        startR += count;
+                        if (countL == 0) {
+                            startL = 0;
+                            baseL = l;
+                        }
+                        if (countR == 0) {
+                            startR = 0;
+                            baseR = h;
+                        }
+                    }
+
+                    // misplaced elements left over on one side go to the boundary
+                    if (countL != 0) {
+                        while (countL-- > 0) {
+                            std::swap(baseL[offsetsL[startL + countL]], *--h);
+                        }
+                        l = h;
+                    }
+                    if (countR != 0) {
+                        while (countR-- > 0) {
+                            std::swap(*(baseR - offsetsR[startR + countR]), *l);
+                            ++l;
+                        }
+                    }
+                }
+
+                T *at = l - 1;
+                *first = std::move(*at);
+                *at = std::move(pivot);
+                return at;
+            }
+
+            /**
+             * Block partitioning pays off when comparing is one cheap
+             * instruction whose outcome the branch predictor cannot guess.
+             */
+            template<typename T, typename Less>
+            constexpr bool BRANCHLESS = std::is_arithmetic_v<T>
+                                        && (std::is_same_v<Less, std::less<T>> || std::is_same_v<Less, std::greater<T>>);
+
+            template<typename T, typename Less>
+            T *partition(T *first, T *last, Less &less) {
+                if constexpr (BRANCHLESS<T, Less>) {
+                    return partitionRightBlock(first, last, less);
+                } else {
+                    return partitionRight(first, last, less);
+                }
+            }
+
+            /**
+             * Partition (first, last) around *first into elements not greater
+             * than it and elements greater, then move the pivot between them.
+             * @return Where the pivot ended
+             */
+            template<typename T, typename Less>
+            T *partitionLeft(T *first, T *last, Less &less) {
+                T *l = first;
+                T *h = last;
+                while (less(*first, *--h)) {
+                }
+                while (l < h && !less(*first, *++l)) {
+                }
+                while (l < h) {
+                    std::swap(*l, *h);
+                    while (less(*first, *--h)) {
+                    }
+                    while (!less(*first, *++l)) {
+                    }
+                }
+                std::swap(*first, *h);
+                return h;
+            }
+
+            /**
+             * @param depth Partitions left before switching to heapSort
+             * @param bound An element not greater than any in the range that
+             * nobody modifies meanwhile, a pivot in its final place, or nullptr
+             */
+            template<typename T, typename Less>
+            void introsort(T *first, T *last, size_t depth, const T *bound, Less &less) {
+                while (size_t(last - first) > INSERTION_CUTOFF) {
+                    if (depth == 0) {
+                        heapSort(first, last, less);
+                        return;
+                    }
+                    --depth;
+                    choosePivot(first, last, less);
+
+                    // a pivot not greater than the bound is the minimum, every
+                    // element equal to it is in place once split off
+                    if (bound != nullptr && !less(*bound, *first)) {
+                        first = partitionLeft(first, last, less) + 1;
+                        continue;
+                    }
+
+                    T *pivot = partition(first, last, less);
+
+                    // recurse into the shorter part, so the stack stays O(log n)
+                    if (pivot - first < last - pivot) {
+                        introsort(first, pivot, depth, bound, less);
+                        first = pivot + 1;
+                        bound = pivot;
+                    } else {
+                        introsort(pivot + 1, last, depth, pivot, less);
+                        last = pivot;
+                    }
+                }
+                insertionSort(first, last, less);
+            }
+
+            /**
+             * introsort() that forks the shorter part of every long
+             * partition into {@code group} instead of recursing.
+             * Pivots stay put once placed, so they are safe bounds for
+             * the tasks on their right.
+             */
+            template<typename T, typename Less>
+            void parallelIntrosort(T *first, T *last, size_t depth, const T *bound, Less &less,
+                                   kit::TaskGroup &group) {
+                while (size_t(last - first) > PARALLEL_CUTOFF) {
+                    if (depth == 0) {
+                        heapSort(first, last, less);
+                        return;
+                    }
+                    --depth;
+                    choosePivot(first, last, less);
+
+                    if (bound != nullptr && !less(*bound, *first)) {
+                        first = partitionLeft(first, last, less) + 1;
+                        continue;
+                    }
+
+                    T *pivot = partition(first, last, less);
+
+                    if (pivot - first < last - pivot) {
+                        group.run([first, pivot, depth, bound, &less, &group] {
+                            parallelIntrosort(first, pivot, depth, bound, less, group);
+                        });
+                        first = pivot + 1;
+                        bound = pivot;
+                    } else {
+                        T *end = last;
+                        group.run([pivot, end, depth, &less, &group] {
+                            parallelIntrosort(pivot + 1, end, depth, pivot, less, group);
+                        });
+                        last = pivot;
+                    }
+                }
+                introsort(first, last, depth, bound, less);
+            }
+
+            /**
+             * 2 * floor(log2(size))
+             */
+            inline size_t depthLimit(size_t size) {
+                size_t depth = 0;
+                for (; size > 1; size >>= 1U) {
+                    depth += 2;
+                }
+                return depth;
+            }
+        }
+
+        /**
+         * Sort [first, last) with introsort: quicksort with ninther pivots,
+         * insertion sort for short ranges and heap sort once the recursion
+         * gets deeper than 2 log2(n), so O(n log n) even on inputs built to
+         * defeat the pivot choice. Not stable.
+         */
+        template<typename T, typename Less = std::less<T>>
+        void introsort(T *first, T *last, Less less = Less()) {
+            detail::introsort(first, last, detail::depthLimit(last - first), static_cast<const T *>(nullptr), less);
+        }
+
+        /**
+         * introsort() with partitions longer than 64Ki elements sorted as
+         * tasks of {@code pool}. The calling thread takes part, so a pool
+         * without workers sorts sequentially. The first partition of the
+         * whole range still runs on one thread. {@code less} is called from
+         * several threads at once.
+         */
+        template<typename T, typename Less = std::less<T>>
+        void parallelSort(T *first, T *last, kit::TaskPool &pool, Less less = Less()) {
+            kit::TaskGroup group(pool);
+            detail::parallelIntrosort(first, last, detail::depthLimit(last - first),
+                                      static_cast<const T *>(nullptr), less, group);
+            group.wait();
+        }
+
+        /**
+         * parallelSort() on a pool of one thread per hardware thread,
+         * started for this call only.
+         */
+        template<typename T, typename Less = std::less<T>>
+        void parallelSort(T *first, T *last, Less less = Less()) {
+            if (size_t(last - first) <= detail::PARALLEL_CUTOFF) {
+                introsort(first, last, less);
+                return;
+            }
+            kit::TaskPool pool;
+            parallelSort(first, last, pool, less);
+        }
+
+        template<typename T>
+        void qsort(T *a, size_t size) {
+            introsort(a, a + size);
+        }
+
+        /**
+         * Sort a[low] to a[high], both included.
+         */
+        template<typename T>
+        void qsort(T *a, size_t low, size_t high) {
+            if (low < high) {
+                introsort(a + low, a + high + 1);
             }
         }
     }
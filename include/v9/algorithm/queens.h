@@ -3,8 +3,13 @@
 //
 #pragma once
 
+#include <v9/algorithm/search.hpp>
+
 #include <cmath>
 #include <cstdio>
+#include <cstdint>
+#include <vector>
+#include <stdexcept>
 
 namespace v9 {
     namespace solve {
@@ -38,25 +43,291 @@ namespace v9 {
             }
         }
 
-        void queenDfs(int step, int n, int *queen, int &counter) {
+        void queenDfs(int step, int n, int *queen, int &counter, bool show = true) {
             if (step == n) {
                 ++counter;
-                queenShowResult(n, queen, counter);
+                if (show) {
+                    queenShowResult(n, queen, counter);
+                }
                 return;
             }
 
             for (int i = 0; i < n; ++i) {
                 queen[step] = i;
                 if (queenCheck(step, queen)) {
-                    queenDfs(step + 1, n, queen, counter);
+                    queenDfs(step + 1, n, queen, counter, show);
+                }
+            }
+        }
+
+        /**
+         * Rows placed so far as bitmasks: bit c of {@code columns} is set
+         * when column c holds a queen, {@code left} and {@code right} are
+         * the squares of the next row attacked along the two diagonals.
+         */
+        struct QueenBoard {
+            uint32_t columns;
+            uint32_t left;
+            uint32_t right;
+
+            QueenBoard place(uint32_t bit) const {
+                return QueenBoard{columns | bit, (left | bit) << 1U, (right | bit) >> 1U};
+            }
+
+            uint32_t free(uint32_t all) const {
+                return all & ~(columns | left | right);
+            }
+        };
+
+        /**
+         * Count the ways to complete {@code board}, {@code all} has one bit
+         * per column. Free squares are taken lowest set bit first; the
+         * board being extended stays in registers and only goes to the
+         * stack to branch. The last row has one column left, so it needs
+         * no placing, only a check.
+         */
+        inline uint64_t queenCount(uint32_t all, const QueenBoard &board) {
+            int rows = __builtin_popcount(all) - __builtin_popcount(board.columns);
+            if (rows <= 1) {
+                return rows == 0 || board.free(all) != 0 ? 1 : 0;
+            }
+
+            QueenBoard stack[32];
+            uint32_t stackFree[32];
+            int depth = 0;
+            QueenBoard current = board;
+            uint32_t free = board.free(all);
+            uint64_t count = 0;
+            while (true) {
+                if (free == 0) {
+                    if (depth == 0) {
+                        return count;
+                    }
+                    --depth;
+                    current = stack[depth];
+                    free = stackFree[depth];
+                    continue;
+                }
+                uint32_t bit = free & -free;
+                free ^= bit;
+                QueenBoard next = current.place(bit);
+                if (depth == rows - 2) {
+                    count += next.free(all) != 0;
+                    continue;
+                }
+                stack[depth] = current;
+                stackFree[depth] = free;
+                ++depth;
+                current = next;
+                free = next.free(all);
+            }
+        }
+
+        /**
+         * First rows of the board, each with the number of solutions one
+         * completion stands for.
+         */
+        struct QueenPrefix {
+            QueenBoard board;
+            uint64_t weight;
+        };
+
+        inline void queenPrefixes(uint32_t all, const QueenBoard &board, int rows, uint32_t allowed,
+                                  uint64_t weight, std::vector<QueenPrefix> &prefixes) {
+            if (rows <= 0 || board.columns == all) {
+                prefixes.push_back(QueenPrefix{board, weight});
+                return;
+            }
+            for (uint32_t free = board.free(all) & allowed; free != 0; free &= free - 1) {
+                queenPrefixes(all, board.place(free & -free), rows - 1, all, weight, prefixes);
+            }
+        }
+
+        /**
+         * Boards of the first {@code rows} rows whose completions, times
+         * their weight, add up to every solution. Mirror images are counted
+         * once with weight 2: the first queen goes in the left half only,
+         * or in the middle column of an odd board with the second queen in
+         * the left half.
+         */
+        inline std::vector<QueenPrefix> queenSplit(int n, int rows) {
+            uint32_t all = n == 32 ? ~uint32_t(0) : (uint32_t(1) << n) - 1;
+            uint32_t half = (uint32_t(1) << (n / 2)) - 1;
+            std::vector<QueenPrefix> prefixes;
+            if (n == 1) {
+                prefixes.push_back(QueenPrefix{QueenBoard{1, 0, 0}, 1});
+                return prefixes;
+            }
+            queenPrefixes(all, QueenBoard{0, 0, 0}, 1, half, 2, prefixes);
+            size_t mirrored = prefixes.size();
+            if (n % 2 == 1) {
+                QueenBoard middle = QueenBoard{0, 0, 0}.place(uint32_t(1) << (n / 2));
+                queenPrefixes(all, middle, 1, half, 2, prefixes);
+            }
+            // extend every prefix to the rows wanted
+            std::vector<QueenPrefix> split;
+            for (size_t i = 0; i < prefixes.size(); ++i) {
+                int placed = i < mirrored ? 1 : 2;
+                queenPrefixes(all, prefixes[i].board, rows - placed, all, prefixes[i].weight, split);
+            }
+            return split;
+        }
+
+        inline void queenCheckSize(int n) {
+            if (n < 0 || n > 32) {
+                throw std::invalid_argument("countQueens: board size out of range [0, 32]");
+            }
+        }
+
+        /**
+         * Number of ways to place n non-attacking queens on an n x n board,
+         * n up to 32: bitboard search over half the first row.
+         */
+        inline uint64_t countQueens(int n) {
+            queenCheckSize(n);
+            if (n == 0) {
+                return 1;
+            }
+            uint32_t all = n == 32 ? ~uint32_t(0) : (uint32_t(1) << n) - 1;
+            uint64_t count = 0;
+            for (auto &&prefix : queenSplit(n, 2)) {
+                count += prefix.weight * queenCount(all, prefix.board);
+            }
+            return count;
+        }
+
+        /**
+         * N-Queens for Backtracking, to count: a state per row filled, a
+         * move per free square of the next row, as its bit. The queen of
+         * the last row has one column left, so a board is solved as soon
+         * as that square is free. Only free squares are generated, so
+         * every move passes the check. Boards of at least 2 columns.
+         *
+         * The search only places the first SEARCH_ROWS rows, enough
+         * subtrees to share between threads; queenCount() does the rest,
+         * about twice as fast per board as generic states.
+         */
+        struct QueenProblem {
+            using State = QueenBoard;
+            using Move = uint32_t;
+
+            static constexpr int SEARCH_ROWS = 3;
+
+            uint32_t all;
+
+            bool isLastRow(const QueenBoard &board) const {
+                uint32_t left = all & ~board.columns;
+                return (left & (left - 1)) == 0;
+            }
+
+            bool isSolution(const QueenBoard &board) const {
+                return isLastRow(board) && board.free(all) != 0;
+            }
+
+            template<typename Emit>
+            void generate(const QueenBoard &board, Emit &&emit) const {
+                if (isLastRow(board)) {
+                    return;
+                }
+                for (uint32_t free = board.free(all); free != 0; free &= free - 1) {
+                    emit(free & -free);
+                }
+            }
+
+            bool check(const QueenBoard &, uint32_t) const {
+                return true;
+            }
+
+            QueenBoard apply(const QueenBoard &board, uint32_t bit) const {
+                return board.place(bit);
+            }
+
+            bool countSubtree(const QueenBoard &board, uint64_t &solutions) const {
+                if (__builtin_popcount(board.columns) < SEARCH_ROWS) {
+                    return false;
                 }
+                solutions += queenCount(all, board);
+                return true;
             }
+        };
+
+        /**
+         * A QueenBoard that remembers the column of the queen on every row.
+         */
+        struct QueenPlacement {
+            QueenBoard board;
+            int rows;
+            int queen[32];
+        };
+
+        /**
+         * N-Queens for Backtracking, to list the boards: every queen placed.
+         */
+        struct QueenPlacementProblem {
+            using State = QueenPlacement;
+            using Move = uint32_t;
+
+            uint32_t all;
+
+            bool isSolution(const QueenPlacement &placement) const {
+                return placement.board.columns == all;
+            }
+
+            template<typename Emit>
+            void generate(const QueenPlacement &placement, Emit &&emit) const {
+                for (uint32_t free = placement.board.free(all); free != 0; free &= free - 1) {
+                    emit(free & -free);
+                }
+            }
+
+            bool check(const QueenPlacement &, uint32_t) const {
+                return true;
+            }
+
+            QueenPlacement apply(const QueenPlacement &placement, uint32_t bit) const {
+                QueenPlacement next = placement;
+                next.board = placement.board.place(bit);
+                next.queen[next.rows++] = __builtin_ctz(bit);
+                return next;
+            }
+        };
+
+        /**
+         * countQueens() with the mirror halves searched by Backtracking on
+         * {@code pool}, which splits subtrees off to idle workers, and
+         * counted by queenCount() below the first rows.
+         */
+        inline uint64_t countQueens(int n, kit::TaskPool &pool) {
+            queenCheckSize(n);
+            if (n <= 1) {
+                return 1;
+            }
+            QueenProblem problem{n == 32 ? ~uint32_t(0) : (uint32_t(1) << n) - 1};
+            std::vector<QueenBoard> roots;
+            for (auto &&prefix : queenSplit(n, 1)) {
+                roots.push_back(prefix.board);
+            }
+            // every root stands for itself and its mirror image
+            return 2 * Backtracking<QueenProblem>(problem).run(roots, &pool);
         }
 
-        int solveQueens(int n) {
-            int array[n];
+        /**
+         * Every board is printed when {@code show}, otherwise this is
+         * countQueens(), which is much faster.
+         */
+        int solveQueens(int n, bool show = true) {
+            if (n < 0) {
+                return 0;
+            }
+            if (!show) {
+                return static_cast<int>(countQueens(n));
+            }
+            queenCheckSize(n);
+            QueenPlacementProblem problem{n == 32 ? ~uint32_t(0) : (uint32_t(1) << n) - 1};
             int counter = 0;
-            queenDfs(0, n, array, counter);
+            forEachSolution(problem, QueenPlacement{}, [n, &counter](const QueenPlacement &placement) {
+                queenShowResult(n, placement.queen, ++counter);
+            });
             return counter;
         }
     }
@@ -0,0 +1,343 @@
+//
+// Created by kiva on 2026/10/19.
+//
+#pragma once
+
+#include <v9/kit/tasks.hpp>
+
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <utility>
+#include <functional>
+#include <type_traits>
+
+namespace v9 {
+    namespace solve {
+        enum class SearchMode {
+            /**
+             * Visit every solution, report none.
+             */
+            COUNT,
+
+            /**
+             * Stop at the first solution found, which is reported.
+             */
+            FIRST,
+
+            /**
+             * Report every solution.
+             */
+            ALL,
+        };
+
+        namespace detail {
+            template<typename Problem, typename = void>
+            struct HasCountSubtree : std::false_type {
+            };
+
+            template<typename Problem>
+            struct HasCountSubtree<Problem, std::void_t<decltype(std::declval<const Problem &>().countSubtree(
+                std::declval<const typename Problem::State &>(), std::declval<uint64_t &>()))>>
+                : std::true_type {
+            };
+        }
+
+        /**
+         * Depth-first backtracking over the states of a {@code Problem}:
+         *
+         * <pre>
+         * struct Problem {
+         *     using State = ...;  // copied for every state visited, keep it small
+         *     using Move = ...;
+         *     bool isSolution(const State &state) const;
+         *     // calls emit(move) for every move that may extend state
+         *     template<typename Emit> void generate(const State &state, Emit &&emit) const;
+         *     // the constraint: whether move keeps state worth extending
+         *     bool check(const State &state, const Move &move) const;
+         *     State apply(const State &state, const Move &move) const;
+         *
+         *     // optional, COUNT mode only: add the solutions below state to
+         *     // solutions and return true, or return false to search it
+         *     bool countSubtree(const State &state, uint64_t &solutions) const;
+         * };
+         * </pre>
+         *
+         * countSubtree() lets a problem finish small subtrees with a faster
+         * special-purpose count than generic states can give. Such a
+         * subtree is as much work as many states, so the search looks at
+         * the pool right after one.
+         *
+         * Solutions are leaves: they are reported and never extended.
+         * The search is iterative: the states on the current path and the
+         * moves not tried yet live on two explicit stacks, the moves of a
+         * state side by side. With a TaskPool, a search that sees the pool
+         * run out of queued tasks gives away the untried moves of its
+         * oldest state as a new task: near the root, so the biggest
+         * subtrees move between threads and idle workers steal them.
+         */
+        template<typename Problem>
+        class Backtracking {
+        public:
+            using State = typename Problem::State;
+            using Move = typename Problem::Move;
+
+            /**
+             * Called for solutions (not in COUNT mode), one call at a time,
+             * from whichever thread found them.
+             */
+            using Callback = std::function<void(const State &)>;
+
+            /**
+             * States visited between two looks at the pool.
+             */
+            static constexpr size_t SPLIT_INTERVAL = 1024;
+
+        private:
+            struct Frame {
+                State state;
+
+                /**
+                 * Moves of the state are [base, end) on the move stack,
+                 * the ones not tried yet [next, end).
+                 */
+                size_t base;
+                size_t next;
+                size_t end;
+            };
+
+            const Problem &_problem;
+            SearchMode _mode;
+            Callback _onSolution;
+
+            std::atomic<uint64_t> _solutions{0};
+            std::atomic<uint64_t> _states{0};
+            std::atomic<bool> _stopped{false};
+            std::mutex _callbackLock;
+
+            kit::TaskPool *_pool = nullptr;
+            kit::TaskGroup *_group = nullptr;
+
+            /**
+             * @return Whether the search stops here
+             */
+            bool report(const State &state, uint64_t &solutions) {
+                switch (_mode) {
+                    case SearchMode::COUNT:
+                        ++solutions;
+                        return false;
+                    case SearchMode::FIRST:
+                        if (_stopped.exchange(true)) {
+                            return true;
+                        }
+                        ++solutions;
+                        break;
+                    case SearchMode::ALL:
+                        ++solutions;
+                        break;
+                }
+                if (_onSolution) {
+                    std::lock_guard<std::mutex> guard(_callbackLock);
+                    _onSolution(state);
+                }
+                return _mode == SearchMode::FIRST;
+            }
+
+            /**
+             * Push the moves of {@code state} that pass the check.
+             */
+            void generate(const State &state, std::vector<Move> &moves) const {
+                _problem.generate(state, [this, &state, &moves](const Move &move) {
+                    if (_problem.check(state, move)) {
+                        moves.push_back(move);
+                    }
+                });
+            }
+
+            /**
+             * @return Whether the problem counted the subtree of {@code state} itself
+             */
+            bool countSubtree(const State &state, uint64_t &solutions) const {
+                if constexpr (detail::HasCountSubtree<Problem>::value) {
+                    return _mode == SearchMode::COUNT && _problem.countSubtree(state, solutions);
+                } else {
+                    return false;
+                }
+            }
+
+            /**
+             * Give the untried moves of the oldest state that has some to
+             * a new task.
+             */
+            void split(std::vector<Frame> &frames, const std::vector<Move> &moves) {
+                for (auto &&frame : frames) {
+                    if (frame.next == frame.end) {
+                        continue;
+                    }
+                    std::vector<Move> given(moves.begin() + frame.next, moves.begin() + frame.end);
+                    frame.next = frame.end;
+                    _group->run([this, state = frame.state, given = std::move(given)]() mutable {
+                        explore(std::move(state), std::move(given));
+                    });
+                    return;
+                }
+            }
+
+            /**
+             * Search the subtrees of {@code state} reached by {@code moves}.
+             */
+            void explore(State &&state, std::vector<Move> &&moves) {
+                std::vector<Frame> frames;
+                size_t end = moves.size();
+                frames.push_back(Frame{std::move(state), 0, 0, end});
+
+                uint64_t solutions = 0;
+                uint64_t states = 0;
+                size_t untilSplit = SPLIT_INTERVAL;
+                while (!frames.empty()) {
+                    Frame &top = frames.back();
+                    if (top.next == top.end) {
+                        moves.resize(top.base);
+                        frames.pop_back();
+                        continue;
+                    }
+
+                    State child = _problem.apply(top.state, moves[top.next++]);
+                    ++states;
+                    if (_problem.isSolution(child)) {
+                        if (report(child, solutions)) {
+                            break;
+                        }
+                        continue;
+                    }
+                    if (countSubtree(child, solutions)) {
+                        untilSplit = 1;
+                    } else {
+                        size_t base = moves.size();
+                        generate(child, moves);
+                        if (moves.size() == base) {
+                            // a dead end, no need to stack it
+                            continue;
+                        }
+                        frames.push_back(Frame{std::move(child), base, base, moves.size()});
+                    }
+
+                    if (--untilSplit == 0) {
+                        untilSplit = SPLIT_INTERVAL;
+                        if (_stopped.load(std::memory_order_relaxed)) {
+                            break;
+                        }
+                        if (_group != nullptr && _pool->getQueuedCount() == 0) {
+                            split(frames, moves);
+                        }
+                    }
+                }
+                _solutions.fetch_add(solutions, std::memory_order_relaxed);
+                _states.fetch_add(states, std::memory_order_relaxed);
+            }
+
+        public:
+            explicit Backtracking(const Problem &problem, SearchMode mode = SearchMode::COUNT,
+                                  Callback onSolution = nullptr)
+                : _problem(problem), _mode(mode), _onSolution(std::move(onSolution)) {
+            }
+
+            Backtracking(const Backtracking &) = delete;
+
+            Backtracking &operator=(const Backtracking &) = delete;
+
+            /**
+             * Search from every root, on {@code pool} when given, otherwise
+             * on the calling thread. Exceptions thrown by the problem or the
+             * callback stop nothing else but are rethrown here.
+             * @return Solutions found by this call
+             */
+            uint64_t run(const std::vector<State> &roots, kit::TaskPool *pool = nullptr) {
+                uint64_t before = _solutions.load();
+                auto start = [this](const State &root) {
+                    if (_stopped.load()) {
+                        return;
+                    }
+                    uint64_t solutions = 0;
+                    if (_problem.isSolution(root)) {
+                        report(root, solutions);
+                        _solutions.fetch_add(solutions);
+                        return;
+                    }
+                    if (countSubtree(root, solutions)) {
+                        _solutions.fetch_add(solutions);
+                        return;
+                    }
+                    std::vector<Move> moves;
+                    generate(root, moves);
+                    explore(State(root), std::move(moves));
+                };
+
+                if (pool == nullptr) {
+                    for (auto &&root : roots) {
+                        start(root);
+                    }
+                } else {
+                    kit::TaskGroup group(*pool);
+                    _pool = pool;
+                    _group = &group;
+                    for (auto &&root : roots) {
+                        group.run([&start, &root] { start(root); });
+                    }
+                    try {
+                        group.wait();
+                    } catch (...) {
+                        _group = nullptr;
+                        throw;
+                    }
+                    _group = nullptr;
+                }
+                return _solutions.load() - before;
+            }
+
+            uint64_t run(const State &root, kit::TaskPool *pool = nullptr) {
+                return run(std::vector<State>{root}, pool);
+            }
+
+            uint64_t getSolutionCount() const {
+                return _solutions.load();
+            }
+
+            /**
+             * States visited, roots excluded, and none inside the subtrees
+             * countSubtree() counted.
+             */
+            uint64_t getStateCount() const {
+                return _states.load();
+            }
+        };
+
+        template<typename Problem>
+        uint64_t countSolutions(const Problem &problem, const typename Problem::State &root,
+                                kit::TaskPool *pool = nullptr) {
+            return Backtracking<Problem>(problem).run(root, pool);
+        }
+
+        /**
+         * @return Whether there is a solution, stored in {@code solution}
+         */
+        template<typename Problem>
+        bool findSolution(const Problem &problem, const typename Problem::State &root,
+                          typename Problem::State &solution, kit::TaskPool *pool = nullptr) {
+            using State = typename Problem::State;
+            return Backtracking<Problem>(problem, SearchMode::FIRST, [&solution](const State &state) {
+                solution = state;
+            }).run(root, pool) != 0;
+        }
+
+        /**
+         * Call {@code f} on every solution, one call at a time.
+         * @return Solutions found
+         */
+        template<typename Problem, typename F>
+        uint64_t forEachSolution(const Problem &problem, const typename Problem::State &root, F &&f,
+                                 kit::TaskPool *pool = nullptr) {
+            return Backtracking<Problem>(problem, SearchMode::ALL, std::forward<F>(f)).run(root, pool);
+        }
+    }
+}
@@ -0,0 +1,371 @@
+//
+// Created by kiva on 2026/10/19.
+//
+#pragma once
+
+#include <v9/expression/evaluator.h>
+
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <initializer_list>
+
+namespace v9 {
+    namespace expression {
+        /**
+         * Instruction sets evaluateBatch() can run on.
+         */
+        enum class BatchIsa {
+            SCALAR, AVX2, AVX512,
+        };
+
+        namespace batch {
+            // rows per block: every stack slot of a block stays in L1
+            constexpr size_t BLOCK_ROWS = 512;
+
+            using Opcode = CompiledExpression::Opcode;
+
+            enum class Kind : uint8_t {
+                SCRATCH, COLUMN, CONSTANT,
+            };
+
+            struct Operand {
+                Kind kind;
+                uint32_t index;
+                Number constant;
+            };
+
+            /**
+             * dst = lhs op rhs over one block.
+             * NEG and COPY only use lhs.
+             */
+            struct Step {
+                enum Op : uint8_t {
+                    ADD, SUB, MUL, DIV, NEG, COPY,
+                } op;
+                // scratch slot, or OUT for the output column
+                uint32_t dst;
+                Operand lhs;
+                Operand rhs;
+            };
+
+            constexpr uint32_t OUT = UINT32_MAX;
+
+            inline Step::Op opFor(Opcode opcode) {
+                switch (opcode) {
+                    case Opcode::ADD:
+                        return Step::ADD;
+                    case Opcode::SUB:
+                        return Step::SUB;
+                    case Opcode::MUL:
+                        return Step::MUL;
+                    case Opcode::DIV:
+                        return Step::DIV;
+                    default:
+                        throw std::invalid_argument("evaluateBatch: not a binary operator");
+                }
+            }
+
+            inline Number fold(Step::Op op, Number lhs, Number rhs) {
+                switch (op) {
+                    case Step::ADD:
+                        return lhs + rhs;
+                    case Step::SUB:
+                        return lhs - rhs;
+                    case Step::MUL:
+                        return lhs * rhs;
+                    default:
+                        return lhs / rhs;
+                }
+            }
+
+            /**
+             * Turn the stack program into steps over whole blocks.
+             * Constants and columns are read where they are, only results
+             * of operations take a scratch slot: the one at their stack depth.
+             */
+            inline std::vector<Step> plan(const CompiledExpression &expr, size_t columnCount) {
+                if (columnCount < expr.getVariableCount()) {
+                    throw std::invalid_argument("evaluateBatch: missing columns");
+                }
+
+                std::vector<Step> steps;
+                std::vector<Operand> stack;
+
+                for (const auto &insn : expr.getCode()) {
+                    switch (insn.opcode) {
+                        case Opcode::CONSTANT:
+                            stack.push_back(Operand{Kind::CONSTANT, 0, insn.constant});
+                            break;
+                        case Opcode::VARIABLE:
+                            stack.push_back(Operand{Kind::COLUMN, insn.slot, 0});
+                            break;
+                        case Opcode::NEG: {
+                            Operand &operand = stack.back();
+                            if (operand.kind == Kind::CONSTANT) {
+                                operand.constant = -operand.constant;
+                                break;
+                            }
+                            auto dst = static_cast<uint32_t>(stack.size() - 1);
+                            steps.push_back(Step{Step::NEG, dst, operand, {}});
+                            operand = Operand{Kind::SCRATCH, dst, 0};
+                            break;
+                        }
+                        default: {
+                            Operand rhs = stack.back();
+                            stack.pop_back();
+                            Operand &lhs = stack.back();
+                            Step::Op op = opFor(insn.opcode);
+                            if (lhs.kind == Kind::CONSTANT && rhs.kind == Kind::CONSTANT) {
+                                lhs.constant = fold(op, lhs.constant, rhs.constant);
+                                break;
+                            }
+                            auto dst = static_cast<uint32_t>(stack.size() - 1);
+                            steps.push_back(Step{op, dst, lhs, rhs});
+                            lhs = Operand{Kind::SCRATCH, dst, 0};
+                            break;
+                        }
+                    }
+                }
+
+                // the last step writes the output, unless there was none: "x" or "2"
+                if (stack.back().kind == Kind::SCRATCH) {
+                    steps.back().dst = OUT;
+                } else {
+                    steps.push_back(Step{Step::COPY, OUT, stack.back(), {}});
+                }
+                return steps;
+            }
+
+// vectors are passed by reference: by value, their ABI depends on the target
+#define V9_BATCH_INLINE inline __attribute__((always_inline))
+
+            struct Add {
+                template <typename T>
+                static V9_BATCH_INLINE void apply(T &r, const T &a, const T &b) {
+                    r = a + b;
+                }
+            };
+
+            struct Sub {
+                template <typename T>
+                static V9_BATCH_INLINE void apply(T &r, const T &a, const T &b) {
+                    r = a - b;
+                }
+            };
+
+            struct Mul {
+                template <typename T>
+                static V9_BATCH_INLINE void apply(T &r, const T &a, const T &b) {
+                    r = a * b;
+                }
+            };
+
+            struct Div {
+                template <typename T>
+                static V9_BATCH_INLINE void apply(T &r, const T &a, const T &b) {
+                    r = a / b;
+                }
+            };
+
+            // lhs only
+            struct Neg {
+                template <typename T>
+                static V9_BATCH_INLINE void apply(T &r, const T &a, const T &) {
+                    r = -a;
+                }
+            };
+
+            /**
+             * Load {@code Vec} from memory, or splat a constant.
+             */
+            template <typename Vec, bool Constant>
+            V9_BATCH_INLINE void load(Vec &v, const Number *p, Number c) {
+                if (Constant) {
+                    v = Vec{} + c;
+                } else {
+                    memcpy(&v, p, sizeof(Vec));
+                }
+            }
+
+            /**
+             * The GCC vector type {@code Vec} becomes ymm or zmm registers
+             * depending on the target of the function this is inlined into.
+             */
+            template <typename Vec, typename Op, bool LhsConstant, bool RhsConstant>
+            V9_BATCH_INLINE void run(Number *dst, const Number *lhs, Number lc,
+                                     const Number *rhs, Number rc, size_t n) {
+                constexpr size_t LANES = sizeof(Vec) / sizeof(Number);
+                size_t i = 0;
+                for (; i + LANES <= n; i += LANES) {
+                    Vec a, b;
+                    load<Vec, LhsConstant>(a, lhs + i, lc);
+                    load<Vec, RhsConstant>(b, rhs + i, rc);
+                    Op::apply(a, a, b);
+                    memcpy(dst + i, &a, sizeof(Vec));
+                }
+                for (; i < n; ++i) {
+                    Number a = LhsConstant ? lc : lhs[i];
+                    Number b = RhsConstant ? rc : rhs[i];
+                    Op::apply(a, a, b);
+                    dst[i] = a;
+                }
+            }
+
+            template <typename Vec, typename Op>
+            V9_BATCH_INLINE void dispatch(Number *dst, const Number *lhs, Number lc, bool lconst,
+                                          const Number *rhs, Number rc, bool rconst, size_t n) {
+                // both constant never happens, plan() folds them
+                if (lconst) {
+                    run<Vec, Op, true, false>(dst, lhs, lc, rhs, rc, n);
+                } else if (rconst) {
+                    run<Vec, Op, false, true>(dst, lhs, lc, rhs, rc, n);
+                } else {
+                    run<Vec, Op, false, false>(dst, lhs, lc, rhs, rc, n);
+                }
+            }
+
+            template <typename Vec>
+            V9_BATCH_INLINE void evaluate(const std::vector<Step> &steps, const Number *const *columns,
+                                          Number *out, size_t rows, Number *scratch) {
+                for (size_t row = 0; row < rows; row += BLOCK_ROWS) {
+                    size_t n = std::min(BLOCK_ROWS, rows - row);
+
+                    auto address = [&](const Operand &o) -> const Number * {
+                        switch (o.kind) {
+                            case Kind::SCRATCH:
+                                return scratch + o.index * BLOCK_ROWS;
+                            case Kind::COLUMN:
+                                return columns[o.index] + row;
+                            default:
+                                return nullptr;
+                        }
+                    };
+
+                    for (const Step &s : steps) {
+                        Number *dst = s.dst == OUT ? out + row : scratch + s.dst * BLOCK_ROWS;
+                        const Number *lhs = address(s.lhs);
+                        const Number *rhs = address(s.rhs);
+                        bool lconst = s.lhs.kind == Kind::CONSTANT;
+                        bool rconst = s.rhs.kind == Kind::CONSTANT;
+
+                        switch (s.op) {
+                            case Step::ADD:
+                                dispatch<Vec, Add>(dst, lhs, s.lhs.constant, lconst, rhs, s.rhs.constant, rconst, n);
+                                break;
+                            case Step::SUB:
+                                dispatch<Vec, Sub>(dst, lhs, s.lhs.constant, lconst, rhs, s.rhs.constant, rconst, n);
+                                break;
+                            case Step::MUL:
+                                dispatch<Vec, Mul>(dst, lhs, s.lhs.constant, lconst, rhs, s.rhs.constant, rconst, n);
+                                break;
+                            case Step::DIV:
+                                dispatch<Vec, Div>(dst, lhs, s.lhs.constant, lconst, rhs, s.rhs.constant, rconst, n);
+                                break;
+                            // single operand: the unused rhs is a splat of 0
+                            case Step::NEG:
+                                dispatch<Vec, Neg>(dst, lhs, s.lhs.constant, lconst, nullptr, 0, true, n);
+                                break;
+                            case Step::COPY:
+                                if (lconst) {
+                                    std::fill(dst, dst + n, s.lhs.constant);
+                                } else {
+                                    memcpy(dst, lhs, n * sizeof(Number));
+                                }
+                                break;
+                        }
+                    }
+                }
+            }
+
+            typedef Number Scalar;
+            typedef Number Vec8 __attribute__((vector_size(32)));
+            typedef Number Vec16 __attribute__((vector_size(64)));
+
+            inline void evaluateScalar(const std::vector<Step> &steps, const Number *const *columns,
+                                       Number *out, size_t rows, Number *scratch) {
+                evaluate<Scalar>(steps, columns, out, rows, scratch);
+            }
+
+            __attribute__((target("avx2")))
+            inline void evaluateAvx2(const std::vector<Step> &steps, const Number *const *columns,
+                                     Number *out, size_t rows, Number *scratch) {
+                evaluate<Vec8>(steps, columns, out, rows, scratch);
+            }
+
+            __attribute__((target("avx512f")))
+            inline void evaluateAvx512(const std::vector<Step> &steps, const Number *const *columns,
+                                       Number *out, size_t rows, Number *scratch) {
+                evaluate<Vec16>(steps, columns, out, rows, scratch);
+            }
+
+#undef V9_BATCH_INLINE
+        }
+
+        /**
+         * Widest instruction set this CPU runs.
+         */
+        inline BatchIsa detectBatchIsa() {
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f")) {
+                return BatchIsa::AVX512;
+            }
+            if (__builtin_cpu_supports("avx2")) {
+                return BatchIsa::AVX2;
+            }
+            return BatchIsa::SCALAR;
+        }
+
+        /**
+         * Evaluate {@code expr} once per row: out[r] = expr(columns[0][r], columns[1][r], ...).
+         * Columns are given in variable slot order.
+         *
+         * Rows go in blocks of batch::BLOCK_ROWS, and each instruction runs over a
+         * whole block with 8 (AVX2) or 16 (AVX-512) lanes at a time, instead of
+         * going through the whole program once per row. Results are the same as
+         * CompiledExpression::evaluate(): every row sees the same operations in
+         * the same order, there is no reassociation or FMA contraction.
+         */
+        inline void evaluateBatch(const CompiledExpression &expr, const Number *const *columns, size_t columnCount,
+                                  Number *out, size_t rows, BatchIsa isa) {
+            auto steps = batch::plan(expr, columnCount);
+            std::vector<Number> scratch(std::max<size_t>(expr.getMaxDepth(), 1) * batch::BLOCK_ROWS);
+
+            switch (isa) {
+                case BatchIsa::AVX512:
+                    batch::evaluateAvx512(steps, columns, out, rows, scratch.data());
+                    break;
+                case BatchIsa::AVX2:
+                    batch::evaluateAvx2(steps, columns, out, rows, scratch.data());
+                    break;
+                default:
+                    batch::evaluateScalar(steps, columns, out, rows, scratch.data());
+                    break;
+            }
+        }
+
+        inline void evaluateBatch(const CompiledExpression &expr, std::initializer_list<const Number *> columns,
+                                  Number *out, size_t rows) {
+            static const BatchIsa isa = detectBatchIsa();
+            evaluateBatch(expr, columns.begin(), columns.size(), out, rows, isa);
+        }
+
+        /**
+         * Reference for evaluateBatch(): CompiledExpression::evaluate() row by row.
+         */
+        inline void evaluateRows(const CompiledExpression &expr, const Number *const *columns, size_t columnCount,
+                                 Number *out, size_t rows) {
+            if (columnCount < expr.getVariableCount()) {
+                throw std::invalid_argument("evaluateRows: missing columns");
+            }
+            std::vector<Number> values(columnCount);
+            for (size_t r = 0; r < rows; ++r) {
+                for (size_t c = 0; c < columnCount; ++c) {
+                    values[c] = columns[c][r];
+                }
+                out[r] = expr.evaluate(values.data());
+            }
+        }
+    }
+}
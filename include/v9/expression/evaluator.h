@@ -1,15 +1,22 @@
 //
 // Created by kiva on 2018/4/20.
 //
+#pragma once
+
 #include <cstdio>
+#include <cstdint>
 #include <string>
 #include <stack>
+#include <vector>
 #include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <initializer_list>
 
 namespace v9 {
     namespace expression {
         enum TokenType {
-            NUMBER, OPERATOR, WHITESPACE
+            NUMBER, OPERATOR, WHITESPACE, IDENTIFIER, LEFT_PAREN, RIGHT_PAREN
         };
 
         enum Operator {
@@ -26,6 +33,10 @@ namespace v9 {
             union {
                 Number num;
                 Operator op;
+                struct {
+                    const char *begin;
+                    size_t length;
+                } name;
             };
         };
 
@@ -38,6 +49,10 @@ namespace v9 {
                 return ch >= '0' && ch <= '9';
             }
 
+            static inline bool isIdentifier(char ch) {
+                return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || ch == '_' || isNumber(ch);
+            }
+
         private:
             bool operatorToken(Token *t, char op) {
                 t->op = static_cast<Operator>(op);
@@ -52,9 +67,9 @@ namespace v9 {
                 int pointCount = 0;
                 bool meetDot = false;
 
+                // the character after the number is left for the next token
                 char ch;
-                while (*stream) {
-                    ch = *stream++;
+                while ((ch = *stream)) {
                     if (ch == '.') {
                         meetDot = true;
 
@@ -68,6 +83,7 @@ namespace v9 {
                     } else {
                         break;
                     }
+                    ++stream;
                 }
                 Number f = integer + point * powf(10, -pointCount);
                 t->num = f;
@@ -79,6 +95,21 @@ namespace v9 {
                 return true;
             }
 
+            bool identifierToken(Token *t) {
+                t->tokenType = IDENTIFIER;
+                t->name.begin = stream - 1;
+                while (isIdentifier(*stream)) {
+                    ++stream;
+                }
+                t->name.length = static_cast<size_t>(stream - t->name.begin);
+                return true;
+            }
+
+            bool parenToken(Token *t, char paren) {
+                t->tokenType = paren == '(' ? LEFT_PAREN : RIGHT_PAREN;
+                return true;
+            }
+
         public:
             static int priorityFor(Operator op) {
                 switch (op) {
@@ -95,9 +126,18 @@ namespace v9 {
         public:
             explicit Lexer(const char *stream) : stream(stream) {}
 
+            /**
+             * @return Where the next token starts, or the character
+             *         nextToken() stopped at
+             */
+            const char *position() const {
+                return stream;
+            }
+
             inline bool nextToken(Token *t) {
                 char ch;
-                while ((ch = *stream++)) {
+                while ((ch = *stream)) {
+                    ++stream;
                     switch (ch) {
                         case '+':
                         case '-':
@@ -109,9 +149,21 @@ namespace v9 {
                             return numberToken(t, ch);
 
                         case ' ':
+                        case '\t':
                             return whiteSpaceToken(t);
 
+                        case '(':
+                        case ')':
+                            return parenToken(t, ch);
+
+                        case 'a'...'z':
+                        case 'A'...'Z':
+                        case '_':
+                            return identifierToken(t);
+
                         default:
+                            // leave it, so position() shows where lexing stopped
+                            --stream;
                             return false;
                     }
                 }
@@ -166,5 +218,347 @@ namespace v9 {
             }
             return nums.top();
         }
+
+        /**
+         * An expression parsed once and evaluated many times.
+         *
+         * The expression becomes a flat array of stack instructions.
+         * Variables are numbered in order of first appearance, and
+         * evaluate() takes their values in that order. Evaluation runs on a
+         * fixed array of MAX_DEPTH registers: the depth is checked when
+         * compiling, so evaluate() does no checks, no allocation and no I/O.
+         */
+        class CompiledExpression {
+        public:
+            enum class Opcode : uint8_t {
+                CONSTANT, VARIABLE, ADD, SUB, MUL, DIV, NEG,
+            };
+
+            struct Instruction {
+                Opcode opcode;
+                union {
+                    Number constant;
+                    uint32_t slot;
+                };
+            };
+
+            static constexpr size_t MAX_DEPTH = 64;
+
+        private:
+            std::vector<Instruction> code;
+            std::vector<std::string> variables;
+            size_t depth = 0;
+            size_t maxDepth = 0;
+
+        private:
+            CompiledExpression() = default;
+
+            [[noreturn]] static void syntaxError(const char *what, const Lexer &lexer, const char *source) {
+                throw std::invalid_argument(std::string("CompiledExpression: ") + what
+                                            + " at offset " + std::to_string(lexer.position() - source));
+            }
+
+            uint32_t slotFor(const Token &t) {
+                std::string name(t.name.begin, t.name.length);
+                auto iter = std::find(variables.begin(), variables.end(), name);
+                if (iter != variables.end()) {
+                    return static_cast<uint32_t>(iter - variables.begin());
+                }
+                variables.push_back(std::move(name));
+                return static_cast<uint32_t>(variables.size() - 1);
+            }
+
+            void push(const Instruction &insn) {
+                if (++depth > MAX_DEPTH) {
+                    throw std::invalid_argument("CompiledExpression: expression too deep");
+                }
+                maxDepth = std::max(maxDepth, depth);
+                code.push_back(insn);
+            }
+
+            void pushConstant(Number num) {
+                Instruction insn{Opcode::CONSTANT, {}};
+                insn.constant = num;
+                push(insn);
+            }
+
+            void pushVariable(const Token &t) {
+                Instruction insn{Opcode::VARIABLE, {}};
+                insn.slot = slotFor(t);
+                push(insn);
+            }
+
+            static Number apply(Opcode opcode, Number lhs, Number rhs) {
+                switch (opcode) {
+                    case Opcode::ADD:
+                        return lhs + rhs;
+                    case Opcode::SUB:
+                        return lhs - rhs;
+                    case Opcode::MUL:
+                        return lhs * rhs;
+                    case Opcode::DIV:
+                        return lhs / rhs;
+                    default:
+                        return 0;
+                }
+            }
+
+            /**
+             * Emit an operator, folding it when its operands are constants.
+             * @return false if there are too few operands
+             */
+            bool emit(Opcode opcode) {
+                size_t operands = opcode == Opcode::NEG ? 1 : 2;
+                if (depth < operands) {
+                    return false;
+                }
+                depth -= operands - 1;
+
+                size_t n = code.size();
+                if (opcode == Opcode::NEG && code[n - 1].opcode == Opcode::CONSTANT) {
+                    code[n - 1].constant = -code[n - 1].constant;
+                } else if (opcode != Opcode::NEG && code[n - 1].opcode == Opcode::CONSTANT
+                           && code[n - 2].opcode == Opcode::CONSTANT) {
+                    code[n - 2].constant = apply(opcode, code[n - 2].constant, code[n - 1].constant);
+                    code.pop_back();
+                } else {
+                    code.push_back(Instruction{opcode, {}});
+                }
+                return true;
+            }
+
+            static Opcode opcodeFor(Operator op) {
+                switch (op) {
+                    case ADD:
+                        return Opcode::ADD;
+                    case SUB:
+                        return Opcode::SUB;
+                    case MUL:
+                        return Opcode::MUL;
+                    case DIV:
+                        return Opcode::DIV;
+                }
+                return Opcode::ADD;
+            }
+
+            void finish(const Lexer &lexer, const char *source) {
+                if (depth != 1) {
+                    syntaxError(depth == 0 ? "empty expression" : "missing operator", lexer, source);
+                }
+                code.shrink_to_fit();
+            }
+
+        public:
+            /**
+             * Compile a postfix expression, like evaluate() takes.
+             * Names may stand for numbers: "x 2 * y +".
+             */
+            static CompiledExpression fromPostfix(const std::string &exp) {
+                CompiledExpression compiled;
+                const char *source = exp.c_str();
+                Lexer lexer(source);
+                Token t{};
+
+                while (lexer.nextToken(&t)) {
+                    switch (t.tokenType) {
+                        case TokenType::NUMBER:
+                            compiled.pushConstant(t.num);
+                            break;
+                        case TokenType::IDENTIFIER:
+                            compiled.pushVariable(t);
+                            break;
+                        case TokenType::OPERATOR:
+                            if (!compiled.emit(opcodeFor(t.op))) {
+                                syntaxError("missing operand", lexer, source);
+                            }
+                            break;
+                        case TokenType::WHITESPACE:
+                            break;
+                        default:
+                            syntaxError("unexpected parenthesis", lexer, source);
+                    }
+                }
+                if (*lexer.position() != '\0') {
+                    syntaxError("unexpected character", lexer, source);
+                }
+                compiled.finish(lexer, source);
+                return compiled;
+            }
+
+            /**
+             * Compile an infix expression with the shunting-yard algorithm:
+             * "(x + 1.5) * -y". Operators bind by Lexer::priorityFor(),
+             * unary minus binds tighter than all of them.
+             */
+            static CompiledExpression fromInfix(const std::string &exp) {
+                // operator stack entries: an Operator, '(' or NEGATE
+                constexpr int NEGATE = 'n';
+                constexpr int NEGATE_PRIORITY = 3;
+
+                CompiledExpression compiled;
+                std::vector<int> ops;
+                const char *source = exp.c_str();
+                Lexer lexer(source);
+                Token t{};
+                bool expectOperand = true;
+
+                auto priority = [](int op) {
+                    return op == NEGATE ? NEGATE_PRIORITY : Lexer::priorityFor(static_cast<Operator>(op));
+                };
+                auto reduce = [&](int op) {
+                    if (!compiled.emit(op == NEGATE ? Opcode::NEG : opcodeFor(static_cast<Operator>(op)))) {
+                        syntaxError("missing operand", lexer, source);
+                    }
+                };
+
+                while (lexer.nextToken(&t)) {
+                    switch (t.tokenType) {
+                        case TokenType::NUMBER:
+                        case TokenType::IDENTIFIER:
+                            if (!expectOperand) {
+                                syntaxError("missing operator", lexer, source);
+                            }
+                            if (t.tokenType == TokenType::NUMBER) {
+                                compiled.pushConstant(t.num);
+                            } else {
+                                compiled.pushVariable(t);
+                            }
+                            expectOperand = false;
+                            break;
+
+                        case TokenType::OPERATOR:
+                            if (expectOperand) {
+                                // prefix sign
+                                if (t.op == SUB) {
+                                    ops.push_back(NEGATE);
+                                } else if (t.op != ADD) {
+                                    syntaxError("missing operand", lexer, source);
+                                }
+                                break;
+                            }
+                            // left associative: pop operators of the same or higher priority
+                            while (!ops.empty() && ops.back() != '(' && priority(ops.back()) >= priority(t.op)) {
+                                reduce(ops.back());
+                                ops.pop_back();
+                            }
+                            ops.push_back(t.op);
+                            expectOperand = true;
+                            break;
+
+                        case TokenType::LEFT_PAREN:
+                            if (!expectOperand) {
+                                syntaxError("missing operator", lexer, source);
+                            }
+                            ops.push_back('(');
+                            break;
+
+                        case TokenType::RIGHT_PAREN:
+                            if (expectOperand) {
+                                syntaxError("missing operand", lexer, source);
+                            }
+                            while (!ops.empty() && ops.back() != '(') {
+                                reduce(ops.back());
+                                ops.pop_back();
+                            }
+                            if (ops.empty()) {
+                                syntaxError("unbalanced ')'", lexer, source);
+                            }
+                            ops.pop_back();
+                            break;
+
+                        case TokenType::WHITESPACE:
+                            break;
+                    }
+                }
+                if (*lexer.position() != '\0') {
+                    syntaxError("unexpected character", lexer, source);
+                }
+                if (expectOperand) {
+                    syntaxError("missing operand", lexer, source);
+                }
+                while (!ops.empty()) {
+                    if (ops.back() == '(') {
+                        syntaxError("unbalanced '('", lexer, source);
+                    }
+                    reduce(ops.back());
+                    ops.pop_back();
+                }
+                compiled.finish(lexer, source);
+                return compiled;
+            }
+
+            const std::vector<Instruction> &getCode() const {
+                return code;
+            }
+
+            const std::vector<std::string> &getVariables() const {
+                return variables;
+            }
+
+            size_t getVariableCount() const {
+                return variables.size();
+            }
+
+            /**
+             * Registers evaluate() uses at most.
+             */
+            size_t getMaxDepth() const {
+                return maxDepth;
+            }
+
+            /**
+             * @return Slot of a variable, or -1 if the expression doesn't use it
+             */
+            int slotOf(const std::string &name) const {
+                auto iter = std::find(variables.begin(), variables.end(), name);
+                return iter == variables.end() ? -1 : static_cast<int>(iter - variables.begin());
+            }
+
+            /**
+             * @param values One value per variable, indexed by slot
+             */
+            Number evaluate(const Number *values) const {
+                Number stack[MAX_DEPTH];
+                Number *top = stack - 1;
+
+                for (const Instruction &insn : code) {
+                    switch (insn.opcode) {
+                        case Opcode::CONSTANT:
+                            *++top = insn.constant;
+                            break;
+                        case Opcode::VARIABLE:
+                            *++top = values[insn.slot];
+                            break;
+                        case Opcode::ADD:
+                            top[-1] += top[0];
+                            --top;
+                            break;
+                        case Opcode::SUB:
+                            top[-1] -= top[0];
+                            --top;
+                            break;
+                        case Opcode::MUL:
+                            top[-1] *= top[0];
+                            --top;
+                            break;
+                        case Opcode::DIV:
+                            top[-1] /= top[0];
+                            --top;
+                            break;
+                        case Opcode::NEG:
+                            top[0] = -top[0];
+                            break;
+                    }
+                }
+                return *top;
+            }
+
+            Number evaluate(std::initializer_list<Number> values) const {
+                if (values.size() < variables.size()) {
+                    throw std::invalid_argument("CompiledExpression: missing variable values");
+                }
+                return evaluate(values.begin());
+            }
+        };
     }
 }
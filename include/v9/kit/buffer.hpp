@@ -0,0 +1,318 @@
+//
+// Created by kiva on 2026/10/19.
+//
+
+#pragma once
+
+#include <v9/bits/types.hpp>
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+
+#include <sys/uio.h>
+
+namespace v9::kit {
+    /**
+     * A growable byte buffer made of a chain of segments.
+     *
+     * Growing never moves bytes that were already written: when the
+     * buffer runs out of space, one new segment is appended whose
+     * length is computed in one step (at least what is needed, otherwise
+     * twice the last segment, capped at SEGMENT_MAX_LENGTH). So pointers
+     * returned by dataAt() and iovecs returned by exportIovec() stay valid
+     * for the lifetime of the buffer, and the content can go straight to
+     * writev() without being copied into one contiguous block first.
+     */
+    class ByteBuffer {
+    public:
+        using byte = uint8_t;
+
+        static constexpr size_t BUFFER_DEFAULT_LENGTH = 1024;
+        static constexpr size_t SEGMENT_MAX_LENGTH = 16 * 1024 * 1024;
+
+    private:
+        struct Segment {
+            byte *_bytes;
+            size_t _start;
+            size_t _length;
+        };
+
+        std::vector<Segment> _segments;
+
+        /**
+         * Sum of all segment lengths.
+         */
+        size_t _capacity = 0;
+
+        /**
+         * Write position, also the number of bytes in use.
+         */
+        size_t _position = 0;
+
+        /**
+         * Index of the segment containing _position,
+         * or _segments.size() when the buffer is full.
+         */
+        size_t _current = 0;
+
+    private:
+        void appendSegment(size_t length) {
+            auto bytes = static_cast<byte *>(malloc(length));
+            if (bytes == nullptr) {
+                throw std::runtime_error("ByteBuffer: malloc failed");
+            }
+
+            _segments.push_back(Segment{bytes, _capacity, length});
+            _capacity += length;
+        }
+
+        /**
+         * Find the segment containing index, index must be below _capacity.
+         */
+        size_t locate(size_t index) const {
+            auto iter = std::upper_bound(_segments.begin(), _segments.end(), index,
+                [](size_t index, const Segment &segment) {
+                    return index < segment._start;
+                });
+            return static_cast<size_t>(iter - _segments.begin()) - 1;
+        }
+
+        void seek(size_t position) {
+            _position = position;
+            _current = position < _capacity ? locate(position) : _segments.size();
+        }
+
+        void writeU8Slow(byte u) {
+            ensureCapacity(_position + 1);
+            writeU8(u);
+        }
+
+    public:
+        ByteBuffer()
+            : ByteBuffer(BUFFER_DEFAULT_LENGTH) {
+        }
+
+        explicit ByteBuffer(size_t initialLength) {
+            appendSegment(std::max<size_t>(initialLength, 1));
+        }
+
+        ~ByteBuffer() {
+            for (auto &&segment : _segments) {
+                free(segment._bytes);
+            }
+        }
+
+        ByteBuffer(const ByteBuffer &) = delete;
+
+        ByteBuffer &operator=(const ByteBuffer &) = delete;
+
+        ByteBuffer(ByteBuffer &&other) noexcept
+            : _segments(std::move(other._segments)),
+              _capacity(std::exchange(other._capacity, 0)),
+              _position(std::exchange(other._position, 0)),
+              _current(std::exchange(other._current, 0)) {
+            other._segments.clear();
+        }
+
+        ByteBuffer &operator=(ByteBuffer &&other) noexcept {
+            if (this != &other) {
+                for (auto &&segment : _segments) {
+                    free(segment._bytes);
+                }
+                _segments = std::move(other._segments);
+                other._segments.clear();
+                _capacity = std::exchange(other._capacity, 0);
+                _position = std::exchange(other._position, 0);
+                _current = std::exchange(other._current, 0);
+            }
+            return *this;
+        }
+
+        /**
+         * Total bytes allocated.
+         */
+        size_t getLength() const {
+            return _capacity;
+        }
+
+        /**
+         * Bytes written so far.
+         */
+        size_t getPosition() const {
+            return _position;
+        }
+
+        size_t getSegmentCount() const {
+            return _segments.size();
+        }
+
+        /**
+         * Drop the content but keep every segment for reuse.
+         */
+        void rewind() {
+            seek(0);
+        }
+
+        /**
+         * Make sure at least {@code least} bytes can be held
+         * without allocating again.
+         */
+        void ensureCapacity(size_t least) {
+            if (least <= _capacity) {
+                return;
+            }
+
+            // a moved-from buffer has no segment left to grow from
+            size_t grown = _segments.empty()
+                           ? BUFFER_DEFAULT_LENGTH
+                           : std::min(_segments.back()._length * 2, SEGMENT_MAX_LENGTH);
+            appendSegment(std::max(least - _capacity, grown));
+
+            // we may have been full, then the new segment is where we write next
+            seek(_position);
+        }
+
+        /**
+         * Get a pointer to the byte at {@code index}.
+         * The pointer never becomes invalid while this buffer is alive.
+         * @param index Byte index, must be below getLength()
+         * @param available Contiguous bytes readable from the pointer
+         * @return Pointer to the byte
+         */
+        const byte *dataAt(size_t index, size_t *available) const {
+            const Segment &segment = _segments[locate(index)];
+            size_t offset = index - segment._start;
+            if (available != nullptr) {
+                *available = segment._length - offset;
+            }
+            return segment._bytes + offset;
+        }
+
+        /**
+         * Describe bytes [offset, offset + length) as iovecs without copying.
+         * The range is clipped to the bytes written so far.
+         * @param out iovecs are appended here
+         * @return Number of iovecs appended
+         */
+        size_t exportIovec(std::vector<iovec> &out, size_t offset, size_t length) const {
+            size_t end = offset < _position ? offset + std::min(length, _position - offset) : offset;
+            size_t count = 0;
+
+            while (offset < end) {
+                size_t available = 0;
+                auto bytes = dataAt(offset, &available);
+                size_t size = std::min(available, end - offset);
+                out.push_back(iovec{const_cast<byte *>(bytes), size});
+                offset += size;
+                ++count;
+            }
+            return count;
+        }
+
+        size_t exportIovec(std::vector<iovec> &out) const {
+            return exportIovec(out, 0, _position);
+        }
+
+        /**
+         * Write all bytes in use to a file descriptor with writev().
+         * @return Bytes written, or -1 with errno set on failure
+         */
+        ssize_t writeTo(int fd) const {
+            std::vector<iovec> iov;
+            exportIovec(iov);
+
+            ssize_t total = 0;
+            size_t first = 0;
+            while (first < iov.size()) {
+                int count = static_cast<int>(std::min<size_t>(iov.size() - first, IOV_MAX));
+                ssize_t written = writev(fd, iov.data() + first, count);
+                if (written < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return -1;
+                }
+                total += written;
+
+                // skip what has been written, including a partial iovec
+                auto left = static_cast<size_t>(written);
+                while (first < iov.size() && left >= iov[first].iov_len) {
+                    left -= iov[first++].iov_len;
+                }
+                if (left > 0) {
+                    iov[first].iov_base = static_cast<byte *>(iov[first].iov_base) + left;
+                    iov[first].iov_len -= left;
+                }
+            }
+            return total;
+        }
+
+    public:
+        /**
+         * Skip {@code count} bytes to be filled later with writeAt().
+         * @return Position of the skipped bytes
+         */
+        size_t reserve(size_t count) {
+            size_t p = _position;
+            ensureCapacity(_position + count);
+            seek(_position + count);
+            return p;
+        }
+
+        void writeU8(byte u) {
+            if (_current < _segments.size()) {
+                Segment &segment = _segments[_current];
+                size_t offset = _position - segment._start;
+                segment._bytes[offset] = u;
+                ++_position;
+                if (offset + 1 == segment._length) {
+                    ++_current;
+                }
+                return;
+            }
+            writeU8Slow(u);
+        }
+
+        void write(const byte *data, size_t size) {
+            writeAt(_position, data, size);
+            seek(_position + size);
+        }
+
+        void writeAt(size_t index, const byte *data, size_t size) {
+            ensureCapacity(index + size);
+
+            for (size_t s = locate(index); size > 0; ++s) {
+                Segment &segment = _segments[s];
+                size_t offset = index - segment._start;
+                size_t count = std::min(size, segment._length - offset);
+                memcpy(segment._bytes + offset, data, count);
+                data += count;
+                index += count;
+                size -= count;
+            }
+        }
+
+        bool readAt(size_t index, byte *to, size_t size) const {
+            if (index + size > _position) {
+                return false;
+            }
+
+            while (size > 0) {
+                size_t available = 0;
+                auto bytes = dataAt(index, &available);
+                size_t count = std::min(size, available);
+                memcpy(to, bytes, count);
+                to += count;
+                index += count;
+                size -= count;
+            }
+            return true;
+        }
+    };
+}
@@ -0,0 +1,65 @@
+//
+// Created by kiva on 2026/10/19.
+//
+
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+
+#include <sys/resource.h>
+
+namespace v9::kit {
+    /**
+     * Reset the peak resident set size of this process, so that
+     * peakRss() only covers what runs from now on (Linux only).
+     */
+    inline void resetPeakRss() {
+        FILE *fp = fopen("/proc/self/clear_refs", "w");
+        if (fp != nullptr) {
+            fputs("5", fp);
+            fclose(fp);
+        }
+    }
+
+    /**
+     * Read a size of this process from /proc/self/status,
+     * the peak resident set size from getrusage() where there is none.
+     * @param field "VmHWM" for the peak resident set size, "VmRSS" for the current one
+     * @return Size in KiB
+     */
+    inline long readRss(const char *field) {
+        FILE *fp = fopen("/proc/self/status", "r");
+        long kb = -1;
+        if (fp != nullptr) {
+            char line[256];
+            size_t length = strlen(field);
+            while (fgets(line, sizeof(line), fp) != nullptr) {
+                if (strncmp(line, field, length) == 0 && sscanf(line + length, ": %ld kB", &kb) == 1) {
+                    break;
+                }
+            }
+            fclose(fp);
+        }
+        if (kb < 0) {
+            rusage usage{};
+            getrusage(RUSAGE_SELF, &usage);
+            kb = usage.ru_maxrss;
+        }
+        return kb;
+    }
+
+    /**
+     * @return Resident set size in KiB
+     */
+    inline long currentRss() {
+        return readRss("VmRSS");
+    }
+
+    /**
+     * @return Peak resident set size in KiB, since the last resetPeakRss()
+     */
+    inline long peakRss() {
+        return readRss("VmHWM");
+    }
+}
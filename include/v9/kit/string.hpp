@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cassert>
+#include <climits>
 #include <cstdio>
 #include <cstring>
 #include <string>
@@ -0,0 +1,263 @@
+//
+// Created by kiva on 2026/10/19.
+//
+
+#pragma once
+
+#include <v9/bits/types.hpp>
+
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+
+namespace v9::kit {
+    /**
+     * Work-stealing pool for fork-join tasks.
+     *
+     * Every worker owns a deque: it pushes and pops its own tasks at the
+     * back (newest first, still warm in its cache) and, when it runs dry,
+     * steals the oldest task at the front of another deque, which for
+     * divide and conquer is the largest piece of work left.
+     *
+     * Threads outside the pool submit into deque 0 and help running tasks
+     * while they wait for a TaskGroup, so a pool of N workers keeps N + 1
+     * threads busy and a pool of 0 workers runs everything on the caller.
+     */
+    class TaskPool {
+    public:
+        using Task = std::function<void()>;
+
+    private:
+        struct Queue {
+            std::mutex _lock;
+            std::deque<Task> _tasks;
+        };
+
+        std::vector<std::unique_ptr<Queue>> _queues;
+        std::vector<std::thread> _threads;
+
+        /**
+         * Tasks submitted and not yet taken, to let idle workers sleep.
+         */
+        std::atomic<size_t> _queued{0};
+        std::mutex _idleLock;
+        std::condition_variable _idle;
+        bool _stopping = false;
+
+        static TaskPool *&currentPool() {
+            static thread_local TaskPool *pool = nullptr;
+            return pool;
+        }
+
+        static size_t &currentQueue() {
+            static thread_local size_t queue = 0;
+            return queue;
+        }
+
+        size_t ownQueue() const {
+            return currentPool() == this ? currentQueue() : 0;
+        }
+
+        bool pop(size_t index, bool back, Task &task) {
+            Queue &queue = *_queues[index];
+            std::lock_guard<std::mutex> guard(queue._lock);
+            if (queue._tasks.empty()) {
+                return false;
+            }
+            if (back) {
+                task = std::move(queue._tasks.back());
+                queue._tasks.pop_back();
+            } else {
+                task = std::move(queue._tasks.front());
+                queue._tasks.pop_front();
+            }
+            _queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        /**
+         * Take a task: own queue first, then steal round the others.
+         */
+        bool take(Task &task) {
+            size_t own = ownQueue();
+            if (pop(own, true, task)) {
+                return true;
+            }
+            for (size_t i = 1; i < _queues.size(); ++i) {
+                if (pop((own + i) % _queues.size(), false, task)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void work(size_t index) {
+            currentPool() = this;
+            currentQueue() = index;
+
+            Task task;
+            while (true) {
+                if (take(task)) {
+                    task();
+                    task = nullptr;
+                    continue;
+                }
+                std::unique_lock<std::mutex> guard(_idleLock);
+                _idle.wait(guard, [this] {
+                    return _stopping || _queued.load(std::memory_order_relaxed) > 0;
+                });
+                if (_stopping) {
+                    return;
+                }
+            }
+        }
+
+    public:
+        /**
+         * One worker per hardware thread, minus the caller's
+         */
+        static size_t defaultWorkers() {
+            size_t threads = std::thread::hardware_concurrency();
+            return threads > 1 ? threads - 1 : 0;
+        }
+
+        /**
+         * @param workers Threads to start, besides the ones that wait
+         */
+        explicit TaskPool(size_t workers = defaultWorkers()) {
+            _queues.reserve(workers + 1);
+            for (size_t i = 0; i <= workers; ++i) {
+                _queues.push_back(std::make_unique<Queue>());
+            }
+            _threads.reserve(workers);
+            for (size_t i = 1; i <= workers; ++i) {
+                _threads.emplace_back(&TaskPool::work, this, i);
+            }
+        }
+
+        ~TaskPool() {
+            {
+                std::lock_guard<std::mutex> guard(_idleLock);
+                _stopping = true;
+            }
+            _idle.notify_all();
+            for (auto &&thread : _threads) {
+                thread.join();
+            }
+        }
+
+        TaskPool(const TaskPool &) = delete;
+
+        TaskPool &operator=(const TaskPool &) = delete;
+
+        size_t getWorkerCount() const {
+            return _threads.size();
+        }
+
+        /**
+         * Tasks submitted and not taken yet. A hint only: none queued means
+         * a worker may be about to run dry, so work worth splitting off
+         * should be submitted now.
+         */
+        size_t getQueuedCount() const {
+            return _queued.load(std::memory_order_relaxed);
+        }
+
+        void submit(Task task) {
+            Queue &queue = *_queues[ownQueue()];
+            {
+                // counted under the lock, before pop() can take it and count it down
+                std::lock_guard<std::mutex> guard(queue._lock);
+                queue._tasks.push_back(std::move(task));
+                _queued.fetch_add(1, std::memory_order_relaxed);
+            }
+            if (!_threads.empty()) {
+                // taking the lock orders this against a worker about to sleep
+                std::lock_guard<std::mutex> guard(_idleLock);
+                _idle.notify_one();
+            }
+        }
+
+        /**
+         * Run one queued task on the calling thread.
+         * @return Whether there was one
+         */
+        bool runOne() {
+            Task task;
+            if (!take(task)) {
+                return false;
+            }
+            task();
+            return true;
+        }
+    };
+
+    /**
+     * Tasks forked into a TaskPool and joined by wait().
+     * The first exception thrown by a task is rethrown by wait().
+     */
+    class TaskGroup {
+    private:
+        TaskPool &_pool;
+        std::atomic<size_t> _running{0};
+        std::mutex _errorLock;
+        std::exception_ptr _error;
+
+    public:
+        explicit TaskGroup(TaskPool &pool) : _pool(pool) {}
+
+        TaskGroup(const TaskGroup &) = delete;
+
+        TaskGroup &operator=(const TaskGroup &) = delete;
+
+        ~TaskGroup() {
+            // tasks refer to the group, never leave before they are done
+            while (_running.load(std::memory_order_acquire) != 0) {
+                if (!_pool.runOne()) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        TaskPool &getPool() const {
+            return _pool;
+        }
+
+        template<typename F>
+        void run(F &&f) {
+            _running.fetch_add(1, std::memory_order_relaxed);
+            _pool.submit([this, f = std::forward<F>(f)]() mutable {
+                try {
+                    f();
+                } catch (...) {
+                    std::lock_guard<std::mutex> guard(_errorLock);
+                    if (!_error) {
+                        _error = std::current_exception();
+                    }
+                }
+                _running.fetch_sub(1, std::memory_order_release);
+            });
+        }
+
+        /**
+         * Help running tasks until every task of this group is done.
+         */
+        void wait() {
+            while (_running.load(std::memory_order_acquire) != 0) {
+                if (!_pool.runOne()) {
+                    std::this_thread::yield();
+                }
+            }
+            if (_error) {
+                std::rethrow_exception(std::exchange(_error, nullptr));
+            }
+        }
+    };
+}
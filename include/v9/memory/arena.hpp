@@ -0,0 +1,367 @@
+//
+// Created by kiva on 2026/10/19.
+//
+
+#pragma once
+
+#include <v9/bits/types.hpp>
+
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <stdexcept>
+#include <type_traits>
+
+namespace v9::memory {
+    class Arena;
+
+    /**
+     * Handle of an object living in an Arena.
+     * It is 32 bits wide instead of 64 and means nothing without the arena,
+     * so a tree of Refs stays small and can only be walked through its owner.
+     * A default constructed Ref is null.
+     *
+     * A Ref<Derived> converts to Ref<Base>. Both then name the same address,
+     * so Base must be at offset 0 in Derived, which holds for the usual
+     * single inheritance node hierarchies.
+     */
+    template<typename T>
+    class Ref {
+        template<typename U>
+        friend class Ref;
+
+        friend class Arena;
+
+    private:
+        uint32_t _index = 0;
+
+        explicit Ref(uint32_t index) : _index(index) {}
+
+    public:
+        Ref() = default;
+
+        template<typename U, typename = std::enable_if_t<std::is_base_of_v<T, U>>>
+        Ref(Ref<U> other) : _index(other._index) {}
+
+        explicit operator bool() const {
+            return _index != 0;
+        }
+
+        uint32_t getIndex() const {
+            return _index;
+        }
+
+        bool operator==(Ref other) const {
+            return _index == other._index;
+        }
+
+        bool operator!=(Ref other) const {
+            return _index != other._index;
+        }
+    };
+
+    /**
+     * Handle of an array living in an Arena.
+     */
+    template<typename T>
+    class ArrayRef {
+        friend class Arena;
+
+    private:
+        Ref<T> _first;
+        uint32_t _length = 0;
+
+        ArrayRef(Ref<T> first, uint32_t length) : _first(first), _length(length) {}
+
+    public:
+        ArrayRef() = default;
+
+        size_t getLength() const {
+            return _length;
+        }
+
+        bool isEmpty() const {
+            return _length == 0;
+        }
+    };
+
+    /**
+     * Elements of an ArrayRef resolved by an Arena, for range-for.
+     */
+    template<typename T>
+    class Range {
+    private:
+        T *_begin = nullptr;
+        T *_end = nullptr;
+
+    public:
+        Range() = default;
+
+        Range(T *begin, T *end) : _begin(begin), _end(end) {}
+
+        T *begin() const {
+            return _begin;
+        }
+
+        T *end() const {
+            return _end;
+        }
+
+        size_t size() const {
+            return static_cast<size_t>(_end - _begin);
+        }
+
+        bool empty() const {
+            return _begin == _end;
+        }
+
+        T &operator[](size_t index) const {
+            return _begin[index];
+        }
+    };
+
+    /**
+     * Bump allocator for trees of small objects, typically AST nodes.
+     *
+     * Objects are placed one after another in CHUNK_LENGTH chunks, so a
+     * whole parse costs a handful of mallocs and nodes built together sit
+     * together. Nothing is freed one by one: clear() or the destructor drops
+     * every object at once. Destructors only run for types that need one,
+     * a tree of trivially destructible nodes is torn down by freeing chunks.
+     *
+     * Objects are named by Ref: chunk number and offset packed in 32 bits,
+     * in GRANULE units. Chunks never move, so pointers from get() stay
+     * valid until clear() as well.
+     */
+    class Arena {
+    public:
+        using byte = uint8_t;
+
+        static constexpr size_t GRANULE = 8;
+        static constexpr size_t CHUNK_SHIFT = 20;
+        static constexpr size_t CHUNK_LENGTH = size_t(1) << CHUNK_SHIFT;
+
+    private:
+        // bits of a Ref holding the offset in a chunk, the rest is the chunk number
+        static constexpr size_t OFFSET_BITS = CHUNK_SHIFT - 3;
+        static constexpr uint32_t OFFSET_MASK = (uint32_t(1) << OFFSET_BITS) - 1;
+        static constexpr size_t CHUNK_MAX = size_t(1) << (32 - OFFSET_BITS);
+
+        static_assert(GRANULE == 1 << 3, "OFFSET_BITS assumes 8-byte granules");
+
+        struct Finalizer {
+            void (*_finalize)(void *);
+            void *_object;
+        };
+
+        std::vector<byte *> _chunks;
+        std::vector<Finalizer> _finalizers;
+
+        /**
+         * Chunk being filled and bytes used in it.
+         * Objects larger than half a chunk get a chunk of their own
+         * and never become current.
+         */
+        size_t _current = 0;
+        size_t _used = 0;
+
+        /**
+         * Sum of all chunk lengths and bytes handed out.
+         */
+        size_t _length = 0;
+        size_t _usage = 0;
+
+    private:
+        size_t appendChunk(size_t length) {
+            if (_chunks.size() == CHUNK_MAX) {
+                throw std::length_error("Arena: out of chunk numbers");
+            }
+            auto bytes = static_cast<byte *>(malloc(length));
+            if (bytes == nullptr) {
+                throw std::bad_alloc();
+            }
+            _chunks.push_back(bytes);
+            _length += length;
+            return _chunks.size() - 1;
+        }
+
+        void startChunk() {
+            _current = appendChunk(CHUNK_LENGTH);
+            // the first granule of chunk 0 is never used, so no object gets index 0
+            _used = _current == 0 ? GRANULE : 0;
+        }
+
+        static uint32_t encode(size_t chunk, size_t offset) {
+            return static_cast<uint32_t>((chunk << OFFSET_BITS) | (offset / GRANULE));
+        }
+
+        byte *decode(uint32_t index) const {
+            return _chunks[index >> OFFSET_BITS] + size_t(index & OFFSET_MASK) * GRANULE;
+        }
+
+        void runFinalizers() {
+            for (auto iter = _finalizers.rbegin(); iter != _finalizers.rend(); ++iter) {
+                iter->_finalize(iter->_object);
+            }
+            _finalizers.clear();
+        }
+
+        template<typename T>
+        void addFinalizer(T *object) {
+            if constexpr (!std::is_trivially_destructible_v<T>) {
+                _finalizers.push_back(Finalizer{
+                    [](void *p) { static_cast<T *>(p)->~T(); },
+                    object});
+            }
+        }
+
+    public:
+        Arena() = default;
+
+        ~Arena() {
+            runFinalizers();
+            for (auto chunk : _chunks) {
+                free(chunk);
+            }
+        }
+
+        Arena(const Arena &) = delete;
+
+        Arena &operator=(const Arena &) = delete;
+
+        Arena(Arena &&other) noexcept
+            : _chunks(std::move(other._chunks)),
+              _finalizers(std::move(other._finalizers)),
+              _current(std::exchange(other._current, 0)),
+              _used(std::exchange(other._used, 0)),
+              _length(std::exchange(other._length, 0)),
+              _usage(std::exchange(other._usage, 0)) {
+            other._chunks.clear();
+            other._finalizers.clear();
+        }
+
+        /**
+         * Total bytes of all chunks.
+         */
+        size_t getLength() const {
+            return _length;
+        }
+
+        /**
+         * Bytes handed out, including padding to GRANULE.
+         */
+        size_t getUsage() const {
+            return _usage;
+        }
+
+        size_t getChunkCount() const {
+            return _chunks.size();
+        }
+
+        /**
+         * Get {@code size} bytes aligned to GRANULE.
+         * @param index Receives the Ref index of the bytes
+         * @return Pointer to the bytes, valid until clear()
+         */
+        void *allocate(size_t size, uint32_t *index) {
+            size = size == 0 ? GRANULE : (size + GRANULE - 1) & ~(GRANULE - 1);
+            if (_chunks.empty()) {
+                startChunk();
+            }
+            _usage += size;
+
+            if (size > CHUNK_LENGTH / 2) {
+                size_t chunk = appendChunk(size);
+                *index = encode(chunk, 0);
+                return _chunks[chunk];
+            }
+
+            if (_used + size > CHUNK_LENGTH) {
+                startChunk();
+            }
+            *index = encode(_current, _used);
+            byte *p = _chunks[_current] + _used;
+            _used += size;
+            return p;
+        }
+
+        template<typename T, typename ...Args>
+        Ref<T> make(Args &&...args) {
+            static_assert(alignof(T) <= GRANULE, "Arena: over-aligned type");
+
+            uint32_t index = 0;
+            void *p = allocate(sizeof(T), &index);
+            addFinalizer(new(p) T(std::forward<Args>(args)...));
+            return Ref<T>(index);
+        }
+
+        /**
+         * Copy {@code length} elements into one contiguous array.
+         */
+        template<typename T>
+        ArrayRef<T> makeArray(const T *data, size_t length) {
+            static_assert(alignof(T) <= GRANULE, "Arena: over-aligned type");
+            static_assert(std::is_trivially_destructible_v<T>, "Arena: array elements are never destroyed");
+
+            if (length == 0) {
+                return ArrayRef<T>{};
+            }
+            if (length > UINT32_MAX || length > SIZE_MAX / sizeof(T)) {
+                throw std::length_error("Arena: array too long");
+            }
+
+            uint32_t index = 0;
+            void *p = allocate(sizeof(T) * length, &index);
+            std::uninitialized_copy(data, data + length, static_cast<T *>(p));
+            return ArrayRef<T>(Ref<T>(index), static_cast<uint32_t>(length));
+        }
+
+        template<typename T>
+        ArrayRef<T> makeArray(const std::vector<T> &elements) {
+            return makeArray(elements.data(), elements.size());
+        }
+
+        template<typename T>
+        T *get(Ref<T> ref) {
+            return ref ? reinterpret_cast<T *>(decode(ref._index)) : nullptr;
+        }
+
+        template<typename T>
+        const T *get(Ref<T> ref) const {
+            return ref ? reinterpret_cast<const T *>(decode(ref._index)) : nullptr;
+        }
+
+        template<typename T>
+        Range<T> get(ArrayRef<T> array) {
+            T *first = get(array._first);
+            return Range<T>(first, first + array._length);
+        }
+
+        template<typename T>
+        Range<const T> get(ArrayRef<T> array) const {
+            const T *first = get(array._first);
+            return Range<const T>(first, first + array._length);
+        }
+
+        /**
+         * Destroy every object, keep the first chunk for reuse.
+         * All Refs and pointers into this arena become invalid.
+         */
+        void clear() {
+            runFinalizers();
+            if (_chunks.empty()) {
+                return;
+            }
+            for (size_t i = 1; i < _chunks.size(); ++i) {
+                free(_chunks[i]);
+            }
+            _chunks.resize(1);
+            _current = 0;
+            _used = GRANULE;
+            _length = CHUNK_LENGTH;
+            _usage = 0;
+        }
+    };
+}
@@ -1,64 +1,645 @@
 #include <iostream>
 #include <string>
 #include <deque>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <sstream>
 #include <utility>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include <fstream>
+#include <unordered_map>
+
+#include <v9/memory/arena.hpp>
+#include <v9/kit/resource.hpp>
+
+using v9::memory::Arena;
+using v9::memory::ArrayRef;
+using v9::memory::Ref;
+
+/**
+ * Arbitrary precision integer: sign and magnitude in 32-bit limbs,
+ * least significant first, without leading zero limbs.
+ * Only what Rational needs once its parts outgrow 64 bits.
+ */
+class BigInt {
+public:
+    using Limb = uint32_t;
+    using Wide = uint64_t;
+    using Limbs = std::vector<Limb>;
+
+private:
+    Limbs mag;
+    bool negative = false;
+
+    void trim() {
+        while (!mag.empty() && mag.back() == 0) {
+            mag.pop_back();
+        }
+        if (mag.empty()) {
+            negative = false;
+        }
+    }
 
-int gcd(int a, int b) {
-    return b == 0 ? a : gcd(b, a % b);
-}
+    static int compareMag(const Limbs &a, const Limbs &b) {
+        if (a.size() != b.size()) {
+            return a.size() < b.size() ? -1 : 1;
+        }
+        for (size_t i = a.size(); i-- > 0;) {
+            if (a[i] != b[i]) {
+                return a[i] < b[i] ? -1 : 1;
+            }
+        }
+        return 0;
+    }
 
-struct Num {
-    int son;
-    int mon;
+    // a += b
+    static void addMag(Limbs &a, const Limbs &b) {
+        if (a.size() < b.size()) {
+            a.resize(b.size(), 0);
+        }
+        Wide carry = 0;
+        for (size_t i = 0; i < a.size() && (carry != 0 || i < b.size()); ++i) {
+            Wide sum = Wide(a[i]) + (i < b.size() ? b[i] : 0) + carry;
+            a[i] = Limb(sum);
+            carry = sum >> 32U;
+        }
+        if (carry != 0) {
+            a.push_back(Limb(carry));
+        }
+    }
 
-    Num() : Num(0, 1) {}
+    // a -= b, requires |a| >= |b|
+    static void subMag(Limbs &a, const Limbs &b) {
+        Wide borrow = 0;
+        for (size_t i = 0; i < a.size() && (borrow != 0 || i < b.size()); ++i) {
+            Wide sub = Wide(i < b.size() ? b[i] : 0) + borrow;
+            borrow = Wide(a[i]) < sub;
+            a[i] = Limb(Wide(a[i]) - sub);
+        }
+        while (!a.empty() && a.back() == 0) {
+            a.pop_back();
+        }
+    }
 
-    void simplify() {
-        int g = gcd(son, mon);
-        son /= g;
-        mon /= g;
+    static Limbs mulMag(const Limbs &a, const Limbs &b) {
+        if (a.empty() || b.empty()) {
+            return {};
+        }
+        Limbs r(a.size() + b.size(), 0);
+        for (size_t i = 0; i < a.size(); ++i) {
+            Wide carry = 0;
+            for (size_t j = 0; j < b.size(); ++j) {
+                Wide t = Wide(a[i]) * b[j] + r[i + j] + carry;
+                r[i + j] = Limb(t);
+                carry = t >> 32U;
+            }
+            r[i + b.size()] = Limb(carry);
+        }
+        while (!r.empty() && r.back() == 0) {
+            r.pop_back();
+        }
+        return r;
     }
 
-    Num(int son, int mon) : son(son), mon(mon) {
-        simplify();
+    // a = a * m + add
+    static void mulAddSmall(Limbs &a, Limb m, Limb add) {
+        Wide carry = add;
+        for (auto &&limb : a) {
+            Wide t = Wide(limb) * m + carry;
+            limb = Limb(t);
+            carry = t >> 32U;
+        }
+        if (carry != 0) {
+            a.push_back(Limb(carry));
+        }
     }
 
-    Num operator+(const Num &rhs) const {
-        return Num(
-            this->son * rhs.mon + this->mon * rhs.son,
-            this->mon * rhs.mon
-        );
+    // a /= d, returns the remainder
+    static Limb divSmall(Limbs &a, Limb d) {
+        Wide rem = 0;
+        for (size_t i = a.size(); i-- > 0;) {
+            Wide cur = (rem << 32U) | a[i];
+            a[i] = Limb(cur / d);
+            rem = cur % d;
+        }
+        while (!a.empty() && a.back() == 0) {
+            a.pop_back();
+        }
+        return Limb(rem);
     }
 
-    Num operator-(const Num &rhs) const {
-        return Num(
-            this->son * rhs.mon - this->mon * rhs.son,
-            this->mon * rhs.mon
-        );
+    static size_t trailingZeros(const Limbs &a) {
+        size_t i = 0;
+        while (a[i] == 0) {
+            ++i;
+        }
+        return i * 32 + __builtin_ctz(a[i]);
     }
 
-    Num operator*(const Num &rhs) const {
-        return Num(
-            this->son * rhs.son,
-            this->mon * rhs.mon
-        );
+    static void shiftRight(Limbs &a, size_t bits) {
+        size_t limbs = bits / 32;
+        unsigned shift = bits % 32;
+        if (limbs >= a.size()) {
+            a.clear();
+            return;
+        }
+        a.erase(a.begin(), a.begin() + static_cast<ptrdiff_t>(limbs));
+        if (shift != 0) {
+            for (size_t i = 0; i < a.size(); ++i) {
+                Limb high = i + 1 < a.size() ? a[i + 1] : 0;
+                a[i] = (a[i] >> shift) | (high << (32 - shift));
+            }
+        }
+        while (!a.empty() && a.back() == 0) {
+            a.pop_back();
+        }
     }
 
-    Num operator/(const Num &rhs) const {
-        if (rhs.son == 0) {
-            throw std::runtime_error("Divide by zero");
+    static void shiftLeft(Limbs &a, size_t bits) {
+        if (a.empty()) {
+            return;
         }
-        return this->operator*(Num(rhs.mon, rhs.son));
+        unsigned shift = bits % 32;
+        if (shift != 0) {
+            Limb carry = 0;
+            for (auto &&limb : a) {
+                Limb next = limb >> (32 - shift);
+                limb = (limb << shift) | carry;
+                carry = next;
+            }
+            if (carry != 0) {
+                a.push_back(carry);
+            }
+        }
+        a.insert(a.begin(), bits / 32, 0);
+    }
+
+    /**
+     * Quotient of u / v, Knuth's algorithm D. Requires v != 0.
+     */
+    static Limbs divMag(const Limbs &u, const Limbs &v) {
+        if (compareMag(u, v) < 0) {
+            return {};
+        }
+        if (v.size() == 1) {
+            Limbs q = u;
+            divSmall(q, v[0]);
+            return q;
+        }
+
+        size_t n = v.size();
+        size_t m = u.size();
+        // normalize: the top bit of the divisor set
+        unsigned s = __builtin_clz(v[n - 1]);
+        Limbs vn = v;
+        Limbs un = u;
+        un.push_back(0);
+        if (s != 0) {
+            for (size_t i = n - 1; i > 0; --i) {
+                vn[i] = (v[i] << s) | (v[i - 1] >> (32 - s));
+            }
+            vn[0] = v[0] << s;
+            un[m] = u[m - 1] >> (32 - s);
+            for (size_t i = m - 1; i > 0; --i) {
+                un[i] = (u[i] << s) | (u[i - 1] >> (32 - s));
+            }
+            un[0] = u[0] << s;
+        }
+
+        Limbs q(m - n + 1, 0);
+        const Wide base = Wide(1) << 32U;
+        for (size_t j = m - n + 1; j-- > 0;) {
+            Wide num = (Wide(un[j + n]) << 32U) | un[j + n - 1];
+            Wide qhat = num / vn[n - 1];
+            Wide rhat = num % vn[n - 1];
+            while (qhat >= base || qhat * vn[n - 2] > ((rhat << 32U) | un[j + n - 2])) {
+                --qhat;
+                rhat += vn[n - 1];
+                if (rhat >= base) {
+                    break;
+                }
+            }
+
+            // un[j .. j + n] -= qhat * vn
+            int64_t borrow = 0;
+            Wide carry = 0;
+            for (size_t i = 0; i < n; ++i) {
+                Wide p = qhat * vn[i] + carry;
+                carry = p >> 32U;
+                int64_t t = int64_t(un[i + j]) - int64_t(p & 0xffffffffU) - borrow;
+                un[i + j] = Limb(t);
+                borrow = t < 0 ? 1 : 0;
+            }
+            int64_t t = int64_t(un[j + n]) - int64_t(carry) - borrow;
+            un[j + n] = Limb(t);
+
+            if (t < 0) {
+                // qhat was one too large, add the divisor back
+                --qhat;
+                Wide c = 0;
+                for (size_t i = 0; i < n; ++i) {
+                    Wide sum = Wide(un[i + j]) + vn[i] + c;
+                    un[i + j] = Limb(sum);
+                    c = sum >> 32U;
+                }
+                un[j + n] = Limb(Wide(un[j + n]) + c);
+            }
+            q[j] = Limb(qhat);
+        }
+        while (!q.empty() && q.back() == 0) {
+            q.pop_back();
+        }
+        return q;
+    }
+
+public:
+    BigInt() = default;
+
+    BigInt(int64_t value) : BigInt(value < 0 ? -static_cast<unsigned __int128>(value)
+                                             : static_cast<unsigned __int128>(value), value < 0) {}
+
+    BigInt(unsigned __int128 magnitude, bool negative) : negative(negative) {
+        while (magnitude != 0) {
+            mag.push_back(Limb(magnitude));
+            magnitude >>= 32U;
+        }
+        trim();
+    }
+
+    static BigInt fromDecimal(const std::string &digits) {
+        BigInt r;
+        for (char ch : digits) {
+            mulAddSmall(r.mag, 10, Limb(ch - '0'));
+        }
+        r.trim();
+        return r;
+    }
+
+    bool isZero() const {
+        return mag.empty();
+    }
+
+    bool isNegative() const {
+        return negative;
+    }
+
+    size_t getLimbCount() const {
+        return mag.size();
+    }
+
+    bool fitsInt64() const {
+        return mag.size() < 2 || (mag.size() == 2 && mag[1] < 0x80000000U);
+    }
+
+    // requires fitsInt64()
+    int64_t toInt64() const {
+        Wide m = 0;
+        for (size_t i = mag.size(); i-- > 0;) {
+            m = (m << 32U) | mag[i];
+        }
+        return negative ? -int64_t(m) : int64_t(m);
+    }
+
+    BigInt operator-() const {
+        BigInt r = *this;
+        r.negative = !r.negative;
+        r.trim();
+        return r;
+    }
+
+    BigInt operator+(const BigInt &rhs) const {
+        BigInt r = *this;
+        if (negative == rhs.negative) {
+            addMag(r.mag, rhs.mag);
+        } else if (compareMag(mag, rhs.mag) >= 0) {
+            subMag(r.mag, rhs.mag);
+        } else {
+            r.mag = rhs.mag;
+            r.negative = rhs.negative;
+            subMag(r.mag, mag);
+        }
+        r.trim();
+        return r;
+    }
+
+    BigInt operator-(const BigInt &rhs) const {
+        return *this + (-rhs);
+    }
+
+    BigInt operator*(const BigInt &rhs) const {
+        BigInt r;
+        r.mag = mulMag(mag, rhs.mag);
+        r.negative = negative != rhs.negative;
+        r.trim();
+        return r;
+    }
+
+    /**
+     * Quotient truncated toward zero, rhs must not be zero.
+     */
+    BigInt operator/(const BigInt &rhs) const {
+        BigInt r;
+        r.mag = divMag(mag, rhs.mag);
+        r.negative = negative != rhs.negative;
+        r.trim();
+        return r;
+    }
+
+    /**
+     * Greatest common divisor of the magnitudes, binary (Stein) algorithm:
+     * only shifts and subtractions.
+     */
+    static BigInt gcd(const BigInt &x, const BigInt &y) {
+        if (x.isZero()) {
+            return y.negative ? -y : y;
+        }
+        if (y.isZero()) {
+            return x.negative ? -x : x;
+        }
+        Limbs a = x.mag;
+        Limbs b = y.mag;
+        size_t za = trailingZeros(a);
+        size_t zb = trailingZeros(b);
+        shiftRight(a, za);
+        while (true) {
+            shiftRight(b, trailingZeros(b));
+            if (compareMag(a, b) > 0) {
+                std::swap(a, b);
+            }
+            subMag(b, a);
+            if (b.empty()) {
+                break;
+            }
+        }
+        shiftLeft(a, std::min(za, zb));
+        BigInt r;
+        r.mag = std::move(a);
+        return r;
+    }
+
+    std::string toString() const {
+        if (isZero()) {
+            return "0";
+        }
+        Limbs a = mag;
+        std::string digits;
+        while (!a.empty()) {
+            Limb chunk = divSmall(a, 1000000000U);
+            for (int i = 0; i < 9 && (!a.empty() || chunk != 0); ++i) {
+                digits.push_back(char('0' + chunk % 10));
+                chunk /= 10;
+            }
+        }
+        if (negative) {
+            digits.push_back('-');
+        }
+        return std::string(digits.rbegin(), digits.rend());
     }
 };
 
-std::ostream &operator<<(std::ostream &out, const Num &num) {
-    if (num.mon == 1) {
-        out << num.son;
-    } else {
-        out << num.son << " % " << num.mon;
+/**
+ * Exact rational number.
+ *
+ * The common case is two int64_t, not necessarily in lowest terms:
+ * results are computed with 128-bit intermediates and only reduced when
+ * they don't fit 64 bits any more, or when printed. Reducing uses the
+ * binary gcd. When even the reduced value doesn't fit, it moves to a
+ * pair of BigInt, reduced again only once it grew to twice the size the
+ * operands had when they were last reduced, and back to int64_t when a
+ * reduced value fits.
+ *
+ * The denominator is always positive.
+ */
+class Rational {
+private:
+    using Wide = __int128;
+
+    struct Big {
+        BigInt num;
+        BigInt den;
+        // limbs of num and den when last reduced, or of the operands that were
+        size_t reduced;
+    };
+
+    // limbs of a value that fits 64 bits
+    static constexpr size_t SMALL_LIMBS = 4;
+
+    int64_t num = 0;
+    int64_t den = 1;
+    // set for values that don't fit, then num and den are unused
+    std::shared_ptr<const Big> big;
+
+    static bool fits(Wide v) {
+        // INT64_MIN excluded, so negating never overflows
+        return v >= -INT64_MAX && v <= INT64_MAX;
     }
-    return out;
+
+    static uint64_t gcd(uint64_t a, uint64_t b) {
+        if (a == 0 || b == 0) {
+            return a | b;
+        }
+        int shift = __builtin_ctzll(a | b);
+        a >>= __builtin_ctzll(a);
+        do {
+            b >>= __builtin_ctzll(b);
+            if (a > b) {
+                std::swap(a, b);
+            }
+            b -= a;
+        } while (b != 0);
+        return a << shift;
+    }
+
+    /**
+     * Euclid steps while an operand needs more than 64 bits, where a
+     * binary gcd would take a step per bit, then the 64-bit one.
+     */
+    static unsigned __int128 gcd(unsigned __int128 a, unsigned __int128 b) {
+        while (b != 0 && ((a | b) >> 64U) != 0) {
+            a %= b;
+            std::swap(a, b);
+        }
+        return b == 0 ? a : gcd(static_cast<uint64_t>(a), static_cast<uint64_t>(b));
+    }
+
+    static unsigned __int128 magnitude(Wide v) {
+        return v < 0 ? -static_cast<unsigned __int128>(v) : static_cast<unsigned __int128>(v);
+    }
+
+    /**
+     * n / d with d > 0: kept as is if both fit, else reduced,
+     * else promoted.
+     */
+    static Rational fromWide(Wide n, Wide d) {
+        Rational r;
+        if (fits(n) && fits(d)) {
+            r.num = static_cast<int64_t>(n);
+            r.den = static_cast<int64_t>(d);
+            return r;
+        }
+        auto g = static_cast<Wide>(gcd(magnitude(n), static_cast<unsigned __int128>(d)));
+        n /= g;
+        d /= g;
+        if (fits(n) && fits(d)) {
+            r.num = static_cast<int64_t>(n);
+            r.den = static_cast<int64_t>(d);
+            return r;
+        }
+        r.big = std::make_shared<const Big>(Big{BigInt(magnitude(n), n < 0),
+                                                BigInt(static_cast<unsigned __int128>(d), false),
+                                                SMALL_LIMBS * 2});
+        return r;
+    }
+
+    /**
+     * n / d with d > 0 from operands {@code lhs} and {@code rhs}:
+     * kept as is while it stays within twice their reduced size,
+     * else reduced and back to 64 bits if possible.
+     */
+    static Rational fromBig(BigInt n, BigInt d, const Rational &lhs, const Rational &rhs) {
+        size_t limbs = n.getLimbCount() + d.getLimbCount();
+        if (limbs <= 2 * (lhs.reducedLimbs() + rhs.reducedLimbs())) {
+            Rational r;
+            r.big = std::make_shared<const Big>(Big{std::move(n), std::move(d),
+                                                    std::max(lhs.reducedLimbs(), rhs.reducedLimbs())});
+            return r;
+        }
+        return reduce(std::move(n), std::move(d));
+    }
+
+    /**
+     * n / d with d > 0 in lowest terms, back to 64 bits if possible.
+     */
+    static Rational reduce(BigInt n, BigInt d) {
+        BigInt g = BigInt::gcd(n, d);
+        n = n / g;
+        d = d / g;
+        Rational r;
+        if (n.fitsInt64() && d.fitsInt64()) {
+            r.num = n.toInt64();
+            r.den = d.toInt64();
+        } else {
+            size_t limbs = n.getLimbCount() + d.getLimbCount();
+            r.big = std::make_shared<const Big>(Big{std::move(n), std::move(d), limbs});
+        }
+        return r;
+    }
+
+    size_t reducedLimbs() const {
+        return big ? big->reduced : SMALL_LIMBS;
+    }
+
+    BigInt bigNum() const {
+        return big ? big->num : BigInt(num);
+    }
+
+    BigInt bigDen() const {
+        return big ? big->den : BigInt(den);
+    }
+
+public:
+    Rational() = default;
+
+    Rational(int64_t value) : num(value) {}
+
+    /**
+     * @param den Must be positive, need not be coprime with num
+     */
+    Rational(int64_t num, int64_t den) : num(num), den(den) {}
+
+    /**
+     * @param digits Decimal digits, any length
+     */
+    static Rational parse(const std::string &digits) {
+        if (digits.size() <= 18) {
+            return Rational(static_cast<int64_t>(std::stoll(digits)));
+        }
+        return reduce(BigInt::fromDecimal(digits), BigInt(1));
+    }
+
+    bool isZero() const {
+        return big ? big->num.isZero() : num == 0;
+    }
+
+    bool isBig() const {
+        return big != nullptr;
+    }
+
+    // only when !isBig()
+    int64_t getNumerator() const {
+        return num;
+    }
+
+    int64_t getDenominator() const {
+        return den;
+    }
+
+    Rational operator+(const Rational &rhs) const {
+        if (!big && !rhs.big) {
+            if (den == rhs.den) {
+                return fromWide(Wide(num) + rhs.num, den);
+            }
+            return fromWide(Wide(num) * rhs.den + Wide(rhs.num) * den, Wide(den) * rhs.den);
+        }
+        return fromBig(bigNum() * rhs.bigDen() + rhs.bigNum() * bigDen(), bigDen() * rhs.bigDen(), *this, rhs);
+    }
+
+    Rational operator-(const Rational &rhs) const {
+        if (!big && !rhs.big) {
+            if (den == rhs.den) {
+                return fromWide(Wide(num) - rhs.num, den);
+            }
+            return fromWide(Wide(num) * rhs.den - Wide(rhs.num) * den, Wide(den) * rhs.den);
+        }
+        return fromBig(bigNum() * rhs.bigDen() - rhs.bigNum() * bigDen(), bigDen() * rhs.bigDen(), *this, rhs);
+    }
+
+    Rational operator*(const Rational &rhs) const {
+        if (!big && !rhs.big) {
+            return fromWide(Wide(num) * rhs.num, Wide(den) * rhs.den);
+        }
+        return fromBig(bigNum() * rhs.bigNum(), bigDen() * rhs.bigDen(), *this, rhs);
+    }
+
+    Rational operator/(const Rational &rhs) const {
+        if (rhs.isZero()) {
+            throw std::runtime_error("Divide by zero");
+        }
+        if (!big && !rhs.big) {
+            Wide n = Wide(num) * rhs.den;
+            Wide d = Wide(den) * rhs.num;
+            return d < 0 ? fromWide(-n, -d) : fromWide(n, d);
+        }
+        BigInt n = bigNum() * rhs.bigDen();
+        BigInt d = bigDen() * rhs.bigNum();
+        return d.isNegative() ? fromBig(-n, -d, *this, rhs) : fromBig(n, d, *this, rhs);
+    }
+
+    /**
+     * In lowest terms: "n" or "n % d"
+     */
+    std::string toString() const {
+        if (big) {
+            Rational r = reduce(big->num, big->den);
+            if (!r.big) {
+                return r.toString();
+            }
+            bool integer = r.big->den.fitsInt64() && r.big->den.toInt64() == 1;
+            return integer ? r.big->num.toString() : r.big->num.toString() + " % " + r.big->den.toString();
+        }
+        auto g = static_cast<int64_t>(gcd(static_cast<uint64_t>(num < 0 ? -num : num), static_cast<uint64_t>(den)));
+        int64_t n = num / g;
+        int64_t d = den / g;
+        return d == 1 ? std::to_string(n) : std::to_string(n) + " % " + std::to_string(d);
+    }
+};
+
+std::ostream &operator<<(std::ostream &out, const Rational &num) {
+    return out << num.toString();
 }
 
 // Lexer : String -> List<Token>
@@ -71,12 +652,12 @@ enum struct TokenType {
 
 struct Token {
     TokenType type;
-    Num num;
+    Rational num;
     std::string id;
 
     explicit Token(TokenType type) : type(type) {}
 
-    explicit Token(Num num) : type(TokenType::NUM), num(num) {}
+    explicit Token(Rational num) : type(TokenType::NUM), num(num) {}
 
     explicit Token(std::string id) : type(TokenType::ID), id(std::move(id)) {}
 };
@@ -94,6 +675,9 @@ std::deque<Token> lex(const std::string &src) {
     const char *p = src.c_str();
     while (*p) {
         skip_ws(p);
+        if (!*p) {
+            break;
+        }
 
         if (*p == '+') {
             result.emplace_back(TokenType::ADD);
@@ -133,11 +717,10 @@ std::deque<Token> lex(const std::string &src) {
 
         // num
         if (*p >= '0' && *p <= '9') {
-            int son = 0;
-            int mon = 0;
+            std::string son;
+            std::string mon;
             while (*p && *p >= '0' && *p <= '9') {
-                son = son * 10 + (*p - '0');
-                ++p;
+                son.push_back(*p++);
             }
 
             skip_ws(p);
@@ -149,14 +732,18 @@ std::deque<Token> lex(const std::string &src) {
                 skip_ws(p);
 
                 while (*p && *p >= '0' && *p <= '9') {
-                    mon = mon * 10 + (*p - '0');
-                    ++p;
+                    mon.push_back(*p++);
+                }
+                if (mon.empty()) {
+                    throw std::runtime_error("Syntax Error: expected digits after '%'");
                 }
-            } else {
-                mon = 1;
             }
 
-            result.emplace_back(Num(son, mon));
+            Rational num = Rational::parse(son);
+            if (!mon.empty()) {
+                num = num / Rational::parse(mon);
+            }
+            result.emplace_back(num);
             continue;
         }
 
@@ -177,99 +764,215 @@ std::deque<Token> lex(const std::string &src) {
     return result;
 }
 
+Rational apply(TokenType op, const Rational &l, const Rational &r) {
+    switch (op) {
+        case TokenType::ADD:
+            return l + r;
+        case TokenType::SUB:
+            return l - r;
+        case TokenType::MUL:
+            return l * r;
+        case TokenType::DIV:
+            return l / r;
+        default:
+            return l;
+    }
+}
+
+// Program : a Unit compiled to postfix, see Session
+
+struct Program {
+    enum struct Op : uint8_t {
+        PUSH, ADD, SUB, MUL, DIV, ID,
+    };
+
+    struct Instruction {
+        Op op;
+        // index in constants for PUSH
+        uint32_t operand;
+    };
+
+    std::vector<Instruction> code;
+    std::vector<Rational> constants;
+
+    void emitConstant(Rational value) {
+        code.push_back(Instruction{Op::PUSH, static_cast<uint32_t>(constants.size())});
+        constants.push_back(std::move(value));
+    }
+
+    /**
+     * Emit a binary operator, or fold it when both operands are constants.
+     * A fold that throws (divide by zero) is left for run() to report.
+     */
+    void emitOp(TokenType op) {
+        size_t n = code.size();
+        if (n >= 2 && code[n - 1].op == Op::PUSH && code[n - 2].op == Op::PUSH) {
+            try {
+                Rational folded = apply(op, constants[constants.size() - 2], constants.back());
+                code.resize(n - 2);
+                constants.resize(constants.size() - 2);
+                emitConstant(std::move(folded));
+                return;
+            } catch (std::runtime_error &) {
+            }
+        }
+        switch (op) {
+            case TokenType::ADD:
+                code.push_back(Instruction{Op::ADD, 0});
+                break;
+            case TokenType::SUB:
+                code.push_back(Instruction{Op::SUB, 0});
+                break;
+            case TokenType::MUL:
+                code.push_back(Instruction{Op::MUL, 0});
+                break;
+            default:
+                code.push_back(Instruction{Op::DIV, 0});
+                break;
+        }
+    }
+
+    void emitId() {
+        code.push_back(Instruction{Op::ID, 0});
+    }
+
+    /**
+     * @param stack Scratch space, reused across calls
+     */
+    Rational run(std::vector<Rational> &stack) const {
+        stack.clear();
+        for (auto &&ins : code) {
+            if (ins.op == Op::PUSH) {
+                stack.push_back(constants[ins.operand]);
+                continue;
+            }
+            if (ins.op == Op::ID) {
+                throw std::runtime_error("Unsupported: identifiers");
+            }
+            Rational r = std::move(stack.back());
+            stack.pop_back();
+            Rational &l = stack.back();
+            switch (ins.op) {
+                case Op::ADD:
+                    l = l + r;
+                    break;
+                case Op::SUB:
+                    l = l - r;
+                    break;
+                case Op::MUL:
+                    l = l * r;
+                    break;
+                default:
+                    l = l / r;
+                    break;
+            }
+        }
+        return std::move(stack.back());
+    }
+};
+
 // Parser : List<Token> -> Unit
-struct Term;
+// Nodes live in an Arena and refer to each other by Ref,
+// a whole line is freed at once by Arena::clear().
 
 struct Node {
-    virtual Num eval() = 0;
+    virtual Rational eval(const Arena &arena) const = 0;
+
+    virtual void compile(const Arena &arena, Program &program) const = 0;
 };
 
 struct Expr : public Node {
-    Node *lhs{};
-    Node *rhs{};
+    Ref<Node> lhs;
+    Ref<Node> rhs;
     TokenType op;
 
-    Num eval() override;
+    Expr(Ref<Node> lhs, TokenType op, Ref<Node> rhs) : lhs(lhs), rhs(rhs), op(op) {}
 
-    ~Expr();
+    void compile(const Arena &arena, Program &program) const override {
+        arena.get(lhs)->compile(arena, program);
+        arena.get(rhs)->compile(arena, program);
+        program.emitOp(op);
+    }
+
+    Rational eval(const Arena &arena) const override {
+        return apply(op, arena.get(lhs)->eval(arena), arena.get(rhs)->eval(arena));
+    }
 };
 
-struct Factor : public Node {
-    Node *expr{};
-    Num *num{};
-    std::string id;
+/**
+ * A literal too large for Factor, the only node that needs a destructor.
+ */
+struct Literal {
+    Rational value;
+
+    explicit Literal(Rational value) : value(std::move(value)) {}
+};
 
-    Num eval() override {
-        if (expr != nullptr) {
-            return expr->eval();
+struct Factor : public Node {
+    Ref<Node> expr;
+    Ref<Literal> big;
+    int64_t num = 0;
+    int64_t den = 1;
+    // copied into the arena too, so Factor needs no destructor
+    ArrayRef<char> id;
+
+    Rational eval(const Arena &arena) const override {
+        if (expr) {
+            return arena.get(expr)->eval(arena);
+        }
+        if (big) {
+            return arena.get(big)->value;
         }
-        if (num != nullptr) {
-            return *num;
+        if (id.isEmpty()) {
+            return Rational(num, den);
         }
-        throw std::runtime_error("// TODO: support id");
+        throw std::runtime_error("Unsupported: identifiers");
     }
 
-    ~Factor() {
-        delete expr;
-        delete num;
+    void compile(const Arena &arena, Program &program) const override {
+        if (expr) {
+            arena.get(expr)->compile(arena, program);
+        } else if (big) {
+            program.emitConstant(arena.get(big)->value);
+        } else if (id.isEmpty()) {
+            program.emitConstant(Rational(num, den));
+        } else {
+            program.emitId();
+        }
     }
 };
 
 struct Term : public Node {
-    Node *lhs{};
-    Node *rhs{};
+    Ref<Node> lhs;
+    Ref<Node> rhs;
     TokenType op;
 
-    Num eval() override {
-        Num l = lhs->eval();
-        if (rhs) {
-            Num r = rhs->eval();
-            switch (op) {
-                case TokenType::MUL:
-                    return l * r;
-                case TokenType::DIV:
-                    return l / r;
-            }
-        }
-        return l;
+    Term(Ref<Node> lhs, TokenType op, Ref<Node> rhs) : lhs(lhs), rhs(rhs), op(op) {}
+
+    void compile(const Arena &arena, Program &program) const override {
+        arena.get(lhs)->compile(arena, program);
+        arena.get(rhs)->compile(arena, program);
+        program.emitOp(op);
     }
 
-    ~Term() {
-        delete lhs;
-        delete rhs;
+    Rational eval(const Arena &arena) const override {
+        return apply(op, arena.get(lhs)->eval(arena), arena.get(rhs)->eval(arena));
     }
 };
 
 struct Unit : public Node {
-    Expr *expr{};
+    Ref<Node> expr;
 
-    Num eval() override {
-        return expr->eval();
-    }
+    explicit Unit(Ref<Node> expr) : expr(expr) {}
 
-    ~Unit() {
-        delete expr;
+    Rational eval(const Arena &arena) const override {
+        return arena.get(expr)->eval(arena);
     }
-};
 
-Num Expr::eval() {
-    Num l = lhs->eval();
-    if (rhs) {
-        Num r = rhs->eval();
-        switch (op) {
-            case TokenType::ADD:
-                return l + r;
-            case TokenType::SUB:
-                return l - r;
-        }
+    void compile(const Arena &arena, Program &program) const override {
+        arena.get(expr)->compile(arena, program);
     }
-    return l;
-}
-
-Expr::~Expr() {
-    delete lhs;
-    delete rhs;
-}
+};
 
 struct Parser {
     std::deque<Token> tokens;
@@ -309,11 +1012,11 @@ struct Parser {
         consume();
     }
 
-    Num consume_num() {
+    Rational consume_num() {
         if (peek() != TokenType::NUM) {
             throw std::runtime_error(std::string("Syntax Error: expected num"));
         }
-        Num num = tokens.front().num;
+        Rational num = tokens.front().num;
         consume();
         return num;
     }
@@ -336,10 +1039,13 @@ struct Parser {
         return tokens.front().type;
     }
 
-    explicit Parser(std::deque<Token> tokens) : tokens(std::move(tokens)) {}
+    Arena &arena;
+
+    Parser(std::deque<Token> tokens, Arena &arena) : tokens(std::move(tokens)), arena(arena) {}
 
-    Factor *parseFactor() {
-        Factor *factor = new Factor;
+    Ref<Node> parseFactor() {
+        auto node = arena.make<Factor>();
+        Factor *factor = arena.get(node);
         // lookahead
         switch (peek()) {
             case TokenType::LEFT_B: {
@@ -349,33 +1055,36 @@ struct Parser {
                 break;
             }
             case TokenType::NUM: {
-                factor->num = new Num(consume_num());
+                Rational num = consume_num();
+                if (num.isBig()) {
+                    factor->big = arena.make<Literal>(std::move(num));
+                } else {
+                    factor->num = num.getNumerator();
+                    factor->den = num.getDenominator();
+                }
                 break;
             }
             case TokenType::ID: {
-                factor->id = consume_id();
+                auto id = consume_id();
+                factor->id = arena.makeArray(id.data(), id.size());
                 break;
             }
             default: {
                 throw std::runtime_error(std::string("Syntax Error: expected '(' or num"));
             }
         }
-        return factor;
+        return node;
     }
 
-    Term *parseTerm() {
-        Term *term = new Term;
-        term->lhs = parseFactor();
+    Ref<Node> parseTerm() {
+        Ref<Node> term = parseFactor();
         // lookahead
         while (!isEOF()) {
             switch (peek()) {
                 case TokenType::MUL:
                 case TokenType::DIV: {
-                    term->op = consumeOp();
-                    term->rhs = parseFactor();
-                    Term *next = new Term;
-                    next->lhs = term;
-                    term = next;
+                    TokenType op = consumeOp();
+                    term = arena.make<Term>(term, op, parseFactor());
                     break;
                 }
                 default:
@@ -386,19 +1095,15 @@ struct Parser {
         return term;
     }
 
-    Expr *parseExpr() {
-        Expr *expr = new Expr;
-        expr->lhs = parseTerm();
+    Ref<Node> parseExpr() {
+        Ref<Node> expr = parseTerm();
         // lookahead
         while (!isEOF()) {
             switch (peek()) {
                 case TokenType::ADD:
                 case TokenType::SUB: {
-                    expr->op = consumeOp();
-                    expr->rhs = parseTerm();
-                    Expr *next = new Expr;
-                    next->lhs = expr;
-                    expr = next;
+                    TokenType op = consumeOp();
+                    expr = arena.make<Expr>(expr, op, parseTerm());
                     break;
                 }
                 default:
@@ -409,10 +1114,148 @@ struct Parser {
         return expr;
     }
 
-    Unit *parseUnit() {
-        Unit *unit = new Unit;
-        unit->expr = parseExpr();
-        return unit;
+    Ref<Unit> parseUnit() {
+        return arena.make<Unit>(parseExpr());
+    }
+};
+
+/**
+ * Evaluates lines through compiled Programs, cached by source text,
+ * so a line seen before is neither lexed nor parsed again. Programs
+ * have no inputs, so the printed result is remembered as well.
+ *
+ * print() only compiles a line the second time it sees it, the first
+ * time it walks the tree like the REPL: when most lines are new, filling
+ * the cache costs more than it ever saves.
+ */
+class Session {
+private:
+    struct Entry {
+        Program program;
+        // result or error message, empty until first printed
+        std::string text;
+    };
+
+    Arena arena;
+    std::unordered_map<std::string, Entry> cache;
+    std::vector<Rational> stack;
+    // the cache is dropped as a whole when it reaches this many lines
+    size_t capacity;
+    // hashes of lines print() has seen, one per slot, newest wins
+    std::vector<size_t> seen;
+    std::string scratch;
+
+    Entry &insert(const std::string &line) {
+        arena.clear();
+        Parser parser(lex(line), arena);
+        auto unit = parser.parseUnit();
+        Program program;
+        arena.get(unit)->compile(arena, program);
+
+        if (cache.size() >= capacity) {
+            cache.clear();
+        }
+        return cache.emplace(line, Entry{std::move(program), std::string()}).first->second;
+    }
+
+    /**
+     * @return Whether print() was asked for this line before, as far as
+     * the slots remember
+     */
+    bool seenBefore(const std::string &line) {
+        size_t hash = std::hash<std::string>()(line);
+        size_t &slot = seen[hash & (seen.size() - 1)];
+        if (slot == hash) {
+            return true;
+        }
+        slot = hash;
+        return false;
+    }
+
+public:
+    /**
+     * @param capacity Lines to cache, rounded up to a power of two
+     */
+    explicit Session(size_t capacity = 1 << 18) : capacity(capacity) {
+        size_t slots = 1;
+        while (slots < capacity) {
+            slots <<= 1;
+        }
+        seen.resize(slots, 0);
+    }
+
+    size_t getCacheSize() const {
+        return cache.size();
+    }
+
+    const Program &compile(const std::string &line) {
+        auto iter = cache.find(line);
+        return iter != cache.end() ? iter->second.program : insert(line).program;
+    }
+
+    Rational eval(const std::string &line) {
+        return compile(line).run(stack);
+    }
+
+    /**
+     * @return What the REPL prints for {@code line}, without the newline,
+     * valid until the next call
+     */
+    const std::string &print(const std::string &line) {
+        try {
+            auto iter = cache.find(line);
+            Entry *entry = nullptr;
+            if (iter != cache.end()) {
+                entry = &iter->second;
+            } else if (seenBefore(line)) {
+                entry = &insert(line);
+            } else {
+                arena.clear();
+                Parser parser(lex(line), arena);
+                auto unit = parser.parseUnit();
+                scratch = arena.get(unit)->eval(arena).toString();
+                return scratch;
+            }
+
+            if (entry->text.empty()) {
+                try {
+                    entry->text = entry->program.run(stack).toString();
+                } catch (std::exception &e) {
+                    entry->text = e.what();
+                }
+            }
+            return entry->text;
+        } catch (std::exception &e) {
+            // lexer and parser errors, never cached
+            scratch = e.what();
+            return scratch;
+        }
+    }
+
+    /**
+     * Evaluate every line of {@code in}, writing one result or error per
+     * line to {@code out} in large blocks instead of a stream call each.
+     * @return Number of lines
+     */
+    size_t batch(std::istream &in, std::ostream &out) {
+        static constexpr size_t FLUSH_LENGTH = 1 << 16;
+        std::string buffer;
+        std::string line;
+        size_t count = 0;
+
+        while (std::getline(in, line)) {
+            buffer += print(line);
+            buffer += '\n';
+            ++count;
+
+            if (buffer.size() >= FLUSH_LENGTH) {
+                out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+                buffer.clear();
+            }
+        }
+        out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        out.flush();
+        return count;
     }
 };
 
@@ -450,8 +1293,338 @@ struct T {
     }
 };
 
-int main() {
+#ifdef CALC_BENCHMARK
+
+/**
+ * About {@code bytes} bytes of expressions, one per line,
+ * small enough for the legacy Num not to overflow
+ */
+std::vector<std::string> make_lines(size_t bytes) {
+    static const char OPS[] = "+-*/";
+    std::vector<std::string> lines;
+    uint32_t seed = 2026;
+    auto next = [&seed](uint32_t bound) {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 16) % bound;
+    };
+
+    for (size_t total = 0; total < bytes;) {
+        std::string line = std::to_string(1 + next(9));
+        for (int n = 2 + next(6); n > 0; --n) {
+            line += ' ';
+            line += OPS[next(4)];
+            if (next(3) == 0) {
+                line += " (" + std::to_string(1 + next(9)) + " " + OPS[next(2)]
+                        + " " + std::to_string(1 + next(9)) + ")";
+            } else {
+                line += " " + std::to_string(1 + next(9));
+            }
+        }
+        total += line.size() + 1;
+        lines.push_back(std::move(line));
+    }
+    return lines;
+}
+
+/**
+ * The int fraction calc-lang used before Rational, reduced after every
+ * operation and silently wrong once a product overflows. Kept to compare.
+ */
+int gcd(int a, int b) {
+    return b == 0 ? a : gcd(b, a % b);
+}
+
+struct Num {
+    int son;
+    int mon;
+
+    Num() : Num(0, 1) {}
+
+    void simplify() {
+        int g = gcd(son, mon);
+        son /= g;
+        mon /= g;
+    }
+
+    Num(int son, int mon) : son(son), mon(mon) {
+        simplify();
+    }
+
+    Num operator+(const Num &rhs) const {
+        return Num(
+            this->son * rhs.mon + this->mon * rhs.son,
+            this->mon * rhs.mon
+        );
+    }
+
+    Num operator-(const Num &rhs) const {
+        return Num(
+            this->son * rhs.mon - this->mon * rhs.son,
+            this->mon * rhs.mon
+        );
+    }
+
+    Num operator*(const Num &rhs) const {
+        return Num(
+            this->son * rhs.son,
+            this->mon * rhs.mon
+        );
+    }
+
+    Num operator/(const Num &rhs) const {
+        if (rhs.son == 0) {
+            throw std::runtime_error("Divide by zero");
+        }
+        return this->operator*(Num(rhs.mon, rhs.son));
+    }
+};
+
+std::ostream &operator<<(std::ostream &out, const Num &num) {
+    if (num.mon == 1) {
+        out << num.son;
+    } else {
+        out << num.son << " % " << num.mon;
+    }
+    return out;
+}
+
+template<typename N>
+N make_fraction(int son, int mon);
+
+template<>
+Num make_fraction<Num>(int son, int mon) {
+    return Num(son, mon);
+}
+
+template<>
+Rational make_fraction<Rational>(int son, int mon) {
+    return Rational(son) / Rational(mon);
+}
+
+template<typename N>
+std::string show(const N &n) {
+    std::stringstream out;
+    out << n;
+    return out.str();
+}
+
+/**
+ * 1 + 1/2 + ... + 1/n, denominators grow without bound
+ */
+template<typename N>
+std::string harmonic(int n) {
+    N sum = make_fraction<N>(0, 1);
+    for (int i = 1; i <= n; ++i) {
+        sum = sum + make_fraction<N>(1, i);
+    }
+    return show(sum);
+}
+
+/**
+ * x = (x * 3 + 1 % 5) / 3 - 1 % 15, {@code rounds} times: the value stays
+ * put, so this is the cost of small operands and of reducing them
+ */
+template<typename N>
+std::string bounded(int rounds) {
+    N x = make_fraction<N>(2, 7);
+    N three = make_fraction<N>(3, 1);
+    N fifth = make_fraction<N>(1, 5);
+    N fifteenth = make_fraction<N>(1, 15);
+    for (int i = 0; i < rounds; ++i) {
+        x = (x * three + fifth) / three - fifteenth;
+    }
+    return show(x);
+}
+
+template<typename F>
+double time_ms(F &&f, std::string &result) {
+    auto start = std::chrono::steady_clock::now();
+    result = f();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * "1 % 1 + 1 % 2 + ... + 1 % n" through the lexer, parser and tree walk
+ */
+double harmonic_line(int n, std::string &result) {
+    std::string line = "1 % 1";
+    for (int i = 2; i <= n; ++i) {
+        line += " + 1 % " + std::to_string(i);
+    }
+    Arena arena;
+    auto start = std::chrono::steady_clock::now();
+    Parser parser(lex(line), arena);
+    auto unit = parser.parseUnit();
+    result = arena.get(unit)->eval(arena).toString();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void bench_chains() {
+    std::string legacy;
+    std::string exact;
+    for (int n : {10, 20, 50, 200, 1000}) {
+        double l = time_ms([n] { return harmonic<Num>(n); }, legacy);
+        double r = time_ms([n] { return harmonic<Rational>(n); }, exact);
+        std::string line;
+        double p = harmonic_line(n, line);
+        printf("harmonic(%d): Num %.3f ms %s, Rational %.3f ms (%zu digits), parsed line %.3f ms %s\n",
+            n, l, legacy == exact ? "ok" : "WRONG", r, exact.size(), p, line == exact ? "ok" : "MISMATCH");
+    }
+
+    const int rounds = 10000000;
+    double l = time_ms([] { return bounded<Num>(rounds); }, legacy);
+    double r = time_ms([] { return bounded<Rational>(rounds); }, exact);
+    printf("bounded x%d: Num %.1f ns/round (%s), Rational %.1f ns/round (%s)\n",
+        rounds, l * 1e6 / rounds, legacy.c_str(), r * 1e6 / rounds, exact.c_str());
+}
+
+/**
+ * The REPL loop over a whole input: lex, parse, walk and print each line
+ */
+size_t tree_batch(std::istream &in, std::ostream &out) {
+    Arena arena;
     std::string line;
+    size_t count = 0;
+    while (std::getline(in, line)) {
+        try {
+            arena.clear();
+            Parser parser(lex(line), arena);
+            auto unit = parser.parseUnit();
+            out << arena.get(unit)->eval(arena) << std::endl;
+        } catch (std::exception &e) {
+            out << e.what() << std::endl;
+        }
+        ++count;
+    }
+    return count;
+}
+
+/**
+ * {@code count} lines drawn from {@code distinct} different expressions,
+ * each line once when there are enough
+ */
+std::string make_input(const std::vector<std::string> &pool, size_t distinct, size_t count) {
+    std::string input;
+    uint32_t seed = 44;
+    for (size_t i = 0; i < count; ++i) {
+        seed = seed * 1103515245 + 12345;
+        input += pool[distinct >= count ? i : (seed >> 8) % distinct];
+        input += '\n';
+    }
+    return input;
+}
+
+void bench_batch(size_t count) {
+    auto pool = make_lines(count * 32);
+    std::ofstream sink("/dev/null");
+
+    for (size_t distinct : {count, size_t(100000), size_t(1000)}) {
+        std::string input = make_input(pool, distinct, count);
+
+        std::istringstream tree_in(input);
+        auto start = std::chrono::steady_clock::now();
+        tree_batch(tree_in, sink);
+        double tree = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        Session session;
+        std::istringstream session_in(input);
+        start = std::chrono::steady_clock::now();
+        session.batch(session_in, sink);
+        double compiled = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        printf("batch %zu lines, %zu distinct: tree + cout %.1f ms (%.2f M lines/s), "
+               "compiled + cache %.1f ms (%.2f M lines/s)\n",
+            count, distinct, tree * 1e3, count / tree / 1e6, compiled * 1e3, count / compiled / 1e6);
+    }
+}
+
+/**
+ * Parse every line into one arena and keep all trees alive, like a
+ * compiler holding a whole translation unit, then walk and drop them.
+ */
+int main(int argc, const char **argv) {
+    bench_chains();
+    bench_batch(2000000);
+
+    size_t megabytes = argc > 1 ? atoi(argv[1]) : 16;
+    auto lines = make_lines(megabytes << 20);
+
+    // lexed up front, so only the parser is timed
+    std::vector<std::deque<Token>> tokens;
+    tokens.reserve(lines.size());
+    for (auto &&line : lines) {
+        tokens.push_back(lex(line));
+    }
+
+    Arena arena;
+    std::vector<Ref<Unit>> units;
+    units.reserve(lines.size());
+
+    v9::kit::resetPeakRss();
+    long base = v9::kit::currentRss();
+    auto parse_start = std::chrono::steady_clock::now();
+    for (auto &&line : tokens) {
+        Parser parser(std::move(line), arena);
+        units.push_back(parser.parseUnit());
+    }
+    double parse = std::chrono::duration<double>(std::chrono::steady_clock::now() - parse_start).count();
+    long peak = v9::kit::peakRss() - base;
+    size_t usage = arena.getUsage();
+    size_t chunks = arena.getChunkCount();
+
+    auto eval_start = std::chrono::steady_clock::now();
+    size_t failed = 0;
+    long checksum = 0;
+    for (auto unit : units) {
+        try {
+            checksum += long(arena.get(unit)->eval(arena).toString().size());
+        } catch (std::exception &) {
+            ++failed;
+        }
+    }
+    double eval = std::chrono::duration<double>(std::chrono::steady_clock::now() - eval_start).count();
+
+    auto clear_start = std::chrono::steady_clock::now();
+    arena.clear();
+    double clear = std::chrono::duration<double>(std::chrono::steady_clock::now() - clear_start).count();
+
+    printf("%zu MB, %zu lines: parse %.2f ms (%.1f MB/s), peak RSS +%.1f MB, "
+           "%.1f MB of nodes in %zu chunks\n",
+        megabytes, lines.size(), parse * 1e3, megabytes / parse, peak / 1024.0,
+        usage / 1048576.0, chunks);
+    printf("eval %.2f ms (%zu divided by zero, checksum %ld), teardown %.3f ms\n",
+        eval * 1e3, failed, checksum, clear * 1e3);
+}
+
+#else
+
+/**
+ * calc-lang              read-eval-print, walking the tree of each line
+ * calc-lang --compiled   same through a Session
+ * calc-lang --batch [f]  evaluate every line of f (default stdin), no prompt
+ */
+int main(int argc, const char **argv) {
+    std::string mode = argc > 1 ? argv[1] : "";
+    Session session;
+
+    if (mode == "--batch") {
+        std::ios::sync_with_stdio(false);
+        if (argc > 2) {
+            std::ifstream in(argv[2]);
+            if (!in) {
+                std::cerr << "cannot open " << argv[2] << std::endl;
+                return 1;
+            }
+            session.batch(in, std::cout);
+        } else {
+            session.batch(std::cin, std::cout);
+        }
+        return 0;
+    }
+
+    bool compiled = mode == "--compiled";
+    std::string line;
+    Arena arena;
 
     while (true) {
         std::cout << "> ";
@@ -461,10 +1634,14 @@ int main() {
         }
 
         try {
-            Parser parser(lex(line));
-            Unit *unit = parser.parseUnit();
-            std::cout << unit->eval() << std::endl;
-            delete unit;
+            if (compiled) {
+                std::cout << session.eval(line) << std::endl;
+                continue;
+            }
+            arena.clear();
+            Parser parser(lex(line), arena);
+            auto unit = parser.parseUnit();
+            std::cout << arena.get(unit)->eval(arena) << std::endl;
         } catch (std::exception &e) {
             std::cout << e.what() << std::endl;
         }
@@ -472,3 +1649,5 @@ int main() {
 
     return 0;
 }
+
+#endif
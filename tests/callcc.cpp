@@ -6,10 +6,13 @@
 #include <utility>
 #include <vector>
 #include <cstdint>
+#include <cstddef>
+#include <cstring>
 #include <string>
 #include <memory>
+#include <algorithm>
 #include <unordered_map>
-#include <stack>
+#include <unordered_set>
 
 enum Opcode {
     LOAD /* n */,       // load local[n] into stack
@@ -20,6 +23,11 @@ enum Opcode {
     CALL_CC /* n */,    // call/cc function named name[n]
     YIELD /* n */,      // resume continuation (local[n]) with stack top
     RESUME /* n */,     // resume continuation (local[n])
+    ADD,                // pop two values, push their sum
+    MUL,                // pop two values, push their product
+    POP,                // drop stack top
+    GOTO /* pc */,      // continue at pc
+    IFNE /* pc */,      // pop two values, continue at pc if they differ
 //    CALL /* i */,       // call function named name[i]
 //    RET,                // return from function with stack top
 };
@@ -27,7 +35,7 @@ enum Opcode {
 struct Frame;
 
 struct Continuation {
-    std::shared_ptr<Frame> _frame;
+    Frame *_frame = nullptr;
 };
 
 union Object {
@@ -35,117 +43,288 @@ union Object {
     Continuation *cont = nullptr;
 };
 
+struct Function;
+
+/**
+ * An instruction decoded by VM::link(): jump targets are instruction
+ * indices and CALL_CC refers to its callee directly.
+ */
+struct Instruction {
+    // label of the handler in VM::run(), filled in on the first run
+    const void *handler;
+    const Function *callee;
+    int operand;
+    uint8_t op;
+};
+
 struct Function {
     int _argc = 0;
     int _locals = 0;
     bool _return = false;
     std::string _name;
     std::vector<uint8_t> _body;
+    // computed by VM::link()
+    int _max_stack = 0;
+    std::vector<Instruction> _code;
+
+    int slots() const {
+        return _argc + _locals + _max_stack;
+    }
 };
 
+/**
+ * A frame is one block from the FramePool: the header is followed
+ * by the locals and then by a fixed-size operand stack.
+ */
 struct Frame {
-    std::vector<Object> _local;
-    std::stack<Object> _stack;
-    std::shared_ptr<Function> _func;
+    const Function *_func;
+    Object *_local;
+    Object *_stack;
+    // next free stack slot
+    Object *_sp;
     int _resumed_to_index = -1;
-    int _pc = 0;
+    const Instruction *_ip;
+    // all continuations of a frame are the same, so capturing
+    // the current continuation hands out this one instead of allocating
+    Continuation _cont;
+    Frame *_next_free = nullptr;
+
+    explicit Frame(const Function *func)
+        : _func(func),
+          _local(reinterpret_cast<Object *>(this + 1)),
+          _stack(_local + func->_argc + func->_locals),
+          _sp(_stack),
+          _ip(func->_code.data()) {
+        std::fill(_local, _stack, Object{});
+        _cont._frame = this;
+    }
+
+    void push(Object value) {
+        *_sp++ = value;
+    }
+};
+
+/**
+ * Frames are carved out of large slabs and recycled through
+ * free lists indexed by slot count.
+ *
+ * A suspended frame may be resumed through any copy of its continuation,
+ * and slots are untyped, so copies cannot be counted as they come and go.
+ * Frames are reclaimed by a collection instead: only frames reachable from
+ * the running one, through continuations held in locals or on operand
+ * stacks, can ever run again. A slot whose bits equal the continuation of
+ * a handed-out frame counts as a reference, so an integer that happens to
+ * look like one keeps a frame alive, but a frame still in use is never
+ * reclaimed. Collections run when a frame would otherwise come from
+ * the slab, and at most once per doubling of the frames handed out.
+ */
+class FramePool {
+private:
+    static constexpr size_t SLAB_SIZE = 64 * 1024;
+    static constexpr size_t ALIGNMENT = alignof(std::max_align_t);
+    static constexpr size_t MIN_COLLECT = 64;
+
+    std::vector<std::unique_ptr<uint8_t[]>> _slabs;
+    uint8_t *_bump = nullptr;
+    size_t _left = 0;
+
+    // free frames of each slot count, linked through _next_free
+    std::vector<Frame *> _free;
+    // frames handed out and not reclaimed yet
+    std::vector<Frame *> _live;
+    size_t _next_collect = MIN_COLLECT;
+
+private:
+    void *allocate(size_t size) {
+        size = (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        if (size > _left) {
+            size_t slab = std::max(size, SLAB_SIZE);
+            _slabs.emplace_back(new uint8_t[slab]);
+            _bump = _slabs.back().get();
+            _left = slab;
+        }
+        void *memory = _bump;
+        _bump += size;
+        _left -= size;
+        return memory;
+    }
+
+    void release(Frame *frame) {
+        auto slots = static_cast<size_t>(frame->_func->slots());
+        frame->_next_free = _free[slots];
+        _free[slots] = frame;
+    }
+
+    /**
+     * Reclaim every frame not reachable from {@code root},
+     * whose _sp must be up to date.
+     */
+    void collect(Frame *root) {
+        std::unordered_map<const Continuation *, Frame *> frames;
+        for (Frame *frame : _live) {
+            frames.emplace(&frame->_cont, frame);
+        }
+
+        std::unordered_set<Frame *> reached{root};
+        std::vector<Frame *> work{root};
+        while (!work.empty()) {
+            Frame *frame = work.back();
+            work.pop_back();
+            // locals and the used part of the operand stack are contiguous
+            for (Object *slot = frame->_local; slot != frame->_sp; ++slot) {
+                const Continuation *cont;
+                memcpy(&cont, slot, sizeof(cont));
+                auto found = frames.find(cont);
+                if (found != frames.end() && reached.insert(found->second).second) {
+                    work.push_back(found->second);
+                }
+            }
+        }
 
-    explicit Frame(const std::shared_ptr<Function> &func)
-        : _func(func), _local(func->_argc + func->_locals) {
+        auto end = std::partition(_live.begin(), _live.end(), [&reached](Frame *frame) {
+            return reached.count(frame) != 0;
+        });
+        std::for_each(end, _live.end(), [this](Frame *frame) { release(frame); });
+        _live.erase(end, _live.end());
+        _next_collect = std::max(MIN_COLLECT, _live.size() * 2);
+    }
+
+public:
+    /**
+     * @param running The running frame, none when starting,
+     * its _sp must be up to date
+     */
+    Frame *acquire(const Function *func, Frame *running) {
+        auto slots = static_cast<size_t>(func->slots());
+        if (slots >= _free.size()) {
+            _free.resize(slots + 1, nullptr);
+        }
+
+        if (_free[slots] == nullptr && running != nullptr && _live.size() >= _next_collect) {
+            collect(running);
+        }
+
+        void *memory = _free[slots];
+        if (memory != nullptr) {
+            _free[slots] = _free[slots]->_next_free;
+        } else {
+            memory = allocate(sizeof(Frame) + slots * sizeof(Object));
+        }
+
+        auto *frame = new(memory) Frame(func);
+        _live.push_back(frame);
+        return frame;
+    }
+
+    void release_all() {
+        for (Frame *frame : _live) {
+            release(frame);
+        }
+        _live.clear();
+        _next_collect = MIN_COLLECT;
+    }
+
+    size_t slab_count() const {
+        return _slabs.size();
     }
 };
 
 struct VM {
-    std::shared_ptr<Frame> _current;
-    std::vector<std::shared_ptr<Frame>> _frames;
+    Frame *_current = nullptr;
+    FramePool _pool;
     std::unordered_map<std::string, std::shared_ptr<Function>> _table;
     std::vector<std::string> _strings;
+    bool _linked = false;
+    bool _threaded = false;
+    // instructions executed, for benchmarks
+    uint64_t _executed = 0;
+
+    // ends every decoded function, running off the end stops the VM
+    static constexpr uint8_t END = IFNE + 1;
 
     explicit VM(std::unordered_map<std::string, std::shared_ptr<Function>> table)
         : _table(std::move(table)) {
     }
 
-    Object current_cont() {
-        auto *cont = new Continuation;
-        cont->_frame = _current;
-        return Object{.cont = cont};
+    const Function *resolve(int index) {
+        auto func = _table.find(_strings[index]);
+        if (func == _table.end()) {
+            fprintf(stderr, "unsatisfied link: %s\n", _strings[index].c_str());
+            std::terminate();
+        }
+        return func->second.get();
     }
 
-    void run() {
-        while (_current->_pc < _current->_func->_body.size()) {
-            switch (_current->_func->_body[_current->_pc++]) {
-                case Opcode::LOAD: {
-                    int index = _current->_func->_body[_current->_pc++];
-                    _current->_stack.push(_current->_local[index]);
+    /**
+     * Find the deepest operand stack of a function by walking every path
+     * through its body. A callee pushes at most its yielded value and
+     * its continuation onto our stack, a resumed one only the value.
+     */
+    void compute_max_stack(Function &func) {
+        constexpr int STACK_LIMIT = 1024;
+        const std::vector<uint8_t> &body = func._body;
+
+        std::vector<int> depth(body.size() + 1, -1);
+        std::vector<size_t> work{0};
+        depth[0] = 0;
+        func._max_stack = 0;
+
+        auto reach = [&](size_t pc, int d) {
+            if (d < 0 || d > STACK_LIMIT || pc > body.size()) {
+                fprintf(stderr, "%s: bad operand stack at %zu\n", func._name.c_str(), pc);
+                std::terminate();
+            }
+            if (d > depth[pc]) {
+                depth[pc] = d;
+                work.push_back(pc);
+            }
+        };
+
+        while (!work.empty()) {
+            size_t pc = work.back();
+            work.pop_back();
+
+            int d = depth[pc];
+            func._max_stack = std::max(func._max_stack, d);
+            if (pc == body.size()) {
+                continue;
+            }
+
+            switch (body[pc]) {
+                case LOAD:
+                case BIPUSH:
+                    reach(pc + 2, d + 1);
                     break;
-                }
-                case Opcode::STORE: {
-                    int index = _current->_func->_body[_current->_pc++];
-                    _current->_local[index] = std::move(_current->_stack.top());
-                    _current->_stack.pop();
+                case STORE:
+                    reach(pc + 2, d - 1);
                     break;
-                }
-                case Opcode::BIPUSH: {
-                    int value = _current->_func->_body[_current->_pc++];
-                    _current->_stack.push(Object{.i32 = value});
+                case INC:
+                    reach(pc + 1, d);
                     break;
-                }
-                case Opcode::INC: {
-                    ++_current->_stack.top().i32;
+                case PRINTLN:
+                case POP:
+                case ADD:
+                case MUL:
+                    reach(pc + 1, d - 1);
                     break;
-                }
-                case Opcode::PRINTLN: {
-                    printf("%d\n", _current->_stack.top().i32);
-                    _current->_stack.pop();
+                case CALL_CC: {
+                    const Function *callee = resolve(body[pc + 1]);
+                    reach(pc + 2, d - (callee->_argc - 1) + (callee->_return ? 1 : 0) + 1);
                     break;
                 }
-                case Opcode::CALL_CC: {
-                    int index = _current->_func->_body[_current->_pc++];
-                    auto func = _table.find(_strings[index]);
-                    if (func == _table.end()) {
-                        fprintf(stderr, "unsatisfied link: %s\n", func->first.c_str());
-                        std::terminate();
-                    }
-
-                    auto frame = std::make_shared<Frame>(func->second);
-                    for (int i = 0; i < func->second->_argc - 1; ++i) {
-                        frame->_local[i] = std::move(_current->_stack.top());
-                        _current->_stack.pop();
-                    }
-                    frame->_local[func->second->_argc - 1] = current_cont();
-                    _frames.push_back(frame);
-                    // switch context
-                    _current = frame;
+                case YIELD:
+                    reach(pc + 2, d - (func._return ? 1 : 0));
                     break;
-                }
-                case Opcode::YIELD: {
-                    int index = _current->_func->_body[_current->_pc++];
-                    auto *caller = _current->_local[index].cont;
-
-                    if (_current->_func->_return) {
-                        caller->_frame->_stack.push(std::move(_current->_stack.top()));
-                        _current->_stack.pop();
-                    }
-                    // if caller resumed us, we update the continuation stored in the caller
-                    if (caller->_frame->_resumed_to_index != -1) {
-                        caller->_frame->_local[_current->_resumed_to_index] = current_cont();
-                        caller->_frame->_resumed_to_index = -1;
-                    } else {
-                        caller->_frame->_stack.push(current_cont());
-                    }
-                    // switch context
-                    _current = caller->_frame;
+                case RESUME:
+                    reach(pc + 2, d + 1);
                     break;
-                }
-                case Opcode::RESUME: {
-                    int index = _current->_func->_body[_current->_pc++];
-                    auto *cont = _current->_local[index].cont;
-                    // for auto-update cont in this scope
-                    _current->_resumed_to_index = index;
-                    // switch context
-                    _current = cont->_frame;
+                case GOTO:
+                    reach(body[pc + 1], d);
+                    break;
+                case IFNE:
+                    reach(pc + 2, d - 2);
+                    reach(body[pc + 1], d - 2);
                     break;
-                }
                 default:
                     fprintf(stderr, "Illegal instruction\n");
                     std::terminate();
@@ -153,6 +332,193 @@ struct VM {
         }
     }
 
+    /**
+     * Turn a body into instructions, ending with END.
+     * Handlers are filled in by run().
+     */
+    void decode(Function &func) {
+        const std::vector<uint8_t> &body = func._body;
+        std::vector<int> index_of(body.size() + 1);
+        func._code.clear();
+
+        for (size_t pc = 0; pc < body.size(); ++pc) {
+            index_of[pc] = static_cast<int>(func._code.size());
+            Instruction insn{nullptr, nullptr, 0, body[pc]};
+            switch (insn.op) {
+                case LOAD:
+                case STORE:
+                case BIPUSH:
+                case YIELD:
+                case RESUME:
+                case GOTO:
+                case IFNE:
+                    insn.operand = body[++pc];
+                    break;
+                case CALL_CC:
+                    insn.operand = body[++pc];
+                    insn.callee = resolve(insn.operand);
+                    break;
+                default:
+                    break;
+            }
+            func._code.push_back(insn);
+        }
+        index_of[body.size()] = static_cast<int>(func._code.size());
+        func._code.push_back(Instruction{nullptr, nullptr, 0, END});
+
+        for (auto &&insn : func._code) {
+            if (insn.op == GOTO || insn.op == IFNE) {
+                insn.operand = index_of[insn.operand];
+            }
+        }
+    }
+
+    void link() {
+        if (_linked) {
+            return;
+        }
+        for (auto &&entry : _table) {
+            compute_max_stack(*entry.second);
+            decode(*entry.second);
+        }
+        _linked = true;
+    }
+
+    void run() {
+        static const void *handlers[] = {
+            &&do_load, &&do_store, &&do_bipush, &&do_inc, &&do_println,
+            &&do_call_cc, &&do_yield, &&do_resume,
+            &&do_add, &&do_mul, &&do_pop, &&do_goto, &&do_ifne,
+            &&do_end,
+        };
+
+        if (!_threaded) {
+            for (auto &&entry : _table) {
+                for (auto &&insn : entry.second->_code) {
+                    insn.handler = handlers[insn.op];
+                }
+            }
+            _threaded = true;
+        }
+
+        // the state of the running frame lives in locals,
+        // and is written back to the frame on every context switch
+        Frame *frame = _current;
+        const Instruction *ip = frame->_ip;
+        Object *sp = frame->_sp;
+        Object *local = frame->_local;
+        uint64_t executed = 0;
+
+#ifdef CALLCC_BENCHMARK
+#define DISPATCH() ++executed; goto *(ip++)->handler
+#else
+#define DISPATCH() goto *(ip++)->handler
+#endif
+#define SWITCH_TO(next) \
+        frame->_ip = ip; frame->_sp = sp; \
+        frame = (next); \
+        ip = frame->_ip; sp = frame->_sp; local = frame->_local
+#define OPERAND (ip[-1].operand)
+
+        DISPATCH();
+
+    do_load:
+        *sp++ = local[OPERAND];
+        DISPATCH();
+
+    do_store:
+        local[OPERAND] = *--sp;
+        DISPATCH();
+
+    do_bipush:
+        (sp++)->i32 = OPERAND;
+        DISPATCH();
+
+    do_inc:
+        ++sp[-1].i32;
+        DISPATCH();
+
+    do_println:
+        printf("%d\n", (--sp)->i32);
+        DISPATCH();
+
+    do_add:
+        --sp;
+        sp[-1].i32 += sp[0].i32;
+        DISPATCH();
+
+    do_mul:
+        --sp;
+        sp[-1].i32 *= sp[0].i32;
+        DISPATCH();
+
+    do_pop:
+        --sp;
+        DISPATCH();
+
+    do_goto:
+        ip = frame->_func->_code.data() + OPERAND;
+        DISPATCH();
+
+    do_ifne:
+        sp -= 2;
+        if (sp[0].i32 != sp[1].i32) {
+            ip = frame->_func->_code.data() + OPERAND;
+        }
+        DISPATCH();
+
+    do_call_cc: {
+        const Function *func = ip[-1].callee;
+        // the pool may collect, which reads our operand stack
+        frame->_sp = sp;
+        Frame *callee = _pool.acquire(func, frame);
+        for (int i = 0; i < func->_argc - 1; ++i) {
+            callee->_local[i] = *--sp;
+        }
+        callee->_local[func->_argc - 1] = Object{.cont = &frame->_cont};
+        // switch context
+        SWITCH_TO(callee);
+        DISPATCH();
+    }
+
+    do_yield: {
+        Frame *caller = local[OPERAND].cont->_frame;
+        if (frame->_func->_return) {
+            caller->push(*--sp);
+        }
+        // if caller resumed us, we update the continuation stored in the caller
+        if (caller->_resumed_to_index != -1) {
+            caller->_local[caller->_resumed_to_index] = Object{.cont = &frame->_cont};
+            caller->_resumed_to_index = -1;
+        } else {
+            caller->push(Object{.cont = &frame->_cont});
+        }
+        // switch context
+        SWITCH_TO(caller);
+        DISPATCH();
+    }
+
+    do_resume: {
+        Frame *callee = local[OPERAND].cont->_frame;
+        // for auto-update cont in this scope
+        frame->_resumed_to_index = OPERAND;
+        // switch context
+        SWITCH_TO(callee);
+        DISPATCH();
+    }
+
+    do_end:
+        // stay on END, so running again does nothing
+        --ip;
+        frame->_ip = ip;
+        frame->_sp = sp;
+        _current = frame;
+        _executed += executed;
+#undef OPERAND
+#undef SWITCH_TO
+#undef DISPATCH
+    }
+
     void start() {
         auto main = _table.find("main");
         if (main == _table.end()) {
@@ -160,9 +526,11 @@ struct VM {
             return;
         }
 
-        _current = std::make_shared<Frame>(main->second);
-        _frames.push_back(_current);
+        link();
+        _current = _pool.acquire(main->second.get(), nullptr);
         run();
+        _current = nullptr;
+        _pool.release_all();
     }
 };
 
@@ -230,6 +598,169 @@ std::shared_ptr<Function> make_generator() {
     return std::shared_ptr<Function>{f};
 }
 
+#ifdef CALLCC_BENCHMARK
+
+#include <chrono>
+#include <cstdlib>
+
+std::shared_ptr<Function> make_counter_main(int millions) {
+    auto f = new Function;
+    /**
+     * void main() {
+     *     var n = millions * 1000000;
+     *     var (cont, x) = counter(n);
+     *     for (var count = 1; count != n; ++count) {
+     *         x = resume cont;
+     *     }
+     *     println(x);
+     * }
+     */
+    f->_argc = 0;
+    f->_locals = 4;
+    f->_return = false;
+    f->_name = "main";
+    f->_body = {
+        // var n = millions * 1000000
+        BIPUSH, 100, BIPUSH, 100, MUL, BIPUSH, 100, MUL, BIPUSH, static_cast<uint8_t>(millions), MUL,
+        STORE, 3,
+        // var (cont, x) = counter(n)
+        LOAD, 3,
+        CALL_CC, 1,
+        STORE, 0, // cont
+        STORE, 1, // x
+        // count = 1
+        BIPUSH, 1,
+        STORE, 2,
+        // loop: x = resume cont
+        RESUME, 0,  // pc = 25
+        STORE, 1,
+        // ++count
+        LOAD, 2,
+        INC,
+        STORE, 2,
+        // if (count != n) goto loop
+        LOAD, 2,
+        LOAD, 3,
+        IFNE, 25,
+        // println(x)
+        LOAD, 1,
+        PRINTLN,
+    };
+    return std::shared_ptr<Function>{f};
+}
+
+std::shared_ptr<Function> make_spawn_main(int millions) {
+    auto f = new Function;
+    /**
+     * void main() {
+     *     var n = millions * 1000000;
+     *     var (cont, x);
+     *     for (var count = 0; count != n; ++count) {
+     *         (cont, x) = counter(1);
+     *     }
+     *     println(x);
+     * }
+     */
+    f->_argc = 0;
+    f->_locals = 4;
+    f->_return = false;
+    f->_name = "main";
+    f->_body = {
+        // var n = millions * 1000000
+        BIPUSH, 100, BIPUSH, 100, MUL, BIPUSH, 100, MUL, BIPUSH, static_cast<uint8_t>(millions), MUL,
+        STORE, 3,
+        // count = 0
+        BIPUSH, 0,
+        STORE, 2,
+        // loop: (cont, x) = counter(1), dropping the previous counter
+        BIPUSH, 1,  // pc = 17
+        CALL_CC, 1,
+        STORE, 0,
+        STORE, 1,
+        // ++count
+        LOAD, 2,
+        INC,
+        STORE, 2,
+        // if (count != n) goto loop
+        LOAD, 2,
+        LOAD, 3,
+        IFNE, 17,
+        // println(x)
+        LOAD, 1,
+        PRINTLN,
+    };
+    return std::shared_ptr<Function>{f};
+}
+
+std::shared_ptr<Function> make_counter() {
+    auto f = new Function;
+    /*
+     * int counter(int n) {
+     *     for (var i = 0; i != n; ++i) {
+     *         yield i;
+     *     }
+     * }
+     */
+    f->_argc = 2;
+    f->_locals = 1;
+    f->_return = true;
+    f->_name = "counter";
+    f->_body = {
+        // loop: yield i
+        LOAD, 2,
+        YIELD, 1,
+        // ++i
+        LOAD, 2,
+        INC,
+        STORE, 2,
+        // if (i != n) goto loop
+        LOAD, 2,
+        LOAD, 0,
+        IFNE, 0,
+    };
+    return std::shared_ptr<Function>{f};
+}
+
+int main(int argc, const char **argv) {
+    int millions = argc > 1 ? atoi(argv[1]) : 10;
+    constexpr int ROUNDS = 3;
+
+    // millions is pushed by a single BIPUSH, whose operand is one unsigned byte
+    if (millions < 1 || millions > UINT8_MAX) {
+        fprintf(stderr, "%s: millions of iterations must be in [1, %d]\n", argv[0], UINT8_MAX);
+        return 1;
+    }
+
+    auto bench = [millions](VM &vm, const char *what) {
+        vm._strings = {"main", "counter"};
+        for (int round = 0; round < ROUNDS; ++round) {
+            vm._executed = 0;
+            auto start = std::chrono::steady_clock::now();
+            vm.start();
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            printf("round %d: %d M %s in %.3f s, %.1f M %s/s, %.1f M instructions/s, %zu frame slab(s)\n",
+                round, millions, what, seconds, millions / seconds, what, vm._executed / seconds / 1e6,
+                vm._pool.slab_count());
+        }
+    };
+
+    VM yields({
+        {"main",    make_counter_main(millions)},
+        {"counter", make_counter()},
+    });
+    bench(yields, "yields");
+
+    // a new counter every iteration, the previous one is unreachable
+    VM spawns({
+        {"main",    make_spawn_main(millions)},
+        {"counter", make_counter()},
+    });
+    bench(spawns, "call/cc");
+}
+
+#else
+
 int main() {
     VM vm({
         {"main",      make_main()},
@@ -240,3 +771,5 @@ int main() {
 
     vm.start();
 }
+
+#endif
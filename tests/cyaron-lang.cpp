@@ -8,9 +8,26 @@
 #include <unordered_map>
 #include <utility>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <cstring>
 #include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <map>
+#include <set>
+#include <cassert>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <v9/memory/arena.hpp>
+#include <v9/kit/resource.hpp>
 
 namespace mpp {
     template <typename T, typename... ArgsT>
@@ -68,13 +85,13 @@ namespace shared {
 }
 
 namespace lexer {
-    enum class token_type {
+    enum class token_type : uint8_t {
         ID_OR_KW,
         INT_LITERAL,
         OPERATOR,
     };
 
-    enum class operator_type {
+    enum class operator_type : uint8_t {
         UNDEFINED,             //
         OPERATOR_ADD,          // +
         OPERATOR_SUB,          // -
@@ -419,6 +436,411 @@ namespace lexer {
             }
         }
     };
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // flat tokens
+    ////////////////////////////////////////////////////////////////////////////////
+
+    enum class keyword : uint8_t {
+        NONE,
+        VARS, INT, ARRAY,
+        WHILE, HOR, IHU, YOSORO, SET, TO,
+        LT, LE, GT, GE, EQ, NEQ,
+    };
+
+    /**
+     * Characters owned by someone else, usually the source
+     */
+    struct string_span {
+        const char *_data;
+        uint32_t _length;
+
+        std::string str() const {
+            return {_data, _length};
+        }
+
+        bool operator==(const char *text) const {
+            return strncmp(_data, text, _length) == 0 && text[_length] == '\0';
+        }
+    };
+
+    /**
+     * A token as plain data, its text points into the source,
+     * which must outlive it
+     */
+    struct flat_token {
+        string_span _text;
+        uint32_t _line;
+        uint32_t _column;
+        // value of an INT_LITERAL
+        int32_t _value;
+        token_type _type;
+        // operator of an OPERATOR
+        operator_type _op;
+        // keyword of an ID_OR_KW, NONE for other identifiers
+        keyword _kw;
+    };
+
+    /**
+     * Source text mapped from a file, or read into memory
+     * when the file cannot be mapped (a pipe or a terminal)
+     */
+    struct mapped_source {
+    private:
+        const char *_data = "";
+        size_t _length = 0;
+        void *_mapping = nullptr;
+        std::string _copy;
+
+    public:
+        explicit mapped_source(int fd) {
+            struct stat st{};
+            if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+                if (st.st_size == 0) {
+                    return;
+                }
+                void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapping != MAP_FAILED) {
+                    madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+                    _mapping = mapping;
+                    _data = static_cast<const char *>(mapping);
+                    _length = st.st_size;
+                    return;
+                }
+            }
+
+            char buffer[64 * 1024];
+            ssize_t n;
+            while ((n = read(fd, buffer, sizeof(buffer))) != 0) {
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    mpp::throw_ex<std::runtime_error>("mapped_source: read failed");
+                }
+                _copy.append(buffer, n);
+            }
+            _data = _copy.data();
+            _length = _copy.size();
+        }
+
+        explicit mapped_source(const char *path)
+            : mapped_source(open_or_throw(path), true) {
+        }
+
+        ~mapped_source() {
+            if (_mapping != nullptr) {
+                munmap(_mapping, _length);
+            }
+        }
+
+        mapped_source(const mapped_source &) = delete;
+
+        mapped_source &operator=(const mapped_source &) = delete;
+
+        const char *begin() const {
+            return _data;
+        }
+
+        const char *end() const {
+            return _data + _length;
+        }
+
+        size_t size() const {
+            return _length;
+        }
+
+    private:
+        static int open_or_throw(const char *path) {
+            int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                mpp::throw_ex<std::runtime_error>(std::string("cannot open ") + path);
+            }
+            return fd;
+        }
+
+        mapped_source(int fd, bool owned)
+            : mapped_source(fd) {
+            if (owned) {
+                // the mapping outlives the descriptor
+                close(fd);
+            }
+        }
+    };
+
+    /**
+     * Table-driven lexer producing flat tokens.
+     * Accepts the same language as lexer, with ';' as a separator and
+     * operators matched longest first, but allocates nothing per token.
+     */
+    struct scanner {
+        using iter_t = const char *;
+
+    private:
+        enum char_flag : uint8_t {
+            SPACE = 1,
+            NEWLINE = 2,
+            DIGIT = 4,
+            IDENT = 8,
+            OPERATOR = 16,
+            COMMENT = 32,
+        };
+
+        struct tables {
+            uint8_t _flags[256] = {};
+            operator_type _single[256] = {};
+            // keywords by perfect hash, see keyword_hash()
+            const char *_keyword_text[32] = {};
+            keyword _keyword[32] = {};
+        };
+
+        iter_t _p;
+        iter_t _end;
+        iter_t _line_start;
+        uint32_t _line = 1;
+
+        static uint32_t keyword_hash(iter_t text, size_t length) {
+            // collision free for the 15 keywords
+            return (static_cast<uint8_t>(text[0]) + 20u * static_cast<uint8_t>(text[length - 1])
+                    + static_cast<uint32_t>(length)) & 31u;
+        }
+
+        static const tables &get_tables() {
+            static const tables t = [] {
+                tables t;
+                for (int c = 0; c < 256; ++c) {
+                    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '$' || c == '_') {
+                        t._flags[c] = IDENT;
+                    }
+                    if (c >= '0' && c <= '9') {
+                        t._flags[c] = DIGIT;
+                    }
+                }
+                for (char c : {' ', '\r', '\t', '\f', '\v', ';'}) {
+                    t._flags[static_cast<uint8_t>(c)] = SPACE;
+                }
+                t._flags[static_cast<uint8_t>('\n')] = NEWLINE;
+                t._flags[static_cast<uint8_t>('#')] = COMMENT;
+
+                std::pair<char, operator_type> singles[] = {
+                    {'+', operator_type::OPERATOR_ADD},
+                    {'-', operator_type::OPERATOR_SUB},
+                    {'*', operator_type::OPERATOR_MUL},
+                    {'/', operator_type::OPERATOR_DIV},
+                    {'%', operator_type::OPERATOR_MOD},
+                    {'=', operator_type::OPERATOR_ASSIGN},
+                    {'>', operator_type::OPERATOR_GT},
+                    {'<', operator_type::OPERATOR_LT},
+                    {':', operator_type::OPERATOR_COLON},
+                    {',', operator_type::OPERATOR_COMMA},
+                    {'(', operator_type::OPERATOR_LPAREN},
+                    {')', operator_type::OPERATOR_RPAREN},
+                    {'[', operator_type::OPERATOR_LBRACKET},
+                    {']', operator_type::OPERATOR_RBRACKET},
+                    {'{', operator_type::OPERATOR_LBRACE},
+                    {'}', operator_type::OPERATOR_RBRACE},
+                    // only valid as the start of != and ..
+                    {'!', operator_type::UNDEFINED},
+                    {'.', operator_type::UNDEFINED},
+                };
+                for (auto &&single : singles) {
+                    t._flags[static_cast<uint8_t>(single.first)] = OPERATOR;
+                    t._single[static_cast<uint8_t>(single.first)] = single.second;
+                }
+
+                std::pair<const char *, keyword> keywords[] = {
+                    {"vars",   keyword::VARS},
+                    {"int",    keyword::INT},
+                    {"array",  keyword::ARRAY},
+                    {"while",  keyword::WHILE},
+                    {"hor",    keyword::HOR},
+                    {"ihu",    keyword::IHU},
+                    {"yosoro", keyword::YOSORO},
+                    {"set",    keyword::SET},
+                    {"to",     keyword::TO},
+                    {"lt",     keyword::LT},
+                    {"le",     keyword::LE},
+                    {"gt",     keyword::GT},
+                    {"ge",     keyword::GE},
+                    {"eq",     keyword::EQ},
+                    {"neq",    keyword::NEQ},
+                };
+                for (auto &&kw : keywords) {
+                    uint32_t h = keyword_hash(kw.first, strlen(kw.first));
+                    assert(t._keyword_text[h] == nullptr && "keyword hash collision");
+                    t._keyword_text[h] = kw.first;
+                    t._keyword[h] = kw.second;
+                }
+                return t;
+            }();
+            return t;
+        }
+
+        static keyword find_keyword(const tables &t, iter_t text, size_t length) {
+            uint32_t h = keyword_hash(text, length);
+            const char *candidate = t._keyword_text[h];
+            if (candidate != nullptr && strncmp(candidate, text, length) == 0 && candidate[length] == '\0') {
+                return t._keyword[h];
+            }
+            return keyword::NONE;
+        }
+
+        static operator_type find_double(char first, char second) {
+            switch (first) {
+                case '=':
+                    return second == '=' ? operator_type::OPERATOR_EQ : operator_type::UNDEFINED;
+                case '!':
+                    return second == '=' ? operator_type::OPERATOR_NE : operator_type::UNDEFINED;
+                case '>':
+                    return second == '=' ? operator_type::OPERATOR_GE : operator_type::UNDEFINED;
+                case '<':
+                    return second == '=' ? operator_type::OPERATOR_LE : operator_type::UNDEFINED;
+                case '.':
+                    return second == '.' ? operator_type::OPERATOR_TO : operator_type::UNDEFINED;
+                default:
+                    return operator_type::UNDEFINED;
+            }
+        }
+
+        __attribute__((noreturn))
+        void error(iter_t token_start, iter_t token_end, const std::string &message) {
+            mpp::throw_ex<lexer_error>(
+                _line, static_cast<std::size_t>(token_start - _line_start),
+                static_cast<std::size_t>(token_end - _line_start),
+                std::string{token_start, static_cast<std::size_t>(token_end - token_start)},
+                message
+            );
+        }
+
+        void fill(flat_token &token, iter_t start, token_type type) {
+            token._text = string_span{start, static_cast<uint32_t>(_p - start)};
+            token._line = _line;
+            token._column = static_cast<uint32_t>(start - _line_start);
+            token._value = 0;
+            token._type = type;
+            token._op = operator_type::UNDEFINED;
+            token._kw = keyword::NONE;
+        }
+
+    public:
+        scanner(iter_t begin, iter_t end)
+            : _p(begin), _end(end), _line_start(begin) {
+        }
+
+        /**
+         * @return false at the end of input
+         */
+        bool next(flat_token &token) {
+            const tables &t = get_tables();
+
+            while (_p < _end) {
+                iter_t start = _p;
+                uint8_t flags = t._flags[static_cast<uint8_t>(*_p)];
+
+                if (flags & SPACE) {
+                    ++_p;
+                    continue;
+                }
+
+                if (flags & NEWLINE) {
+                    ++_line;
+                    _line_start = ++_p;
+                    continue;
+                }
+
+                if (flags & COMMENT) {
+                    auto newline = static_cast<iter_t>(memchr(_p, '\n', _end - _p));
+                    _p = newline ? newline : _end;
+                    continue;
+                }
+
+                if (flags & DIGIT) {
+                    uint32_t value = 0;
+                    while (_p < _end && (t._flags[static_cast<uint8_t>(*_p)] & DIGIT)) {
+                        value = value * 10 + (*_p++ - '0');
+                    }
+                    fill(token, start, token_type::INT_LITERAL);
+                    token._value = static_cast<int32_t>(value);
+                    return true;
+                }
+
+                if (flags & IDENT) {
+                    ++_p;
+                    while (_p < _end && (t._flags[static_cast<uint8_t>(*_p)] & (IDENT | DIGIT))) {
+                        ++_p;
+                    }
+                    fill(token, start, token_type::ID_OR_KW);
+                    token._kw = find_keyword(t, start, _p - start);
+                    return true;
+                }
+
+                if (flags & OPERATOR) {
+                    operator_type op = _p + 1 < _end ? find_double(_p[0], _p[1]) : operator_type::UNDEFINED;
+                    if (op != operator_type::UNDEFINED) {
+                        _p += 2;
+                    } else {
+                        op = t._single[static_cast<uint8_t>(*_p++)];
+                    }
+                    if (op == operator_type::UNDEFINED) {
+                        error(start, _p, "unexpected token");
+                    }
+                    fill(token, start, token_type::OPERATOR);
+                    token._op = op;
+                    return true;
+                }
+
+                ++_p;
+                error(start, _p, "unexpected token");
+            }
+            return false;
+        }
+
+        /**
+         * Fill {@code out} with up to {@code capacity} tokens
+         * @return Number of tokens, less than capacity only at the end of input
+         */
+        size_t lex(flat_token *out, size_t capacity) {
+            size_t count = 0;
+            while (count < capacity && next(out[count])) {
+                ++count;
+            }
+            return count;
+        }
+    };
+
+    /**
+     * Tokens scanned a batch at a time into a fixed array,
+     * so memory stays the same however long the source is
+     */
+    struct token_stream {
+        static constexpr size_t BATCH = 1024;
+
+    private:
+        scanner _scanner;
+        flat_token _batch[BATCH];
+        size_t _count = 0;
+        size_t _next = 0;
+
+    public:
+        token_stream(const char *begin, const char *end)
+            : _scanner(begin, end) {
+        }
+
+        /**
+         * @return The next token, or nullptr at the end of input
+         */
+        const flat_token *peek() {
+            if (_next == _count) {
+                _count = _scanner.lex(_batch, BATCH);
+                _next = 0;
+            }
+            return _next < _count ? &_batch[_next] : nullptr;
+        }
+
+        void pop() {
+            ++_next;
+        }
+    };
 }
 
 namespace rt {
@@ -432,6 +854,8 @@ namespace rt {
 
         explicit type(type_type tt) : _type_type(tt) {}
 
+        virtual ~type() = default;
+
         type_type get_type_type() const {
             return _type_type;
         }
@@ -456,6 +880,16 @@ namespace tree {
     using namespace lexer;
     using namespace rt;
 
+    /*
+     * Nodes live in the arena of their ast and name their children by
+     * 32-bit refs into it. Identifiers are numbers into ast::_names.
+     */
+    template<typename T>
+    using ref = v9::memory::Ref<T>;
+
+    template<typename T>
+    using refs = v9::memory::ArrayRef<ref<T>>;
+
     enum class node_type {
         PROGRAM,
         DECL,
@@ -502,9 +936,9 @@ namespace tree {
     };
 
     struct expr_atom : public expr {
-        std::string _str;
-        int _i32;
-        std::unique_ptr<expr> _index;
+        uint32_t _name = 0;
+        int _i32 = 0;
+        ref<expr> _index;
 
         expr_atom(expr_type type)
             : expr(type) {}
@@ -512,8 +946,8 @@ namespace tree {
 
     struct expr_binary : public expr {
         operator_type op_type;
-        std::unique_ptr<expr> lhs;
-        std::unique_ptr<expr> rhs;
+        ref<expr> lhs;
+        ref<expr> rhs;
 
         explicit expr_binary(expr_type type) : expr(type) {}
     };
@@ -525,47 +959,75 @@ namespace tree {
     };
 
     struct stmt_for : public stmt {
-        std::string _var;
-        std::unique_ptr<expr> _start;
-        std::unique_ptr<expr> _end;
-        std::vector<std::unique_ptr<stmt>> _body;
+        uint32_t _var = 0;
+        ref<expr> _start;
+        ref<expr> _end;
+        refs<stmt> _body;
 
         stmt_for() : stmt(stmt_type::FOR) {}
     };
 
     struct stmt_while : public stmt {
-        std::unique_ptr<expr> _cond;
-        std::vector<std::unique_ptr<stmt>> _body;
+        ref<expr> _cond;
+        refs<stmt> _body;
 
         stmt_while() : stmt(stmt_type::WHILE) {}
     };
 
     struct stmt_if : public stmt {
-        std::unique_ptr<expr> _cond;
-        std::vector<std::unique_ptr<stmt>> _body;
+        ref<expr> _cond;
+        refs<stmt> _body;
 
         stmt_if() : stmt(stmt_type::IF) {}
     };
 
     struct stmt_set : public stmt {
-        std::unique_ptr<expr> _var;
-        std::unique_ptr<expr> _value;
+        ref<expr> _var;
+        ref<expr> _value;
 
         stmt_set() : stmt(stmt_type::SET) {}
     };
 
     struct stmt_print : public stmt {
-        std::unique_ptr<expr> _var;
+        ref<expr> _var;
 
         stmt_print() : stmt(stmt_type::PRINT) {}
     };
 
     struct program : public node {
-        std::unique_ptr<decl> _decl;
-        std::vector<std::unique_ptr<stmt>> _stmts;
+        ref<decl> _decl;
+        refs<stmt> _stmts;
 
         program() : node(node_type::PROGRAM) {}
     };
+
+    /**
+     * A parsed program: the arena holding all of its nodes, and the names
+     * its identifiers refer to. Destroying it frees the tree in one go.
+     */
+    struct ast {
+        v9::memory::Arena _nodes;
+        std::vector<std::string> _names;
+        ref<program> _program;
+
+        template<typename T>
+        const T *get(ref<T> node) const {
+            return _nodes.get(node);
+        }
+
+        template<typename T>
+        v9::memory::Range<const ref<T>> get(refs<T> nodes) const {
+            return _nodes.get(nodes);
+        }
+
+        const std::string &name(uint32_t id) const {
+            return _names[id];
+        }
+
+        const program &root() const {
+            return *get(_program);
+        }
+    };
 }
 
 namespace parser {
@@ -580,152 +1042,140 @@ namespace parser {
     using state_manager = shared::state_manager<parser_state, parser_state::GLOBAL>;
 
     struct parser_error : public std::runtime_error {
-        std::unique_ptr<token> _offending;
+        std::size_t _line = 0;
+        std::size_t _column = 0;
+        std::string _offending;
 
         parser_error(const std::string &message)
             : std::runtime_error(message) {
         }
 
-        parser_error(const std::string &message, std::unique_ptr<token> offending)
-            : std::runtime_error(message), _offending(std::move(offending)) {
+        parser_error(const std::string &message, const flat_token &offending)
+            : std::runtime_error(message), _line(offending._line),
+              _column(offending._column), _offending(offending._text.str()) {
         }
     };
 
     struct parser {
     private:
-        std::deque<std::unique_ptr<token>> _tokens;
+        token_stream _tokens;
         state_manager _state;
+        std::unique_ptr<ast> _ast;
+        // names seen so far, the views point into the source
+        std::unordered_map<std::string_view, uint32_t> _ids;
 
     public:
-        explicit parser(std::deque<std::unique_ptr<token>> tokens) : _tokens(std::move(tokens)) {}
+        parser(const char *begin, const char *end)
+            : _tokens(begin, end), _ast(std::make_unique<ast>()) {}
 
     private:
-        bool has_token() {
-            return !_tokens.empty();
+        template<typename T, typename ...Args>
+        std::pair<ref<T>, T *> make(Args &&...args) {
+            auto node = _ast->_nodes.make<T>(std::forward<Args>(args)...);
+            return {node, _ast->_nodes.get(node)};
         }
 
-        void ensure_token() {
-            if (!has_token()) {
-                mpp::throw_ex<parser_error>("unexpected EOF");
+        uint32_t intern(const string_span &id) {
+            auto result = _ids.emplace(std::string_view{id._data, id._length},
+                static_cast<uint32_t>(_ast->_names.size()));
+            if (result.second) {
+                _ast->_names.push_back(id.str());
             }
+            return result.first->second;
         }
 
-        void consume(token_type type, const std::string &token_text) {
-            ensure_token();
+        bool has_token() {
+            return _tokens.peek() != nullptr;
+        }
 
-            auto top = std::move(_tokens.front());
-            _tokens.pop_front();
-            if (top->_type != type || top->_token_text != token_text) {
-                mpp::throw_ex<parser_error>("unexpected token", std::move(top));
+        flat_token take() {
+            auto top = _tokens.peek();
+            if (top == nullptr) {
+                mpp::throw_ex<parser_error>("unexpected EOF");
             }
+            _tokens.pop();
+            return *top;
         }
 
-        auto consume(token_type type) {
-            ensure_token();
-
-            auto top = std::move(_tokens.front());
-            _tokens.pop_front();
-            if (top->_type != type) {
-                mpp::throw_ex<parser_error>("unexpected token", std::move(top));
+        void consume(token_type type, keyword kw) {
+            auto top = take();
+            if (top._type != type || top._kw != kw) {
+                mpp::throw_ex<parser_error>("unexpected token", top);
             }
-            return std::move(top);
         }
 
-        auto consume(operator_type type) {
-            ensure_token();
-
-            auto top = std::move(_tokens.front());
-            _tokens.pop_front();
-            if (top->_type != token_type::OPERATOR) {
-                mpp::throw_ex<parser_error>("unexpected token", std::move(top));
+        flat_token consume(token_type type) {
+            auto top = take();
+            if (top._type != type) {
+                mpp::throw_ex<parser_error>("unexpected token", top);
             }
+            return top;
+        }
 
-            auto *opt = static_cast<token_operator *>(top.get());
-            if (opt->_op_type != type) {
-                mpp::throw_ex<parser_error>("unexpected token", std::move(top));
+        flat_token consume(operator_type type) {
+            auto top = take();
+            if (top._type != token_type::OPERATOR || top._op != type) {
+                mpp::throw_ex<parser_error>("unexpected token", top);
             }
-            return std::move(top);
+            return top;
         }
 
         bool coming(operator_type type) {
-            if (!has_token()) {
-                return false;
-            }
-
-            auto &top = _tokens.front();
-            if (top->_type != token_type::OPERATOR) {
-                return false;
-            }
-
-            auto *opt = static_cast<token_operator *>(top.get());
-            return opt->_op_type == type;
+            auto top = _tokens.peek();
+            return top != nullptr && top->_type == token_type::OPERATOR && top->_op == type;
         }
 
         bool coming(token_type type) {
-            if (!has_token()) {
-                return false;
-            }
-
-            auto &top = _tokens.front();
-            return top->_type == type;
+            auto top = _tokens.peek();
+            return top != nullptr && top->_type == type;
         }
 
-        bool coming(token_type type, const std::string &text) {
-            if (!has_token()) {
-                return false;
-            }
-
-            auto &top = _tokens.front();
-            return top->_type == type && top->_token_text == text;
+        bool coming(keyword kw) {
+            auto top = _tokens.peek();
+            return top != nullptr && top->_type == token_type::ID_OR_KW && top->_kw == kw;
         }
 
         int consume_int() {
-            ensure_token();
-
-            auto lit = consume(token_type::INT_LITERAL);
-            auto *p = static_cast<token_int_literal *>(lit.get());
-            return p->_value;
+            return consume(token_type::INT_LITERAL)._value;
         }
 
     private:
-        bool is_operator(const std::string &text) {
-            return text == "lt"
-                   || text == "le"
-                   || text == "gt"
-                   || text == "ge"
-                   || text == "eq"
-                   || text == "neq";
-        }
-
-        operator_type to_operator(const std::string &text) {
-            if (text == "lt") {
-                return operator_type::OPERATOR_LT;
-            } else if (text == "le") {
-                return operator_type::OPERATOR_LE;
-            } else if (text == "gt") {
-                return operator_type::OPERATOR_GT;
-            } else if (text == "ge") {
-                return operator_type::OPERATOR_GE;
-            } else if (text == "neq") {
-                return operator_type::OPERATOR_NE;
-            } else if (text == "eq") {
-                return operator_type::OPERATOR_EQ;
-            } else if (text == "+") {
-                return operator_type::OPERATOR_ADD;
-            } else if (text == "-") {
-                return operator_type::OPERATOR_SUB;
-            }
-            mpp::throw_ex<parser_error>("unsupported operator");
+        bool is_operator(keyword kw) {
+            return kw == keyword::LT
+                   || kw == keyword::LE
+                   || kw == keyword::GT
+                   || kw == keyword::GE
+                   || kw == keyword::EQ
+                   || kw == keyword::NEQ;
+        }
+
+        operator_type to_operator(keyword kw) {
+            switch (kw) {
+                case keyword::LT:
+                    return operator_type::OPERATOR_LT;
+                case keyword::LE:
+                    return operator_type::OPERATOR_LE;
+                case keyword::GT:
+                    return operator_type::OPERATOR_GT;
+                case keyword::GE:
+                    return operator_type::OPERATOR_GE;
+                case keyword::NEQ:
+                    return operator_type::OPERATOR_NE;
+                case keyword::EQ:
+                    return operator_type::OPERATOR_EQ;
+                default:
+                    mpp::throw_ex<parser_error>("unsupported operator");
+            }
         }
 
         std::unique_ptr<rt::type> parse_type() {
             auto name = consume(token_type::ID_OR_KW);
-            if (name->_token_text == "int") {
+            if (name._kw == keyword::INT) {
                 return std::make_unique<rt::int_type>();
             }
-            if (name->_token_text == "array") {
+            if (name._kw == keyword::ARRAY) {
                 consume(operator_type::OPERATOR_LBRACKET);
-                consume(token_type::ID_OR_KW, "int");
+                consume(token_type::ID_OR_KW, keyword::INT);
                 consume(operator_type::OPERATOR_COMMA);
                 auto start = consume_int();
                 consume(operator_type::OPERATOR_TO);
@@ -734,43 +1184,42 @@ namespace parser {
                 return std::make_unique<rt::array_type>(start, end - start + 1);
             }
 
-            mpp::throw_ex<parser_error>("unsupported type name", std::move(name));
+            mpp::throw_ex<parser_error>("unsupported type name", name);
         }
 
-        std::string parse_id() {
-            auto id = consume(token_type::ID_OR_KW);
-            return id->_token_text;
+        uint32_t parse_id() {
+            return intern(consume(token_type::ID_OR_KW)._text);
         }
 
-        std::unique_ptr<decl> parse_decl() {
+        ref<decl> parse_decl() {
             consume(operator_type::OPERATOR_LBRACE);
-            consume(token_type::ID_OR_KW, "vars");
+            consume(token_type::ID_OR_KW, keyword::VARS);
 
-            auto d = std::make_unique<decl>();
+            auto [node, d] = make<decl>();
 
             while (!coming(operator_type::OPERATOR_RBRACE)) {
                 auto name = consume(token_type::ID_OR_KW);
                 consume(operator_type::OPERATOR_COLON);
                 auto type = parse_type();
-                d->_vars.insert(std::make_pair(name->_token_text, std::move(type)));
+                d->_vars.insert(std::make_pair(name._text.str(), std::move(type)));
             }
 
             consume(operator_type::OPERATOR_RBRACE);
-            return d;
+            return node;
         }
 
-        std::unique_ptr<stmt> parse_block_stmt() {
+        ref<stmt> parse_block_stmt() {
             consume(operator_type::OPERATOR_LBRACE);
             auto kw = consume(token_type::ID_OR_KW);
-            if (kw->_token_text == "while") {
-                auto loop = std::make_unique<stmt_while>();
+            if (kw._kw == keyword::WHILE) {
+                auto [node, loop] = make<stmt_while>();
                 loop->_cond = parse_expr();
                 loop->_body = parse_stmts();
                 consume(operator_type::OPERATOR_RBRACE);
-                return loop;
+                return node;
 
-            } else if (kw->_token_text == "hor") {
-                auto loop = std::make_unique<stmt_for>();
+            } else if (kw._kw == keyword::HOR) {
+                auto [node, loop] = make<stmt_for>();
                 loop->_var = parse_id();
                 if (coming(operator_type::OPERATOR_ASSIGN)) {
                     consume(operator_type::OPERATOR_ASSIGN);
@@ -778,7 +1227,7 @@ namespace parser {
                     consume(operator_type::OPERATOR_COMMA);
                 }
                 loop->_start = parse_expr();
-                if (coming(token_type::ID_OR_KW, "to")) {
+                if (coming(keyword::TO)) {
                     consume(token_type::ID_OR_KW);
                 } else {
                     consume(operator_type::OPERATOR_COMMA);
@@ -786,125 +1235,126 @@ namespace parser {
                 loop->_end = parse_expr();
                 loop->_body = parse_stmts();
                 consume(operator_type::OPERATOR_RBRACE);
-                return loop;
+                return node;
 
-            } else if (kw->_token_text == "ihu") {
-                auto cond = std::make_unique<stmt_if>();
+            } else if (kw._kw == keyword::IHU) {
+                auto [node, cond] = make<stmt_if>();
                 cond->_cond = parse_expr();
                 cond->_body = parse_stmts();
                 consume(operator_type::OPERATOR_RBRACE);
-                return cond;
+                return node;
             }
 
             mpp::throw_ex<parser_error>("unsupported loop statement");
         }
 
-        std::unique_ptr<stmt> parse_stmt() {
+        ref<stmt> parse_stmt() {
             if (coming(operator_type::OPERATOR_LBRACE)) {
                 return parse_block_stmt();
             }
 
             consume(operator_type::OPERATOR_COLON);
             auto kw = consume(token_type::ID_OR_KW);
-            if (kw->_token_text == "yosoro") {
-                auto print = std::make_unique<stmt_print>();
+            if (kw._kw == keyword::YOSORO) {
+                auto [node, print] = make<stmt_print>();
                 print->_var = parse_expr();
-                return print;
-            } else if (kw->_token_text == "set") {
-                auto set = std::make_unique<stmt_set>();
+                return node;
+            } else if (kw._kw == keyword::SET) {
+                auto [node, set] = make<stmt_set>();
                 set->_var = parse_expr();
                 consume(operator_type::OPERATOR_COMMA);
                 set->_value = parse_expr();
-                return set;
+                return node;
             }
 
             mpp::throw_ex<parser_error>("unsupported statement");
         }
 
-        std::vector<std::unique_ptr<stmt>> parse_stmts() {
-            std::vector<std::unique_ptr<stmt>> v{};
+        refs<stmt> parse_stmts() {
+            // collected here first, the block gets one contiguous array
+            std::vector<ref<stmt>> v{};
             while (coming(operator_type::OPERATOR_COLON)
                    || coming(operator_type::OPERATOR_LBRACE)) {
                 v.push_back(parse_stmt());
             }
-            return v;
+            return _ast->_nodes.makeArray(v);
         }
 
-        std::unique_ptr<expr> parse_expr_relation(const std::string &op) {
-            auto expr = std::make_unique<expr_binary>(expr_type::BINARY_RELATION);
+        ref<expr> parse_expr_relation(keyword op) {
+            auto [node, expr] = make<expr_binary>(expr_type::BINARY_RELATION);
             expr->op_type = to_operator(op);
             consume(operator_type::OPERATOR_COMMA);
             expr->lhs = parse_expr();
             consume(operator_type::OPERATOR_COMMA);
             expr->rhs = parse_expr();
-            return expr;
+            return node;
         }
 
-        std::unique_ptr<expr> parse_atom_lit(bool negative) {
+        ref<expr> parse_atom_lit(bool negative) {
             auto lit = consume(token_type::INT_LITERAL);
-            auto *ptr = static_cast<token_int_literal *>(lit.get());
-            auto expr = std::make_unique<expr_atom>(expr_type::ATOM_LIT);
-            expr->_i32 = negative ? -(ptr->_value) : ptr->_value;
-            return expr;
+            auto [node, expr] = make<expr_atom>(expr_type::ATOM_LIT);
+            expr->_i32 = negative ? -lit._value : lit._value;
+            return node;
         }
 
-        std::unique_ptr<expr> lookahead_parse_visit(const std::string &id) {
-            auto expr = std::make_unique<expr_atom>(expr_type::ATOM_ID);
-            expr->_str = id;
+        ref<expr> lookahead_parse_visit(const string_span &id) {
+            auto [node, expr] = make<expr_atom>(expr_type::ATOM_ID);
+            expr->_name = intern(id);
             if (coming(operator_type::OPERATOR_LBRACKET)) {
                 consume(operator_type::OPERATOR_LBRACKET);
                 auto index = parse_expr();
                 expr->_expr_type = expr_type::ATOM_VISIT;
-                expr->_index = std::move(index);
+                expr->_index = index;
                 consume(operator_type::OPERATOR_RBRACKET);
             }
-            return expr;
+            return node;
         }
 
-        std::unique_ptr<expr> lookahead_parse_binary(std::unique_ptr<expr> lhs) {
+        ref<expr> lookahead_parse_binary(ref<expr> lhs) {
             if (coming(operator_type::OPERATOR_ADD)
                 || coming(operator_type::OPERATOR_SUB)) {
                 auto op = consume(token_type::OPERATOR);
                 auto rhs = parse_expr();
-                auto expr = std::make_unique<expr_binary>(expr_type::BINARY_MATH);
-                expr->op_type = to_operator(op->_token_text);
-                expr->lhs = std::move(lhs);
-                expr->rhs = std::move(rhs);
-                return expr;
+                auto [node, expr] = make<expr_binary>(expr_type::BINARY_MATH);
+                expr->op_type = op._op;
+                expr->lhs = lhs;
+                expr->rhs = rhs;
+                return node;
             }
             return lhs;
         }
 
-        std::unique_ptr<expr> parse_expr() {
+        ref<expr> parse_expr() {
             if (coming(token_type::ID_OR_KW)) {
                 auto kw = consume(token_type::ID_OR_KW);
-                if (is_operator(kw->_token_text)) {
-                    return parse_expr_relation(kw->_token_text);
+                if (is_operator(kw._kw)) {
+                    return parse_expr_relation(kw._kw);
                 } else {
-                    auto lhs = lookahead_parse_visit(kw->_token_text);
-                    return lookahead_parse_binary(std::move(lhs));
+                    auto lhs = lookahead_parse_visit(kw._text);
+                    return lookahead_parse_binary(lhs);
                 }
             } else if (coming(token_type::INT_LITERAL)) {
                 auto lit = parse_atom_lit(false);
-                return lookahead_parse_binary(std::move(lit));
+                return lookahead_parse_binary(lit);
             } else if (coming(operator_type::OPERATOR_SUB)) {
                 // maybe negative numbers
                 consume(operator_type::OPERATOR_SUB);
                 auto lit = parse_atom_lit(true);
-                return lookahead_parse_binary(std::move(lit));
+                return lookahead_parse_binary(lit);
             }
 
             mpp::throw_ex<parser_error>("Unsupported expression");
         }
 
     public:
-        std::unique_ptr<program> parse_program() {
-            auto prog = std::make_unique<program>();
+        std::unique_ptr<ast> parse_program() {
+            auto [node, prog] = make<program>();
             if (coming(operator_type::OPERATOR_LBRACE)) {
                 prog->_decl = parse_decl();
             }
             prog->_stmts = parse_stmts();
-            return prog;
+            _ast->_program = node;
+            return std::move(_ast);
         }
     };
 }
@@ -916,33 +1366,38 @@ namespace rt {
         type_type _type;
         int _start;
         int *_value;
+
+        // backing store, _value points into one of these or into another value
+        int _scalar = 0;
+        std::unique_ptr<int[]> _array;
     };
 
     struct interpreter {
     private:
+        const ast *_ast = nullptr;
         std::unordered_map<std::string, std::shared_ptr<value>> _vars;
 
     private:
-        std::shared_ptr<value> create_var(std::unique_ptr<rt::type> &type) {
+        std::shared_ptr<value> create_var(const std::unique_ptr<rt::type> &type) {
             auto val = std::make_shared<value>();
             val->_type = type->get_type_type();
 
             switch (type->get_type_type()) {
                 case rt::type_type::INT:
-                    val->_value = new int(0);
+                    val->_value = &val->_scalar;
                     val->_start = 0;
                     break;
                 case rt::type_type::ARRAY:
                     auto t = static_cast<array_type *>(type.get());
-                    val->_value = new int[t->_length];
+                    val->_array = std::make_unique<int[]>(t->_length);
+                    val->_value = val->_array.get();
                     val->_start = t->_start_index;
-                    memset(val->_value, '\0', sizeof(int) * t->_length);
                     break;
             }
             return val;
         }
 
-        void run_decls(std::unique_ptr<decl> &decls) {
+        void run_decls(const decl *decls) {
             if (!decls) {
                 return;
             }
@@ -963,30 +1418,31 @@ namespace rt {
             auto result = std::make_shared<value>();
             result->_start = 0;
             result->_type = type_type::INT;
-            result->_value = new int(val);
+            result->_scalar = val;
+            result->_value = &result->_scalar;
             return result;
         }
 
-        std::shared_ptr<value> eval_expr_atom_id(expr_atom *expr) {
-            auto iter = _vars.find(expr->_str);
+        std::shared_ptr<value> eval_expr_atom_id(const expr_atom *expr) {
+            auto iter = _vars.find(_ast->name(expr->_name));
             if (iter == _vars.end()) {
                 mpp::throw_ex<std::runtime_error>("Variable not found");
             }
             return iter->second;
         }
 
-        std::shared_ptr<value> eval_expr_atom_visit(expr_atom *expr) {
+        std::shared_ptr<value> eval_expr_atom_visit(const expr_atom *expr) {
             auto arr = eval_expr_atom_id(expr);
             int index = *eval_expr(expr->_index)->_value;
             int offset = index - arr->_start;
             return wrap_value(arr->_value + offset);
         }
 
-        std::shared_ptr<value> eval_expr_atom_lit(expr_atom *expr) {
+        std::shared_ptr<value> eval_expr_atom_lit(const expr_atom *expr) {
             return wrap_value(expr->_i32);
         }
 
-        std::shared_ptr<value> eval_expr_binary_relation(expr_binary *expr) {
+        std::shared_ptr<value> eval_expr_binary_relation(const expr_binary *expr) {
             auto lhs = eval_expr(expr->lhs);
             auto rhs = eval_expr(expr->rhs);
             switch (expr->op_type) {
@@ -1006,7 +1462,7 @@ namespace rt {
             mpp::throw_ex<std::runtime_error>("unsupported relation operator");
         }
 
-        std::shared_ptr<value> eval_expr_binary_math(expr_binary *expr) {
+        std::shared_ptr<value> eval_expr_binary_math(const expr_binary *expr) {
             auto lhs = eval_expr(expr->lhs);
             auto rhs = eval_expr(expr->rhs);
             switch (expr->op_type) {
@@ -1018,33 +1474,35 @@ namespace rt {
             mpp::throw_ex<std::runtime_error>("unsupported math operator");
         }
 
-        std::shared_ptr<value> eval_expr(std::unique_ptr<expr> &expr) {
+        std::shared_ptr<value> eval_expr(ref<expr> node) {
+            auto expr = _ast->get(node);
             switch (expr->_expr_type) {
                 case expr_type::ATOM_ID:
-                    return eval_expr_atom_id(static_cast<expr_atom *>(expr.get()));
+                    return eval_expr_atom_id(static_cast<const expr_atom *>(expr));
                 case expr_type::ATOM_VISIT:
-                    return eval_expr_atom_visit(static_cast<expr_atom *>(expr.get()));
+                    return eval_expr_atom_visit(static_cast<const expr_atom *>(expr));
                 case expr_type::ATOM_LIT:
-                    return eval_expr_atom_lit(static_cast<expr_atom *>(expr.get()));
+                    return eval_expr_atom_lit(static_cast<const expr_atom *>(expr));
                 case expr_type::BINARY_RELATION:
-                    return eval_expr_binary_relation(static_cast<expr_binary *>(expr.get()));
+                    return eval_expr_binary_relation(static_cast<const expr_binary *>(expr));
                 case expr_type::BINARY_MATH:
-                    return eval_expr_binary_math(static_cast<expr_binary *>(expr.get()));
+                    return eval_expr_binary_math(static_cast<const expr_binary *>(expr));
             }
         }
 
-        void run_stmt_for(stmt_for *stmt) {
+        void run_stmt_for(const stmt_for *stmt) {
             auto start = *eval_expr(stmt->_start)->_value;
             auto end = *eval_expr(stmt->_end)->_value;
-            _vars.insert(std::make_pair(stmt->_var, wrap_value(start)));
+            auto &name = _ast->name(stmt->_var);
+            _vars.insert(std::make_pair(name, wrap_value(start)));
 
             for (int i = start; i <= end; ++i) {
-                *(_vars[stmt->_var])->_value = i;
+                *(_vars[name])->_value = i;
                 run_stmts(stmt->_body);
             }
         }
 
-        void run_stmt_while(stmt_while *stmt) {
+        void run_stmt_while(const stmt_while *stmt) {
             while (true) {
                 auto cond = *eval_expr(stmt->_cond)->_value;
                 if (!cond) {
@@ -1054,14 +1512,14 @@ namespace rt {
             }
         }
 
-        void run_stmt_if(stmt_if *stmt) {
+        void run_stmt_if(const stmt_if *stmt) {
             auto cond = *eval_expr(stmt->_cond)->_value;
             if (cond) {
                 run_stmts(stmt->_body);
             }
         }
 
-        void run_stmt_set(stmt_set *stmt) {
+        void run_stmt_set(const stmt_set *stmt) {
             auto var = eval_expr(stmt->_var);
             auto value = eval_expr(stmt->_value);
             if (var->_type != value->_type) {
@@ -1071,7 +1529,7 @@ namespace rt {
             *(var->_value) = *(value->_value);
         }
 
-        void run_stmt_print(stmt_print *stmt) {
+        void run_stmt_print(const stmt_print *stmt) {
             auto val = eval_expr(stmt->_var);
             switch (val->_type) {
                 case type_type::INT:
@@ -1082,82 +1540,1544 @@ namespace rt {
             }
         }
 
-        void run_stmts(const std::vector<std::unique_ptr<stmt>> &stmts) {
-            for (auto &&stmt : stmts) {
+        void run_stmts(refs<stmt> stmts) {
+            for (auto node : _ast->get(stmts)) {
+                auto stmt = _ast->get(node);
                 switch (stmt->_stmt_type) {
                     case stmt_type::FOR:
-                        run_stmt_for(static_cast<stmt_for *>(stmt.get()));
+                        run_stmt_for(static_cast<const stmt_for *>(stmt));
                         break;
                     case stmt_type::WHILE:
-                        run_stmt_while(static_cast<stmt_while *>(stmt.get()));
+                        run_stmt_while(static_cast<const stmt_while *>(stmt));
                         break;
                     case stmt_type::IF:
-                        run_stmt_if(static_cast<stmt_if *>(stmt.get()));
+                        run_stmt_if(static_cast<const stmt_if *>(stmt));
                         break;
                     case stmt_type::SET:
-                        run_stmt_set(static_cast<stmt_set *>(stmt.get()));
+                        run_stmt_set(static_cast<const stmt_set *>(stmt));
                         break;
                     case stmt_type::PRINT:
-                        run_stmt_print(static_cast<stmt_print *>(stmt.get()));
+                        run_stmt_print(static_cast<const stmt_print *>(stmt));
                         break;
                 }
             }
         }
 
     public:
-        void run(std::unique_ptr<program> prog) {
-            run_decls(prog->_decl);
-            run_stmts(prog->_stmts);
+        void run(const ast &tree) {
+            _ast = &tree;
+            run_decls(tree.get(tree.root()._decl));
+            run_stmts(tree.root()._stmts);
         }
     };
 }
 
-int main() {
-    using lexer::operator_type;
-    using lexer::token_type;
-    using lexer::token;
+namespace bytecode {
+    using namespace tree;
 
-    lexer::lexer lex;
-    lex.add_operators({
-        {"+",  operator_type::OPERATOR_ADD},
-        {"-",  operator_type::OPERATOR_SUB},
-        {"*",  operator_type::OPERATOR_MUL},
-        {"/",  operator_type::OPERATOR_DIV},
-        {"%",  operator_type::OPERATOR_MOD},
-        {"=",  operator_type::OPERATOR_ASSIGN},
-        {"==", operator_type::OPERATOR_EQ},
-        {"!=", operator_type::OPERATOR_NE},
-        {">",  operator_type::OPERATOR_GT},
-        {">=", operator_type::OPERATOR_GE},
-        {"<",  operator_type::OPERATOR_LT},
-        {"<=", operator_type::OPERATOR_LE},
-        {":",  operator_type::OPERATOR_COLON},
-        {",",  operator_type::OPERATOR_COMMA},
-        {"(",  operator_type::OPERATOR_LPAREN},
-        {")",  operator_type::OPERATOR_RPAREN},
-        {"[",  operator_type::OPERATOR_LBRACKET},
-        {"]",  operator_type::OPERATOR_RBRACKET},
-        {"{",  operator_type::OPERATOR_LBRACE},
-        {"}",  operator_type::OPERATOR_RBRACE},
-        {";",  operator_type::OPERATOR_SEMI},
-        {"..", operator_type::OPERATOR_TO},
-    });
+    /*
+     * Register bytecode. Registers are laid out as
+     *   [ variables | constants | temporaries ]
+     * so a variable or a literal is just a register number and
+     * costs no instruction to read.
+     */
+    enum opcode : uint8_t {
+        MOV,            // r[a] = r[b]
+        ADD,            // r[a] = r[b] + r[c]
+        SUB,            // r[a] = r[b] - r[c]
+        LT,             // r[a] = r[b] < r[c], same for the five below
+        LE,
+        GT,
+        GE,
+        NE,
+        EQ,
+        ALOAD,          // r[a] = arrays[b][r[c]]
+        ASTORE,         // arrays[a][r[b]] = r[c]
+        JMP,            // goto c
+        JZ,             // if (r[a] == 0) goto c
+        JNZ,            // if (r[a] != 0) goto c
+        JLT,            // if (r[a] < r[b]) goto c, same for the five below
+        JLE,
+        JGT,
+        JGE,
+        JNE,
+        JEQ,
+        FORPREP,        // if (r[a] > r[a + 1]) goto c, else r[b] = r[a]
+        FORLOOP,        // if (r[a] < r[a + 1]) { r[b] = ++r[a]; goto c }
+        PRINT,          // printf("%d ", r[a])
+        HALT,
+        LOOP,           // loop head, a = hor counter or -1, b = hor variable, c = back edge
+    };
 
-    std::string content;
-    std::string line;
-    while (std::getline(std::cin, line)) {
-        content.append(line);
-        content.push_back('\n');
-    }
+    struct instruction {
+        // label of the handler in machine::run(), filled in on the first run
+        const void *handler;
+        int32_t a;
+        int32_t b;
+        int32_t c;
+        opcode op;
+        // LOOP only: iterations left before the loop is compiled,
+        // then the index of its native code in chunk::_natives
+        uint16_t hot;
+    };
+
+    struct array_info {
+        int32_t _start;
+        int32_t _length;
+    };
 
-    lex.source(content);
+    /**
+     * Returns the index of the instruction to continue at
+     */
+    using native_entry = int32_t (*)(int32_t *registers, int32_t *const *arrays);
 
-    std::deque<std::unique_ptr<token>> tokens;
-    lex.lex(tokens);
+    /**
+     * Machine code of one loop, in its own mapping
+     */
+    struct native_code {
+    private:
+        void *_memory = nullptr;
+        size_t _size = 0;
+
+    public:
+        explicit native_code(const std::vector<uint8_t> &code) {
+            _size = code.size();
+            _memory = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (_memory == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            memcpy(_memory, code.data(), _size);
+            if (mprotect(_memory, _size, PROT_READ | PROT_EXEC) != 0) {
+                munmap(_memory, _size);
+                throw std::runtime_error("native_code: mprotect failed");
+            }
+        }
 
-    parser::parser par{std::move(tokens)};
-    auto p = par.parse_program();
+        ~native_code() {
+            munmap(_memory, _size);
+        }
 
-    rt::interpreter interp;
-    interp.run(std::move(p));
-}
+        native_code(const native_code &) = delete;
+
+        native_code &operator=(const native_code &) = delete;
+
+        native_entry entry() const {
+            return reinterpret_cast<native_entry>(_memory);
+        }
+    };
+
+    struct chunk {
+        std::vector<instruction> _code;
+        std::vector<array_info> _arrays;
+        // initial register file: zeroed variables, then constants
+        std::vector<int32_t> _registers;
+        // registers needed, including temporaries
+        int _register_count = 0;
+        // first constant and first temporary register
+        int _constant_base = 0;
+        int _temp_base = 0;
+        // loops compiled by the JIT, indexed by instruction::hot of their LOOP
+        std::vector<std::unique_ptr<native_code>> _natives;
+        bool _threaded = false;
+    };
+
+    struct compile_error : public std::runtime_error {
+        explicit compile_error(const std::string &message)
+            : std::runtime_error(message) {
+        }
+    };
+
+    struct compiler {
+    private:
+        std::unordered_map<std::string, int> _ints;
+        std::unordered_map<std::string, int> _arrays;
+        std::unordered_map<int, int> _constants;
+        const ast *_ast = nullptr;
+        std::vector<std::string> _loop_vars;
+        std::vector<int> _literals;
+        chunk _chunk;
+        int _top = 0;
+        bool _loop_heads = false;
+
+    private:
+        ////////////////////////////////////////////////////////////////////////////////
+        // pre-pass: variables introduced by hor and all literals need fixed registers
+        ////////////////////////////////////////////////////////////////////////////////
+
+        void scan_expr(const expr *e) {
+            switch (e->_expr_type) {
+                case expr_type::ATOM_ID:
+                    break;
+                case expr_type::ATOM_VISIT:
+                    scan_expr(_ast->get(static_cast<const expr_atom *>(e)->_index));
+                    break;
+                case expr_type::ATOM_LIT:
+                    _literals.push_back(static_cast<const expr_atom *>(e)->_i32);
+                    break;
+                case expr_type::BINARY_RELATION:
+                case expr_type::BINARY_MATH: {
+                    auto b = static_cast<const expr_binary *>(e);
+                    scan_expr(_ast->get(b->lhs));
+                    scan_expr(_ast->get(b->rhs));
+                    break;
+                }
+            }
+        }
+
+        void scan_stmts(refs<stmt> stmts) {
+            for (auto node : _ast->get(stmts)) {
+                auto s = _ast->get(node);
+                switch (s->_stmt_type) {
+                    case stmt_type::FOR: {
+                        auto loop = static_cast<const stmt_for *>(s);
+                        _loop_vars.push_back(_ast->name(loop->_var));
+                        scan_expr(_ast->get(loop->_start));
+                        scan_expr(_ast->get(loop->_end));
+                        scan_stmts(loop->_body);
+                        break;
+                    }
+                    case stmt_type::WHILE: {
+                        auto loop = static_cast<const stmt_while *>(s);
+                        scan_expr(_ast->get(loop->_cond));
+                        scan_stmts(loop->_body);
+                        break;
+                    }
+                    case stmt_type::IF: {
+                        auto cond = static_cast<const stmt_if *>(s);
+                        scan_expr(_ast->get(cond->_cond));
+                        scan_stmts(cond->_body);
+                        break;
+                    }
+                    case stmt_type::SET: {
+                        auto set = static_cast<const stmt_set *>(s);
+                        scan_expr(_ast->get(set->_var));
+                        scan_expr(_ast->get(set->_value));
+                        break;
+                    }
+                    case stmt_type::PRINT:
+                        scan_expr(_ast->get(static_cast<const stmt_print *>(s)->_var));
+                        break;
+                }
+            }
+        }
+
+        void allocate(const program &prog) {
+            if (prog._decl) {
+                for (auto &&decl : _ast->get(prog._decl)->_vars) {
+                    if (decl.second->get_type_type() == type_type::INT) {
+                        _ints.emplace(decl.first, static_cast<int>(_chunk._registers.size()));
+                        _chunk._registers.push_back(0);
+                    } else {
+                        auto t = static_cast<const array_type *>(decl.second.get());
+                        _arrays.emplace(decl.first, static_cast<int>(_chunk._arrays.size()));
+                        _chunk._arrays.push_back(array_info{
+                            static_cast<int32_t>(t->_start_index), static_cast<int32_t>(t->_length)});
+                    }
+                }
+            }
+
+            for (auto &&name : _loop_vars) {
+                if (_arrays.count(name)) {
+                    throw compile_error("array used as loop variable: " + name);
+                }
+                if (_ints.emplace(name, static_cast<int>(_chunk._registers.size())).second) {
+                    _chunk._registers.push_back(0);
+                }
+            }
+
+            _chunk._constant_base = static_cast<int>(_chunk._registers.size());
+            for (int lit : _literals) {
+                if (_constants.emplace(lit, static_cast<int>(_chunk._registers.size())).second) {
+                    _chunk._registers.push_back(lit);
+                }
+            }
+
+            _top = static_cast<int>(_chunk._registers.size());
+            _chunk._temp_base = _top;
+            _chunk._register_count = _top;
+        }
+
+        ////////////////////////////////////////////////////////////////////////////////
+        // code generation
+        ////////////////////////////////////////////////////////////////////////////////
+
+        int emit(opcode op, int a, int b, int c) {
+            _chunk._code.push_back(instruction{nullptr, a, b, c, op, 0});
+            return static_cast<int>(_chunk._code.size()) - 1;
+        }
+
+        int here() const {
+            return static_cast<int>(_chunk._code.size());
+        }
+
+        void patch(int at, int target) {
+            _chunk._code[at].c = target;
+        }
+
+        int temp() {
+            int r = _top++;
+            _chunk._register_count = std::max(_chunk._register_count, _top);
+            return r;
+        }
+
+        int int_var(const std::string &name) {
+            auto iter = _ints.find(name);
+            if (iter == _ints.end()) {
+                throw compile_error(_arrays.count(name)
+                                    ? "array used as a value: " + name
+                                    : "variable not found: " + name);
+            }
+            return iter->second;
+        }
+
+        int array_var(const std::string &name) {
+            auto iter = _arrays.find(name);
+            if (iter == _arrays.end()) {
+                throw compile_error("not an array: " + name);
+            }
+            return iter->second;
+        }
+
+        static opcode relation_op(operator_type type) {
+            switch (type) {
+                case operator_type::OPERATOR_LT:
+                    return LT;
+                case operator_type::OPERATOR_LE:
+                    return LE;
+                case operator_type::OPERATOR_GT:
+                    return GT;
+                case operator_type::OPERATOR_GE:
+                    return GE;
+                case operator_type::OPERATOR_NE:
+                    return NE;
+                case operator_type::OPERATOR_EQ:
+                    return EQ;
+                default:
+                    throw compile_error("unsupported relation operator");
+            }
+        }
+
+        static opcode negate(opcode jump) {
+            switch (jump) {
+                case JLT:
+                    return JGE;
+                case JLE:
+                    return JGT;
+                case JGT:
+                    return JLE;
+                case JGE:
+                    return JLT;
+                case JNE:
+                    return JEQ;
+                case JEQ:
+                    return JNE;
+                case JZ:
+                    return JNZ;
+                default:
+                    return JZ;
+            }
+        }
+
+        /**
+         * Evaluate an expression into a register.
+         * Variables and literals already live in one, so they emit nothing
+         * unless {@code dst} asks for a specific register.
+         * Only the last instruction writes {@code dst}, so it may be an
+         * operand of the expression itself.
+         */
+        int compile_expr(const expr *e, int dst = -1) {
+            int src = -1;
+            switch (e->_expr_type) {
+                case expr_type::ATOM_ID:
+                    src = int_var(_ast->name(static_cast<const expr_atom *>(e)->_name));
+                    break;
+                case expr_type::ATOM_LIT:
+                    src = _constants.at(static_cast<const expr_atom *>(e)->_i32);
+                    break;
+                case expr_type::ATOM_VISIT: {
+                    auto atom = static_cast<const expr_atom *>(e);
+                    int arr = array_var(_ast->name(atom->_name));
+                    int index = compile_expr(_ast->get(atom->_index));
+                    dst = dst < 0 ? temp() : dst;
+                    emit(ALOAD, dst, arr, index);
+                    return dst;
+                }
+                case expr_type::BINARY_RELATION:
+                case expr_type::BINARY_MATH: {
+                    auto b = static_cast<const expr_binary *>(e);
+                    opcode op;
+                    if (e->_expr_type == expr_type::BINARY_RELATION) {
+                        op = relation_op(b->op_type);
+                    } else if (b->op_type == operator_type::OPERATOR_ADD) {
+                        op = ADD;
+                    } else if (b->op_type == operator_type::OPERATOR_SUB) {
+                        op = SUB;
+                    } else {
+                        throw compile_error("unsupported math operator");
+                    }
+                    int lhs = compile_expr(_ast->get(b->lhs));
+                    int rhs = compile_expr(_ast->get(b->rhs));
+                    dst = dst < 0 ? temp() : dst;
+                    emit(op, dst, lhs, rhs);
+                    return dst;
+                }
+            }
+
+            if (dst >= 0 && dst != src) {
+                emit(MOV, dst, src, 0);
+                return dst;
+            }
+            return src;
+        }
+
+        /**
+         * Emit a jump taken when {@code cond} is true (or false if {@code negated}),
+         * comparisons are fused into the jump.
+         * @return Index of the jump, whose target is patched later
+         */
+        int compile_branch(const expr *cond, bool negated) {
+            int saved = _top;
+            int at;
+            if (cond->_expr_type == expr_type::BINARY_RELATION) {
+                auto b = static_cast<const expr_binary *>(cond);
+                auto jump = static_cast<opcode>(relation_op(b->op_type) - LT + JLT);
+                int lhs = compile_expr(_ast->get(b->lhs));
+                int rhs = compile_expr(_ast->get(b->rhs));
+                at = emit(negated ? negate(jump) : jump, lhs, rhs, -1);
+            } else {
+                int value = compile_expr(cond);
+                at = emit(negated ? JZ : JNZ, value, 0, -1);
+            }
+            _top = saved;
+            return at;
+        }
+
+        /**
+         * Mark the first instruction of a loop body for the JIT
+         * @return Index of the LOOP, or -1 if loops are not marked
+         */
+        int loop_head(int counter, int var) {
+            if (!_loop_heads) {
+                return -1;
+            }
+            int at = emit(LOOP, counter, var, -1);
+            _chunk._code[at].hot = HOT_LOOP;
+            return at;
+        }
+
+        void patch_head(int head, int back) {
+            if (head >= 0) {
+                patch(head, back);
+            }
+        }
+
+        void compile_for(const stmt_for *loop) {
+            int saved = _top;
+            int var = int_var(_ast->name(loop->_var));
+            // the counter is hidden from the body, like the interpreter's local i
+            int counter = temp();
+            int end = temp();
+            compile_expr(_ast->get(loop->_start), counter);
+            compile_expr(_ast->get(loop->_end), end);
+
+            int prep = emit(FORPREP, counter, var, -1);
+            int body = here();
+            int head = loop_head(counter, var);
+            compile_stmts(loop->_body);
+            int back = emit(FORLOOP, counter, var, body);
+            patch_head(head, back);
+            patch(prep, here());
+            _top = saved;
+        }
+
+        void compile_while(const stmt_while *loop) {
+            // rotated: test at the bottom, one jump per iteration
+            int entry = emit(JMP, 0, 0, -1);
+            int body = here();
+            int head = loop_head(-1, 0);
+            compile_stmts(loop->_body);
+            patch(entry, here());
+            int back = compile_branch(_ast->get(loop->_cond), false);
+            patch(back, body);
+            patch_head(head, back);
+        }
+
+        void compile_if(const stmt_if *cond) {
+            int skip = compile_branch(_ast->get(cond->_cond), true);
+            compile_stmts(cond->_body);
+            patch(skip, here());
+        }
+
+        void compile_set(const stmt_set *set) {
+            int saved = _top;
+            auto target = _ast->get(set->_var);
+            if (target->_expr_type == expr_type::ATOM_ID) {
+                compile_expr(_ast->get(set->_value), int_var(_ast->name(static_cast<const expr_atom *>(target)->_name)));
+            } else if (target->_expr_type == expr_type::ATOM_VISIT) {
+                auto atom = static_cast<const expr_atom *>(target);
+                int arr = array_var(_ast->name(atom->_name));
+                int index = compile_expr(_ast->get(atom->_index));
+                int value = compile_expr(_ast->get(set->_value));
+                emit(ASTORE, arr, index, value);
+            } else {
+                throw compile_error("unsupported assign");
+            }
+            _top = saved;
+        }
+
+        void compile_stmts(refs<stmt> stmts) {
+            for (auto node : _ast->get(stmts)) {
+                auto s = _ast->get(node);
+                switch (s->_stmt_type) {
+                    case stmt_type::FOR:
+                        compile_for(static_cast<const stmt_for *>(s));
+                        break;
+                    case stmt_type::WHILE:
+                        compile_while(static_cast<const stmt_while *>(s));
+                        break;
+                    case stmt_type::IF:
+                        compile_if(static_cast<const stmt_if *>(s));
+                        break;
+                    case stmt_type::SET:
+                        compile_set(static_cast<const stmt_set *>(s));
+                        break;
+                    case stmt_type::PRINT: {
+                        int saved = _top;
+                        emit(PRINT, compile_expr(_ast->get(static_cast<const stmt_print *>(s)->_var)), 0, 0);
+                        _top = saved;
+                        break;
+                    }
+                }
+            }
+        }
+
+    public:
+        // iterations of a loop before it is compiled to native code
+        static constexpr uint16_t HOT_LOOP = 64;
+
+        /**
+         * @param loop_heads Put a LOOP at the head of every loop,
+         *                   for machine::run() to find hot loops to compile
+         */
+        explicit compiler(bool loop_heads = false) : _loop_heads(loop_heads) {}
+
+        /**
+         * Resolve every name to a register or an array and lower the program.
+         * Names are checked here, so an unknown variable is reported even
+         * if the code using it would never run.
+         * A variable introduced by hor starts at 0 like a declared one,
+         * instead of taking the start value when the loop runs zero times.
+         */
+        chunk compile(const ast &tree) {
+            _ast = &tree;
+            auto &prog = tree.root();
+            scan_stmts(prog._stmts);
+            allocate(prog);
+            compile_stmts(prog._stmts);
+            emit(HALT, 0, 0, 0);
+            return std::move(_chunk);
+        }
+    };
+}
+
+namespace jit {
+    using namespace bytecode;
+
+    /**
+     * Encoder for the x86-64 instructions loop code needs.
+     *
+     * Compiled code sees rbx as the bytecode register file (register n at
+     * [rbx + 4 * n]) and r12 as the array base pointers ([r12 + 8 * n]).
+     * eax, ecx and edx are scratch, nothing lives in machine registers
+     * across bytecode instructions, so code can be left at any of them.
+     */
+    struct emitter {
+        enum reg {
+            RAX = 0, RCX = 1, RDX = 2, RBX = 3,
+        };
+
+        // condition codes of jcc/setcc, flipping the lowest bit negates
+        enum cond {
+            AE = 0x3, E = 0x4, NE = 0x5, L = 0xc, GE = 0xd, LE = 0xe, G = 0xf,
+        };
+
+        std::vector<uint8_t> _code;
+
+        size_t position() const {
+            return _code.size();
+        }
+
+        void byte(uint8_t b) {
+            _code.push_back(b);
+        }
+
+        void imm32(int32_t value) {
+            for (int i = 0; i < 4; ++i) {
+                _code.push_back(static_cast<uint8_t>(static_cast<uint32_t>(value) >> (8 * i)));
+            }
+        }
+
+        // op r32, [rbx + 4 * slot]
+        void slot_op(uint8_t opcode, int reg, int slot) {
+            byte(opcode);
+            byte(0x80 | (reg << 3) | RBX);
+            imm32(4 * slot);
+        }
+
+        void load(int reg, int slot) {
+            slot_op(0x8b, reg, slot);
+        }
+
+        void store(int slot, int reg) {
+            slot_op(0x89, reg, slot);
+        }
+
+        void add(int reg, int slot) {
+            slot_op(0x03, reg, slot);
+        }
+
+        void sub(int reg, int slot) {
+            slot_op(0x2b, reg, slot);
+        }
+
+        void cmp(int reg, int slot) {
+            slot_op(0x3b, reg, slot);
+        }
+
+        // cmp dword [rbx + 4 * slot], 0
+        void cmp_zero(int slot) {
+            slot_op(0x83, 7, slot);
+            byte(0);
+        }
+
+        // movsxd r64, [rbx + 4 * slot]
+        void load_sx(int reg, int slot) {
+            byte(0x48);
+            slot_op(0x63, reg, slot);
+        }
+
+        // add/sub/cmp r, imm32 as /ext of opcode 0x81, 64-bit if wide
+        void alu_imm(int ext, int reg, int32_t imm, bool wide) {
+            if (wide) {
+                byte(0x48);
+            }
+            byte(0x81);
+            byte(0xc0 | (ext << 3) | reg);
+            imm32(imm);
+        }
+
+        void add_imm(int reg, int32_t imm, bool wide = false) {
+            alu_imm(0, reg, imm, wide);
+        }
+
+        void sub_imm(int reg, int32_t imm, bool wide = false) {
+            alu_imm(5, reg, imm, wide);
+        }
+
+        void cmp_imm(int reg, int32_t imm, bool wide = false) {
+            alu_imm(7, reg, imm, wide);
+        }
+
+        void inc(int reg) {
+            byte(0xff);
+            byte(0xc0 | reg);
+        }
+
+        void mov_imm(int reg, int32_t imm) {
+            byte(0xb8 | reg);
+            imm32(imm);
+        }
+
+        // reg = cond ? 1 : 0, from the flags of a previous cmp
+        void setcc(cond c, int reg) {
+            byte(0x0f);
+            byte(0x90 | c);
+            byte(0xc0 | reg);
+            // movzx reg, reg8
+            byte(0x0f);
+            byte(0xb6);
+            byte(0xc0 | (reg << 3) | reg);
+        }
+
+        // mov r64, [r12 + 8 * array]
+        void load_array(int reg, int array) {
+            byte(0x49);
+            byte(0x8b);
+            byte(0x84 | (reg << 3));
+            byte(0x24);
+            imm32(8 * array);
+        }
+
+        // op r32, [rdx + rcx * 4 + disp]
+        void element_op(uint8_t opcode, int reg, int32_t disp) {
+            byte(opcode);
+            byte(0x84 | (reg << 3));
+            byte(0x80 | (RCX << 3) | RDX);
+            imm32(disp);
+        }
+
+        /**
+         * @return Position of the rel32 to backfill
+         */
+        size_t jcc(cond c) {
+            byte(0x0f);
+            byte(0x80 | c);
+            imm32(0);
+            return position() - 4;
+        }
+
+        size_t jmp() {
+            byte(0xe9);
+            imm32(0);
+            return position() - 4;
+        }
+
+        void patch_rel32(size_t at, size_t target) {
+            auto offset = static_cast<int32_t>(target - (at + 4));
+            memcpy(_code.data() + at, &offset, sizeof(offset));
+        }
+
+        void prologue() {
+            byte(0x53);                     // push rbx
+            byte(0x41), byte(0x54);         // push r12
+            byte(0x48), byte(0x89), byte(0xfb); // mov rbx, rdi
+            byte(0x49), byte(0x89), byte(0xf4); // mov r12, rsi
+        }
+
+        void epilogue() {
+            byte(0x41), byte(0x5c);         // pop r12
+            byte(0x5b);                     // pop rbx
+            byte(0xc3);                     // ret
+        }
+    };
+
+    /**
+     * Compiles one loop of a chunk, from its LOOP to its back edge,
+     * to native code entered at the LOOP.
+     *
+     * Jumps leaving the loop, print and halt return to the interpreter
+     * with the index to continue at. So does an array access out of
+     * bounds, and the interpreter then raises the error itself.
+     *
+     * An index that is a hor variable plus or minus a constant is checked
+     * once for the whole range of the variable, when the loop is entered,
+     * provided nothing else in the body writes the variable or its bounds.
+     * If that check fails, the loop runs in the interpreter instead.
+     */
+    struct loop_compiler {
+    private:
+        struct hor_loop {
+            int _counter;
+            int _var;
+            // body is [_begin, _back), _back is the FORLOOP
+            int _begin;
+            int _back;
+            // (array, offset) pairs to check on entry
+            std::set<std::pair<int, int32_t>> _checks;
+        };
+
+        const chunk &_chunk;
+        const std::vector<instruction> &_code;
+        int _head;
+        int _back;
+        emitter _asm;
+
+        std::vector<hor_loop> _loops;
+        // unchecked[i - _head]: the access at i is covered by a hoisted check
+        std::vector<bool> _unchecked;
+        // native position of each instruction
+        std::vector<size_t> _labels;
+        // rel32 to patch -> instruction index inside the loop
+        std::vector<std::pair<size_t, int>> _jumps;
+        // instruction index to continue at -> rel32 jumping to its exit stub
+        std::map<int, std::vector<size_t>> _exits;
+
+    private:
+        static bool writes(const instruction &insn, int reg) {
+            switch (insn.op) {
+                case MOV: case ADD: case SUB:
+                case LT: case LE: case GT: case GE: case NE: case EQ:
+                case ALOAD:
+                    return insn.a == reg;
+                case FORPREP:
+                    return insn.b == reg;
+                case FORLOOP:
+                    return insn.a == reg || insn.b == reg;
+                default:
+                    return false;
+            }
+        }
+
+        bool is_constant(int reg) const {
+            return reg >= _chunk._constant_base && reg < _chunk._temp_base;
+        }
+
+        /**
+         * Find k such that the index register at access {@code at} is loop.var + k
+         */
+        bool affine(const hor_loop &loop, int index, int at, int64_t &offset) const {
+            if (index == loop._var) {
+                offset = 0;
+                return true;
+            }
+            if (index < _chunk._temp_base) {
+                return false;
+            }
+            // a temporary is defined earlier in the same statement
+            for (int i = at - 1; i >= loop._begin; --i) {
+                const instruction &def = _code[i];
+                if (!writes(def, index)) {
+                    continue;
+                }
+                if (def.op == ADD && def.b == loop._var && is_constant(def.c)) {
+                    offset = _chunk._registers[def.c];
+                } else if (def.op == ADD && def.c == loop._var && is_constant(def.b)) {
+                    offset = _chunk._registers[def.b];
+                } else if (def.op == SUB && def.b == loop._var && is_constant(def.c)) {
+                    offset = -int64_t(_chunk._registers[def.c]);
+                } else {
+                    return false;
+                }
+                return offset >= INT32_MIN && offset <= INT32_MAX;
+            }
+            return false;
+        }
+
+        void analyze() {
+            // the loop being compiled, if it is a hor
+            if (_code[_head].a >= 0) {
+                _loops.push_back(hor_loop{_code[_head].a, _code[_head].b, _head, _back, {}});
+            }
+            for (int i = _head; i <= _back; ++i) {
+                if (_code[i].op == FORPREP) {
+                    _loops.push_back(hor_loop{_code[i].a, _code[i].b, i + 1, _code[i].c - 1, {}});
+                }
+            }
+
+            std::vector<bool> safe;
+            for (auto &&loop : _loops) {
+                bool ok = true;
+                for (int i = loop._begin; i < loop._back && ok; ++i) {
+                    const instruction &insn = _code[i];
+                    ok = !writes(insn, loop._var) && !writes(insn, loop._counter)
+                         && !writes(insn, loop._counter + 1);
+                }
+                safe.push_back(ok);
+            }
+
+            _unchecked.assign(_back - _head + 1, false);
+            for (int i = _head; i <= _back; ++i) {
+                const instruction &insn = _code[i];
+                if (insn.op != ALOAD && insn.op != ASTORE) {
+                    continue;
+                }
+                int array = insn.op == ALOAD ? insn.b : insn.a;
+                int index = insn.op == ALOAD ? insn.c : insn.b;
+                const array_info &info = _chunk._arrays[array];
+                if (int64_t(info._start) * 4 < INT32_MIN || int64_t(info._start) * 4 > INT32_MAX) {
+                    continue;
+                }
+
+                // loops are in program order, so the innermost comes last
+                for (size_t l = _loops.size(); l-- > 0;) {
+                    hor_loop &loop = _loops[l];
+                    int64_t offset = 0;
+                    if (i >= loop._begin && i < loop._back && safe[l]
+                        && affine(loop, index, i, offset)) {
+                        loop._checks.emplace(array, static_cast<int32_t>(offset));
+                        _unchecked[i - _head] = true;
+                        break;
+                    }
+                }
+            }
+        }
+
+        void jump_to(int target) {
+            if (target >= _head && target <= _back) {
+                _jumps.emplace_back(_asm.jmp(), target);
+            } else {
+                _exits[target].push_back(_asm.jmp());
+            }
+        }
+
+        void jcc_to(emitter::cond c, int target) {
+            if (target >= _head && target <= _back) {
+                _jumps.emplace_back(_asm.jcc(c), target);
+            } else {
+                _exits[target].push_back(_asm.jcc(c));
+            }
+        }
+
+        /**
+         * Leave to {@code fail} unless every var + offset over [counter, end] is in bounds
+         */
+        void emit_checks(const hor_loop &loop, int fail) {
+            for (auto &&check : loop._checks) {
+                const array_info &info = _chunk._arrays[check.first];
+                int32_t last = static_cast<int32_t>(int64_t(info._start) + info._length - 1);
+                _asm.load_sx(emitter::RAX, loop._counter);
+                _asm.add_imm(emitter::RAX, check.second, true);
+                _asm.cmp_imm(emitter::RAX, info._start, true);
+                _exits[fail].push_back(_asm.jcc(emitter::L));
+                _asm.load_sx(emitter::RAX, loop._counter + 1);
+                _asm.add_imm(emitter::RAX, check.second, true);
+                _asm.cmp_imm(emitter::RAX, last, true);
+                _exits[fail].push_back(_asm.jcc(emitter::G));
+            }
+        }
+
+        /**
+         * Point rdx and rcx at an element, leave to {@code at} if out of bounds
+         * @return Displacement to use with emitter::element_op()
+         */
+        int32_t emit_element(int array, int index, int at) {
+            const array_info &info = _chunk._arrays[array];
+            _asm.load_array(emitter::RDX, array);
+            if (_unchecked[at - _head]) {
+                _asm.load_sx(emitter::RCX, index);
+                return -4 * info._start;
+            }
+            _asm.load(emitter::RCX, index);
+            _asm.sub_imm(emitter::RCX, info._start);
+            _asm.cmp_imm(emitter::RCX, info._length);
+            _exits[at].push_back(_asm.jcc(emitter::AE));
+            return 0;
+        }
+
+        static emitter::cond condition_of(opcode op) {
+            switch (op) {
+                case LT: case JLT:
+                    return emitter::L;
+                case LE: case JLE:
+                    return emitter::LE;
+                case GT: case JGT:
+                    return emitter::G;
+                case GE: case JGE:
+                    return emitter::GE;
+                case NE: case JNE:
+                    return emitter::NE;
+                default:
+                    return emitter::E;
+            }
+        }
+
+        const hor_loop *loop_at(int prep) const {
+            for (auto &&loop : _loops) {
+                if (loop._begin == prep + 1) {
+                    return &loop;
+                }
+            }
+            return nullptr;
+        }
+
+        void emit_instruction(int i) {
+            const instruction &insn = _code[i];
+            switch (insn.op) {
+                case MOV:
+                    _asm.load(emitter::RAX, insn.b);
+                    _asm.store(insn.a, emitter::RAX);
+                    break;
+                case ADD:
+                case SUB:
+                    _asm.load(emitter::RAX, insn.b);
+                    if (insn.op == ADD) {
+                        _asm.add(emitter::RAX, insn.c);
+                    } else {
+                        _asm.sub(emitter::RAX, insn.c);
+                    }
+                    _asm.store(insn.a, emitter::RAX);
+                    break;
+                case LT: case LE: case GT: case GE: case NE: case EQ:
+                    _asm.load(emitter::RAX, insn.b);
+                    _asm.cmp(emitter::RAX, insn.c);
+                    _asm.setcc(condition_of(insn.op), emitter::RAX);
+                    _asm.store(insn.a, emitter::RAX);
+                    break;
+                case ALOAD: {
+                    int32_t disp = emit_element(insn.b, insn.c, i);
+                    _asm.element_op(0x8b, emitter::RAX, disp);
+                    _asm.store(insn.a, emitter::RAX);
+                    break;
+                }
+                case ASTORE: {
+                    int32_t disp = emit_element(insn.a, insn.b, i);
+                    _asm.load(emitter::RAX, insn.c);
+                    _asm.element_op(0x89, emitter::RAX, disp);
+                    break;
+                }
+                case JMP:
+                    jump_to(insn.c);
+                    break;
+                case JZ:
+                case JNZ:
+                    _asm.cmp_zero(insn.a);
+                    jcc_to(insn.op == JZ ? emitter::E : emitter::NE, insn.c);
+                    break;
+                case JLT: case JLE: case JGT: case JGE: case JNE: case JEQ:
+                    _asm.load(emitter::RAX, insn.a);
+                    _asm.cmp(emitter::RAX, insn.b);
+                    jcc_to(condition_of(insn.op), insn.c);
+                    break;
+                case FORPREP:
+                    _asm.load(emitter::RAX, insn.a);
+                    _asm.cmp(emitter::RAX, insn.a + 1);
+                    jcc_to(emitter::G, insn.c);
+                    _asm.store(insn.b, emitter::RAX);
+                    // on failure FORPREP runs again in the interpreter, which is harmless
+                    emit_checks(*loop_at(i), i);
+                    break;
+                case FORLOOP: {
+                    _asm.load(emitter::RAX, insn.a);
+                    _asm.cmp(emitter::RAX, insn.a + 1);
+                    size_t done = _asm.jcc(emitter::GE);
+                    _asm.inc(emitter::RAX);
+                    _asm.store(insn.a, emitter::RAX);
+                    _asm.store(insn.b, emitter::RAX);
+                    jump_to(insn.c);
+                    _asm.patch_rel32(done, _asm.position());
+                    break;
+                }
+                case LOOP:
+                    break;
+                case PRINT:
+                case HALT:
+                    _exits[i].push_back(_asm.jmp());
+                    break;
+            }
+        }
+
+    public:
+        loop_compiler(const chunk &c, int head)
+            : _chunk(c), _code(c._code), _head(head), _back(c._code[head].c) {
+        }
+
+        std::unique_ptr<native_code> compile() {
+            analyze();
+
+            _asm.prologue();
+            if (_code[_head].a >= 0) {
+                // entering again at the head would come straight back here
+                emit_checks(_loops.front(), _head + 1);
+            }
+
+            _labels.resize(_back - _head + 1);
+            for (int i = _head; i <= _back; ++i) {
+                _labels[i - _head] = _asm.position();
+                emit_instruction(i);
+            }
+            _exits[_back + 1].push_back(_asm.jmp());
+
+            for (auto &&jump : _jumps) {
+                _asm.patch_rel32(jump.first, _labels[jump.second - _head]);
+            }
+            for (auto &&exit : _exits) {
+                for (size_t at : exit.second) {
+                    _asm.patch_rel32(at, _asm.position());
+                }
+                _asm.mov_imm(emitter::RAX, exit.first);
+                _asm.epilogue();
+            }
+
+            return std::make_unique<native_code>(_asm._code);
+        }
+    };
+
+    /**
+     * @return Native code for the loop whose LOOP is at {@code head},
+     *         or nullptr if there is no JIT for this platform
+     */
+    std::unique_ptr<native_code> compile_loop(const chunk &c, int head) {
+#if defined(__x86_64__)
+        return loop_compiler{c, head}.compile();
+#else
+        return nullptr;
+#endif
+    }
+}
+
+namespace bytecode {
+    struct machine {
+    private:
+        static int32_t wrapping_add(int32_t x, int32_t y) {
+            return static_cast<int32_t>(static_cast<uint32_t>(x) + static_cast<uint32_t>(y));
+        }
+
+        static int32_t wrapping_sub(int32_t x, int32_t y) {
+            return static_cast<int32_t>(static_cast<uint32_t>(x) - static_cast<uint32_t>(y));
+        }
+
+        __attribute__((noreturn))
+        static void out_of_bounds(const array_info &info, int32_t index) {
+            mpp::throw_ex<std::runtime_error>(
+                "array index " + std::to_string(index) + " out of bounds ["
+                + std::to_string(info._start) + ", "
+                + std::to_string(int64_t(info._start) + info._length - 1) + "]");
+        }
+
+    public:
+        uint64_t _executed = 0;
+
+        void run(chunk &c) {
+            static const void *handlers[] = {
+                &&do_mov, &&do_add, &&do_sub,
+                &&do_lt, &&do_le, &&do_gt, &&do_ge, &&do_ne, &&do_eq,
+                &&do_aload, &&do_astore,
+                &&do_jmp, &&do_jz, &&do_jnz,
+                &&do_jlt, &&do_jle, &&do_jgt, &&do_jge, &&do_jne, &&do_jeq,
+                &&do_forprep, &&do_forloop, &&do_print, &&do_halt,
+                &&do_loop,
+            };
+
+            if (!c._threaded) {
+                for (auto &&insn : c._code) {
+                    insn.handler = handlers[insn.op];
+                }
+                c._threaded = true;
+            }
+
+            // everything is allocated up front, the loop below never allocates
+            std::vector<int32_t> registers(c._register_count);
+            std::copy(c._registers.begin(), c._registers.end(), registers.begin());
+
+            size_t total = 0;
+            for (auto &&info : c._arrays) {
+                total += info._length;
+            }
+            std::vector<int32_t> memory(total);
+            std::vector<int32_t *> arrays(c._arrays.size());
+            for (size_t i = 0, offset = 0; i < c._arrays.size(); offset += c._arrays[i++]._length) {
+                arrays[i] = memory.data() + offset;
+            }
+
+            const array_info *infos = c._arrays.data();
+            int32_t *r = registers.data();
+            instruction *code = c._code.data();
+            instruction *ip = code;
+            uint64_t executed = 0;
+
+#ifdef CYARON_BENCHMARK
+#define DISPATCH() ++executed; goto *(ip++)->handler
+#else
+#define DISPATCH() goto *(ip++)->handler
+#endif
+#define A (ip[-1].a)
+#define B (ip[-1].b)
+#define C (ip[-1].c)
+#define RELATION(op) r[A] = r[B] op r[C]; DISPATCH()
+#define BRANCH(op) if (r[A] op r[B]) { ip = code + C; } DISPATCH()
+
+            DISPATCH();
+
+        do_mov:
+            r[A] = r[B];
+            DISPATCH();
+
+        do_add:
+            r[A] = wrapping_add(r[B], r[C]);
+            DISPATCH();
+
+        do_sub:
+            r[A] = wrapping_sub(r[B], r[C]);
+            DISPATCH();
+
+        do_lt: RELATION(<);
+        do_le: RELATION(<=);
+        do_gt: RELATION(>);
+        do_ge: RELATION(>=);
+        do_ne: RELATION(!=);
+        do_eq: RELATION(==);
+
+        do_aload: {
+            const array_info &info = infos[B];
+            auto index = static_cast<uint32_t>(wrapping_sub(r[C], info._start));
+            if (index >= static_cast<uint32_t>(info._length)) {
+                out_of_bounds(info, r[C]);
+            }
+            r[A] = arrays[B][index];
+            DISPATCH();
+        }
+
+        do_astore: {
+            const array_info &info = infos[A];
+            auto index = static_cast<uint32_t>(wrapping_sub(r[B], info._start));
+            if (index >= static_cast<uint32_t>(info._length)) {
+                out_of_bounds(info, r[B]);
+            }
+            arrays[A][index] = r[C];
+            DISPATCH();
+        }
+
+        do_jmp:
+            ip = code + C;
+            DISPATCH();
+
+        do_jz:
+            if (r[A] == 0) {
+                ip = code + C;
+            }
+            DISPATCH();
+
+        do_jnz:
+            if (r[A] != 0) {
+                ip = code + C;
+            }
+            DISPATCH();
+
+        do_jlt: BRANCH(<);
+        do_jle: BRANCH(<=);
+        do_jgt: BRANCH(>);
+        do_jge: BRANCH(>=);
+        do_jne: BRANCH(!=);
+        do_jeq: BRANCH(==);
+
+        do_forprep:
+            if (r[A] > r[A + 1]) {
+                ip = code + C;
+            } else {
+                r[B] = r[A];
+            }
+            DISPATCH();
+
+        do_forloop:
+            // compare before incrementing, so end == INT_MAX cannot overflow
+            if (r[A] < r[A + 1]) {
+                r[B] = ++r[A];
+                ip = code + C;
+            }
+            DISPATCH();
+
+        do_print:
+            printf("%d ", r[A]);
+            DISPATCH();
+
+        do_loop:
+            if (--ip[-1].hot == 0) {
+                auto native = jit::compile_loop(c, static_cast<int>(ip - 1 - code));
+                if (native) {
+                    ip[-1].hot = static_cast<uint16_t>(c._natives.size());
+                    ip[-1].handler = &&do_enter;
+                    c._natives.push_back(std::move(native));
+                    --ip;
+                } else {
+                    ip[-1].handler = &&do_loop_cold;
+                }
+            }
+            DISPATCH();
+
+        do_loop_cold:
+            DISPATCH();
+
+        do_enter:
+            ip = code + c._natives[ip[-1].hot]->entry()(r, arrays.data());
+            DISPATCH();
+
+        do_halt:
+            _executed += executed;
+#undef BRANCH
+#undef RELATION
+#undef C
+#undef B
+#undef A
+#undef DISPATCH
+        }
+    };
+}
+
+std::unique_ptr<tree::ast> parse_source(const char *begin, const char *end) {
+    parser::parser par{begin, end};
+    return par.parse_program();
+}
+
+std::unique_ptr<tree::ast> parse_source(const std::string &content) {
+    return parse_source(content.data(), content.data() + content.size());
+}
+
+#ifdef CYARON_BENCHMARK
+
+lexer::lexer make_legacy_lexer() {
+    using lexer::operator_type;
+
+    lexer::lexer lex;
+    lex.add_operators({
+        {"+",  operator_type::OPERATOR_ADD},
+        {"-",  operator_type::OPERATOR_SUB},
+        {"*",  operator_type::OPERATOR_MUL},
+        {"/",  operator_type::OPERATOR_DIV},
+        {"%",  operator_type::OPERATOR_MOD},
+        {"=",  operator_type::OPERATOR_ASSIGN},
+        {"==", operator_type::OPERATOR_EQ},
+        {"!=", operator_type::OPERATOR_NE},
+        {">",  operator_type::OPERATOR_GT},
+        {">=", operator_type::OPERATOR_GE},
+        {"<",  operator_type::OPERATOR_LT},
+        {"<=", operator_type::OPERATOR_LE},
+        {":",  operator_type::OPERATOR_COLON},
+        {",",  operator_type::OPERATOR_COMMA},
+        {"(",  operator_type::OPERATOR_LPAREN},
+        {")",  operator_type::OPERATOR_RPAREN},
+        {"[",  operator_type::OPERATOR_LBRACKET},
+        {"]",  operator_type::OPERATOR_RBRACKET},
+        {"{",  operator_type::OPERATOR_LBRACE},
+        {"}",  operator_type::OPERATOR_RBRACE},
+        {";",  operator_type::OPERATOR_SEMI},
+        {"..", operator_type::OPERATOR_TO},
+    });
+    return lex;
+}
+
+/**
+ * A program of about {@code bytes} bytes: many variables and
+ * loops of sets, prints and conditions over them
+ */
+std::string make_large_program(size_t bytes) {
+    std::string source = "{ vars\n    arr: array[int, 0..1000]\n";
+    for (int v = 0; v < 100; ++v) {
+        source += "    var_" + std::to_string(v) + ": int\n";
+    }
+    source += "}\n";
+
+    for (int block = 0; source.size() < bytes; ++block) {
+        std::string a = "var_" + std::to_string(block % 100);
+        std::string b = "var_" + std::to_string((block * 7 + 3) % 100);
+        std::string n = std::to_string(block % 997);
+        source += "{ hor " + a + ", 1, " + n + "\n"
+                  "    :set arr[" + a + "], arr[" + a + " - 1] + " + b + " - 42\n"
+                  "    { ihu lt, " + b + ", " + n + "\n"
+                  "        :set " + b + ", " + b + " + 1   # keep going\n"
+                  "    }\n"
+                  "    { while ge, " + b + ", 10000 :set " + b + ", 0 }\n"
+                  "}\n"
+                  ":yosoro arr[" + n + "]\n";
+    }
+    return source;
+}
+
+void bench_lexer(size_t megabytes) {
+    std::string source = make_large_program(megabytes << 20);
+
+    // go through a file, like a real run
+    char path[] = "/tmp/cyaron-bench-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0 || write(fd, source.data(), source.size()) != static_cast<ssize_t>(source.size())) {
+        perror("cyaron-bench: temporary file");
+        exit(1);
+    }
+    unlink(path);
+    lexer::mapped_source mapped{fd};
+    close(fd);
+    double mb = mapped.size() / 1048576.0;
+
+    auto legacy_start = std::chrono::steady_clock::now();
+    size_t legacy_count = 0;
+    {
+        auto lex = make_legacy_lexer();
+        lex.source(std::string{mapped.begin(), mapped.end()});
+        std::deque<std::unique_ptr<lexer::token>> tokens;
+        lex.lex(tokens);
+        legacy_count = tokens.size();
+    }
+    double legacy = std::chrono::duration<double>(std::chrono::steady_clock::now() - legacy_start).count();
+
+    auto scan_start = std::chrono::steady_clock::now();
+    size_t count = 0;
+    {
+        lexer::scanner scanner{mapped.begin(), mapped.end()};
+        lexer::flat_token batch[lexer::token_stream::BATCH];
+        while (size_t n = scanner.lex(batch, lexer::token_stream::BATCH)) {
+            count += n;
+        }
+    }
+    double scan = std::chrono::duration<double>(std::chrono::steady_clock::now() - scan_start).count();
+
+    auto parse_start = std::chrono::steady_clock::now();
+    auto prog = parse_source(mapped.begin(), mapped.end());
+    double parse = std::chrono::duration<double>(std::chrono::steady_clock::now() - parse_start).count();
+
+    printf("lex %.1f MB, %zu tokens: lexer %.1f MB/s, scanner %.1f MB/s, scanner + parser %.1f MB/s (%zu statements)\n",
+        mb, count, mb / legacy, mb / scan, mb / parse, prog->root()._stmts.getLength());
+    if (legacy_count != count) {
+        printf("token count mismatch: lexer %zu, scanner %zu\n", legacy_count, count);
+    }
+}
+
+/**
+ * Parse time, memory held by the tree and the time to drop it
+ */
+void bench_parser(size_t megabytes) {
+    std::string source = make_large_program(megabytes << 20);
+    double mb = source.size() / 1048576.0;
+
+    // don't count memory the lexer benchmark freed and malloc kept
+    malloc_trim(0);
+    v9::kit::resetPeakRss();
+    long base = v9::kit::currentRss();
+    auto parse_start = std::chrono::steady_clock::now();
+    auto tree = parse_source(source);
+    double parse = std::chrono::duration<double>(std::chrono::steady_clock::now() - parse_start).count();
+    long peak = v9::kit::peakRss() - base;
+
+    auto walk_start = std::chrono::steady_clock::now();
+    auto chunk = bytecode::compiler{}.compile(*tree);
+    double walk = std::chrono::duration<double>(std::chrono::steady_clock::now() - walk_start).count();
+
+    size_t usage = tree->_nodes.getUsage();
+    size_t chunks = tree->_nodes.getChunkCount();
+    auto drop_start = std::chrono::steady_clock::now();
+    tree.reset();
+    double drop = std::chrono::duration<double>(std::chrono::steady_clock::now() - drop_start).count();
+
+    printf("parse %.1f MB: %.2f ms (%.1f MB/s), peak RSS +%.1f MB, %.1f MB of nodes in %zu chunks, "
+           "compile %.2f ms (%zu insns), teardown %.3f ms\n",
+        mb, parse * 1e3, mb / parse, peak / 1024.0, usage / 1048576.0, chunks,
+        walk * 1e3, chunk._code.size(), drop * 1e3);
+}
+
+std::string make_sort_program(int n) {
+    std::string N = std::to_string(n);
+    return "{ vars\n"
+           "    a: array[int, 1.." + N + "]\n"
+           "    i: int\n"
+           "    j: int\n"
+           "    t: int\n"
+           "    s: int\n"
+           "}\n"
+           "{ hor i, 1, " + N + "\n"
+           "    :set a[i], " + N + " - i\n"
+           "}\n"
+           "# bubble sort\n"
+           "{ hor i, 1, " + N + " - 1\n"
+           "    { hor j, 1, " + N + " - i\n"
+           "        { ihu gt, a[j], a[j + 1]\n"
+           "            :set t, a[j]\n"
+           "            :set a[j], a[j + 1]\n"
+           "            :set a[j + 1], t\n"
+           "        }\n"
+           "    }\n"
+           "}\n"
+           "{ hor i, 1, " + N + "\n"
+           "    :set s, s + a[i]\n"
+           "}\n"
+           ":yosoro s\n";
+}
+
+std::string make_prefix_program(int n) {
+    std::string N = std::to_string(n);
+    return "{ vars\n"
+           "    a: array[int, 0.." + N + "]\n"
+           "    i: int\n"
+           "    j: int\n"
+           "    s: int\n"
+           "}\n"
+           "{ hor j, 1, 200\n"
+           "    { hor i, 1, " + N + "\n"
+           "        :set a[i], a[i - 1] + i - j\n"
+           "    }\n"
+           "}\n"
+           ":set i, " + N + "\n"
+           "{ while gt, i, 0\n"
+           "    :set s, s + a[i] - a[i - 1]\n"
+           "    :set i, i - 1\n"
+           "}\n"
+           ":yosoro a[" + N + "]\n"
+           ":yosoro s\n";
+}
+
+std::string make_shift_program(int n) {
+    std::string N = std::to_string(n);
+    return "{ vars\n"
+           "    a: array[int, 1.." + N + "]\n"
+           "    c: array[int, 1.." + N + "]\n"
+           "    i: int\n"
+           "    j: int\n"
+           "}\n"
+           "{ hor i, 1, " + N + "\n"
+           "    :set a[i], i\n"
+           "}\n"
+           "# c[j] = sum of a[i + j] - a[j] over all shifts i\n"
+           "{ hor i, 1, " + N + " - 1\n"
+           "    { hor j, 1, " + N + " - i\n"
+           "        :set c[j], c[j] + a[i + j] - a[j]\n"
+           "    }\n"
+           "}\n"
+           ":yosoro c[1]\n"
+           ":yosoro c[" + N + " - 1]\n";
+}
+
+int main(int argc, const char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000;
+
+    bench_lexer(64);
+    bench_parser(64);
+
+    struct {
+        const char *name;
+        std::string source;
+    } programs[] = {
+        {"bubble sort", make_sort_program(n)},
+        {"prefix sums", make_prefix_program(n * 10)},
+        {"shifts", make_shift_program(n * 2)},
+    };
+
+    for (auto &&p : programs) {
+        auto ast_start = std::chrono::steady_clock::now();
+        rt::interpreter interp;
+        interp.run(*parse_source(p.source));
+        double ast = std::chrono::duration<double>(std::chrono::steady_clock::now() - ast_start).count();
+
+        auto vm_start = std::chrono::steady_clock::now();
+        auto chunk = bytecode::compiler{}.compile(*parse_source(p.source));
+        bytecode::machine vm;
+        vm.run(chunk);
+        double bc = std::chrono::duration<double>(std::chrono::steady_clock::now() - vm_start).count();
+
+        auto jit_start = std::chrono::steady_clock::now();
+        auto jit_chunk = bytecode::compiler{true}.compile(*parse_source(p.source));
+        bytecode::machine jit_vm;
+        jit_vm.run(jit_chunk);
+        double jit = std::chrono::duration<double>(std::chrono::steady_clock::now() - jit_start).count();
+
+        printf("\n%-12s n=%-6d ast %8.2f ms, bytecode %8.2f ms (%.1f M insns/s) %.1fx, "
+               "jit %8.2f ms (%zu loop(s) compiled) %.1fx\n",
+            p.name, n, ast * 1e3, bc * 1e3, vm._executed / bc / 1e6, ast / bc,
+            jit * 1e3, jit_chunk._natives.size(), ast / jit);
+    }
+}
+
+#else
+
+/**
+ * Usage: cyaron [--ast | --bytecode] [file]
+ * Programs are read from the file or stdin, and run on the bytecode machine with
+ * hot loops compiled to native code. --bytecode only interprets the bytecode,
+ * --ast runs the tree-walking interpreter.
+ */
+int main(int argc, const char **argv) {
+    bool ast = false;
+    bool jit = true;
+    const char *path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--ast") == 0) {
+            ast = true;
+        } else if (strcmp(argv[i], "--bytecode") == 0) {
+            jit = false;
+        } else {
+            path = argv[i];
+        }
+    }
+
+    auto source = path ? std::make_unique<lexer::mapped_source>(path)
+                       : std::make_unique<lexer::mapped_source>(STDIN_FILENO);
+    auto p = parse_source(source->begin(), source->end());
+
+    if (ast) {
+        rt::interpreter interp;
+        interp.run(*p);
+        return 0;
+    }
+
+    auto chunk = bytecode::compiler{jit}.compile(*p);
+    bytecode::machine vm;
+    vm.run(chunk);
+}
+
+#endif
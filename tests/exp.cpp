@@ -3,9 +3,104 @@
 //
 
 #include <v9/expression/evaluator.h>
+#include <v9/expression/batch.h>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+#ifdef EXP_BENCHMARK
+
+using namespace v9::expression;
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Evaluate a formula over columns of 1M to 100M rows: row by row with
+ * CompiledExpression::evaluate(), then blocked with each instruction set.
+ * The row-by-row results are the reference, every batch must match them bit for bit.
+ */
+int main(int argc, const char **argv) {
+    size_t maxRows = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000000;
+
+    static const char *FORMULAS[] = {
+        "(price - cost) * count / (1 + rate)",
+        "price * 0.9 - cost",
+        "-(a + b) * (a - b) / (c * c + 1) + a / 3 - b * 2.5",
+    };
+    static const struct {
+        const char *name;
+        BatchIsa isa;
+    } ISAS[] = {
+        {"scalar", BatchIsa::SCALAR},
+        {"avx2", BatchIsa::AVX2},
+        {"avx512", BatchIsa::AVX512},
+    };
+    BatchIsa best = detectBatchIsa();
+
+    for (size_t rows = 1000000; rows <= maxRows; rows *= 10) {
+        std::vector<std::vector<Number>> data(4, std::vector<Number>(rows));
+        uint32_t seed = 2026;
+        for (auto &&column : data) {
+            for (auto &&v : column) {
+                seed = seed * 1664525 + 1013904223;
+                v = static_cast<Number>(seed >> 8) / 65536.0f - 128;
+            }
+        }
+        const Number *columns[] = {data[0].data(), data[1].data(), data[2].data(), data[3].data()};
+        std::vector<Number> reference(rows);
+        std::vector<Number> out(rows);
+
+        for (const char *formula : FORMULAS) {
+            auto expr = CompiledExpression::fromInfix(formula);
+            printf("%zuM rows, %s\n", rows / 1000000, formula);
+
+            auto start = std::chrono::steady_clock::now();
+            evaluateRows(expr, columns, expr.getVariableCount(), reference.data(), rows);
+            double perRow = secondsSince(start);
+            printf("    row by row %9.2f ms %8.1f M rows/s\n", perRow * 1e3, rows / perRow / 1e6);
+
+            for (auto &&isa : ISAS) {
+                if (static_cast<int>(isa.isa) > static_cast<int>(best)) {
+                    continue;
+                }
+                std::fill(out.begin(), out.end(), 0);
+                start = std::chrono::steady_clock::now();
+                evaluateBatch(expr, columns, expr.getVariableCount(), out.data(), rows, isa.isa);
+                double batch = secondsSince(start);
+                bool same = memcmp(out.data(), reference.data(), rows * sizeof(Number)) == 0;
+                printf("    %-10s %9.2f ms %8.1f M rows/s %5.1fx %s\n", isa.name, batch * 1e3,
+                    rows / batch / 1e6, perRow / batch, same ? "ok" : "MISMATCH");
+            }
+        }
+    }
+}
+
+#else
 
 int main() {
     using namespace v9::expression;
     Number r = evaluate("9 2 3 + 6 * +");
     printf("%f\n", r);
+
+    auto postfix = CompiledExpression::fromPostfix("9 2 3 + 6 * +");
+    printf("compiled: %f\n", postfix.evaluate({}));
+
+    auto infix = CompiledExpression::fromInfix("(price - cost) * count / -(1 + rate)");
+    printf("%s = %f\n", "(price - cost) * count / -(1 + rate)", infix.evaluate({12.5f, 10, 4, 0.25f}));
+
+    // same formula, many inputs
+    const int N = 10000000;
+    Number values[4] = {0, 10, 4, 0.25f};
+    Number sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < N; ++i) {
+        values[0] = static_cast<Number>(i % 100);
+        sum += infix.evaluate(values);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%d evaluations in %.2f ms (%.1f M/s), sum %f\n", N, seconds * 1e3, N / seconds / 1e6, sum);
 }
+
+#endif
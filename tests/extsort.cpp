@@ -0,0 +1,135 @@
+//
+// Created by kiva on 2026/10/19.
+//
+
+#include <v9/algorithm/extsort.hpp>
+#include <cstdio>
+#include <cstdint>
+
+#ifdef EXTSORT_BENCHMARK
+
+#include <chrono>
+#include <cstdlib>
+
+static uint64_t next(uint64_t &seed) {
+    seed ^= seed << 13U;
+    seed ^= seed >> 7U;
+    seed ^= seed << 17U;
+    return seed;
+}
+
+static void generate(const char *path, size_t records) {
+    FILE *fp = fopen(path, "wb");
+    if (fp == nullptr) {
+        perror(path);
+        exit(1);
+    }
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    std::vector<uint64_t> block(1U << 16U);
+    for (size_t done = 0; done < records; done += block.size()) {
+        size_t count = std::min(block.size(), records - done);
+        for (size_t i = 0; i < count; ++i) {
+            block[i] = next(seed);
+        }
+        fwrite(block.data(), sizeof(uint64_t), count, fp);
+    }
+    fclose(fp);
+}
+
+/**
+ * Sorted, and the same sum as the input: what is cheap to check in one pass.
+ */
+static bool verify(const char *path, size_t records) {
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    uint64_t expected = 0;
+    for (size_t i = 0; i < records; ++i) {
+        expected += next(seed);
+    }
+
+    FILE *fp = fopen(path, "rb");
+    std::vector<uint64_t> block(1U << 16U);
+    uint64_t sum = 0;
+    uint64_t last = 0;
+    size_t seen = 0;
+    bool sorted = true;
+    size_t count;
+    while ((count = fread(block.data(), sizeof(uint64_t), block.size(), fp)) > 0) {
+        for (size_t i = 0; i < count; ++i) {
+            sorted = sorted && last <= block[i];
+            last = block[i];
+            sum += block[i];
+        }
+        seen += count;
+    }
+    fclose(fp);
+    return sorted && seen == records && sum == expected;
+}
+
+/**
+ * extsort-bench [MiB of input, default 2048] [MiB of memory, default 256] [threads, default all]
+ */
+int main(int argc, const char **argv) {
+    size_t inputLength = (argc > 1 ? static_cast<size_t>(atof(argv[1])) : 2048) << 20U;
+    size_t memoryLimit = (argc > 2 ? static_cast<size_t>(atof(argv[2])) : 256) << 20U;
+    size_t workers = argc > 3 ? static_cast<size_t>(atoi(argv[3])) - 1 : v9::kit::TaskPool::defaultWorkers();
+    size_t records = inputLength / sizeof(uint64_t);
+
+    const char *input = "extsort-input.bin";
+    const char *output = "extsort-output.bin";
+    generate(input, records);
+
+    v9::kit::TaskPool pool(workers);
+    for (size_t memory = memoryLimit; memory >= memoryLimit / 16; memory /= 4) {
+        v9::sorts::ExternalSortOptions options;
+        options.memoryLimit = memory;
+        options.tempDirectory = ".";
+        options.pool = &pool;
+
+        auto start = std::chrono::steady_clock::now();
+        auto stats = v9::sorts::externalSort<uint64_t>(input, output, options);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("%zu MiB, %zu MiB memory, %zu threads: %zu runs, %zu extra merges, %.1f s, %.1f MiB/s %s\n",
+            inputLength >> 20U, memory >> 20U, workers + 1, stats.runs, stats.intermediateMerges,
+            seconds, inputLength / seconds / (1U << 20U), verify(output, records) ? "" : "WRONG");
+    }
+    remove(input);
+    remove(output);
+}
+
+#else
+
+struct Record {
+    uint32_t key;
+    char name[12];
+};
+
+int main() {
+    const char *names[] = {"kiva", "imkiva", "v9", "qsort", "merge", "loser", "tree", "run"};
+    FILE *input = tmpfile();
+    for (uint32_t i = 0; i < 1000; ++i) {
+        Record record{};
+        record.key = (i * 7919U) % 1000U;
+        snprintf(record.name, sizeof(record.name), "%s", names[i % 8]);
+        fwrite(&record, sizeof(record), 1, input);
+    }
+    rewind(input);
+
+    // 100 records a run: 10 runs, too many for the memory limit to merge at once
+    v9::sorts::ExternalSortOptions options;
+    options.memoryLimit = 100 * sizeof(Record);
+    FILE *output = tmpfile();
+    auto stats = v9::sorts::externalSort<Record>(input, output, options,
+        [](const Record &a, const Record &b) { return a.key < b.key; });
+    printf("%zu records, %zu runs, %zu extra merges\n", stats.records, stats.runs, stats.intermediateMerges);
+
+    rewind(output);
+    Record record{};
+    for (int i = 0; i < 8 && fread(&record, sizeof(record), 1, output) == 1; ++i) {
+        printf("%u %s, ", record.key, record.name);
+    }
+    printf("...\n");
+    fclose(input);
+    fclose(output);
+}
+
+#endif
@@ -0,0 +1,105 @@
+//
+// Created by kiva on 2026/10/19.
+//
+
+#include <v9/algorithm/histogram.hpp>
+
+#include <cmath>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+
+using namespace v9::stats;
+
+using Table = uint64_t[BYTE_TABLE_SIZE];
+using Kernel = void (*)(const uint8_t *, size_t, uint64_t *);
+
+static void sampledKernel(const uint8_t *bytes, size_t size, uint64_t *table) {
+    byteHistogramSampled<uint64_t>(bytes, size, table, 64 * 1024, 16);
+}
+
+static std::vector<uint8_t> makeInput(const char *kind, size_t size) {
+    std::vector<uint8_t> input(size);
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+
+    for (size_t i = 0; i < size; ++i) {
+        switch (kind[0]) {
+            case 'z':
+                input[i] = 0;
+                break;
+            case 't':
+                input[i] = "the quick brown fox jumps over the lazy dog\n"[i % 44];
+                break;
+            default:
+                seed ^= seed << 13U;
+                seed ^= seed >> 7U;
+                seed ^= seed << 17U;
+                input[i] = static_cast<uint8_t>(seed);
+                break;
+        }
+    }
+    return input;
+}
+
+static double bench(Kernel kernel, const std::vector<uint8_t> &input, uint64_t *table) {
+    constexpr int ROUNDS = 5;
+    double best = 1e30;
+
+    for (int r = 0; r < ROUNDS; ++r) {
+        std::fill(table, table + BYTE_TABLE_SIZE, 0);
+        auto start = std::chrono::steady_clock::now();
+        kernel(input.data(), input.size(), table);
+        auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double>(end - start).count());
+    }
+
+    // MiB/s
+    return input.size() / best / (1024 * 1024);
+}
+
+int main(int argc, const char **argv) {
+    size_t size = (argc > 1 ? strtoull(argv[1], nullptr, 10) : 64) * 1024 * 1024;
+
+    struct {
+        const char *name;
+        Kernel kernel;
+    } kernels[] = {
+        {"1 table",   byteHistogram<uint64_t>},
+        {"4 tables",  byteHistogramInterleaved<4, uint64_t>},
+        {"8 tables",  byteHistogramInterleaved<8, uint64_t>},
+        {"sampled",   sampledKernel},
+    };
+
+    printf("%-8s %-10s %12s  %s\n", "input", "kernel", "MiB/s", "result");
+    for (const char *kind : {"zeros", "text", "random"}) {
+        auto input = makeInput(kind, size);
+
+        Table expected{0};
+        byteHistogram(input.data(), input.size(), expected);
+
+        for (auto &&k : kernels) {
+            Table table{0};
+            double speed = bench(k.kernel, input, table);
+
+            // sampled counts are estimates, report the worst relative error
+            double error = 0;
+            for (size_t ch = 0; ch < BYTE_TABLE_SIZE; ++ch) {
+                if (expected[ch] != 0) {
+                    double diff = std::abs(double(table[ch]) - double(expected[ch]));
+                    error = std::max(error, diff / expected[ch]);
+                } else if (table[ch] != 0) {
+                    error = 1;
+                }
+            }
+
+            printf("%-8s %-10s %12.1f  ", kind, k.name, speed);
+            if (error == 0) {
+                printf("exact\n");
+            } else {
+                printf("max error %.2f%%\n", error * 100);
+            }
+        }
+    }
+}
@@ -5,164 +5,43 @@
 #include <set>
 #include <list>
 #include <array>
+#include <chrono>
+#include <algorithm>
+#include <memory>
 #include <cerrno>
 #include <vector>
 #include <string>
 #include <sstream>
 #include <utility>
+#include <climits>
+#include <cstring>
+#include <cmath>
+#include <cassert>
+#include <iterator>
+#include <stdexcept>
 #include <unordered_map>
 
 #include <sys/stat.h>
+#include <unistd.h>
+
+#include <v9/algorithm/histogram.hpp>
+#include <v9/kit/buffer.hpp>
 
 #pragma clang diagnostic push
 #pragma ide diagnostic ignored "hicpp-signed-bitwise"
 #pragma ide diagnostic ignored "modernize-use-nodiscard"
 
-namespace cs::compiler {
-    struct SizedBuffer {
-        size_t _size;
-        size_t _used;
-        uint8_t *_bytes;
-    };
-
-    class ByteBuffer {
-    public:
-        using byte = uint8_t;
-
-        static constexpr float BUFFER_GROWTH_FACTOR = 1.5f;
-        static constexpr size_t BUFFER_DEFAULT_LENGTH = 1024;
-
-    private:
-        byte *_buffer;
-        size_t _bufferLength;
-        size_t _position;
-
-    private:
-        void growBuffer() {
-            if (_buffer == nullptr) {
-                // The buffer has not been allocated
-                _buffer = static_cast<byte *>(malloc(sizeof(_buffer[0]) * _bufferLength));
-
-                if (!_buffer) {
-                    throw std::runtime_error("growBuffer(): malloc failed");
-                }
-                return;
-            }
-
-            // The buffer needs to be expanded
-            size_t currentLength = _bufferLength == 1 ? 2 : _bufferLength;
-            size_t fitSize = currentLength * BUFFER_GROWTH_FACTOR;
-            byte *fitBuffer = static_cast<byte *>(realloc(_buffer, sizeof(_buffer[0]) * fitSize));
-
-            if (fitBuffer != nullptr) {
-                // New buffer successfully allocated, the original buffer
-                // was freed by realloc()
-                _buffer = fitBuffer;
-                _bufferLength = fitSize;
-            } else {
-                // Nothing changed when allocation failed
-                throw std::runtime_error("growBuffer(): realloc failed");
-            }
-        }
-
-        void growIfNeeded(size_t least) {
-            // Keep growing until current buffer can afford the required length.
-            while (_position + least >= _bufferLength) {
-                growBuffer();
-            }
-        }
-
-        static void copy(const byte *from, byte *to, size_t count) {
-            memcpy(to, from, count);
-        }
-
-    public:
-        ByteBuffer()
-            : ByteBuffer(BUFFER_DEFAULT_LENGTH) {
-        }
-
-        explicit ByteBuffer(size_t initialLength)
-            : _buffer(nullptr), _bufferLength(initialLength), _position(0) {
-            growBuffer();
-        }
-
-        ~ByteBuffer() {
-            if (_buffer != nullptr) {
-                free(_buffer);
-            }
-        }
-
-        SizedBuffer getBuffer() {
-            return {
-                ._size = getLength(),
-                ._used = getPosition(),
-                ._bytes = _buffer,
-            };
-        }
-
-        size_t getLength() const {
-            return _bufferLength;
-        }
-
-        size_t getPosition() const {
-            return _position;
-        }
-
-        void rewind() {
-            _position = 0;
-        }
-
-    public:
-        size_t reserve(size_t count) {
-            size_t p = this->_position;
-            _position += count;
-            return p;
-        }
-
-        void writeU8(byte u) {
-            writeU8At(_position++, u);
-        }
-
-        void write(const byte *data, size_t size) {
-            writeAt(_position, data, size);
-            _position += size;
-        }
-
-        bool read(byte *to, size_t size) {
-            bool r = readAt(_position, to, size);
-            _position += size;
-            return r;
-        }
-
-        void writeU8At(size_t index, byte u) {
-            growIfNeeded(1);
-            _buffer[index] = u;
-        }
-
-        void writeAt(size_t index, const byte *data, size_t size) {
-            if (index + size >= _bufferLength) {
-                growIfNeeded(size);
-            }
-            copy(data, _buffer + index, size);
-        }
-
-        bool readAt(size_t index, byte *to, size_t size) {
-            if (index + size >= _bufferLength) {
-                return false;
-            }
-            copy(_buffer + index, to, size);
-            return true;
-        }
-    };
-}
-
 namespace kiva::huffman {
-    using namespace cs::compiler;
+    using v9::kit::ByteBuffer;
 
     constexpr size_t HFZ_MAGIC_SIZE = 4;
     constexpr size_t TABLE_SIZE = UINT8_MAX + 1;
     constexpr unsigned char HFZ_MAGIC[HFZ_MAGIC_SIZE] = {0xde, 0xad, 0xfa, 0xce};
 
+    // frequency sampling: count one 64KiB block out of every 16 blocks
+    constexpr size_t HFZ_SAMPLE_BLOCK_SIZE = 64 * 1024;
+    constexpr size_t HFZ_SAMPLE_STRIDE = 16;
+
     template <typename T, size_t S>
     using Array = std::array<T, S>;
     template <typename T, typename U>
@@ -170,174 +49,184 @@ namespace kiva::huffman {
     using String = std::string;
     using CodePoint = int;
     using HuffmanTable = Array<int, TABLE_SIZE>;
-    using HuffmanInvTable = std::unordered_map<short, unsigned char>;
 
     /**
-     * The minimal heap whose root element is always the minimal value
-     * @tparam T Heap object type
-     * @tparam S Heap size
-     * @tparam Comparator Comparator used in sort
+     * Huffman code length builder working over fixed arrays.
+     *
+     * Leaves are sorted by frequency, so merged nodes are created in
+     * non-decreasing weight order and the two lightest nodes are always
+     * at the front of either the leaf queue or the merged queue
+     * (the two-queue method). No tree is allocated: every node only
+     * records its parent, which is enough to derive the code lengths.
      */
-    template <typename T, size_t S, typename Comparator>
-    class MinHeap {
+    class HuffmanBuilder {
+    public:
+        // code bits are stored in a short, see HuffmanTable
+        static constexpr int MAX_CODE_LENGTH = 15;
+
+        using Lengths = Array<uint8_t, TABLE_SIZE>;
+
     private:
-        Array<T, S> _data = {0};
-        size_t _position = 0;
-        Comparator _comparator;
+        static constexpr size_t NODE_SIZE = 2 * TABLE_SIZE;
 
-        void sortHeap(int currentNode) {
-            int left = 2 * currentNode + 1;
-            int right = 2 * currentNode + 2;
-            int tmp;
+        // leaves [0, _leaves) sorted by frequency, merged nodes after them
+        Array<uint64_t, NODE_SIZE> _weight{};
+        Array<uint16_t, NODE_SIZE> _parent{};
+        Array<CodePoint, TABLE_SIZE> _codePoints{};
+        Array<int, TABLE_SIZE> _depth{};
+        size_t _leaves = 0;
 
-            if (left >= size()) {
-                return;
-            }
+        Lengths _lengths{};
 
-            if (left == size() - 1) {
-                if (_comparator(_data[currentNode], _data[left]) > 0) {
-                    std::swap(_data[currentNode], _data[left]);
+    private:
+        void sortLeaves(const int *freq) {
+            _leaves = 0;
+            for (size_t ch = 0; ch < TABLE_SIZE; ++ch) {
+                if (freq[ch] != 0) {
+                    _codePoints[_leaves++] = static_cast<CodePoint>(ch);
                 }
-                return;
             }
 
-            if (_comparator(_data[currentNode], _data[left]) > 0
-                || _comparator(_data[currentNode], _data[right]) > 0) {
-                // swap the min parent node with current one
-                if (_comparator(_data[left], _data[right]) < 0) {
-                    std::swap(_data[currentNode], _data[left]);
-                    sortHeap(left);
-                } else {
-                    std::swap(_data[currentNode], _data[right]);
-                    sortHeap(right);
-                }
-            }
-        }
+            std::sort(_codePoints.begin(), _codePoints.begin() + _leaves,
+                [freq](CodePoint lhs, CodePoint rhs) {
+                    return freq[lhs] != freq[rhs] ? freq[lhs] < freq[rhs] : lhs < rhs;
+                });
 
-        void sortHeap() {
-            for (int i = size() - 1; i >= 0; i--) {
-                int left = 2 * i + 1;
-                if (left < size()) {
-                    sortHeap(i);
-                }
+            for (size_t i = 0; i < _leaves; ++i) {
+                _weight[i] = static_cast<uint64_t>(freq[_codePoints[i]]);
             }
         }
 
-    public:
-        MinHeap() = default;
+        void mergeNodes() {
+            size_t leaf = 0;
+            size_t merged = _leaves;
+            size_t next = _leaves;
 
-        ~MinHeap() = default;
+            auto lightest = [&]() {
+                if (leaf < _leaves && (merged == next || _weight[leaf] <= _weight[merged])) {
+                    return leaf++;
+                }
+                return merged++;
+            };
 
-        void push(const T &t) {
-            if (_position >= S) {
-                throw std::runtime_error("Heap overflow");
+            while (next < 2 * _leaves - 1) {
+                size_t one = lightest();
+                size_t two = lightest();
+                _weight[next] = _weight[one] + _weight[two];
+                _parent[one] = static_cast<uint16_t>(next);
+                _parent[two] = static_cast<uint16_t>(next);
+                ++next;
             }
 
-            _data.at(_position++) = std::move(t);
-            sortHeap();
-        }
-
-        bool empty() {
-            return _position == 0;
+            // parents always come after their children,
+            // so walking down from the root visits parents first
+            size_t root = 2 * _leaves - 2;
+            Array<int, NODE_SIZE> depth{};
+            depth[root] = 0;
+            for (size_t i = root; i-- > 0;) {
+                depth[i] = depth[_parent[i]] + 1;
+            }
+            for (size_t i = 0; i < _leaves; ++i) {
+                _depth[i] = depth[i];
+            }
         }
 
-        size_t size() {
-            return _position;
-        }
+        /**
+         * Clamp code lengths to MAX_CODE_LENGTH and repair the Kraft sum
+         * by lengthening the rarest codes, then shorten the most frequent
+         * codes again while the sum leaves room for it.
+         */
+        void limitLengths() {
+            constexpr uint32_t ONE = 1U << MAX_CODE_LENGTH;
+            uint32_t kraft = 0;
 
-        T pop() {
-            if (empty()) {
-                throw std::runtime_error("Empty heap");
+            for (size_t i = 0; i < _leaves; ++i) {
+                _depth[i] = std::min(_depth[i], MAX_CODE_LENGTH);
+                kraft += 1U << (MAX_CODE_LENGTH - _depth[i]);
             }
 
-            T elem = _data[0];
-            _data[0] = _data[_position - 1];
-            --_position;
-
-            sortHeap();
-            return std::move(elem);
-        }
-    };
-
-    /**
-     * The huffman tree
-     */
-    class HuffmanTree {
-    public:
-        struct Comparator {
-            int operator()(HuffmanTree *lhs, HuffmanTree *rhs) {
-                if (*lhs < *rhs) {
-                    return -1;
-                }
-                if (*lhs > *rhs) {
-                    return 1;
+            while (kraft > ONE) {
+                // lengthening the deepest code that can still grow costs least
+                size_t pick = _leaves;
+                for (size_t i = 0; i < _leaves; ++i) {
+                    if (_depth[i] < MAX_CODE_LENGTH
+                        && (pick == _leaves || _depth[i] > _depth[pick])) {
+                        pick = i;
+                    }
                 }
-                return 0;
+                kraft -= 1U << (MAX_CODE_LENGTH - _depth[pick] - 1);
+                ++_depth[pick];
             }
-        };
 
-    private:
-        CodePoint _codePoint = '\0';
-        bool _codePointNode = false;
-        int _freq = 0;
-
-        HuffmanTree *_left = nullptr;
-        HuffmanTree *_right = nullptr;
-
-    public:
-        HuffmanTree() = default;
-
-        HuffmanTree(CodePoint codePoint, int freq)
-            : _codePoint(codePoint), _freq(freq), _codePointNode(true) {
+            for (size_t i = _leaves; i-- > 0;) {
+                while (_depth[i] > 1 && kraft + (1U << (MAX_CODE_LENGTH - _depth[i])) <= ONE) {
+                    kraft += 1U << (MAX_CODE_LENGTH - _depth[i]);
+                    --_depth[i];
+                }
+            }
         }
 
-        HuffmanTree(HuffmanTree *left, HuffmanTree *right) {
-            setLeft(left);
-            setRight(right);
-        }
+    public:
+        HuffmanBuilder() = default;
 
-        ~HuffmanTree() = default;
+        ~HuffmanBuilder() = default;
 
-        bool isCodePoint() const {
-            return _codePointNode;
-        }
+        /**
+         * Compute code lengths from code point frequencies
+         * @param freq Frequency of every code point, TABLE_SIZE entries
+         * @return Code length of every code point, 0 if absent
+         */
+        const Lengths &build(const int *freq) {
+            _lengths.fill(0);
+            sortLeaves(freq);
 
-        void setLeft(HuffmanTree *left) {
-            this->_left = left;
-            if (left != nullptr) {
-                this->_freq += left->getFreq();
+            if (_leaves == 0) {
+                return _lengths;
             }
-        }
 
-        void setRight(HuffmanTree *right) {
-            this->_right = right;
-            if (right != nullptr) {
-                this->_freq += right->getFreq();
+            if (_leaves == 1) {
+                // a lonely code point still needs one bit
+                _depth[0] = 1;
+            } else {
+                mergeNodes();
+                limitLengths();
             }
-        }
-
-        int getFreq() const {
-            return _freq;
-        }
-
-        CodePoint getCodePoint() const {
-            return _codePoint;
-        }
 
-        HuffmanTree *getLeft() {
-            return _left;
+            for (size_t i = 0; i < _leaves; ++i) {
+                _lengths[_codePoints[i]] = static_cast<uint8_t>(_depth[i]);
+            }
+            return _lengths;
         }
 
-        HuffmanTree *getRight() {
-            return _right;
-        }
+        /**
+         * Assign canonical codes to code lengths: shorter codes first,
+         * ties broken by code point. Canonical code values are unique
+         * across all lengths.
+         * @param lengths Code lengths
+         * @return Huffman table
+         */
+        static HuffmanTable genCanonicalTable(const Lengths &lengths) {
+            Array<int, MAX_CODE_LENGTH + 1> count{};
+            for (auto length : lengths) {
+                ++count[length];
+            }
+            count[0] = 0;
 
-        bool operator>(const HuffmanTree &other) {
-            return this->getFreq() > other.getFreq();
-        }
+            Array<int, MAX_CODE_LENGTH + 1> nextCode{};
+            int code = 0;
+            for (int length = 1; length <= MAX_CODE_LENGTH; ++length) {
+                code = (code + count[length - 1]) << 1;
+                nextCode[length] = code;
+            }
 
-        bool operator<(const HuffmanTree &other) {
-            return this->getFreq() < other.getFreq();
+            HuffmanTable table{0};
+            for (size_t ch = 0; ch < TABLE_SIZE; ++ch) {
+                int length = lengths[ch];
+                if (length != 0) {
+                    table[ch] = (length << 16) | (nextCode[length]++ & 0xffff);
+                }
+            }
+            return table;
         }
     };
 
@@ -357,7 +246,8 @@ namespace kiva::huffman {
     public:
         void writeAll(ByteBuffer &byteBuffer) {
             if (_count != 0) {
-                byteBuffer.writeU8(_buffer);
+                // pad the last byte on the right, bits are read from the left
+                byteBuffer.writeU8(_buffer << (8 - _count));
                 _buffer = 0;
                 _count = 0;
             }
@@ -402,6 +292,29 @@ namespace kiva::huffman {
             return reversed.size() == expectedSize;
         }
 
+        /**
+         * Skip bytes of a stream, which can be a pipe or a socket
+         * where fseek() does not work
+         * @param stream Stream to skip
+         * @param count Bytes to skip
+         * @return true if success
+         */
+        static bool skipStream(FILE *stream, uint64_t count) {
+            if (count == 0 || fseeko(stream, static_cast<off_t>(count), SEEK_CUR) == 0) {
+                return true;
+            }
+
+            unsigned char drop[4096];
+            while (count > 0) {
+                size_t n = fread(drop, 1, std::min<uint64_t>(count, sizeof(drop)), stream);
+                if (n == 0) {
+                    return false;
+                }
+                count -= n;
+            }
+            return true;
+        }
+
         /**
          * Recursivly create a directory, including its parent directory
          * @param cpath Directory to create
@@ -449,51 +362,46 @@ namespace kiva::huffman {
         }
     };
 
-    namespace debug {
-        void dumpTree(HuffmanTree *tree, const String &code, int depth) {
-            if (tree == nullptr) {
-                return;
-            }
-
-            if (tree->isCodePoint()) {
-                printf("%*sCodePointNode: { %d -> %s }\n", depth * 2, " ",
-                    tree->getCodePoint(), code.c_str());
-                return;
-            }
-
-            printf("%*sLeft {\n", depth * 2, " ");
-            dumpTree(tree->getLeft(), code + "0", depth + 1);
-            printf("%*s}\n", depth * 2, " ");
-
-            printf("%*sRight {\n", depth * 2, " ");
-            dumpTree(tree->getRight(), code + "1", depth + 1);
-            printf("%*s}\n", depth * 2, " ");
-        }
-
-        void dumpTree(HuffmanTree *tree) {
-            printf("RootLeft {\n");
-            dumpTree(tree->getLeft(), "0", 1);
-            printf("}\n");
-
-            printf("RootRight {\n");
-            dumpTree(tree->getRight(), "1", 1);
-            printf("}\n");
-        }
-    }
-
     /**
      * Compressed entry header
      */
     struct HfzEntryHeader {
-        int compressedSize = 0;
+        uint64_t compressedSize = 0;
+        uint64_t originalSize = 0;
         char filePath[PATH_MAX] = {0};
         int huffmanTable[TABLE_SIZE] = {0};
     };
 
+    /**
+     * Seconds spent in each compression phase, accumulated over calls
+     */
+    struct HfzPhaseTimes {
+        using Clock = std::chrono::steady_clock;
+
+        double histogram = 0;
+        double treeBuild = 0;
+        double encode = 0;
+
+        /**
+         * Add the time since {@code start} to a phase and restart the clock
+         * @param times Where to record, nothing happens if nullptr
+         * @param phase Phase to add to
+         * @param start Start of the phase, reset to now
+         */
+        static void record(HfzPhaseTimes *times, double HfzPhaseTimes::*phase,
+                           Clock::time_point &start) {
+            if (times == nullptr) {
+                return;
+            }
+            auto now = Clock::now();
+            times->*phase += std::chrono::duration<double>(now - start).count();
+            start = now;
+        }
+    };
+
     class HfzCommand {
     private:
         // Type alias to save typing time
-        using TreeHeap = MinHeap<HuffmanTree *, TABLE_SIZE, HuffmanTree::Comparator>;
         using CodeDict = Array<CodePoint, TABLE_SIZE>;
 
     private:
@@ -511,94 +419,40 @@ namespace kiva::huffman {
                 sizeof(CodePoint) * dictionary.size());
         }
 
-        static void deleteTree(HuffmanTree *tree) {
-            if (tree == nullptr) {
-                return;
-            }
-
-            deleteTree(tree->getLeft());
-            deleteTree(tree->getRight());
-            delete tree;
-        }
-
         /**
          * Calculate code point frequency of a file
-         * @param filePath File to calculate
+         * @param bytes File content
+         * @param size File size
          * @param dictionary code point frequency
+         * @param sampled Estimate frequencies from sampled blocks
          * @return true if success
          */
-        static bool loadDictionary(const ByteBuffer::byte *bytes, size_t size, CodeDict &dictionary) {
+        static bool loadDictionary(const ByteBuffer::byte *bytes, size_t size,
+                                   CodeDict &dictionary, bool sampled) {
             if (bytes == nullptr) {
                 return false;
             }
 
-            auto v = bytes;
-            for (size_t i = 0; i < size; ++i) {
-                ++dictionary[*v++];
+            if (sampled) {
+                // every code point must own a code even if no sampled
+                // block contains it, so unseen ones get frequency 1
+                v9::stats::byteHistogramSampled(bytes, size, dictionary.data(),
+                    HFZ_SAMPLE_BLOCK_SIZE, HFZ_SAMPLE_STRIDE, 1);
+            } else {
+                v9::stats::byteHistogramFast(bytes, size, dictionary.data());
             }
 
             return true;
         }
 
-        static void genHuffmanTable(HuffmanTable &table, HuffmanTree *tree,
-                                    short code, int depth) {
-            if (tree == nullptr) {
-                return;
-            }
-
-            if (tree->isCodePoint()) {
-                auto item = static_cast<int>((depth << 16) | (code & 0xffff));
-                table[tree->getCodePoint()] = item;
-                return;
-            }
-
-            short left = (code << 1) | 0;
-            short right = (code << 1) | 1;
-            genHuffmanTable(table, tree->getLeft(), left, depth + 1);
-            genHuffmanTable(table, tree->getRight(), right, depth + 1);
-        }
-
         /**
          * Generate a map from code point to huffman encoding
-         * @param tree Huffman tree
+         * @param dictionary code point frequency
          * @return Huffman table
          */
-        static HuffmanTable genHuffmanTable(HuffmanTree *tree) {
-            HuffmanTable table{0};
-            genHuffmanTable(table, tree->getLeft(), 0, 1);
-            genHuffmanTable(table, tree->getRight(), 1, 1);
-            return table;
-        }
-
         static HuffmanTable genHuffmanTable(const CodeDict &dictionary) {
-            assert(dictionary.size() == UINT8_MAX + 1);
-
-            TreeHeap heap;
-            for (CodePoint ch = 0; ch < dictionary.size(); ++ch) {
-                if (dictionary[ch] == 0) {
-                    continue;
-                }
-                auto tree = new HuffmanTree(ch, dictionary[ch]);
-                heap.push(tree);
-            }
-
-            // the dictionary contains nothing
-            // so the huffman table is all-zero
-            if (heap.empty()) {
-                return HuffmanTable();
-            }
-
-            while (heap.size() > 1) {
-                auto one = heap.pop();
-                auto two = heap.pop();
-                auto node = new HuffmanTree(one, two);
-                heap.push(node);
-            }
-
-            auto tree = heap.pop();
-            auto &&table = genHuffmanTable(tree);
-            deleteTree(tree);
-            return table;
+            HuffmanBuilder builder;
+            return HuffmanBuilder::genCanonicalTable(builder.build(dictionary.data()));
         }
 
         static void writeEncoded(ByteBuffer &byteBuffer, const HuffmanTable &table,
@@ -621,36 +475,22 @@ namespace kiva::huffman {
             writer.writeAll(byteBuffer);
         }
 
-        static HuffmanInvTable genHuffmanInvTable(const HuffmanTable &table) {
-            HuffmanInvTable invTable;
-            for (size_t i = 0; i < table.size(); ++i) {
-                int comb = table[i];
-                if (comb == 0) {
-                    continue;
-                }
-
-//                auto bitCount = static_cast<short>(comb >> 16);
-                auto bits = static_cast<short>(comb & 0xffff);
-
-                invTable[bits] = i;
-//                for (int p = bitCount - 1; p >= 0; p--) {
-//                    bool b = (bits & (1 << p)) != 0;
-//                }
-            }
-            return invTable;
-        }
-
     public:
-        static bool compressContent(const ByteBuffer::byte *bytes, size_t size, ByteBuffer &result) {
+        static bool compressContent(const ByteBuffer::byte *bytes, size_t size, ByteBuffer &result,
+                                    bool sampled = false, HfzPhaseTimes *times = nullptr) {
+            auto start = HfzPhaseTimes::Clock::now();
+
             CodeDict dict{0};
-            if (!loadDictionary(bytes, size, dict)) {
+            if (!loadDictionary(bytes, size, dict, sampled)) {
                 return false;
             }
+            HfzPhaseTimes::record(times, &HfzPhaseTimes::histogram, start);
 
             auto &&table = genHuffmanTable(dict);
             if (!checkTable(table)) {
                 return false;
             }
+            HfzPhaseTimes::record(times, &HfzPhaseTimes::treeBuild, start);
 
             // let's encode the buffer
 
@@ -662,12 +502,14 @@ namespace kiva::huffman {
             // write the compressed data
             size_t compressedStart = result.getPosition();
             writeEncoded(result, table, bytes, size);
+            HfzPhaseTimes::record(times, &HfzPhaseTimes::encode, start);
 
             // fill header fields
             // note that: we won't fill the filePath field
             size_t compressedEnd = result.getPosition();
             HfzEntryHeader header{};
-            header.compressedSize = static_cast<int>(compressedEnd - compressedStart);
+            header.compressedSize = compressedEnd - compressedStart;
+            header.originalSize = size;
             memcpy(header.huffmanTable, table.data(), sizeof(int) * table.size());
 
             // write the real header
@@ -677,29 +519,6 @@ namespace kiva::huffman {
 
             return true;
         }
-
-        static bool decompressContent(const ByteBuffer::byte *bytes, size_t size,
-                                      const HuffmanTable &table, ByteBuffer &result) {
-            auto &&inv = genHuffmanInvTable(table);
-
-            auto v = bytes;
-            short bits = 0;
-
-            for (size_t i = 0; i < size; ++i) {
-                auto ch = *v++;
-                for (int p = 7; p >= 0; p--) {
-                    bool b = (ch & (1 << p)) != 0;
-                    bits = (bits << 1) | (b ? 1 : 0);
-
-                    if (inv.find(bits) != inv.end()) {
-                        result.writeU8(inv[bits]);
-                        bits = 0;
-                    }
-                }
-            }
-
-            return true;
-        }
     };
 
     class HfzCompressor {
@@ -707,6 +526,9 @@ namespace kiva::huffman {
         std::vector<String> _files;
         String _outputFile;
 
+        // files at least this large get sampled frequencies, 0 disables sampling
+        size_t _sampleThreshold = 0;
+
     public:
         HfzCompressor() = default;
 
@@ -732,14 +554,30 @@ namespace kiva::huffman {
             return _files;
         }
 
+        size_t getSampleThreshold() const {
+            return _sampleThreshold;
+        }
+
+        void setSampleThreshold(size_t sampleThreshold) {
+            _sampleThreshold = sampleThreshold;
+        }
+
         void compress() {
-            ByteBuffer outputBuffer;
             ByteBuffer inputBuffer;
 
+            printf("Creating %s\n", _outputFile.c_str());
+            FILE *fp = fopen(_outputFile.c_str(), "wb");
+            if (fp == nullptr) {
+                throw std::runtime_error("failed to create hfz file "
+                                         + _outputFile + ": "
+                                         + strerror(errno));
+            }
+            auto output = std::shared_ptr<FILE>(fp, std::fclose);
+
             // file magic
-            outputBuffer.write(HFZ_MAGIC, HFZ_MAGIC_SIZE);
+            fwrite(HFZ_MAGIC, HFZ_MAGIC_SIZE, 1, fp);
+            fflush(fp);
 
-            printf("Creating %s\n", _outputFile.c_str());
             for (auto &&f : _files) {
                 FILE *fileIn = fopen(f.c_str(), "rb");
                 if (fileIn == nullptr) {
@@ -747,16 +585,22 @@ namespace kiva::huffman {
                 }
 
                 fseek(fileIn, 0, SEEK_END);
-                long fileSize = ftell(fileIn);
+                long end = ftell(fileIn);
                 fseek(fileIn, 0, SEEK_SET);
+                if (end < 0) {
+                    fclose(fileIn);
+                    throw std::runtime_error("failed to size " + f + ": " + strerror(errno));
+                }
+                auto fileSize = static_cast<size_t>(end);
 
                 auto bytes = new ByteBuffer::byte[fileSize];
                 fread(bytes, fileSize, 1, fileIn);
+                fclose(fileIn);
 
                 inputBuffer.rewind();
-                if (!HfzCommand::compressContent(bytes, fileSize, inputBuffer)) {
+                bool sampled = _sampleThreshold != 0 && fileSize >= _sampleThreshold;
+                if (!HfzCommand::compressContent(bytes, fileSize, inputBuffer, sampled)) {
                     delete[] bytes;
-                    fclose(fileIn);
                     throw std::runtime_error("failed to compress file " + f);
                 }
 
@@ -768,9 +612,12 @@ namespace kiva::huffman {
                     reinterpret_cast<const ByteBuffer::byte *>(f.c_str()),
                     f.size());
 
-                // write compressed entry to output buffer
-                auto &&compressed = inputBuffer.getBuffer();
-                outputBuffer.write(compressed._bytes, compressed._used);
+                // write compressed entry segments straight to the hfz file
+                if (inputBuffer.writeTo(fileno(fp)) < 0) {
+                    throw std::runtime_error("failed to write hfz file "
+                                             + _outputFile + ": "
+                                             + strerror(errno));
+                }
 
                 if (fileSize > 0) {
                     size_t compressedSize = inputBuffer.getPosition();
@@ -780,59 +627,193 @@ namespace kiva::huffman {
                     printf("  adding: %s (empty file)\n", f.c_str());
                 }
             }
+        }
 
-            // all entries compressed
-            // create the output hfz file
-            FILE *fp = fopen(_outputFile.c_str(), "wb");
+        void operator()() {
+            compress();
+        }
+    };
 
-            if (fp == nullptr) {
-                throw std::runtime_error("failed to create hfz file "
-                                         + _outputFile + ": "
-                                         + strerror(errno));
+    /**
+     * Pull-based decoder of one compressed entry.
+     *
+     * Memory use does not depend on the entry size: compressed bytes are
+     * pulled from the stream through a fixed input window, and every code
+     * is decoded with one lookup of MAX_CODE_LENGTH bits into a fixed table.
+     * The stream is only read forward, so pipes and sockets work as well.
+     */
+    class HfzReader {
+    public:
+        using byte = ByteBuffer::byte;
+
+        static constexpr size_t INPUT_WINDOW_SIZE = 64 * 1024;
+        static constexpr int LOOKUP_BITS = HuffmanBuilder::MAX_CODE_LENGTH;
+
+    private:
+        FILE *_stream;
+
+        // compressed bytes not yet pulled from the stream
+        uint64_t _compressedLeft;
+        // decoded bytes not yet handed out
+        uint64_t _originalLeft;
+
+        // (length << 8) | code point, indexed by the next LOOKUP_BITS bits
+        std::vector<uint16_t> _lookup;
+        bool _valid = true;
+
+        std::vector<byte> _window;
+        size_t _windowPosition = 0;
+        size_t _windowEnd = 0;
+
+        // pending bits, aligned to the most significant bit
+        uint64_t _bits = 0;
+        int _bitCount = 0;
+
+    private:
+        void buildLookup(const int *table) {
+            for (size_t ch = 0; ch < TABLE_SIZE; ++ch) {
+                int comb = table[ch];
+                if (comb == 0) {
+                    continue;
+                }
+
+                int bitCount = comb >> 16;
+                int bits = comb & 0xffff;
+                if (bitCount <= 0 || bitCount > LOOKUP_BITS || (bits >> bitCount) != 0) {
+                    _valid = false;
+                    return;
+                }
+
+                // every index starting with this code decodes to it
+                size_t first = static_cast<size_t>(bits) << (LOOKUP_BITS - bitCount);
+                size_t last = first + (size_t(1) << (LOOKUP_BITS - bitCount));
+                for (size_t i = first; i < last; ++i) {
+                    if (_lookup[i] != 0) {
+                        // not a prefix code
+                        _valid = false;
+                        return;
+                    }
+                    _lookup[i] = static_cast<uint16_t>((bitCount << 8) | ch);
+                }
             }
+        }
 
-            auto &&sizedBuffer = outputBuffer.getBuffer();
-            fwrite(sizedBuffer._bytes, sizedBuffer._used, 1, fp);
+        void refill() {
+            while (_bitCount <= 56) {
+                if (_windowPosition == _windowEnd) {
+                    if (_compressedLeft == 0) {
+                        return;
+                    }
+                    size_t want = std::min<uint64_t>(_compressedLeft, _window.size());
+                    _windowEnd = fread(_window.data(), 1, want, _stream);
+                    _windowPosition = 0;
+                    _compressedLeft -= _windowEnd;
+                    if (_windowEnd == 0) {
+                        // truncated stream
+                        _compressedLeft = 0;
+                        return;
+                    }
+                }
+                _bits |= static_cast<uint64_t>(_window[_windowPosition++]) << (56 - _bitCount);
+                _bitCount += 8;
+            }
+        }
 
-            fclose(fp);
+    public:
+        HfzReader(FILE *stream, const int *table, uint64_t compressedSize, uint64_t originalSize)
+            : _stream(stream), _compressedLeft(compressedSize), _originalLeft(originalSize),
+              _lookup(size_t(1) << LOOKUP_BITS), _window(INPUT_WINDOW_SIZE) {
+            buildLookup(table);
         }
 
-        void operator()() {
-            compress();
+        ~HfzReader() = default;
+
+        HfzReader(const HfzReader &) = delete;
+
+        HfzReader &operator=(const HfzReader &) = delete;
+
+        /**
+         * Decode at most {@code size} bytes into {@code buffer}
+         * @return Bytes decoded, 0 at the end of the entry, -1 on corrupted input
+         */
+        ssize_t read(byte *buffer, size_t size) {
+            if (!_valid) {
+                return -1;
+            }
+
+            size = std::min<uint64_t>(size, _originalLeft);
+            for (size_t i = 0; i < size; ++i) {
+                if (_bitCount < LOOKUP_BITS) {
+                    refill();
+                }
+
+                uint16_t entry = _lookup[_bits >> (64 - LOOKUP_BITS)];
+                int bitCount = entry >> 8;
+                if (bitCount == 0 || bitCount > _bitCount) {
+                    _valid = false;
+                    return -1;
+                }
+
+                buffer[i] = static_cast<byte>(entry & 0xff);
+                _bits <<= bitCount;
+                _bitCount -= bitCount;
+            }
+
+            _originalLeft -= size;
+            return static_cast<ssize_t>(size);
+        }
+
+        /**
+         * Skip the compressed bytes that were not pulled yet,
+         * so the stream is positioned at the next entry
+         * @return true if success
+         */
+        bool skipRest() {
+            uint64_t left = _compressedLeft;
+            _compressedLeft = 0;
+            _originalLeft = 0;
+            return HfzUtils::skipStream(_stream, left);
         }
     };
 
     class HfzEntry {
         friend class HfzIterator;
 
+    public:
+        using byte = ByteBuffer::byte;
+
+        static constexpr size_t OUTPUT_WINDOW_SIZE = 64 * 1024;
+
     private:
         HfzEntryHeader _entryHeader{};
+        std::unique_ptr<HfzReader> _reader;
         ByteBuffer _inflateBuffer;
         bool _inflated = false;
         FILE *_stream = nullptr;
 
     private:
         bool doInflate() {
-            auto bytes = new ByteBuffer::byte[getCompressedSize()];
-            if (fread(bytes, getCompressedSize(), 1, _stream) != 1) {
-                delete[] bytes;
-                return false;
-            }
-
             _inflateBuffer.rewind();
-            HuffmanTable table{0};
-            memcpy(table.data(), _entryHeader.huffmanTable, sizeof(int) * table.size());
-            bool r = HfzCommand::decompressContent(bytes, getCompressedSize(),
-                table, _inflateBuffer);
-            delete[] bytes;
-            return r;
+            _inflateBuffer.ensureCapacity(getOriginalSize());
+
+            byte window[OUTPUT_WINDOW_SIZE];
+            ssize_t n;
+            while ((n = read(window, sizeof(window))) > 0) {
+                _inflateBuffer.write(window, n);
+            }
+            return n == 0;
         }
 
-        void discard() {
-            if (_inflated || _stream == nullptr) {
-                return;
+        bool discard() {
+            if (_stream == nullptr) {
+                return true;
             }
-            fseek(_stream, getCompressedSize(), SEEK_CUR);
+
+            bool r = _reader != nullptr
+                     ? _reader->skipRest()
+                     : HfzUtils::skipStream(_stream, getCompressedSize());
+            _reader = nullptr;
+            return r;
         }
 
     public:
@@ -848,26 +829,49 @@ namespace kiva::huffman {
 
         HfzEntry &&operator=(HfzEntry &&) = delete;
 
-        int getCompressedSize() const {
+        uint64_t getCompressedSize() const {
             return _entryHeader.compressedSize;
         }
 
+        uint64_t getOriginalSize() const {
+            return _entryHeader.originalSize;
+        }
+
         String getEntryFilePath() const {
             return _entryHeader.filePath;
         }
 
-        SizedBuffer inflate() {
+        /**
+         * Decode the next part of the entry content, memory use is
+         * bounded no matter how large the entry is
+         * @param buffer Output buffer
+         * @param size Output buffer size
+         * @return Bytes decoded, 0 at the end of the entry, -1 on corrupted input
+         */
+        ssize_t read(byte *buffer, size_t size) {
+            if (_reader == nullptr) {
+                if (_stream == nullptr) {
+                    return -1;
+                }
+                _reader = std::make_unique<HfzReader>(_stream, _entryHeader.huffmanTable,
+                    getCompressedSize(), getOriginalSize());
+            }
+            return _reader->read(buffer, size);
+        }
+
+        /**
+         * Inflate the rest of the entry content into memory,
+         * only meant for small entries, use read() for large ones
+         * @return Inflated content, nullptr on failure
+         */
+        const ByteBuffer *inflate() {
             if (!_inflated) {
                 if (!doInflate()) {
-                    return SizedBuffer{
-                        ._bytes = nullptr,
-                        ._size = 0,
-                        ._used = 0,
-                    };
+                    return nullptr;
                 }
                 _inflated = true;
             }
-            return _inflateBuffer.getBuffer();
+            return &_inflateBuffer;
         }
     };
 
@@ -883,16 +887,17 @@ namespace kiva::huffman {
                 return false;
             }
 
-            if (!entry->_inflated) {
-                entry->discard();
+            if (!entry->discard()) {
+                return false;
             }
 
-            memset(&entry->_entryHeader, '\0', sizeof(HfzEntryHeader));
+            entry->_entryHeader = HfzEntryHeader{};
             if (fread(&entry->_entryHeader, sizeof(HfzEntryHeader), 1, _stream) != 1) {
                 return false;
             }
 
             entry->_stream = _stream;
+            entry->_inflated = false;
             return true;
         }
 
@@ -941,6 +946,18 @@ namespace kiva::huffman {
         String _hfzFile;
         std::shared_ptr<FILE> _stream;
 
+    private:
+        void checkMagic() {
+            FILE *fp = _stream.get();
+
+            // check magic
+            unsigned char magic[HFZ_MAGIC_SIZE] = {0};
+            fread(magic, HFZ_MAGIC_SIZE, 1, fp);
+            if (memcmp(magic, HFZ_MAGIC, HFZ_MAGIC_SIZE) != 0) {
+                throw std::runtime_error(".hfz file magic not found in " + _hfzFile);
+            }
+        }
+
     public:
         explicit HfzArchive(String hfzFile)
             : _hfzFile(std::move(hfzFile)) {
@@ -951,6 +968,13 @@ namespace kiva::huffman {
         }
 
         void open() {
+            if (_hfzFile == "-") {
+                // read from a pipe
+                _stream = std::shared_ptr<FILE>(stdin, [](FILE *) {});
+                checkMagic();
+                return;
+            }
+
             FILE *fp = fopen(_hfzFile.c_str(), "rb");
             if (fp == nullptr) {
                 throw std::runtime_error("failed to open file "
@@ -960,13 +984,17 @@ namespace kiva::huffman {
             }
 
             _stream = std::shared_ptr<FILE>(fp, std::fclose);
+            checkMagic();
+        }
 
-            // check magic
-            unsigned char magic[HFZ_MAGIC_SIZE] = {0};
-            fread(magic, HFZ_MAGIC_SIZE, 1, fp);
-            if (memcmp(magic, HFZ_MAGIC, HFZ_MAGIC_SIZE) != 0) {
-                throw std::runtime_error(".hfz file magic not found in " + _hfzFile);
-            }
+        /**
+         * Read archive entries from a stream opened elsewhere,
+         * such as a socket wrapped with fdopen()
+         * @param stream Stream positioned at the file magic
+         */
+        void open(FILE *stream) {
+            _stream = std::shared_ptr<FILE>(stream, [](FILE *) {});
+            checkMagic();
         }
 
         HfzIterator begin() {
@@ -1027,9 +1055,25 @@ namespace kiva::huffman {
                                              + ": " + strerror(errno));
                 }
 
-                auto buffer = item->inflate();
-                fwrite(buffer._bytes, buffer._used, 1, fp);
-                fclose(fp);
+                HfzEntry::byte window[HfzEntry::OUTPUT_WINDOW_SIZE];
+                ssize_t n;
+                while ((n = item->read(window, sizeof(window))) > 0) {
+                    if (fwrite(window, static_cast<size_t>(n), 1, fp) != 1) {
+                        int error = errno;
+                        fclose(fp);
+                        throw std::runtime_error("failed to write file " + outputFile
+                                                 + ": " + strerror(error));
+                    }
+                }
+                if (fclose(fp) != 0) {
+                    throw std::runtime_error("failed to write file " + outputFile
+                                             + ": " + strerror(errno));
+                }
+
+                if (n < 0) {
+                    throw std::runtime_error("failed to inflate " + outputFile
+                                             + ": corrupted entry");
+                }
             }
         }
 
@@ -1039,14 +1083,227 @@ namespace kiva::huffman {
     };
 }
 
+#ifdef HFZ_BENCHMARK
+
+#include <v9/kit/resource.hpp>
+
+namespace kiva::huffman::bench {
+    using byte = ByteBuffer::byte;
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * Deterministic pseudo random numbers, so every run
+     * compresses exactly the same corpus
+     */
+    class XorShift {
+    private:
+        uint64_t _state;
+
+    public:
+        explicit XorShift(uint64_t seed)
+            : _state(seed) {
+        }
+
+        uint64_t next() {
+            _state ^= _state << 13U;
+            _state ^= _state >> 7U;
+            _state ^= _state << 17U;
+            return _state;
+        }
+
+        uint32_t below(uint32_t bound) {
+            return static_cast<uint32_t>(next() % bound);
+        }
+    };
+
+    static void genText(std::vector<byte> &out, size_t size, XorShift &rng) {
+        static const char *words[] = {
+            "the", "of", "and", "to", "in", "a", "is", "that", "for", "it",
+            "as", "was", "with", "be", "by", "on", "not", "he", "this", "are",
+            "huffman", "compression", "entropy", "archive", "buffer", "table",
+        };
+        constexpr uint32_t WORDS = sizeof(words) / sizeof(words[0]);
+
+        while (out.size() < size) {
+            // squaring skews the pick towards the first, more common words
+            uint32_t pick = rng.below(WORDS * WORDS);
+            const char *word = words[WORDS - 1 - static_cast<uint32_t>(sqrt(pick))];
+            out.insert(out.end(), word, word + strlen(word));
+            out.push_back(rng.below(12) == 0 ? '\n' : ' ');
+        }
+    }
+
+    static void genLogs(std::vector<byte> &out, size_t size, XorShift &rng) {
+        static const char *levels[] = {"info", "info", "info", "debug", "warn", "error"};
+        static const char *paths[] = {"/api/user", "/api/order", "/static/app.js", "/health"};
+        char line[256];
+
+        for (uint64_t ts = 1571482800000; out.size() < size; ts += rng.below(50)) {
+            int n = snprintf(line, sizeof(line),
+                R"({"ts":%llu,"level":"%s","path":"%s","status":%d,"latency_ms":%u,"req":"%08x"})" "\n",
+                static_cast<unsigned long long>(ts), levels[rng.below(6)], paths[rng.below(4)],
+                rng.below(20) == 0 ? 500 : 200, rng.below(2000),
+                static_cast<unsigned>(rng.next()));
+            out.insert(out.end(), line, line + n);
+        }
+    }
+
+    static void genRandom(std::vector<byte> &out, size_t size, XorShift &rng) {
+        while (out.size() < size) {
+            out.push_back(static_cast<byte>(rng.next()));
+        }
+    }
+
+    static void genZeros(std::vector<byte> &out, size_t size, XorShift &) {
+        out.resize(size, 0);
+    }
+
+    static void genSkewed(std::vector<byte> &out, size_t size, XorShift &rng) {
+        // geometric distribution: byte k appears with probability 2^-(k+1)
+        while (out.size() < size) {
+            uint64_t r = rng.next();
+            out.push_back(static_cast<byte>(r == 0 ? 63 : __builtin_ctzll(r)));
+        }
+    }
+
+    struct Corpus {
+        const char *name;
+        void (*generate)(std::vector<byte> &, size_t, XorShift &);
+    };
+
+    static const Corpus CORPORA[] = {
+        {"text",   genText},
+        {"logs",   genLogs},
+        {"random", genRandom},
+        {"zeros",  genZeros},
+        {"skewed", genSkewed},
+    };
+
+    static double secondsSince(Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    static double mibPerSecond(size_t bytes, double seconds) {
+        return seconds > 0 ? bytes / seconds / (1024 * 1024) : 0;
+    }
+
+    /**
+     * Compress and decompress one corpus through a temporary archive
+     * @return false if the decompressed content differs
+     */
+    static bool runCorpus(const Corpus &corpus, size_t size) {
+        XorShift rng(0x9e3779b97f4a7c15ULL);
+        std::vector<byte> input;
+        input.reserve(size + 256);
+        corpus.generate(input, size, rng);
+        input.resize(size);
+
+        v9::kit::resetPeakRss();
+
+        // compress
+        HfzPhaseTimes times;
+        ByteBuffer compressed;
+        auto start = Clock::now();
+        if (!HfzCommand::compressContent(input.data(), input.size(), compressed, false, &times)) {
+            fprintf(stderr, "%s: compression failed\n", corpus.name);
+            return false;
+        }
+        double compressTime = secondsSince(start);
+
+        // write the archive out
+        FILE *archive = tmpfile();
+        if (archive == nullptr) {
+            fprintf(stderr, "%s: tmpfile() failed: %s\n", corpus.name, strerror(errno));
+            return false;
+        }
+        start = Clock::now();
+        compressed.writeTo(fileno(archive));
+        fsync(fileno(archive));
+        double writeTime = secondsSince(start);
+
+        // read it back
+        start = Clock::now();
+        rewind(archive);
+        HfzEntryHeader header{};
+        fread(&header, sizeof(header), 1, archive);
+        std::vector<byte> payload(header.compressedSize);
+        fread(payload.data(), payload.size(), 1, archive);
+        double readTime = secondsSince(start);
+        fclose(archive);
+
+        // decompress from memory
+        FILE *stream = fmemopen(payload.data(), std::max<size_t>(payload.size(), 1), "rb");
+        HfzReader reader(stream, header.huffmanTable, header.compressedSize, header.originalSize);
+        byte window[HfzEntry::OUTPUT_WINDOW_SIZE];
+        size_t offset = 0;
+        bool same = true;
+        ssize_t n;
+
+        start = Clock::now();
+        while ((n = reader.read(window, sizeof(window))) > 0) {
+            same = same && offset + n <= input.size()
+                   && memcmp(window, input.data() + offset, n) == 0;
+            offset += n;
+        }
+        double decodeTime = secondsSince(start);
+        fclose(stream);
+        same = same && n == 0 && offset == input.size();
+
+        double ratio = 100.0 * compressed.getPosition() / std::max<size_t>(size, 1);
+        printf("%-7s %6.1f%% %9.1f %9.1f %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f  %s\n",
+            corpus.name, ratio,
+            mibPerSecond(size, compressTime), mibPerSecond(size, decodeTime),
+            times.histogram * 1000, times.treeBuild * 1000, times.encode * 1000,
+            decodeTime * 1000, (writeTime + readTime) * 1000,
+            v9::kit::peakRss() / 1024.0, input.size() / (1024.0 * 1024),
+            same ? "ok" : "MISMATCH");
+        return same;
+    }
+
+    int run(int argc, const char **argv) {
+        if (argc > 1 && strcmp(argv[1], "-h") == 0) {
+            fprintf(stderr, "Usage: %s [size-in-MiB] [corpus...]\n", argv[0]);
+            fprintf(stderr, "  corpus: text logs random zeros skewed (default: all)\n");
+            return 1;
+        }
+
+        size_t size = (argc > 1 ? strtoull(argv[1], nullptr, 10) : 16) * 1024 * 1024;
+
+        printf("%-7s %7s %9s %9s %8s %8s %8s %8s %8s %8s %8s\n",
+            "corpus", "ratio", "comp", "decomp", "hist", "tree", "encode", "decode", "io",
+            "peakRSS", "input");
+        printf("%-7s %7s %9s %9s %8s %8s %8s %8s %8s %8s %8s\n",
+            "", "", "MiB/s", "MiB/s", "ms", "ms", "ms", "ms", "ms", "MiB", "MiB");
+
+        bool ok = true;
+        for (auto &&corpus : CORPORA) {
+            bool selected = argc <= 2;
+            for (int i = 2; i < argc; ++i) {
+                selected = selected || strcmp(argv[i], corpus.name) == 0;
+            }
+            if (selected) {
+                ok = runCorpus(corpus, size) && ok;
+            }
+        }
+        return ok ? 0 : 1;
+    }
+}
+
+int main(int argc, const char **argv) {
+    return kiva::huffman::bench::run(argc, argv);
+}
+
+#else
+
 int main(int argc, const char **argv) {
     using namespace kiva::huffman;
 
     if (argc < 2) {
         fprintf(stderr, "Usage: %s <command> [args...]\n", argv[0]);
         fprintf(stderr, "  where command are one of the followings:\n");
-        fprintf(stderr, "    c <out.hfz> <file [, file...]>\n");
-        fprintf(stderr, "    d <file.hfz> <out-dir>\n");
+        fprintf(stderr, "    c [-s <MiB>] <out.hfz> <file [, file...]>\n");
+        fprintf(stderr, "    d <file.hfz | -> <out-dir>\n");
+        fprintf(stderr, "  -s: sample code point frequencies of files larger than <MiB>\n");
         return 1;
     }
 
@@ -1056,12 +1313,21 @@ int main(int argc, const char **argv) {
     if (strcmp(argv[0], "c") == 0) {
         ++argv;
         --argc;
+
+        size_t sampleThreshold = 0;
+        if (argc >= 2 && strcmp(argv[0], "-s") == 0) {
+            sampleThreshold = strtoull(argv[1], nullptr, 10) * 1024 * 1024;
+            argv += 2;
+            argc -= 2;
+        }
+
         if (argc == 0) {
             fprintf(stderr, "compress: No output file name specified\n");
             return 1;
         }
 
         HfzCompressor compressor(*argv++);
+        compressor.setSampleThreshold(sampleThreshold);
 
         while (*argv) {
             compressor.addFile(*argv++);
@@ -1097,3 +1363,5 @@ int main(int argc, const char **argv) {
 
     return 0;
 }
+
+#endif
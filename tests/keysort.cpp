@@ -0,0 +1,120 @@
+//
+// Created by kiva on 2026/10/19.
+//
+
+#include <v9/algorithm/keysort.hpp>
+#include <cstdio>
+
+#ifdef KEYSORT_BENCHMARK
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+template<typename T>
+static void fill(const char *kind, T *a, size_t size) {
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    for (size_t i = 0; i < size; ++i) {
+        seed ^= seed << 13U;
+        seed ^= seed >> 7U;
+        seed ^= seed << 17U;
+        if (strcmp(kind, "sorted") == 0) {
+            a[i] = static_cast<T>(i);
+        } else if (strcmp(kind, "reversed") == 0) {
+            a[i] = static_cast<T>(size - i);
+        } else if (strcmp(kind, "dup16") == 0) {
+            a[i] = static_cast<T>(seed % 16);
+        } else if (std::is_floating_point_v<T>) {
+            a[i] = static_cast<T>(static_cast<int64_t>(seed)) / static_cast<T>(1U << 20U);
+        } else {
+            a[i] = static_cast<T>(seed);
+        }
+    }
+}
+
+template<typename T, typename F>
+static void run(const char *name, const char *kind, std::vector<T> &buffer, size_t size, F &&sort) {
+    T *a = buffer.data();
+    fill(kind, a, size);
+    std::vector<T> expected(a, a + size);
+    std::sort(expected.begin(), expected.end());
+    auto start = std::chrono::steady_clock::now();
+    sort(a, size);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    bool ok = std::equal(a, a + size, expected.begin());
+    printf("  %-10s %-12s %10.1f ms %8.1f M/s %s\n",
+        kind, name, seconds * 1e3, size / seconds / 1e6, ok ? "" : "WRONG");
+}
+
+template<typename T>
+static void bench(const char *type, size_t max) {
+    using namespace v9::sorts;
+    std::vector<T> buffer(max);
+    for (size_t size = std::min<size_t>(100000, max); size <= max; size *= 10) {
+        printf("%zu %s\n", size, type);
+        for (const char *kind : {"random", "sorted", "reversed", "dup16"}) {
+            run("std::sort", kind, buffer, size, [](T *a, size_t size) {
+                std::sort(a, a + size);
+            });
+            run("qsort", kind, buffer, size, [](T *a, size_t size) {
+                qsort(a, size);
+            });
+            if constexpr (IS_SIMD_KEY<T>) {
+                run("avx2", kind, buffer, size, [](T *a, size_t size) {
+                    keyQuicksort(a, size, SortIsa::AVX2);
+                });
+                if (detectSortIsa() == SortIsa::AVX512) {
+                    run("avx512", kind, buffer, size, [](T *a, size_t size) {
+                        keyQuicksort(a, size, SortIsa::AVX512);
+                    });
+                }
+            }
+            run("radix", kind, buffer, size, [](T *a, size_t size) {
+                radixSort(a, size);
+            });
+            run("sortKeys", kind, buffer, size, [](T *a, size_t size) {
+                sortKeys(a, size);
+            });
+        }
+    }
+}
+
+/**
+ * keysort-bench [max elements, default 1e7]
+ */
+int main(int argc, const char **argv) {
+    size_t max = argc > 1 ? static_cast<size_t>(atof(argv[1])) : 10000000;
+    if (v9::sorts::detectSortIsa() == v9::sorts::SortIsa::SCALAR) {
+        printf("no AVX2 on this CPU, vector sorts skipped\n");
+        return 0;
+    }
+    bench<int32_t>("int32", max);
+    bench<int64_t>("int64", max);
+    bench<float>("float", max);
+    bench<double>("double", max);
+}
+
+#else
+
+int main() {
+    int a[] = {6, 8, 7, 6, 5, 4, 1, 2, 5, 6, 3, 2, 1, 2, 3, 4, 5, 7,
+               5, 6, 4, 12, 312, 3, 412, 4, 13, 21, 4, 12, 31, 4, 12,
+               4, 1, 3, 6, 4, 99, 12312, 41231, 523, 1234, 4, 123, 413, 13213, 1,};
+    v9::sorts::sortKeys(a, sizeof(a) / sizeof(a[0]));
+    for (int i : a) {
+        printf("%d, ", i);
+    }
+    printf("\n");
+
+    double keys[] = {2.5, -1, 0.25, 3, -7.5, 0};
+    const char *values[] = {"c", "b", "a", "d", "e", "f"};
+    v9::sorts::sortPairs(keys, values, 6);
+    for (size_t i = 0; i < 6; ++i) {
+        printf("%g=%s, ", keys[i], values[i]);
+    }
+    printf("\n");
+}
+
+#endif
@@ -3,8 +3,87 @@
 //
 
 #include <v9/algorithm/palindrome.h>
+#include <cstdio>
+
+#ifdef PALINDROME_BENCHMARK
+
+#include <chrono>
+#include <random>
+#include <cstdlib>
+
+template<typename F>
+static double timed(F &&f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * palindrome-bench [MiB of text, default 64] [threads, default all]
+ */
+int main(int argc, const char **argv) {
+    using namespace v9::solve;
+    size_t bytes = (argc > 1 ? static_cast<size_t>(atoi(argv[1])) : 64) << 20U;
+    size_t workers = argc > 2 ? static_cast<size_t>(atoi(argv[2])) - 1 : v9::kit::TaskPool::defaultWorkers();
+    v9::kit::TaskPool pool(workers);
+
+    // one long palindrome, the worst case: every byte is compared
+    std::string text(bytes, 'a');
+    std::mt19937 random(42);
+    for (size_t i = 0; i < bytes / 2; ++i) {
+        text[i] = text[bytes - 1 - i] = static_cast<char>('a' + random() % 26);
+    }
+    bool slow = false;
+    bool fast = false;
+    double slowSeconds = timed([&] {
+        slow = true;
+        for (size_t i = 0, j = bytes - 1; i < j; ++i, --j) {
+            if (text[i] != text[j]) {
+                slow = false;
+                break;
+            }
+        }
+    });
+    double fastSeconds = timed([&] { fast = isPalindrome(text); });
+    printf("%zu MiB palindrome    bytewise %8.3f s  isPalindrome %8.3f s %s\n",
+        bytes >> 20U, slowSeconds, fastSeconds, slow && fast ? "" : "WRONG");
+
+    // words of a corpus, a few of them palindromes
+    std::vector<v9::kit::StringRef> words;
+    for (size_t at = 0; at < bytes;) {
+        size_t length = std::min<size_t>(1 + random() % 24, bytes - at);
+        words.emplace_back(text.data() + at, length);
+        at += length;
+    }
+    std::unique_ptr<bool[]> serial(new bool[words.size()]);
+    std::unique_ptr<bool[]> parallel(new bool[words.size()]);
+    double serialSeconds = timed([&] { isPalindrome(words.data(), words.size(), serial.get()); });
+    double parallelSeconds = timed([&] { isPalindrome(words.data(), words.size(), parallel.get(), pool); });
+    printf("%zu words          batch %8.3f s  %zu threads %8.3f s %s\n",
+        words.size(), serialSeconds, workers + 1, parallelSeconds,
+        std::equal(serial.get(), serial.get() + words.size(), parallel.get()) ? "" : "WRONG");
+
+    v9::kit::StringRef longest;
+    double manacherSeconds = timed([&] { longest = longestPalindrome(v9::kit::StringRef(text).dropBack(1)); });
+    printf("longest palindrome  %zu bytes       Manacher %8.3f s\n", longest.size(), manacherSeconds);
+}
+
+#else
 
 int main() {
     using namespace v9::solve;
     printf("%d\n", isPalindrome("cDcDc") ? 1 : 0);
+
+    const char *words[] = {"", "a", "ab", "abba", "racecar", "palindrome",
+                           "amanaplanacanalpanamaamanaplanacanalpanama"};
+    for (auto &&word : words) {
+        printf("%-45s %d\n", word, isPalindrome(word) ? 1 : 0);
+    }
+
+    const char *texts[] = {"babad", "cbbd", "forgeeksskeegfor", "abacdfgdcaba"};
+    for (auto &&text : texts) {
+        printf("%-20s %s\n", text, longestPalindrome(text).str().c_str());
+    }
 }
+
+#endif
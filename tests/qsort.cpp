@@ -5,6 +5,115 @@
 #include <v9/v9.hpp>
 #include <cstdio>
 
+#ifdef QSORT_BENCHMARK
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+/**
+ * The Hoare quicksort qsort used to be, middle element as pivot
+ * and no guard against deep recursion. Kept to compare.
+ */
+template<typename T>
+void legacy_qsort(T *a, size_t low, size_t high) {
+    while (low < high) {
+        size_t md = low + (high - low) / 2;
+        size_t l = low - 1;
+        size_t h = high + 1;
+        T p = a[md];
+
+        while (true) {
+            while (a[++l] < p);
+            while (a[--h] > p);
+            if (l >= h) {
+                break;
+            }
+            std::swap(a[l], a[h]);
+        }
+
+        l = h++;
+        if ((l - low) <= (high - h)) {
+            legacy_qsort(a, low, l);
+            low = h;
+        } else {
+            legacy_qsort(a, h, high);
+            high = l;
+        }
+    }
+}
+
+static void fill(const char *kind, uint32_t *a, size_t size) {
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    for (size_t i = 0; i < size; ++i) {
+        seed ^= seed << 13U;
+        seed ^= seed >> 7U;
+        seed ^= seed << 17U;
+        if (strcmp(kind, "sorted") == 0) {
+            a[i] = static_cast<uint32_t>(i);
+        } else if (strcmp(kind, "reversed") == 0) {
+            a[i] = static_cast<uint32_t>(size - i);
+        } else if (strcmp(kind, "dup16") == 0) {
+            a[i] = static_cast<uint32_t>(seed % 16);
+        } else {
+            a[i] = static_cast<uint32_t>(seed);
+        }
+    }
+}
+
+static uint64_t sum(const uint32_t *a, size_t size) {
+    uint64_t s = 0;
+    for (size_t i = 0; i < size; ++i) {
+        s += a[i];
+    }
+    return s;
+}
+
+template<typename F>
+static void run(const char *name, const char *kind, uint32_t *a, size_t size, F &&sort) {
+    fill(kind, a, size);
+    uint64_t before = sum(a, size);
+    auto start = std::chrono::steady_clock::now();
+    sort(a, size);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    bool ok = std::is_sorted(a, a + size) && sum(a, size) == before;
+    printf("  %-10s %-9s %10.1f ms %8.1f M/s %s\n",
+        kind, name, seconds * 1e3, size / seconds / 1e6, ok ? "" : "WRONG");
+}
+
+/**
+ * qsort-bench [max elements, default 1e7] [threads, default all]
+ */
+int main(int argc, const char **argv) {
+    size_t max = argc > 1 ? static_cast<size_t>(atof(argv[1])) : 10000000;
+    size_t workers = argc > 2 ? static_cast<size_t>(atoi(argv[2])) - 1 : v9::kit::TaskPool::defaultWorkers();
+    v9::kit::TaskPool pool(workers);
+
+    std::vector<uint32_t> buffer(max);
+    uint32_t *a = buffer.data();
+    for (size_t size = std::min<size_t>(100000, max); size <= max; size *= 10) {
+        printf("%zu elements, %zu threads\n", size, workers + 1);
+        for (const char *kind : {"random", "sorted", "reversed", "dup16"}) {
+            run("legacy", kind, a, size, [](uint32_t *a, size_t size) {
+                legacy_qsort(a, 0, size - 1);
+            });
+            run("std::sort", kind, a, size, [](uint32_t *a, size_t size) {
+                std::sort(a, a + size);
+            });
+            run("introsort", kind, a, size, [](uint32_t *a, size_t size) {
+                v9::sorts::qsort(a, size);
+            });
+            run("parallel", kind, a, size, [&pool](uint32_t *a, size_t size) {
+                v9::sorts::parallelSort(a, a + size, pool);
+            });
+        }
+    }
+}
+
+#else
+
 int main() {
     int a[] = {6, 8, 7, 6, 5, 4, 1, 2, 5, 6, 3, 2, 1, 2, 3, 4, 5, 7,
                5, 6, 4, 12, 312, 3, 412, 4, 13, 21, 4, 12, 31, 4, 12,
@@ -15,3 +124,5 @@ int main() {
     }
     printf("\n");
 }
+
+#endif
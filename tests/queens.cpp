@@ -4,8 +4,51 @@
 
 #include <v9/algorithm/queens.h>
 
+#ifdef QUEENS_BENCHMARK
+
+#include <chrono>
+#include <cstdlib>
+
+template<typename F>
+static double timed(F &&f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * queens-bench [largest n, default 17] [threads, default all]
+ */
+int main(int argc, const char **argv) {
+    using namespace v9::solve;
+    int max = argc > 1 ? atoi(argv[1]) : 17;
+    size_t workers = argc > 2 ? static_cast<size_t>(atoi(argv[2])) - 1 : v9::kit::TaskPool::defaultWorkers();
+    v9::kit::TaskPool pool(workers);
+
+    for (int n = 8; n <= max; ++n) {
+        // the original search, re-checking every earlier row, too slow past 13
+        int legacy = 0;
+        std::vector<int> queen(n);
+        double legacySeconds = n <= 13 ? timed([&] { queenDfs(0, n, queen.data(), legacy, false); }) : 0;
+        uint64_t serial = 0;
+        uint64_t parallel = 0;
+        double serialSeconds = timed([&] { serial = countQueens(n); });
+        double parallelSeconds = timed([&] { parallel = countQueens(n, pool); });
+        printf("n=%2d %14llu  queenDfs %8.3f s  bitboard %8.3f s  Backtracking, %zu threads %8.3f s %s\n",
+            n, static_cast<unsigned long long>(serial), legacySeconds, serialSeconds, workers + 1,
+            parallelSeconds, serial == parallel && (n > 13 || uint64_t(legacy) == serial) ? "" : "WRONG");
+    }
+}
+
+#else
+
 int main() {
     using namespace v9::solve;
     int c = solveQueens(8);
     printf("%d\n", c);
+    for (int n = 1; n <= 12; ++n) {
+        printf("%d queens: %llu\n", n, static_cast<unsigned long long>(countQueens(n)));
+    }
 }
+
+#endif
@@ -0,0 +1,110 @@
+//
+// Created by kiva on 2026/10/19.
+//
+
+#include <v9/algorithm/search.hpp>
+#include <cstdio>
+#include <cstdint>
+
+/**
+ * Sudoku for v9::solve::Backtracking: moves fill the empty cell with the
+ * fewest candidates left, the check keeps the digits its row, column
+ * and box do not have yet.
+ */
+struct Sudoku {
+    struct State {
+        uint8_t cells[81];
+        uint16_t rows[9];
+        uint16_t columns[9];
+        uint16_t boxes[9];
+        int filled;
+    };
+
+    struct Move {
+        int at;
+        int digit;
+    };
+
+    static int boxOf(int at) {
+        return at / 27 * 3 + at % 9 / 3;
+    }
+
+    static uint16_t used(const State &state, int at) {
+        return state.rows[at / 9] | state.columns[at % 9] | state.boxes[boxOf(at)];
+    }
+
+    static State parse(const char *text) {
+        State state{};
+        for (int at = 0; at < 81; ++at) {
+            if (text[at] >= '1' && text[at] <= '9') {
+                state = Sudoku().apply(state, Move{at, text[at] - '0'});
+            }
+        }
+        return state;
+    }
+
+    bool isSolution(const State &state) const {
+        return state.filled == 81;
+    }
+
+    template<typename Emit>
+    void generate(const State &state, Emit &&emit) const {
+        int best = -1;
+        int fewest = 10;
+        for (int at = 0; at < 81 && fewest > 1; ++at) {
+            int candidates = 9 - __builtin_popcount(used(state, at));
+            if (state.cells[at] == 0 && candidates < fewest) {
+                best = at;
+                fewest = candidates;
+            }
+        }
+        for (int digit = 1; best >= 0 && digit <= 9; ++digit) {
+            emit(Move{best, digit});
+        }
+    }
+
+    bool check(const State &state, const Move &move) const {
+        return (used(state, move.at) & (1U << move.digit)) == 0;
+    }
+
+    State apply(const State &state, const Move &move) const {
+        State next = state;
+        uint16_t bit = 1U << move.digit;
+        next.cells[move.at] = static_cast<uint8_t>(move.digit);
+        next.rows[move.at / 9] |= bit;
+        next.columns[move.at % 9] |= bit;
+        next.boxes[boxOf(move.at)] |= bit;
+        ++next.filled;
+        return next;
+    }
+};
+
+int main() {
+    using namespace v9::solve;
+    const char *puzzle =
+        "8........"
+        "..36....."
+        ".7..9.2.."
+        ".5...7..."
+        "....457.."
+        "...1...3."
+        "..1....68"
+        "..85...1."
+        ".9....4..";
+
+    Sudoku sudoku;
+    Sudoku::State root = Sudoku::parse(puzzle);
+    Sudoku::State solution{};
+    if (findSolution(sudoku, root, solution)) {
+        for (int at = 0; at < 81; ++at) {
+            printf("%d%s", solution.cells[at], at % 9 == 8 ? "\n" : " ");
+        }
+    }
+
+    v9::kit::TaskPool pool;
+    Backtracking<Sudoku> search(sudoku);
+    uint64_t solutions = search.run(root, &pool);
+    printf("solutions: %llu, states visited: %llu\n",
+        static_cast<unsigned long long>(solutions),
+        static_cast<unsigned long long>(search.getStateCount()));
+}
@@ -4,190 +4,2092 @@
 
 #include <iostream>
 #include <vector>
+#include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <mutex>
 #include <memory>
 #include <functional>
+#include <algorithm>
+#include <iterator>
 #include <cstdint>
 #include <cstddef>
 #include <cstring>
+#include <system_error>
 
 #include <sys/mman.h>
+#include <unistd.h>
 
-enum Opcode { SUB, MUL, PUSH, STORE, LOAD, JNZ, HALT };
+/**
+ * Bytecodes are 64-bit words: an opcode, followed by one operand word
+ * for the opcodes marked below. Jump and call offsets are counted in words
+ * from the opcode word of the jump itself.
+ *
+ * Every call gets a fresh frame of local slots (all zero), the operand
+ * stack is shared between caller and callee, so arguments and results
+ * are passed on it. A RET outside of any call ends the program like HALT.
+ * Division by zero traps, just like the idiv it compiles to.
+ */
+enum Opcode {
+    SUB, MUL, PUSH /* imm */, STORE /* slot */, LOAD /* slot */, JNZ /* offset */, HALT,
+    ADD, DIV, MOD,
+    // comparisons push 1 or 0
+    EQ, NE, LT, LE, GT, GE,
+    JMP /* offset */, JZ /* offset */, CALL /* offset */, RET,
+    // immediate forms, mostly produced by the peephole optimizer
+    ADDI /* imm */, SUBI /* imm */, MULI /* imm */,
+};
 
-class VM {
+static int operandCount(int64_t op) {
+    switch (op) {
+        case PUSH:
+        case STORE:
+        case LOAD:
+        case JNZ:
+        case JMP:
+        case JZ:
+        case CALL:
+        case ADDI:
+        case SUBI:
+        case MULI:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static bool isJump(int64_t op) {
+    return op == JNZ || op == JZ || op == JMP || op == CALL;
+}
+
+// arithmetic wraps around like the machine code does
+static int64_t wrappingAdd(int64_t lhs, int64_t rhs) {
+    return static_cast<int64_t>(static_cast<uint64_t>(lhs) + static_cast<uint64_t>(rhs));
+}
+
+static int64_t wrappingSub(int64_t lhs, int64_t rhs) {
+    return static_cast<int64_t>(static_cast<uint64_t>(lhs) - static_cast<uint64_t>(rhs));
+}
+
+static int64_t wrappingMul(int64_t lhs, int64_t rhs) {
+    return static_cast<int64_t>(static_cast<uint64_t>(lhs) * static_cast<uint64_t>(rhs));
+}
+
+/**
+ * Evaluate a binary opcode on constants, for the constant folders.
+ * @return false if op is not binary, or the result would trap at runtime
+ */
+static bool evalBinary(int64_t op, int64_t lhs, int64_t rhs, int64_t &result) {
+    switch (op) {
+        case ADD:
+        case ADDI:
+            result = wrappingAdd(lhs, rhs);
+            return true;
+        case SUB:
+        case SUBI:
+            result = wrappingSub(lhs, rhs);
+            return true;
+        case MUL:
+        case MULI:
+            result = wrappingMul(lhs, rhs);
+            return true;
+        case DIV:
+        case MOD:
+            if (rhs == 0 || (lhs == INT64_MIN && rhs == -1)) {
+                return false;
+            }
+            result = op == DIV ? lhs / rhs : lhs % rhs;
+            return true;
+        case EQ:
+            result = lhs == rhs;
+            return true;
+        case NE:
+            result = lhs != rhs;
+            return true;
+        case LT:
+            result = lhs < rhs;
+            return true;
+        case LE:
+            result = lhs <= rhs;
+            return true;
+        case GT:
+            result = lhs > rhs;
+            return true;
+        case GE:
+            result = lhs >= rhs;
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Number of local slots a frame needs
+ */
+static int localSlots(const std::vector<int64_t> &bytecodes) {
+    int64_t slots = 0;
+    for (size_t pc = 0; pc < bytecodes.size(); pc += 1 + operandCount(bytecodes[pc])) {
+        if (bytecodes[pc] == LOAD || bytecodes[pc] == STORE) {
+            slots = std::max(slots, bytecodes[pc + 1] + 1);
+        }
+    }
+    return static_cast<int>(slots);
+}
+
+/**
+ * Bytecode-level peephole optimizer, all tiers run its output.
+ *  - constant folding: PUSH a, PUSH b, op => PUSH (a op b),
+ *    and a branch on a constant becomes a JMP or disappears
+ *  - immediate forms: PUSH b, ADD/SUB/MUL => ADDI/SUBI/MULI b
+ *  - jump threading: a jump to a JMP goes straight to its final target,
+ *    a JMP to the next instruction is dropped
+ *
+ * Patterns never span a jump target. Code is decoded into a list with
+ * absolute jump targets, rewritten until nothing changes, and encoded back.
+ */
+class Peephole {
 private:
-    using CompiledCode = int64_t(void *);
-    using ManagedCompiledCode = std::unique_ptr<void, std::function<void(void *)>>;
+    struct Insn {
+        int64_t op;
+        // instruction index for jumps and calls
+        int64_t operand;
+        bool removed;
+    };
 
-    std::vector<int8_t> _bytecodes;
-    std::vector<uint8_t> _buffer;
-    ManagedCompiledCode _managedCode;
+    std::vector<Insn> _code;
+    std::vector<bool> _target;
+
+private:
+    static int64_t immediateFormOf(int64_t op) {
+        switch (op) {
+            case ADD:
+                return ADDI;
+            case SUB:
+                return SUBI;
+            case MUL:
+                return MULI;
+            default:
+                return -1;
+        }
+    }
+
+    void decode(const std::vector<int64_t> &bytecodes) {
+        std::vector<size_t> indexOf(bytecodes.size() + 1);
+        for (size_t pc = 0; pc < bytecodes.size(); pc += 1 + operandCount(bytecodes[pc])) {
+            indexOf[pc] = _code.size();
+            int64_t op = bytecodes[pc];
+            int64_t operand = operandCount(op) != 0 ? bytecodes[pc + 1] : 0;
+            if (isJump(op)) {
+                operand += static_cast<int64_t>(pc);
+            }
+            _code.push_back(Insn{op, operand, false});
+        }
+        indexOf[bytecodes.size()] = _code.size();
+
+        for (auto &&insn : _code) {
+            if (isJump(insn.op)) {
+                insn.operand = static_cast<int64_t>(indexOf[insn.operand]);
+            }
+        }
+    }
+
+    std::vector<int64_t> encode() const {
+        std::vector<int64_t> pcOf(_code.size() + 1);
+        int64_t pc = 0;
+        for (size_t i = 0; i < _code.size(); ++i) {
+            pcOf[i] = pc;
+            pc += 1 + operandCount(_code[i].op);
+        }
+        pcOf[_code.size()] = pc;
+
+        std::vector<int64_t> bytecodes;
+        bytecodes.reserve(pc);
+        for (size_t i = 0; i < _code.size(); ++i) {
+            const Insn &insn = _code[i];
+            bytecodes.push_back(insn.op);
+            if (isJump(insn.op)) {
+                bytecodes.push_back(pcOf[insn.operand] - pcOf[i]);
+            } else if (operandCount(insn.op) != 0) {
+                bytecodes.push_back(insn.operand);
+            }
+        }
+        return bytecodes;
+    }
+
+    void markTargets() {
+        _target.assign(_code.size() + 1, false);
+        for (auto &&insn : _code) {
+            if (isJump(insn.op)) {
+                _target[insn.operand] = true;
+            }
+        }
+    }
+
+    /**
+     * Drop removed instructions. A jump to a removed instruction
+     * lands on the next one that was kept.
+     */
+    void compact() {
+        std::vector<int64_t> newIndex(_code.size() + 1);
+        int64_t kept = 0;
+        for (size_t i = 0; i < _code.size(); ++i) {
+            newIndex[i] = kept;
+            if (!_code[i].removed) {
+                ++kept;
+            }
+        }
+        newIndex[_code.size()] = kept;
+
+        std::vector<Insn> code;
+        code.reserve(kept);
+        for (auto &&insn : _code) {
+            if (!insn.removed) {
+                code.push_back(insn);
+                if (isJump(insn.op)) {
+                    code.back().operand = newIndex[insn.operand];
+                }
+            }
+        }
+        _code = std::move(code);
+    }
+
+    bool fold() {
+        bool changed = false;
+        size_t n = _code.size();
+
+        for (size_t i = 0; i < n; ++i) {
+            Insn &a = _code[i];
+            if (a.removed) {
+                continue;
+            }
+
+            // ADDI 0, SUBI 0 and MULI 1 do nothing
+            if (((a.op == ADDI || a.op == SUBI) && a.operand == 0) || (a.op == MULI && a.operand == 1)) {
+                a.removed = changed = true;
+                continue;
+            }
+
+            if (a.op != PUSH || i + 1 >= n || _target[i + 1]) {
+                continue;
+            }
+
+            Insn &b = _code[i + 1];
+            int64_t result = 0;
+
+            if (b.op == PUSH && i + 2 < n && !_target[i + 2] && operandCount(_code[i + 2].op) == 0
+                && evalBinary(_code[i + 2].op, a.operand, b.operand, result)) {
+                a.operand = result;
+                b.removed = _code[i + 2].removed = changed = true;
+                i += 2;
+
+            } else if ((b.op == ADDI || b.op == SUBI || b.op == MULI)
+                       && evalBinary(b.op, a.operand, b.operand, result)) {
+                a.operand = result;
+                b.removed = changed = true;
+                ++i;
+
+            } else if (immediateFormOf(b.op) >= 0) {
+                a.op = immediateFormOf(b.op);
+                b.removed = changed = true;
+                ++i;
+
+            } else if (b.op == JNZ || b.op == JZ) {
+                bool taken = (a.operand != 0) == (b.op == JNZ);
+                a.removed = changed = true;
+                if (taken) {
+                    b.op = JMP;
+                } else {
+                    b.removed = true;
+                }
+                ++i;
+            }
+        }
+        return changed;
+    }
+
+    bool threadJumps() {
+        bool changed = false;
+        size_t n = _code.size();
+
+        for (size_t i = 0; i < n; ++i) {
+            Insn &insn = _code[i];
+            if (insn.removed || insn.op == CALL || !isJump(insn.op)) {
+                continue;
+            }
+
+            // the step limit stops at jump cycles
+            auto target = static_cast<size_t>(insn.operand);
+            for (size_t steps = 0; target < n && _code[target].op == JMP
+                                   && !_code[target].removed && steps < n; ++steps) {
+                target = static_cast<size_t>(_code[target].operand);
+            }
+            if (target != static_cast<size_t>(insn.operand)) {
+                insn.operand = static_cast<int64_t>(target);
+                changed = true;
+            }
+
+            if (insn.op == JMP && target == i + 1) {
+                insn.removed = changed = true;
+            }
+        }
+        return changed;
+    }
+
+public:
+    static std::vector<int64_t> optimize(const std::vector<int64_t> &bytecodes) {
+        Peephole peephole;
+        peephole.decode(bytecodes);
+
+        bool changed = true;
+        while (changed) {
+            peephole.markTargets();
+            changed = peephole.fold();
+            changed |= peephole.threadJumps();
+            peephole.compact();
+        }
+        return peephole.encode();
+    }
+};
+
+/**
+ * How bytecodes are turned into machine code
+ */
+enum class Tier {
+    // direct-threaded interpreter, no code generation at all
+    INTERPRETER,
+    // one fixed template per opcode, the operand stack lives in memory
+    TEMPLATE,
+    // operand stack slots are mapped to registers within a basic block
+    OPTIMIZING,
+};
+
+/**
+ * Encoder for the handful of x86-64 instructions the JIT needs.
+ *
+ * Compiled code sees r12 as the operand stack pointer, rbp as the
+ * frame of local slots (slot n at [rbp - 8 * (n + 1)]) and r13 as
+ * the native stack pointer to restore on HALT.
+ */
+class X86Emitter {
+public:
+    enum Reg {
+        RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+        R8, R9, R10, R11, R12, R13, R14, R15,
+    };
+
+    // condition codes of jcc/setcc, flipping the lowest bit negates
+    enum Cond {
+        E = 0x4, NE = 0x5, L = 0xc, GE = 0xd, LE = 0xe, G = 0xf,
+    };
+
+    // add/sub/cmp share the encoding, this is the /ext of opcode 0x81
+    enum Alu {
+        ALU_ADD = 0, ALU_SUB = 5, ALU_CMP = 7,
+    };
 
 private:
-    void pushCode(std::initializer_list<uint8_t> code) {
+    std::vector<uint8_t> &_buffer;
+
+private:
+    void emit(uint8_t byte) {
+        _buffer.push_back(byte);
+    }
+
+    void emit32(int32_t value) {
+        for (int i = 0; i < 4; ++i) {
+            _buffer.push_back(reinterpret_cast<uint8_t *>(&value)[i]);
+        }
+    }
+
+    void emit64(int64_t value) {
+        for (int i = 0; i < 8; ++i) {
+            _buffer.push_back(reinterpret_cast<uint8_t *>(&value)[i]);
+        }
+    }
+
+    void rexW(int reg, int rm) {
+        emit(0x48 | ((reg >> 3) << 2) | (rm >> 3));
+    }
+
+    void modrmReg(int reg, int rm) {
+        emit(0xc0 | ((reg & 7) << 3) | (rm & 7));
+    }
+
+    // op reg, [base + disp32]
+    void mem(uint8_t opcode, int reg, int base, int32_t disp) {
+        rexW(reg, base);
+        emit(opcode);
+        emit(0x80 | ((reg & 7) << 3) | (base & 7));
+        if ((base & 7) == RSP) {
+            // rsp and r12 need a SIB byte
+            emit(0x24);
+        }
+        emit32(disp);
+    }
+
+    size_t rel32(std::initializer_list<uint8_t> opcode) {
+        raw(opcode);
+        emit32(0);
+        return position() - 4;
+    }
+
+public:
+    explicit X86Emitter(std::vector<uint8_t> &buffer) : _buffer(buffer) {}
+
+    static bool fitsInt32(int64_t imm) {
+        return imm >= INT32_MIN && imm <= INT32_MAX;
+    }
+
+    static int32_t localDisp(int64_t slot) {
+        return static_cast<int32_t>(-8 * (slot + 1));
+    }
+
+    static Cond negate(Cond cond) {
+        return static_cast<Cond>(cond ^ 1);
+    }
+
+    size_t position() const {
+        return _buffer.size();
+    }
+
+    void raw(std::initializer_list<uint8_t> code) {
         _buffer.insert(_buffer.end(), code);
     }
 
-    void genPrologue() {
-        pushCode({
-            0x53,             // push rbx
-            0x41, 0x54,       // push r12
-            0x49, 0x89, 0xfc, // mov  r12, rdi
-        });
-    }
+    void movRegReg(int dst, int src) {
+        rexW(src, dst);
+        emit(0x89);
+        modrmReg(src, dst);
+    }
+
+    void movRegImm(int dst, int64_t imm) {
+        if (fitsInt32(imm)) {
+            rexW(0, dst);
+            emit(0xc7);
+            modrmReg(0, dst);
+            emit32(static_cast<int32_t>(imm));
+        } else {
+            rexW(0, dst);
+            emit(0xb8 | (dst & 7));
+            emit64(imm);
+        }
+    }
+
+    // xor r32, r32, also clears the upper half
+    void zero(int reg) {
+        if (reg >= R8) {
+            emit(0x45);
+        }
+        emit(0x31);
+        modrmReg(reg, reg);
+    }
+
+    void load(int dst, int base, int32_t disp) {
+        mem(0x8b, dst, base, disp);
+    }
+
+    void store(int base, int32_t disp, int src) {
+        mem(0x89, src, base, disp);
+    }
+
+    void storeImm(int base, int32_t disp, int32_t imm) {
+        mem(0xc7, 0, base, disp);
+        emit32(imm);
+    }
+
+    void alu(Alu op, int dst, int src) {
+        rexW(src, dst);
+        emit((op << 3) | 1);
+        modrmReg(src, dst);
+    }
+
+    void aluImm(Alu op, int dst, int32_t imm) {
+        rexW(0, dst);
+        emit(0x81);
+        modrmReg(op, dst);
+        emit32(imm);
+    }
+
+    void addImm(int dst, int32_t imm) {
+        aluImm(ALU_ADD, dst, imm);
+    }
+
+    void subImm(int dst, int32_t imm) {
+        aluImm(ALU_SUB, dst, imm);
+    }
+
+    void imulRegReg(int dst, int src) {
+        rexW(dst, src);
+        emit(0x0f);
+        emit(0xaf);
+        modrmReg(dst, src);
+    }
+
+    void imulRegImm(int dst, int src, int32_t imm) {
+        rexW(dst, src);
+        emit(0x69);
+        modrmReg(dst, src);
+        emit32(imm);
+    }
+
+    // rdx:rax / divisor, quotient in rax and remainder in rdx
+    void cqoIdiv(int divisor) {
+        raw({0x48, 0x99});
+        rexW(0, divisor);
+        emit(0xf7);
+        modrmReg(7, divisor);
+    }
+
+    // reg = cond ? 1 : 0, from the flags of a previous cmp
+    void setcc(Cond cond, int reg) {
+        // the REX prefix selects sil/dil instead of dh/bh
+        emit(0x40 | (reg >> 3));
+        emit(0x0f);
+        emit(0x90 | cond);
+        modrmReg(0, reg);
+        // movzx reg, reg8
+        rexW(reg, reg);
+        emit(0x0f);
+        emit(0xb6);
+        modrmReg(reg, reg);
+    }
+
+    void testRegReg(int lhs, int rhs) {
+        rexW(rhs, lhs);
+        emit(0x85);
+        modrmReg(rhs, lhs);
+    }
+
+    void pushReg(int reg) {
+        if (reg >= R8) {
+            emit(0x41);
+        }
+        emit(0x50 | (reg & 7));
+    }
+
+    void popReg(int reg) {
+        if (reg >= R8) {
+            emit(0x41);
+        }
+        emit(0x58 | (reg & 7));
+    }
+
+    void ret() {
+        emit(0xc3);
+    }
+
+    /**
+     * @return Position of the rel32 to backfill
+     */
+    size_t jcc(Cond cond) {
+        return rel32({0x0f, static_cast<uint8_t>(0x80 | cond)});
+    }
+
+    size_t jmp() {
+        return rel32({0xe9});
+    }
+
+    size_t call() {
+        return rel32({0xe8});
+    }
+
+    void patchRel32(size_t at, size_t target) {
+        auto offset = static_cast<int32_t>(target - (at + 4));
+        memcpy(_buffer.data() + at, &offset, sizeof(offset));
+    }
+
+    /**
+     * Call with a fresh frame of zeroed local slots.
+     * @return Position of the rel32 to backfill
+     */
+    size_t callWithFrame(int slots) {
+        pushReg(RBP);
+        movRegReg(RBP, RSP);
+        for (int i = 0; i < slots; ++i) {
+            raw({0x6a, 0x00}); // push 0
+        }
+        size_t at = call();
+        movRegReg(RSP, RBP);
+        popReg(RBP);
+        return at;
+    }
+
+    /**
+     * The program body is called like any other function, so a RET
+     * at the top level ends up returning the top of the operand stack.
+     * Code emitted after this is the program body.
+     */
+    void enterProgram(int slots) {
+        for (int reg : {RBX, R12, R13, R14, R15, RBP}) {
+            pushReg(reg);
+        }
+        movRegReg(R12, RDI);
+        movRegReg(R13, RSP);
+
+        size_t body = callWithFrame(slots);
+        load(RAX, R12, 0);
+        leaveProgram();
+        patchRel32(body, position());
+    }
+
+    /**
+     * Return rax from anywhere, however deep the calls are
+     */
+    void leaveProgram() {
+        movRegReg(RSP, R13);
+        for (int reg : {RBP, R15, R14, R13, R12, RBX}) {
+            popReg(reg);
+        }
+        ret();
+    }
+};
+
+static X86Emitter::Cond conditionOf(int64_t op) {
+    switch (op) {
+        case EQ:
+            return X86Emitter::E;
+        case NE:
+            return X86Emitter::NE;
+        case LT:
+            return X86Emitter::L;
+        case LE:
+            return X86Emitter::LE;
+        case GT:
+            return X86Emitter::G;
+        default:
+            return X86Emitter::GE;
+    }
+}
+
+/**
+ * One fixed template per opcode: operands are loaded from
+ * the memory stack at [r12] and the result is stored back.
+ */
+class TemplateCompiler {
+private:
+    using Reg = X86Emitter::Reg;
+
+    const std::vector<int64_t> &_bytecodes;
+    X86Emitter _emitter;
+    int _slots;
+
+private:
+    void pushFrom(int reg) {
+        _emitter.addImm(Reg::R12, 8);
+        _emitter.store(Reg::R12, 0, reg);
+    }
+
+    void popTo(int reg) {
+        _emitter.load(reg, Reg::R12, 0);
+        _emitter.subImm(Reg::R12, 8);
+    }
+
+    // rhs in rcx, lhs in rax, the result replaces lhs on the stack
+    void loadOperands() {
+        popTo(Reg::RCX);
+        _emitter.load(Reg::RAX, Reg::R12, 0);
+    }
+
+    void storeResult(int reg) {
+        _emitter.store(Reg::R12, 0, reg);
+    }
+
+    void genBinary(int64_t op) {
+        loadOperands();
+        switch (op) {
+            case ADD:
+                _emitter.alu(X86Emitter::ALU_ADD, Reg::RAX, Reg::RCX);
+                break;
+            case SUB:
+                _emitter.alu(X86Emitter::ALU_SUB, Reg::RAX, Reg::RCX);
+                break;
+            case MUL:
+                _emitter.imulRegReg(Reg::RAX, Reg::RCX);
+                break;
+            case DIV:
+            case MOD:
+                _emitter.cqoIdiv(Reg::RCX);
+                storeResult(op == DIV ? Reg::RAX : Reg::RDX);
+                return;
+            default:
+                _emitter.alu(X86Emitter::ALU_CMP, Reg::RAX, Reg::RCX);
+                _emitter.setcc(conditionOf(op), Reg::RAX);
+                break;
+        }
+        storeResult(Reg::RAX);
+    }
+
+    void genImmediate(int64_t op, int64_t imm) {
+        _emitter.load(Reg::RAX, Reg::R12, 0);
+        if (!X86Emitter::fitsInt32(imm)) {
+            _emitter.movRegImm(Reg::RCX, imm);
+            switch (op) {
+                case ADDI:
+                    _emitter.alu(X86Emitter::ALU_ADD, Reg::RAX, Reg::RCX);
+                    break;
+                case SUBI:
+                    _emitter.alu(X86Emitter::ALU_SUB, Reg::RAX, Reg::RCX);
+                    break;
+                default:
+                    _emitter.imulRegReg(Reg::RAX, Reg::RCX);
+                    break;
+            }
+        } else {
+            auto imm32 = static_cast<int32_t>(imm);
+            switch (op) {
+                case ADDI:
+                    _emitter.addImm(Reg::RAX, imm32);
+                    break;
+                case SUBI:
+                    _emitter.subImm(Reg::RAX, imm32);
+                    break;
+                default:
+                    _emitter.imulRegImm(Reg::RAX, Reg::RAX, imm32);
+                    break;
+            }
+        }
+        storeResult(Reg::RAX);
+    }
+
+    void genHalt() {
+        _emitter.load(Reg::RAX, Reg::R12, 0);
+        _emitter.leaveProgram();
+    }
+
+public:
+    TemplateCompiler(const std::vector<int64_t> &bytecodes, int slots, std::vector<uint8_t> &buffer)
+        : _bytecodes(bytecodes), _emitter(buffer), _slots(slots) {
+    }
+
+    void compile() {
+        std::unordered_map<int64_t, std::size_t> labels;
+        std::unordered_map<std::size_t, int64_t> backfill;
+
+        _emitter.enterProgram(_slots);
+
+        for (size_t pc = 0; pc < _bytecodes.size(); pc += 1 + operandCount(_bytecodes[pc])) {
+            labels[pc] = _emitter.position();
+            int64_t op = _bytecodes[pc];
+            int64_t operand = operandCount(op) != 0 ? _bytecodes[pc + 1] : 0;
+
+            switch (op) {
+                case PUSH:
+                    _emitter.movRegImm(Reg::RAX, operand);
+                    pushFrom(Reg::RAX);
+                    break;
+                case LOAD:
+                    _emitter.load(Reg::RAX, Reg::RBP, X86Emitter::localDisp(operand));
+                    pushFrom(Reg::RAX);
+                    break;
+                case STORE:
+                    popTo(Reg::RAX);
+                    _emitter.store(Reg::RBP, X86Emitter::localDisp(operand), Reg::RAX);
+                    break;
+                case ADDI:
+                case SUBI:
+                case MULI:
+                    genImmediate(op, operand);
+                    break;
+                case JNZ:
+                case JZ:
+                    popTo(Reg::RAX);
+                    _emitter.testRegReg(Reg::RAX, Reg::RAX);
+                    backfill[_emitter.jcc(op == JNZ ? X86Emitter::NE : X86Emitter::E)] = static_cast<int64_t>(pc) + operand;
+                    break;
+                case JMP:
+                    backfill[_emitter.jmp()] = static_cast<int64_t>(pc) + operand;
+                    break;
+                case CALL:
+                    backfill[_emitter.callWithFrame(_slots)] = static_cast<int64_t>(pc) + operand;
+                    break;
+                case RET:
+                    _emitter.ret();
+                    break;
+                case HALT:
+                    genHalt();
+                    break;
+                default:
+                    genBinary(op);
+                    break;
+            }
+        }
+
+        // falling off the end halts
+        labels[static_cast<int64_t>(_bytecodes.size())] = _emitter.position();
+        genHalt();
+
+        for (const auto &it : backfill) {
+            _emitter.patchRel32(it.first, labels[it.second]);
+        }
+    }
+};
+
+/**
+ * Compile bytecodes without a memory round trip per opcode.
+ *
+ * The operand stack is tracked symbolically while compiling:
+ * within a basic block, pushed values stay constants, registers or
+ * a reference to a local slot, and are only written to the memory stack
+ * at [r12] when the block ends (a jump, a call or a jump target) or when
+ * registers run out. Values below the block entry are loaded from memory
+ * on demand.
+ *
+ * In programs without calls, the first local slots live in callee-saved
+ * registers instead of the frame. A comparison directly followed by
+ * JNZ/JZ compiles to cmp + jcc.
+ */
+class OptimizingCompiler {
+private:
+    using Reg = X86Emitter::Reg;
+
+    struct Value {
+        enum Kind { CONST, REG, LOCAL } kind;
+        // the constant, or the slot of a LOCAL
+        int64_t imm;
+        int reg;
+
+        static Value constant(int64_t imm) { return Value{CONST, imm, -1}; }
+
+        static Value inReg(int reg) { return Value{REG, 0, reg}; }
+
+        static Value local(int64_t slot) { return Value{LOCAL, slot, -1}; }
+    };
+
+    // rbp holds the frame and r12 the memory stack,
+    // r11 is kept as scratch for 64-bit immediates and frame slots
+    static constexpr Reg POOL[] = {
+        Reg::RAX, Reg::RCX, Reg::RDX, Reg::RSI, Reg::RDI, Reg::R8, Reg::R9, Reg::R10,
+    };
+    static constexpr Reg SCRATCH = Reg::R11;
+    static constexpr Reg LOCAL_REGS[] = {Reg::RBX, Reg::R14, Reg::R15};
+
+    const std::vector<int64_t> &_bytecodes;
+    X86Emitter _emitter;
+    int _slots;
+    // slots below this live in LOCAL_REGS
+    int _registerLocals = 0;
+
+    // values pushed since the block entry
+    std::vector<Value> _stack;
+    // memory stack entries popped since the block entry
+    int _memoryPopped = 0;
+    uint32_t _freeRegs = 0;
+
+private:
+    static bool isImm32(const Value &value) {
+        return value.kind == Value::CONST && X86Emitter::fitsInt32(value.imm);
+    }
+
+    int localReg(int64_t slot) const {
+        return slot < _registerLocals ? LOCAL_REGS[slot] : -1;
+    }
+
+    void freeReg(const Value &value) {
+        if (value.kind == Value::REG) {
+            _freeRegs |= 1U << value.reg;
+        }
+    }
+
+    int allocReg() {
+        if (!hasFreeReg()) {
+            // out of registers: write back the whole symbolic stack
+            flush();
+        }
+        for (Reg reg : POOL) {
+            if (_freeRegs & (1U << reg)) {
+                _freeRegs &= ~(1U << reg);
+                return reg;
+            }
+        }
+        // only reachable if an instruction holds more values than POOL
+        fprintf(stderr, "register allocation failed\n");
+        std::terminate();
+    }
+
+    /**
+     * Claim a specific register, it must be free
+     */
+    void takeReg(int reg) {
+        _freeRegs &= ~(1U << reg);
+    }
+
+    bool hasFreeReg() const {
+        for (Reg reg : POOL) {
+            if (_freeRegs & (1U << reg)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void moveTo(int dst, const Value &value) {
+        switch (value.kind) {
+            case Value::CONST:
+                _emitter.movRegImm(dst, value.imm);
+                break;
+            case Value::REG:
+                if (value.reg != dst) {
+                    _emitter.movRegReg(dst, value.reg);
+                }
+                break;
+            case Value::LOCAL: {
+                int reg = localReg(value.imm);
+                if (reg < 0) {
+                    _emitter.load(dst, Reg::RBP, X86Emitter::localDisp(value.imm));
+                } else if (reg != dst) {
+                    _emitter.movRegReg(dst, reg);
+                }
+                break;
+            }
+        }
+    }
+
+    /**
+     * Give a value a register that can be overwritten
+     */
+    int ownReg(const Value &value) {
+        if (value.kind == Value::REG) {
+            return value.reg;
+        }
+        int reg = allocReg();
+        moveTo(reg, value);
+        return reg;
+    }
+
+    /**
+     * Give a value a register to read, which may be SCRATCH,
+     * so nothing else may use SCRATCH before the read.
+     */
+    int readReg(const Value &value) {
+        if (value.kind == Value::REG) {
+            return value.reg;
+        }
+        if (value.kind == Value::LOCAL && localReg(value.imm) >= 0) {
+            return localReg(value.imm);
+        }
+        moveTo(SCRATCH, value);
+        return SCRATCH;
+    }
+
+    void push(const Value &value) {
+        _stack.push_back(value);
+    }
+
+    Value pop() {
+        if (!_stack.empty()) {
+            Value value = _stack.back();
+            _stack.pop_back();
+            return value;
+        }
+        int reg = allocReg();
+        _emitter.load(reg, Reg::R12, -8 * _memoryPopped++);
+        return Value::inReg(reg);
+    }
+
+    /**
+     * Write the symbolic stack back to memory and move r12 to the real top,
+     * after which the stack looks exactly like the template tier's.
+     */
+    void flush() {
+        for (size_t i = 0; i < _stack.size(); ++i) {
+            const Value &value = _stack[i];
+            auto disp = static_cast<int32_t>(8 * (static_cast<int>(i) + 1 - _memoryPopped));
+            if (isImm32(value)) {
+                _emitter.storeImm(Reg::R12, disp, static_cast<int32_t>(value.imm));
+            } else {
+                _emitter.store(Reg::R12, disp, readReg(value));
+            }
+            freeReg(value);
+        }
+
+        int delta = static_cast<int>(_stack.size()) - _memoryPopped;
+        if (delta > 0) {
+            _emitter.addImm(Reg::R12, 8 * delta);
+        } else if (delta < 0) {
+            _emitter.subImm(Reg::R12, -8 * delta);
+        }
+
+        _stack.clear();
+        _memoryPopped = 0;
+    }
+
+    void genStore(int64_t slot) {
+        Value value = pop();
+        // values on the stack that refer to the slot must keep the old content
+        for (size_t i = 0; i < _stack.size(); ++i) {
+            if (_stack[i].kind == Value::LOCAL && _stack[i].imm == slot) {
+                if (!hasFreeReg()) {
+                    // writing back the stack saves the old content too
+                    flush();
+                    break;
+                }
+                int reg = allocReg();
+                moveTo(reg, _stack[i]);
+                _stack[i] = Value::inReg(reg);
+            }
+        }
+
+        if (value.kind == Value::LOCAL && value.imm == slot) {
+            return;
+        }
+
+        int reg = localReg(slot);
+        if (reg >= 0) {
+            moveTo(reg, value);
+        } else if (isImm32(value)) {
+            _emitter.storeImm(Reg::RBP, X86Emitter::localDisp(slot), static_cast<int32_t>(value.imm));
+        } else {
+            _emitter.store(Reg::RBP, X86Emitter::localDisp(slot), readReg(value));
+        }
+        freeReg(value);
+    }
+
+    /**
+     * ADD, SUB and MUL, also in their immediate forms
+     */
+    void genArith(int64_t op, Value lhs, Value rhs) {
+        int64_t folded = 0;
+        if (lhs.kind == Value::CONST && rhs.kind == Value::CONST && evalBinary(op, lhs.imm, rhs.imm, folded)) {
+            push(Value::constant(folded));
+            return;
+        }
+
+        // addition and multiplication commute, keep constants on the right
+        // and reuse a register on the left
+        bool commutes = op != SUB && op != SUBI;
+        if (commutes && (lhs.kind == Value::CONST || (lhs.kind != Value::REG && rhs.kind == Value::REG))) {
+            std::swap(lhs, rhs);
+        }
+
+        bool multiply = op == MUL || op == MULI;
+        if (multiply && isImm32(rhs) && lhs.kind != Value::REG) {
+            // three-operand imul reads the local without copying it first
+            int dst = allocReg();
+            _emitter.imulRegImm(dst, readReg(lhs), static_cast<int32_t>(rhs.imm));
+            push(Value::inReg(dst));
+            return;
+        }
+
+        int dst = ownReg(lhs);
+        if (isImm32(rhs)) {
+            auto imm = static_cast<int32_t>(rhs.imm);
+            if (multiply) {
+                _emitter.imulRegImm(dst, dst, imm);
+            } else {
+                _emitter.aluImm(commutes ? X86Emitter::ALU_ADD : X86Emitter::ALU_SUB, dst, imm);
+            }
+        } else {
+            int src = readReg(rhs);
+            if (multiply) {
+                _emitter.imulRegReg(dst, src);
+            } else {
+                _emitter.alu(commutes ? X86Emitter::ALU_ADD : X86Emitter::ALU_SUB, dst, src);
+            }
+        }
+        freeReg(rhs);
+        push(Value::inReg(dst));
+    }
+
+    /**
+     * idiv needs the dividend in rax and clobbers rdx. The stack is
+     * written back first, so only the two operands can hold registers.
+     */
+    void genDivMod(int64_t op) {
+        Value rhs = pop();
+        Value lhs = pop();
+        int64_t folded = 0;
+        if (lhs.kind == Value::CONST && rhs.kind == Value::CONST && evalBinary(op, lhs.imm, rhs.imm, folded)) {
+            push(Value::constant(folded));
+            return;
+        }
+
+        flush();
+
+        int divisor = rhs.kind == Value::REG ? rhs.reg : -1;
+        if (divisor < 0 || divisor == Reg::RAX || divisor == Reg::RDX) {
+            // any other pool register is free at this point
+            for (Reg reg : POOL) {
+                if (reg != Reg::RAX && reg != Reg::RDX && (_freeRegs & (1U << reg))) {
+                    divisor = reg;
+                    break;
+                }
+            }
+            takeReg(divisor);
+            moveTo(divisor, rhs);
+            freeReg(rhs);
+        }
+
+        moveTo(Reg::RAX, lhs);
+        freeReg(lhs);
+        takeReg(Reg::RAX);
+        takeReg(Reg::RDX);
+
+        _emitter.cqoIdiv(divisor);
+
+        _freeRegs |= 1U << divisor;
+        int result = op == DIV ? Reg::RAX : Reg::RDX;
+        _freeRegs |= 1U << (op == DIV ? Reg::RDX : Reg::RAX);
+        push(Value::inReg(result));
+    }
+
+    /**
+     * cmp lhs, rhs, leaving the flags for the caller.
+     * @return Register holding lhs that must be freed after use, or -1
+     */
+    int genCmp(const Value &lhs, const Value &rhs) {
+        int owned = -1;
+        int left;
+        if (lhs.kind == Value::REG) {
+            left = owned = lhs.reg;
+        } else if (lhs.kind == Value::LOCAL && localReg(lhs.imm) >= 0) {
+            left = localReg(lhs.imm);
+        } else {
+            left = owned = ownReg(lhs);
+        }
+
+        if (isImm32(rhs)) {
+            _emitter.aluImm(X86Emitter::ALU_CMP, left, static_cast<int32_t>(rhs.imm));
+        } else {
+            _emitter.alu(X86Emitter::ALU_CMP, left, readReg(rhs));
+        }
+        freeReg(rhs);
+        return owned;
+    }
+
+    void genCompare(int64_t op) {
+        Value rhs = pop();
+        Value lhs = pop();
+        int64_t folded = 0;
+        if (lhs.kind == Value::CONST && rhs.kind == Value::CONST && evalBinary(op, lhs.imm, rhs.imm, folded)) {
+            push(Value::constant(folded));
+            return;
+        }
 
-    void genHalt() {
-        pushCode({
-            0x49, 0x8b, 0x04, 0x24, // mov  rax, qword ptr [r12]
-            0x41, 0x5c,             // pop  r12
-            0x5b,                   // pop  rbx
-            0xc3,                   // ret
-        });
+        int dst = ownReg(lhs);
+        genCmp(Value::inReg(dst), rhs);
+        _emitter.setcc(conditionOf(op), dst);
+        push(Value::inReg(dst));
     }
 
-    void genJnz() {
-        pushCode({
-            0x49, 0x8b, 0x04, 0x24, // mov  rax, qword ptr [r12]
-            0x49, 0x83, 0xec, 0x08, // sub  r12, 8
-            0x48, 0x83, 0xf8, 0x00, // cmp  rax, 0
-            0x0f, 0x85,             // jnz  label
-        });
-    }
+    /**
+     * A comparison directly followed by JNZ or JZ.
+     * @return Position of the rel32 to backfill, or 0 if no jump was emitted
+     */
+    size_t genCompareBranch(int64_t op, int64_t jump) {
+        Value rhs = pop();
+        Value lhs = pop();
+        int64_t folded = 0;
+        if (lhs.kind == Value::CONST && rhs.kind == Value::CONST && evalBinary(op, lhs.imm, rhs.imm, folded)) {
+            flush();
+            return (folded != 0) == (jump == JNZ) ? _emitter.jmp() : 0;
+        }
 
-    void genLoad() {
-        pushCode({
-            0x49, 0x83, 0xc4, 0x08, // add  r12, 8
-            0x49, 0x89, 0x1c, 0x24, // mov  qword ptr [r12], rbx
-        });
-    }
+        flush();
+        int owned = genCmp(lhs, rhs);
+        if (owned >= 0) {
+            _freeRegs |= 1U << owned;
+        }
 
-    void genStore() {
-        pushCode({
-            0x49, 0x8b, 0x1c, 0x24, // mov  rbx, qword ptr [r12]
-            0x49, 0x83, 0xec, 0x08, // sub  r12, 8
-        });
+        X86Emitter::Cond cond = conditionOf(op);
+        return _emitter.jcc(jump == JNZ ? cond : X86Emitter::negate(cond));
     }
 
-    void genPush(int64_t imm) {
-        pushCode({
-            0x48, 0xb8, // mov  rax, imm
-        });
-        for (int i = 0; i < 8; ++i) {
-            _buffer.push_back(reinterpret_cast<uint8_t *>(&imm)[i]);
+    /**
+     * @return Position of the rel32 to backfill, or 0 if no jump was emitted
+     */
+    size_t genBranch(int64_t jump) {
+        Value cond = pop();
+        flush();
+
+        if (cond.kind == Value::CONST) {
+            return (cond.imm != 0) == (jump == JNZ) ? _emitter.jmp() : 0;
         }
-        pushCode({
-            0x49, 0x83, 0xc4, 0x08, // add  r12, 8
-            0x49, 0x89, 0x04, 0x24, // mov  qword ptr [r12], rax
-        });
+        int reg = readReg(cond);
+        _emitter.testRegReg(reg, reg);
+        freeReg(cond);
+        return _emitter.jcc(jump == JNZ ? X86Emitter::NE : X86Emitter::E);
     }
 
-    void genMul() {
-        pushCode({
-            0x49, 0x8b, 0x04, 0x24,       // mov  rax, qword ptr [r12]
-            0x49, 0x83, 0xec, 0x08,       // sub  r12, 8
-            0x49, 0x0f, 0xaf, 0x04, 0x24, // imul rax, qword ptr [r12]
-            0x49, 0x89, 0x04, 0x24,       // mov  qword ptr [r12], rax
-        });
-    }
+    void genHalt() {
+        if (_stack.empty()) {
+            _emitter.load(Reg::RAX, Reg::R12, -8 * _memoryPopped);
+        } else {
+            moveTo(Reg::RAX, _stack.back());
+        }
+        _emitter.leaveProgram();
 
-    void genSub() {
-        pushCode({
-            0x49, 0x8b, 0x04, 0x24, // mov  rax, qword ptr [r12]
-            0x49, 0x83, 0xec, 0x08, // sub  r12, 8
-            0x49, 0x29, 0x04, 0x24, // sub  qword ptr [r12], rax
-        });
+        // whatever follows is only reachable through a jump target
+        for (const Value &value : _stack) {
+            freeReg(value);
+        }
+        _stack.clear();
+        _memoryPopped = 0;
     }
 
-    CompiledCode *createExecutableBuffer() {
-        auto buf_size = _buffer.size();
-        auto buf = mmap(nullptr, buf_size, PROT_READ | PROT_WRITE,
-            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-        memcpy(buf, _buffer.data(), buf_size);
-        mprotect(buf, buf_size, PROT_READ | PROT_EXEC);
-        _managedCode = ManagedCompiledCode(buf, [buf_size](void *buf) { munmap(buf, buf_size); });
-        return reinterpret_cast<CompiledCode *>(buf);
+public:
+    OptimizingCompiler(const std::vector<int64_t> &bytecodes, int slots, std::vector<uint8_t> &buffer)
+        : _bytecodes(bytecodes), _emitter(buffer), _slots(slots) {
+        for (Reg reg : POOL) {
+            _freeRegs |= 1U << reg;
+        }
     }
 
-public:
-    VM(std::initializer_list<int8_t> code) : _bytecodes(code) {}
+    void compile() {
+        // every jump or call target starts a basic block
+        std::unordered_set<int64_t> targets;
+        bool calls = false;
+        for (size_t pc = 0; pc < _bytecodes.size(); pc += 1 + operandCount(_bytecodes[pc])) {
+            if (isJump(_bytecodes[pc])) {
+                targets.insert(static_cast<int64_t>(pc) + _bytecodes[pc + 1]);
+            }
+            calls |= _bytecodes[pc] == CALL;
+        }
 
-    int64_t run() {
-        char stack[64 * 8] = {0};
-        return compile()(stack);
-    }
+        // every frame would have to save them across calls
+        if (!calls) {
+            _registerLocals = std::min<int>(_slots, std::size(LOCAL_REGS));
+        }
 
-    CompiledCode *compile() {
-        std::unordered_map<int, std::size_t> labels;
-        std::unordered_map<std::size_t, int> backfill;
-        _buffer.clear();
-        // generate prologue
-        genPrologue();
+        std::unordered_map<int64_t, std::size_t> labels;
+        std::unordered_map<std::size_t, int64_t> backfill;
+
+        _emitter.enterProgram(_slots);
+        for (int slot = 0; slot < _registerLocals; ++slot) {
+            _emitter.zero(LOCAL_REGS[slot]);
+        }
 
-        // generate code
-        for (int pc = 0; pc < _bytecodes.size(); ++pc) {
-            labels[pc] = _buffer.size();
-            switch (_bytecodes[pc]) {
-                case SUB: {
-                    genSub();
+        auto size = static_cast<int64_t>(_bytecodes.size());
+        for (int64_t pc = 0; pc < size; pc += 1 + operandCount(_bytecodes[pc])) {
+            if (targets.count(pc) != 0) {
+                flush();
+                labels[pc] = _emitter.position();
+            }
+
+            int64_t op = _bytecodes[pc];
+            int64_t operand = operandCount(op) != 0 ? _bytecodes[pc + 1] : 0;
+
+            switch (op) {
+                case PUSH:
+                    push(Value::constant(operand));
                     break;
-                }
+                case LOAD:
+                    push(Value::local(operand));
+                    break;
+                case STORE:
+                    genStore(operand);
+                    break;
+                case ADD:
+                case SUB:
                 case MUL: {
-                    genMul();
+                    Value rhs = pop();
+                    Value lhs = pop();
+                    genArith(op, lhs, rhs);
                     break;
                 }
-                case PUSH: {
-                    int64_t imm = _bytecodes[++pc];
-                    genPush(imm);
+                case ADDI:
+                case SUBI:
+                case MULI:
+                    genArith(op, pop(), Value::constant(operand));
                     break;
-                }
-                case STORE: {
-                    genStore();
+                case DIV:
+                case MOD:
+                    genDivMod(op);
                     break;
-                }
-                case LOAD: {
-                    genLoad();
+                case JNZ:
+                case JZ: {
+                    size_t at = genBranch(op);
+                    if (at != 0) {
+                        backfill[at] = pc + operand;
+                    }
                     break;
                 }
-                case JNZ: {
-                    genJnz();
-                    backfill[_buffer.size()] = pc + _bytecodes[pc + 1];
-                    _buffer.resize(_buffer.size() + 4);
-                    ++pc;
+                case JMP:
+                    flush();
+                    backfill[_emitter.jmp()] = pc + operand;
                     break;
-                }
-                case HALT: {
+                case CALL:
+                    flush();
+                    backfill[_emitter.callWithFrame(_slots)] = pc + operand;
+                    break;
+                case RET:
+                    flush();
+                    _emitter.ret();
+                    break;
+                case HALT:
                     genHalt();
                     break;
+                default: {
+                    int64_t next = pc + 1;
+                    int64_t jump = next < size ? _bytecodes[next] : int64_t(HALT);
+                    if ((jump == JNZ || jump == JZ) && targets.count(next) == 0) {
+                        size_t at = genCompareBranch(op, jump);
+                        if (at != 0) {
+                            backfill[at] = next + _bytecodes[next + 1];
+                        }
+                        pc = next;
+                    } else {
+                        genCompare(op);
+                    }
+                    break;
                 }
             }
         }
-        // backfill labels
+
+        // falling off the end halts
+        if (targets.count(size) != 0) {
+            flush();
+            labels[size] = _emitter.position();
+        }
+        genHalt();
+
         for (const auto &it : backfill) {
-            int32_t offset = labels[it.second];
-            offset -= it.first + 4;
-            for (int i = 0; i < 4; ++i) {
-                _buffer[it.first + i] = reinterpret_cast<uint8_t *>(&offset)[i];
+            _emitter.patchRel32(it.first, labels[it.second]);
+        }
+    }
+};
+
+/**
+ * Executable memory for compiled code, carved out of large chunks
+ * instead of one mmap() per compile.
+ *
+ * Each chunk is a memfd mapped twice: code is copied in through a writable
+ * view and runs from an executable view, so no page is ever writable and
+ * executable at once and installing code needs no mprotect(). Released
+ * blocks go back to their chunk's free list (first fit, coalesced with
+ * their neighbours) and are reused by later compiles.
+ *
+ * Where memfd is not available, a chunk is one anonymous mapping and
+ * every block in it takes whole pages: an install flips only the pages of
+ * its own block to writable and back, so code of other blocks keeps
+ * running on other threads meanwhile.
+ */
+class CodeArena {
+public:
+    static constexpr size_t CHUNK_SIZE = 1024 * 1024;
+    static constexpr size_t ALIGNMENT = 16;
+
+private:
+    struct Chunk {
+        uint8_t *writable;
+        uint8_t *executable;
+        size_t size;
+        // free blocks, offset -> length
+        std::map<size_t, size_t> free;
+    };
+
+    bool _dualMapping;
+    std::vector<std::unique_ptr<Chunk>> _chunks;
+    // executable address -> length of every block in use
+    std::unordered_map<uintptr_t, size_t> _used;
+    size_t _bytesInUse = 0;
+    std::mutex _lock;
+
+private:
+    static size_t roundUp(size_t size, size_t alignment) {
+        return (size + alignment - 1) / alignment * alignment;
+    }
+
+    Chunk *mapChunk(size_t size) {
+        auto chunk = std::make_unique<Chunk>();
+        chunk->size = size;
+
+        int fd = _dualMapping ? memfd_create("v9-jit", MFD_CLOEXEC) : -1;
+        if (fd >= 0 && ftruncate(fd, static_cast<off_t>(size)) == 0) {
+            void *writable = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            void *executable = mmap(nullptr, size, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+            if (writable != MAP_FAILED && executable != MAP_FAILED) {
+                chunk->writable = static_cast<uint8_t *>(writable);
+                chunk->executable = static_cast<uint8_t *>(executable);
+            } else {
+                // executable shared mappings may be forbidden, e.g. noexec
+                if (writable != MAP_FAILED) {
+                    munmap(writable, size);
+                }
+                if (executable != MAP_FAILED) {
+                    munmap(executable, size);
+                }
+                _dualMapping = false;
+            }
+        } else {
+            _dualMapping = false;
+        }
+        if (fd >= 0) {
+            // the mappings keep the memory alive
+            close(fd);
+        }
+
+        if (!_dualMapping) {
+            void *memory = mmap(nullptr, size, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            chunk->writable = chunk->executable = static_cast<uint8_t *>(memory);
+        }
+
+        chunk->free[0] = size;
+        _chunks.push_back(std::move(chunk));
+        return _chunks.back().get();
+    }
+
+    void unmapChunk(const Chunk &chunk) {
+        munmap(chunk.executable, chunk.size);
+        if (chunk.writable != chunk.executable) {
+            munmap(chunk.writable, chunk.size);
+        }
+    }
+
+    static bool isDualMapped(const Chunk &chunk) {
+        return chunk.writable != chunk.executable;
+    }
+
+    /**
+     * Bytes a block of {@code length} bytes takes in {@code chunk}:
+     * whole pages in a single-mapped one, whose protection is per page.
+     */
+    static size_t blockSize(const Chunk &chunk, size_t length) {
+        static const auto PAGE_SIZE = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        return roundUp(std::max<size_t>(length, 1), isDualMapped(chunk) ? ALIGNMENT : PAGE_SIZE);
+    }
+
+    static void protect(void *address, size_t length, int prot) {
+        if (mprotect(address, length, prot) != 0) {
+            throw std::system_error(errno, std::generic_category(), "CodeArena: mprotect");
+        }
+    }
+
+    static bool takeFirstFit(Chunk &chunk, size_t size, size_t &offset) {
+        for (auto it = chunk.free.begin(); it != chunk.free.end(); ++it) {
+            if (it->second >= size) {
+                offset = it->first;
+                size_t rest = it->second - size;
+                chunk.free.erase(it);
+                if (rest > 0) {
+                    chunk.free[offset + size] = rest;
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void giveBack(Chunk &chunk, size_t offset, size_t size) {
+        auto next = chunk.free.lower_bound(offset);
+        if (next != chunk.free.end() && offset + size == next->first) {
+            size += next->second;
+            next = chunk.free.erase(next);
+        }
+        if (next != chunk.free.begin()) {
+            auto prev = std::prev(next);
+            if (prev->first + prev->second == offset) {
+                prev->second += size;
+                return;
+            }
+        }
+        chunk.free[offset] = size;
+    }
+
+public:
+    explicit CodeArena(bool dualMapping = true) : _dualMapping(dualMapping) {}
+
+    ~CodeArena() {
+        for (auto &&chunk : _chunks) {
+            unmapChunk(*chunk);
+        }
+    }
+
+    CodeArena(const CodeArena &) = delete;
+
+    CodeArena &operator=(const CodeArena &) = delete;
+
+    /**
+     * The arena every VM installs its code into
+     */
+    static CodeArena &shared() {
+        static CodeArena arena;
+        return arena;
+    }
+
+    /**
+     * Copy machine code into executable memory.
+     * @return Executable address, valid until release()
+     */
+    void *install(const std::vector<uint8_t> &code) {
+        std::lock_guard<std::mutex> guard(_lock);
+
+        Chunk *chunk = nullptr;
+        size_t size = 0;
+        size_t offset = 0;
+        for (auto &&candidate : _chunks) {
+            size = blockSize(*candidate, code.size());
+            if (takeFirstFit(*candidate, size, offset)) {
+                chunk = candidate.get();
+                break;
+            }
+        }
+        if (chunk == nullptr) {
+            // a multiple of CHUNK_SIZE, so a block rounded to pages fits too
+            chunk = mapChunk(roundUp(std::max(roundUp(code.size(), ALIGNMENT), CHUNK_SIZE), CHUNK_SIZE));
+            size = blockSize(*chunk, code.size());
+            takeFirstFit(*chunk, size, offset);
+        }
+
+        if (isDualMapped(*chunk)) {
+            memcpy(chunk->writable + offset, code.data(), code.size());
+        } else {
+            // the block's pages are its own, nothing runs there yet
+            uint8_t *block = chunk->writable + offset;
+            try {
+                protect(block, size, PROT_READ | PROT_WRITE);
+                memcpy(block, code.data(), code.size());
+                protect(block, size, PROT_READ | PROT_EXEC);
+            } catch (...) {
+                giveBack(*chunk, offset, size);
+                throw;
+            }
+        }
+
+        uint8_t *executable = chunk->executable + offset;
+        __builtin___clear_cache(reinterpret_cast<char *>(executable),
+            reinterpret_cast<char *>(executable + code.size()));
+
+        _used[reinterpret_cast<uintptr_t>(executable)] = size;
+        _bytesInUse += size;
+        return executable;
+    }
+
+    void release(void *code) {
+        std::lock_guard<std::mutex> guard(_lock);
+        auto address = reinterpret_cast<uintptr_t>(code);
+        auto used = _used.find(address);
+        if (used == _used.end()) {
+            return;
+        }
+
+        for (auto &&chunk : _chunks) {
+            auto base = reinterpret_cast<uintptr_t>(chunk->executable);
+            if (address >= base && address < base + chunk->size) {
+                giveBack(*chunk, address - base, used->second);
+                break;
+            }
+        }
+        _bytesInUse -= used->second;
+        _used.erase(used);
+    }
+
+    bool isDualMapped() const {
+        return _dualMapping;
+    }
+
+    size_t getChunkCount() const {
+        return _chunks.size();
+    }
+
+    size_t getBytesInUse() const {
+        return _bytesInUse;
+    }
+};
+
+class VM {
+private:
+    using CompiledCode = int64_t(void *);
+    using ManagedCompiledCode = std::unique_ptr<void, std::function<void(void *)>>;
+
+    /**
+     * Pre-decoded instruction for the threaded interpreter
+     */
+    struct Instruction {
+        const void *handler;
+        int64_t operand;
+    };
+
+    /**
+     * Interpreter call frame
+     */
+    struct Frame {
+        const Instruction *returnTo;
+        size_t locals;
+    };
+
+    static constexpr int JIT_TIERS = 2;
+    static constexpr size_t STACK_SLOTS = 1024;
+
+    std::vector<int64_t> _bytecodes;
+    int _slots;
+    std::vector<uint8_t> _buffer;
+
+    // compiled code cache, indexed by jitIndex(tier)
+    ManagedCompiledCode _managedCode[JIT_TIERS];
+    CompiledCode *_compiledCode[JIT_TIERS] = {nullptr};
+
+    std::vector<Instruction> _threaded;
+    // interpreter frames, kept across runs
+    std::vector<int64_t> _locals;
+    std::vector<Frame> _frames;
+
+    // run() interprets until the program was run this many times
+    int _hotThreshold = 2;
+    int _runs = 0;
+
+private:
+    static int jitIndex(Tier tier) {
+        return tier == Tier::OPTIMIZING ? 1 : 0;
+    }
+
+    CompiledCode *createExecutableBuffer(ManagedCompiledCode &managedCode) {
+        void *code = CodeArena::shared().install(_buffer);
+        managedCode = ManagedCompiledCode(code, [](void *code) { CodeArena::shared().release(code); });
+        return reinterpret_cast<CompiledCode *>(code);
+    }
+
+    /**
+     * Run the bytecodes with a direct-threaded interpreter.
+     * The operand stack and the frames behave exactly
+     * like the JIT tiers: the first push lands at stack + 8.
+     */
+    int64_t interpret(void *stack) {
+        static const void *handlers[] = {
+            &&do_sub, &&do_mul, &&do_push, &&do_store, &&do_load, &&do_jnz, &&do_halt,
+            &&do_add, &&do_div, &&do_mod,
+            &&do_eq, &&do_ne, &&do_lt, &&do_le, &&do_gt, &&do_ge,
+            &&do_jmp, &&do_jz, &&do_call, &&do_ret,
+            &&do_addi, &&do_subi, &&do_muli,
+        };
+
+        if (_threaded.empty()) {
+            // decode once: resolve handlers and turn jump offsets into indices
+            std::vector<size_t> indexOf(_bytecodes.size() + 1);
+            for (size_t pc = 0; pc < _bytecodes.size(); pc += 1 + operandCount(_bytecodes[pc])) {
+                indexOf[pc] = _threaded.size();
+                int64_t op = _bytecodes[pc];
+                int64_t operand = operandCount(op) != 0 ? _bytecodes[pc + 1] : 0;
+                if (isJump(op)) {
+                    operand += static_cast<int64_t>(pc);
+                }
+                _threaded.push_back(Instruction{handlers[op], operand});
+            }
+            indexOf[_bytecodes.size()] = _threaded.size();
+
+            for (auto &&insn : _threaded) {
+                if (insn.handler == &&do_jnz || insn.handler == &&do_jz
+                    || insn.handler == &&do_jmp || insn.handler == &&do_call) {
+                    insn.operand = static_cast<int64_t>(indexOf[insn.operand]);
+                }
             }
+            _threaded.push_back(Instruction{&&do_halt, 0});
+        }
+
+        const Instruction *code = _threaded.data();
+        const Instruction *ip = code;
+        auto *sp = static_cast<int64_t *>(stack);
+
+        if (_locals.size() < static_cast<size_t>(_slots)) {
+            _locals.resize(_slots);
+        }
+        std::fill(_locals.begin(), _locals.begin() + _slots, 0);
+        _frames.clear();
+        size_t base = 0;
+        int64_t *local = _locals.data();
+
+#define DISPATCH() goto *(ip++)->handler
+#define BINARY(expr) --sp; sp[0] = (expr); DISPATCH()
+        DISPATCH();
+
+    do_sub:
+        BINARY(wrappingSub(sp[0], sp[1]));
+
+    do_mul:
+        BINARY(wrappingMul(sp[0], sp[1]));
+
+    do_add:
+        BINARY(wrappingAdd(sp[0], sp[1]));
+
+    do_div:
+        BINARY(sp[0] / sp[1]);
+
+    do_mod:
+        BINARY(sp[0] % sp[1]);
+
+    do_eq:
+        BINARY(sp[0] == sp[1]);
+
+    do_ne:
+        BINARY(sp[0] != sp[1]);
+
+    do_lt:
+        BINARY(sp[0] < sp[1]);
+
+    do_le:
+        BINARY(sp[0] <= sp[1]);
+
+    do_gt:
+        BINARY(sp[0] > sp[1]);
+
+    do_ge:
+        BINARY(sp[0] >= sp[1]);
+
+    do_addi:
+        sp[0] = wrappingAdd(sp[0], ip[-1].operand);
+        DISPATCH();
+
+    do_subi:
+        sp[0] = wrappingSub(sp[0], ip[-1].operand);
+        DISPATCH();
+
+    do_muli:
+        sp[0] = wrappingMul(sp[0], ip[-1].operand);
+        DISPATCH();
+
+    do_push:
+        *++sp = ip[-1].operand;
+        DISPATCH();
+
+    do_store:
+        local[ip[-1].operand] = *sp--;
+        DISPATCH();
+
+    do_load:
+        *++sp = local[ip[-1].operand];
+        DISPATCH();
+
+    do_jnz:
+        if (*sp-- != 0) {
+            ip = code + ip[-1].operand;
+        }
+        DISPATCH();
+
+    do_jz:
+        if (*sp-- == 0) {
+            ip = code + ip[-1].operand;
+        }
+        DISPATCH();
+
+    do_jmp:
+        ip = code + ip[-1].operand;
+        DISPATCH();
+
+    do_call:
+        _frames.push_back(Frame{ip, base});
+        base += _slots;
+        if (_locals.size() < base + _slots) {
+            _locals.resize(2 * (base + _slots));
+        }
+        local = _locals.data() + base;
+        std::fill(local, local + _slots, 0);
+        ip = code + ip[-1].operand;
+        DISPATCH();
+
+    do_ret:
+        if (_frames.empty()) {
+            return *sp;
+        }
+        ip = _frames.back().returnTo;
+        base = _frames.back().locals;
+        local = _locals.data() + base;
+        _frames.pop_back();
+        DISPATCH();
+
+    do_halt:
+        return *sp;
+#undef BINARY
+#undef DISPATCH
+    }
+
+    CompiledCode *compileTemplate() {
+        _buffer.clear();
+        TemplateCompiler(_bytecodes, _slots, _buffer).compile();
+        return createExecutableBuffer(_managedCode[jitIndex(Tier::TEMPLATE)]);
+    }
+
+    CompiledCode *compileOptimizing() {
+        _buffer.clear();
+        OptimizingCompiler(_bytecodes, _slots, _buffer).compile();
+        return createExecutableBuffer(_managedCode[jitIndex(Tier::OPTIMIZING)]);
+    }
+
+public:
+    VM(std::initializer_list<int64_t> code) : VM(std::vector<int64_t>(code)) {}
+
+    /**
+     * @param peephole Run the bytecode peephole optimizer before anything else
+     */
+    explicit VM(std::vector<int64_t> code, bool peephole = true)
+        : _bytecodes(peephole ? Peephole::optimize(code) : std::move(code)),
+          _slots(localSlots(_bytecodes)) {
+    }
+
+    /**
+     * Run with tiered execution: interpret while the program is cold,
+     * compile it with the optimizing tier once it was run hotThreshold times
+     */
+    int64_t run() {
+        if (_compiledCode[jitIndex(Tier::OPTIMIZING)] != nullptr || ++_runs > _hotThreshold) {
+            return run(Tier::OPTIMIZING);
+        }
+        return run(Tier::INTERPRETER);
+    }
+
+    int64_t run(Tier tier) {
+        // only the bottom slot is read if the program halts on an empty stack
+        int64_t stack[STACK_SLOTS];
+        stack[0] = 0;
+        if (tier == Tier::INTERPRETER) {
+            return interpret(stack);
+        }
+        return compile(tier)(stack);
+    }
+
+    void setHotThreshold(int hotThreshold) {
+        _hotThreshold = hotThreshold;
+    }
+
+    const std::vector<int64_t> &getBytecodes() const {
+        return _bytecodes;
+    }
+
+    /**
+     * Compile with a JIT tier, code is cached so every tier compiles once
+     */
+    CompiledCode *compile(Tier tier = Tier::TEMPLATE) {
+        int index = jitIndex(tier);
+        if (_compiledCode[index] == nullptr) {
+            _compiledCode[index] = tier == Tier::OPTIMIZING ? compileOptimizing() : compileTemplate();
+        }
+        return _compiledCode[index];
+    }
+};
+
+/**
+ * Build bytecodes with named labels instead of hand-counted offsets
+ */
+class Assembler {
+private:
+    std::vector<int64_t> _code;
+    std::unordered_map<std::string, int64_t> _labels;
+    // operand position and the label it jumps to
+    std::vector<std::pair<size_t, std::string>> _fixups;
+
+public:
+    Assembler &op(Opcode op) {
+        _code.push_back(op);
+        return *this;
+    }
+
+    Assembler &op(Opcode op, int64_t operand) {
+        _code.push_back(op);
+        _code.push_back(operand);
+        return *this;
+    }
+
+    Assembler &jump(Opcode op, const std::string &label) {
+        _code.push_back(op);
+        _fixups.emplace_back(_code.size(), label);
+        _code.push_back(0);
+        return *this;
+    }
+
+    Assembler &label(const std::string &name) {
+        _labels[name] = static_cast<int64_t>(_code.size());
+        return *this;
+    }
+
+    std::vector<int64_t> build() {
+        for (const auto &fixup : _fixups) {
+            _code[fixup.first] = _labels.at(fixup.second) - static_cast<int64_t>(fixup.first - 1);
         }
-        // create executable buffer
-        return createExecutableBuffer();
+        return _code;
     }
 };
 
-int64_t fact(int8_t n) {
-    VM vm = {
-        PUSH, n, STORE, PUSH, 1,
-        LOAD, MUL,
-        LOAD, PUSH, 1, SUB, STORE,
-        LOAD, JNZ, -8,
+std::vector<int64_t> factProgram(int64_t n) {
+    return {
+        PUSH, n, STORE, 0, PUSH, 1,
+        LOAD, 0, MUL,
+        LOAD, 0, PUSH, 1, SUB, STORE, 0,
+        LOAD, 0, JNZ, -12,
+        HALT,
+    };
+}
+
+/**
+ * Count down from 100 * 100 * 100, keeping a running product on the stack
+ */
+std::vector<int64_t> loopProgram() {
+    return {
+        PUSH, 100, PUSH, 100, MUL, PUSH, 100, MUL, STORE, 0,
+        PUSH, 1,
+        PUSH, 3, MUL, PUSH, 7, SUB,
+        LOAD, 0, PUSH, 1, SUB, STORE, 0,
+        LOAD, 0, JNZ, -15,
         HALT,
     };
+}
+
+/**
+ * sum of i * i % 7 for i in [1, n]
+ */
+std::vector<int64_t> sumModProgram(int64_t n) {
+    return Assembler()
+        .op(PUSH, n).op(STORE, 0)
+        .label("loop")
+        .op(LOAD, 1).op(LOAD, 0).op(LOAD, 0).op(MUL).op(PUSH, 7).op(MOD).op(ADD).op(STORE, 1)
+        .op(LOAD, 0).op(PUSH, 1).op(SUB).op(STORE, 0)
+        .op(LOAD, 0).op(PUSH, 0).op(GT).jump(JNZ, "loop")
+        .op(LOAD, 1).op(HALT)
+        .build();
+}
+
+/**
+ * Total Collatz steps of every number in [1, n]
+ */
+std::vector<int64_t> collatzProgram(int64_t n) {
+    return Assembler()
+        .op(PUSH, n).op(STORE, 0)
+        .label("outer")
+        .op(LOAD, 0).op(STORE, 2)
+        .label("inner")
+        .op(LOAD, 2).op(PUSH, 1).op(EQ).jump(JNZ, "next")
+        .op(LOAD, 1).op(PUSH, 1).op(ADD).op(STORE, 1)
+        .op(LOAD, 2).op(PUSH, 2).op(MOD).jump(JZ, "even")
+        .op(LOAD, 2).op(PUSH, 3).op(MUL).op(PUSH, 1).op(ADD).op(STORE, 2).jump(JMP, "inner")
+        .label("even")
+        .op(LOAD, 2).op(PUSH, 2).op(DIV).op(STORE, 2).jump(JMP, "inner")
+        .label("next")
+        .op(LOAD, 0).op(PUSH, 1).op(SUB).op(STORE, 0)
+        .op(LOAD, 0).jump(JNZ, "outer")
+        .op(LOAD, 1).op(HALT)
+        .build();
+}
+
+/**
+ * Naive recursive fibonacci, the argument and result are passed on the stack
+ */
+std::vector<int64_t> fibProgram(int64_t n) {
+    return Assembler()
+        .op(PUSH, n).jump(CALL, "fib").op(HALT)
+        .label("fib")
+        .op(STORE, 0)
+        .op(LOAD, 0).op(PUSH, 2).op(LT).jump(JZ, "recurse")
+        .op(LOAD, 0).op(RET)
+        .label("recurse")
+        .op(LOAD, 0).op(PUSH, 1).op(SUB).jump(CALL, "fib")
+        .op(LOAD, 0).op(PUSH, 2).op(SUB).jump(CALL, "fib")
+        .op(ADD).op(RET)
+        .build();
+}
+
+int64_t fact(int64_t n) {
+    VM vm(factProgram(n));
     return vm.run();
 }
 
+#ifdef VM_BENCHMARK
+
+#include <chrono>
+
+using Clock = std::chrono::steady_clock;
+
+const char *tierName(Tier tier) {
+    switch (tier) {
+        case Tier::INTERPRETER:
+            return "interpreter";
+        case Tier::TEMPLATE:
+            return "template";
+        case Tier::OPTIMIZING:
+            return "optimizing";
+    }
+    return "?";
+}
+
+double nanosSince(Clock::time_point start, int rounds) {
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / rounds;
+}
+
+/**
+ * Steady state: code generation is cached, only execution is timed
+ */
+double benchmark(const std::vector<int64_t> &program, bool peephole, Tier tier, int rounds, int64_t &result) {
+    VM vm(program, peephole);
+    vm.run(tier);
+
+    auto start = Clock::now();
+    for (int i = 0; i < rounds; ++i) {
+        result = vm.run(tier);
+    }
+    return nanosSince(start, rounds);
+}
+
+/**
+ * One-shot scripts: every run builds a fresh VM, so code generation is timed too
+ */
+double benchmarkOneShot(const std::vector<int64_t> &program, Tier tier, int rounds) {
+    auto start = Clock::now();
+    for (int i = 0; i < rounds; ++i) {
+        VM vm(program);
+        vm.run(tier);
+    }
+    return nanosSince(start, rounds);
+}
+
+double benchmarkTiered(const std::vector<int64_t> &program, int rounds) {
+    VM vm(program);
+    auto start = Clock::now();
+    for (int i = 0; i < rounds; ++i) {
+        vm.run();
+    }
+    return nanosSince(start, rounds);
+}
+
+int main(int argc, const char *argv[]) {
+    struct {
+        const char *name;
+        std::vector<int64_t> program;
+        int rounds;
+    } cases[] = {
+        {"fact(20)", factProgram(20), 1000000},
+        {"loop(1e6)", loopProgram(), 20},
+        {"summod(1e6)", sumModProgram(1000000), 20},
+        {"collatz(1e5)", collatzProgram(100000), 5},
+        {"fib(25)", fibProgram(25), 20},
+    };
+
+    printf("%-13s %-12s %14s %14s %14s %20s\n",
+        "program", "tier", "ns/run", "no peephole", "ns/one-shot", "result");
+    for (auto &&c : cases) {
+        for (Tier tier : {Tier::INTERPRETER, Tier::TEMPLATE, Tier::OPTIMIZING}) {
+            int64_t result = 0;
+            int64_t unoptimized = 0;
+            double ns = benchmark(c.program, true, tier, c.rounds, result);
+            double raw = benchmark(c.program, false, tier, c.rounds, unoptimized);
+            double oneShot = benchmarkOneShot(c.program, tier, std::min(c.rounds, 10000));
+            printf("%-13s %-12s %14.1f %14.1f %14.1f %20ld%s\n",
+                c.name, tierName(tier), ns, raw, oneShot, result, result == unoptimized ? "" : " MISMATCH");
+        }
+        printf("%-13s %-12s %14.1f\n", c.name, "tiered", benchmarkTiered(c.program, c.rounds));
+    }
+
+    const CodeArena &arena = CodeArena::shared();
+    printf("\ncode arena: %s, %zu chunk(s), %zu bytes in use\n",
+        arena.isDualMapped() ? "memfd dual mapping" : "single mapping",
+        arena.getChunkCount(), arena.getBytesInUse());
+    return 0;
+}
+
+#else
+
 int main(int argc, const char *argv[]) {
     printf("%d! = %ld\n", 10, fact(10));
 
+    VM vm(factProgram(10));
+    printf("%d! = %ld (interpreter)\n", 10, vm.run(Tier::INTERPRETER));
+    printf("%d! = %ld (optimizing)\n", 10, vm.run(Tier::OPTIMIZING));
+
+    VM fib(fibProgram(20));
+    for (Tier tier : {Tier::INTERPRETER, Tier::TEMPLATE, Tier::OPTIMIZING}) {
+        printf("fib(%d) = %ld\n", 20, fib.run(tier));
+    }
+
     return 0;
 }
+
+#endif